@@ -212,7 +212,7 @@ void CSimpleLogger::Activate(bool bActivate)
     }
 }
 
-void CSimpleLogger::Add(const TCHAR* str)
+void CSimpleLogger::doAdd(const TCHAR* str)
 {
     const unsigned int nMask = lfStrList | lfLogFile | lfOutputFunc;
     const unsigned int nMode = getMode() & nMask;
@@ -227,7 +227,7 @@ void CSimpleLogger::Add(const TCHAR* str)
     }
 }
 
-void CSimpleLogger::Add_WithoutOutput(const TCHAR* str)
+void CSimpleLogger::doAdd_WithoutOutput(const TCHAR* str)
 {
     const unsigned int nMask = lfStrList | lfLogFile;
     const unsigned int nMode = getMode() & nMask;
@@ -287,7 +287,7 @@ void CSimpleLogger::add(const sCurrentState& state, const TCHAR* str)
     }
 }
 
-void CSimpleLogger::AddEx(const TCHAR* fmt, ...)
+void CSimpleLogger::doAddEx(const TCHAR* fmt, ...)
 {
     if ( fmt && fmt[0] )
     {
@@ -309,7 +309,7 @@ void CSimpleLogger::AddEx(const TCHAR* fmt, ...)
     }
 }
 
-void CSimpleLogger::AddEx_WithoutOutput(const TCHAR* fmt, ...)
+void CSimpleLogger::doAddEx_WithoutOutput(const TCHAR* fmt, ...)
 {
     if ( fmt && fmt[0] )
     {
@@ -357,7 +357,7 @@ void CSimpleLogger::addex(const sCurrentState& state, const TCHAR* fmt, va_list
     add(state, str);
 }
 
-void CSimpleLogger::Clear()
+void CSimpleLogger::doClear()
 {
     const unsigned int nMask = lfStrList | lfLogFile | lfOutputFunc;
     const unsigned int nMode = getMode() & nMask;
@@ -413,7 +413,7 @@ void CSimpleLogger::Clear()
     }
 }
 
-void CSimpleLogger::DecIndentLevel()
+void CSimpleLogger::doDecIndentLevel()
 {
     const unsigned int nMask = lfStrList | lfLogFile | lfOutputFunc;
     const unsigned int nMode = getMode() & nMask;
@@ -440,7 +440,7 @@ void CSimpleLogger::DecIndentLevel()
     }
 }
 
-void CSimpleLogger::IncIndentLevel()
+void CSimpleLogger::doIncIndentLevel()
 {
     const unsigned int nMask = lfStrList | lfLogFile | lfOutputFunc;
     const unsigned int nMode = getMode() & nMask;
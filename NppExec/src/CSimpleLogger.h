@@ -28,6 +28,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #define SIMPLELOGGER_USE_STRLIST 0
 
+#ifndef SIMPLELOGGER_ENABLED
+  #define SIMPLELOGGER_ENABLED 1 // 0 - all the Add/AddEx calls are compiled out
+#endif
+
 class LogFileWriter;
 
 class CSimpleLogger
@@ -85,7 +89,7 @@ protected:
     // data...
     LogFileWriter* m_pFileWriter;
     OUTPUTFUNC     m_pOutputStrFunc;
-    unsigned int   m_nMode;
+    volatile unsigned int m_nMode; // modified under m_csState, see IsLogging()
     tstr           m_IndentStr;
   #if SIMPLELOGGER_USE_STRLIST
     CListT<tstr>   m_StrList;
@@ -101,18 +105,66 @@ protected:
     void add(const sCurrentState& state, const TCHAR* str);
     void addex(const sCurrentState& state, const TCHAR* fmt, va_list argList);
 
+    void doAdd(const TCHAR* str);
+    void doAdd_WithoutOutput(const TCHAR* str);
+    void doAddEx(const TCHAR* fmt, ...);
+    void doAddEx_WithoutOutput(const TCHAR* fmt, ...);
+    void doClear();
+    void doDecIndentLevel();
+    void doIncIndentLevel();
+
 public:
     CSimpleLogger();
     ~CSimpleLogger();
 
+    // Does not lock anything, so it is cheap enough to be called for
+    // each log line. When it returns false, nothing is formatted.
+    bool IsLogging() const
+    {
+      #if SIMPLELOGGER_ENABLED
+        return ((m_nMode & (lfStrList | lfLogFile | lfOutputFunc)) != 0);
+      #else
+        return false;
+      #endif
+    }
+
     void Activate(bool bActivate);
-    void Add(const TCHAR* str);
-    void Add_WithoutOutput(const TCHAR* str);
-    void AddEx(const TCHAR* fmt, ...);
-    void AddEx_WithoutOutput(const TCHAR* fmt, ...);
-    void Clear();
-    void DecIndentLevel();
-    void IncIndentLevel();
+
+    void Add(const TCHAR* str)
+    {
+        if ( IsLogging() )  doAdd(str);
+    }
+
+    void Add_WithoutOutput(const TCHAR* str)
+    {
+        if ( IsLogging() )  doAdd_WithoutOutput(str);
+    }
+
+    template<typename... Args> void AddEx(const TCHAR* fmt, Args... args)
+    {
+        if ( IsLogging() )  doAddEx(fmt, args...);
+    }
+
+    template<typename... Args> void AddEx_WithoutOutput(const TCHAR* fmt, Args... args)
+    {
+        if ( IsLogging() )  doAddEx_WithoutOutput(fmt, args...);
+    }
+
+    void Clear()
+    {
+        if ( IsLogging() )  doClear();
+    }
+
+    void DecIndentLevel()
+    {
+        if ( IsLogging() )  doDecIndentLevel();
+    }
+
+    void IncIndentLevel()
+    {
+        if ( IsLogging() )  doIncIndentLevel();
+    }
+
     tstr GetIndentStr() const;
     void SetIndentStr(const TCHAR* str);
   #if SIMPLELOGGER_USE_STRLIST
@@ -96,6 +96,11 @@ const TCHAR CONSOLE_COMMANDS_INFO[] = _T_RE_EOL \
   _T("if <condition> goto <label>  -  jumps to the label if the condition is true") _T_RE_EOL \
   _T("if ... else if ... else ... endif  -  conditional execution") _T_RE_EOL \
   _T("goto <label>  -  jumps to the label") _T_RE_EOL \
+  _T("while <condition> ... endwhile  -  loop while the condition is true") _T_RE_EOL \
+  _T("for <var> = <a> to <b> [step <s>] ... endfor  -  loop from <a> to <b>") _T_RE_EOL \
+  _T("break  -  leaves the loop") _T_RE_EOL \
+  _T("continue  -  goes to the next iteration of the loop") _T_RE_EOL \
+  _T("parallel [<max_jobs>] ... join  -  runs child processes concurrently") _T_RE_EOL \
   _T("exit  -  exits the current NppExec's script") _T_RE_EOL \
   _T("exit <type>  -  exits the NppExec's script") _T_RE_EOL \
   _T("set  -  shows all user\'s variables") _T_RE_EOL \
@@ -119,6 +124,8 @@ const TCHAR CONSOLE_COMMANDS_INFO[] = _T_RE_EOL \
   _T("set local <var>  -  shows the value of user\'s local variable <var>") _T_RE_EOL \
   _T("set local <var> = ...  -  sets the value of user\'s local variable <var>") _T_RE_EOL \
   _T("set local <var> ~ ...  -  calculates the value of user\'s local variable") _T_RE_EOL \
+  _T("set <arr>[] = ...  -  appends an item to the array <arr>") _T_RE_EOL \
+  _T("set <arr>[<key>] = ...  -  sets the item of the array (dictionary) <arr>") _T_RE_EOL \
   _T("unset <var>  -  removes user\'s variable <var>") _T_RE_EOL \
   _T("unset <var> = <value>  -  removes user\'s variable <var>") _T_RE_EOL \
   _T("unset local <var>  -  removes user\'s local variable <var>") _T_RE_EOL \
@@ -183,6 +190,12 @@ const TCHAR CONSOLE_COMMANDS_INFO[] = _T_RE_EOL \
   _T("proc_signal <signal>  -  signal to a child process") _T_RE_EOL \
   _T("sleep <ms>  -  sleep during ms milliseconds") _T_RE_EOL \
   _T("sleep <ms> <text>  -  print the text and sleep during ms milliseconds") _T_RE_EOL \
+  _T("npe_benchmark start <name>  -  start measuring a workload") _T_RE_EOL \
+  _T("npe_benchmark stop  -  stop measuring the workload") _T_RE_EOL \
+  _T("npe_benchmark report [<file>]  -  report the measured workloads as JSON") _T_RE_EOL \
+  _T("npe_benchmark calc <threads> [<count>]  -  measure math calculations in 1..threads threads") _T_RE_EOL \
+  _T("npe_benchmark int64 [<count>]  -  measure integer math with and without fparser") _T_RE_EOL \
+  _T("npe_benchmark optimize [<count>]  -  measure fparser's parsed vs. optimized bytecode") _T_RE_EOL \
   _T("npe_cmdalias  -  show all command aliases") _T_RE_EOL \
   _T("npe_cmdalias <alias>  -  shows the value of command alias") _T_RE_EOL \
   _T("npe_cmdalias <alias> =  -  removes the command alias") _T_RE_EOL \
@@ -191,6 +204,8 @@ const TCHAR CONSOLE_COMMANDS_INFO[] = _T_RE_EOL \
   _T("npe_debuglog <on/off>  -  enable/disable Debug Log") _T_RE_EOL \
   _T("npe_debug <1/0>  -  see \"npe_debuglog\"") _T_RE_EOL \
   _T("npe_noemptyvars <1/0>  -  enable/disable replacement of empty vars") _T_RE_EOL \
+  _T("npe_profile <on/off>  -  enable/disable profiling of the script lines") _T_RE_EOL \
+  _T("npe_profile report [<file>]  -  report the profiled script lines") _T_RE_EOL \
   _T("npe_queue <command>  -  queue NppExec's command to be executed") _T_RE_EOL \
   _T("npe_sendmsgbuflen <max_len>  -  set npp/sci_sendmsg's buffer length") _T_RE_EOL \
   DEFAULT_ALIAS_CMD_NPPEXEC _T("<script/file>  -  the same as  npp_exec <script/file>") _T_RE_EOL \
@@ -225,7 +240,13 @@ const TCHAR CONSOLE_COMMANDS_INFO[] = _T_RE_EOL \
   _T("$(OUTPUT)  :  this value can be set by the child process, see npe_console v+") _T_RE_EOL \
   _T("$(OUTPUT1)  :  first line in $(OUTPUT)") _T_RE_EOL \
   _T("$(OUTPUTL)  :  last line in $(OUTPUT)") _T_RE_EOL \
+  _T("$(OUTPUTL[N])  :  Nth line in $(OUTPUT) (N=1,2,3...; -1 is the last line)") _T_RE_EOL \
+  _T("$(<arr>[N])  :  Nth item of the user\'s array <arr> (N=1,2,3...; -1 is the last)") _T_RE_EOL \
+  _T("$(<arr>[<key>])  :  item of the user\'s array <arr> with the given key") _T_RE_EOL \
+  _T("$(<arr>.count)  :  number of items in the user\'s array <arr>") _T_RE_EOL \
   _T("$(EXITCODE)  :  exit code of the last executed child process") _T_RE_EOL \
+  _T("$(EXITCODE[N])  :  exit code of the Nth job of the last PARALLEL block") _T_RE_EOL \
+  _T("$(OUTPUT[N])  :  output of the Nth job of the last PARALLEL block") _T_RE_EOL \
   _T("$(PID)  :  process id of the current (or the last) child process") _T_RE_EOL \
   _T("$(LAST_CMD_RESULT)  :  result of the last NppExec's command") _T_RE_EOL \
   _T("                         (1 - succeeded, 0 - failed, -1 - invalid arg)") _T_RE_EOL \
@@ -1113,6 +1134,10 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  unset <var>") _T_RE_EOL \
     _T("  unset <var> = <value>") _T_RE_EOL \
     _T("  unset local <var>") _T_RE_EOL \
+    _T("  set [local] <arr>[] = <value>") _T_RE_EOL \
+    _T("  set [local] <arr>[<key>] = <value>") _T_RE_EOL \
+    _T("  unset [local] <arr>[<key>]") _T_RE_EOL \
+    _T("  unset [local] <arr>") _T_RE_EOL \
     _T("DESCRIPTION:") _T_RE_EOL \
     _T("  1. Shows all user\'s variables (\"set\" without parameters)") _T_RE_EOL \
     _T("  2. Shows the value of user\'s variable (\"set\" without \"=\")") _T_RE_EOL \
@@ -1133,6 +1158,9 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  6.  Shows/sets the value of local variable (\"set local <var> ...\")") _T_RE_EOL \
     _T("  7.  Removes the variable <var> (\"unset <var>\")") _T_RE_EOL \
     _T("  8.  Removes the local variable <var> (\"unset local <var>\")") _T_RE_EOL \
+    _T("  9.  Appends an item to the array <arr> (\"set <arr>[] = <value>\")") _T_RE_EOL \
+    _T("  10. Sets the item of the array <arr> (\"set <arr>[<key>] = <value>\")") _T_RE_EOL \
+    _T("  11. Removes the item or the whole array (\"unset <arr>[<key>]\")") _T_RE_EOL \
     _T("EXAMPLES:") _T_RE_EOL \
     _T("  set p = C:\\Program Files") _T_RE_EOL \
     _T("  dir $(p)\\*  // the same as dir C:\\Program Files\\*") _T_RE_EOL \
@@ -1186,6 +1214,23 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  set s ~ strreplace \"$(s)\" 1 \"y \"         // Hey y 0 w0ry d (\"1\" -> \"y \")") _T_RE_EOL \
     _T("  set s ~ strreplace \"queen-bee\" ee \"\"     // qun-b          (\"ee\" -> \"\")") _T_RE_EOL \
     _T_HELP_STRTOHEX_STRFROMHEX \
+    _T("  // arrays and dictionaries") _T_RE_EOL \
+    _T("  set a[] = one          // $(a[1]) = one") _T_RE_EOL \
+    _T("  set a[] = two          // $(a[2]) = two, $(a[-1]) = two") _T_RE_EOL \
+    _T("  set a[1] = first       // $(a[1]) = first") _T_RE_EOL \
+    _T("  set d[name] = NppExec  // $(d[name]) = NppExec") _T_RE_EOL \
+    _T("  echo $(a.count)        // 2") _T_RE_EOL \
+    _T("  set a                  // prints all the items of a") _T_RE_EOL \
+    _T("  unset a[1]             // $(a[1]) = two") _T_RE_EOL \
+    _T("  unset d                // removes the whole dictionary d") _T_RE_EOL \
+    _T("  set files[] = a.txt") _T_RE_EOL \
+    _T("  set files[] = b.txt") _T_RE_EOL \
+    _T("  set n = 0") _T_RE_EOL \
+    _T("  for each f in files") _T_RE_EOL \
+    _T("    set n ~ $(n) + 1") _T_RE_EOL \
+    _T("    set idx[$(f)] = $(n)  // the key is the value of f") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("  echo $(idx[b.txt])     // 2") _T_RE_EOL \
     _T("REMARKS:") _T_RE_EOL \
     _T("  User\'s variables have the lowest priority, so they can\'t override") _T_RE_EOL \
     _T("  other (predefined) variables. Thus, you can set your own variables") _T_RE_EOL \
@@ -1198,7 +1243,20 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  The math expression can contain hex numbers with leading \"0x\"") _T_RE_EOL \
     _T("  (e.g. set ans ~ 0x0F + 0x10A - 0xB).") _T_RE_EOL \
     _T("  The following constants are hardcoded: WM_USER, NPPMSG.") _T_RE_EOL \
+    _T("  Other constants are read from the *.h files in the \"NppExec\"") _T_RE_EOL \
+    _T("  subfolder of the plugins folder when Notepad++ starts; their values") _T_RE_EOL \
+    _T("  are cached in \"npes_fpconsts.bin\" and each *.h file is read again") _T_RE_EOL \
+    _T("  only when it has been modified.") _T_RE_EOL \
     _T("  For more details about supported functions, see \"fparser.html\".") _T_RE_EOL \
+    _T("  When the user\'s variables of a math expression hold plain numbers,") _T_RE_EOL \
+    _T("  the expression is parsed once and then evaluated with their values,") _T_RE_EOL \
+    _T("  so \"set i ~ $(i) + 1\" in a loop is not parsed on each iteration.") _T_RE_EOL \
+    _T("  A math expression of integer numbers and constants with the operators") _T_RE_EOL \
+    _T("  + - * / % ^ & | << >> ~ and hex() is calculated as 64-bit integers") _T_RE_EOL \
+    _T("  without fparser, so its result is exact even above 2^53 (e.g.") _T_RE_EOL \
+    _T("  set ans ~ hex(0x1F << 58)). The operators have the same meaning as in") _T_RE_EOL \
+    _T("  fparser: \"^\" is power, and an expression with a fraction (e.g. 5/2)") _T_RE_EOL \
+    _T("  is calculated by fparser.") _T_RE_EOL \
     _T("  You can use NPE_CMDALIAS to define a short alias to the built-in") _T_RE_EOL \
     _T("  calculator:") _T_RE_EOL \
     _T("    npe_cmdalias = = set ans ~  // \"=\" -> \"set ans ~\"") _T_RE_EOL \
@@ -1212,8 +1270,16 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  The same applies to local variables created directly in NppExec\'s") _T_RE_EOL \
     _T("  Console - these local variables live only in NppExec\'s Console") _T_RE_EOL \
     _T("  and are not visible in NppExec\'s scripts.") _T_RE_EOL \
+    _T("  An array keeps the order of its items. An integer key is the 1-based") _T_RE_EOL \
+    _T("  index of the item (a negative one counts from the end), any other key") _T_RE_EOL \
+    _T("  is a case-insensitive dictionary key. \"set <arr>[N] = ...\" fails if") _T_RE_EOL \
+    _T("  there is no Nth item; if there is no array <arr> at all, it sets the") _T_RE_EOL \
+    _T("  plain variable $(<arr>[N]) instead. A plain variable such as") _T_RE_EOL \
+    _T("  $(INPUT[1]) takes precedence over an array item with the same name.") _T_RE_EOL \
+    _T("  The user\'s variables in the key are substituted: \"set d[$(k)] = v\"") _T_RE_EOL \
+    _T("  sets the item that $(d[$(k)]) returns.") _T_RE_EOL \
     _T("SEE ALSO:") _T_RE_EOL \
-    _T("  env_set/env_unset, if") _T_RE_EOL
+    _T("  env_set/env_unset, if, for") _T_RE_EOL
   },
   
   // ENV_SET
@@ -1352,6 +1418,77 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  inputbox") _T_RE_EOL
   },
   
+  // NPE_BENCHMARK
+  {
+    CScriptEngine::DoNpeBenchmarkCommand::Name(),
+    _T("COMMAND:  npe_benchmark") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  npe_benchmark") _T_RE_EOL \
+    _T("  npe_benchmark start <name>") _T_RE_EOL \
+    _T("  npe_benchmark stop") _T_RE_EOL \
+    _T("  npe_benchmark report") _T_RE_EOL \
+    _T("  npe_benchmark report <file>") _T_RE_EOL \
+    _T("  npe_benchmark calc <threads>") _T_RE_EOL \
+    _T("  npe_benchmark calc <threads> <count>") _T_RE_EOL \
+    _T("  npe_benchmark int64") _T_RE_EOL \
+    _T("  npe_benchmark int64 <count>") _T_RE_EOL \
+    _T("  npe_benchmark optimize") _T_RE_EOL \
+    _T("  npe_benchmark optimize <count>") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  1. Without parameter - shows the current workload or the number of") _T_RE_EOL \
+    _T("     the measured workloads") _T_RE_EOL \
+    _T("  2. start <name> - starts measuring the workload <name>; each script") _T_RE_EOL \
+    _T("     line executed after this command is timed (the workload being") _T_RE_EOL \
+    _T("     measured, if any, is stopped first)") _T_RE_EOL \
+    _T("  3. stop - stops measuring the current workload") _T_RE_EOL \
+    _T("  4. report - prints the measured workloads as JSON in the Console") _T_RE_EOL \
+    _T("     and clears them") _T_RE_EOL \
+    _T("  5. report <file> - saves the measured workloads as JSON (UTF-8)") _T_RE_EOL \
+    _T("     to the file and clears them") _T_RE_EOL \
+    _T("  6. calc <threads> [<count>] - for n = 1..<threads>, measures n threads") _T_RE_EOL \
+    _T("     calculating <count> (default: 100000) math expressions each; the") _T_RE_EOL \
+    _T("     workloads \"calc_threads_n\" use each thread's own fparser, the") _T_RE_EOL \
+    _T("     workloads \"calc_shared_n\" use one fparser under a lock. Their") _T_RE_EOL \
+    _T("     \"lines\" are the calculations") _T_RE_EOL \
+    _T("  7. int64 [<count>] - calculates a few integer math expressions <count>") _T_RE_EOL \
+    _T("     (default: 100000) times as 64-bit integers (\"int64_calc\") and") _T_RE_EOL \
+    _T("     then by fparser (\"fparser_calc\"); fails if the results differ") _T_RE_EOL \
+    _T("  8. optimize [<count>] - evaluates a few cached math expressions <count>") _T_RE_EOL \
+    _T("     (default: 100000) times by fparser's parsed bytecode (\"fparser_parsed\")") _T_RE_EOL \
+    _T("     and then by the optimized one (\"fparser_optimized\"); fails if the") _T_RE_EOL \
+    _T("     results differ") _T_RE_EOL \
+    _T("  For each workload, the report contains the number of executed lines,") _T_RE_EOL \
+    _T("  the elapsed time and lines/sec. For each command type, it contains") _T_RE_EOL \
+    _T("  the count of lines, their total time and p50/p99 latency (in us).") _T_RE_EOL \
+    _T("  The lines of an NPP_EXEC'ed script are measured as well; child") _T_RE_EOL \
+    _T("  processes are measured as \"(child process)\".") _T_RE_EOL \
+    _T("  \"fparser_cache\" shows the hits and misses of the parsed math") _T_RE_EOL \
+    _T("  expressions of \"set <var> ~ <math expression>\" since Notepad++") _T_RE_EOL \
+    _T("  has been started. \"int64_calc\" shows how many of them have been") _T_RE_EOL \
+    _T("  calculated as 64-bit integers, without fparser. \"optimized\" is the") _T_RE_EOL \
+    _T("  number of the cached expressions optimized by fparser's optimizer after") _T_RE_EOL \
+    _T("  Calc_OptimizeHits hits, \"optimized_evals\" is the number of their") _T_RE_EOL \
+    _T("  evaluations by the optimized bytecode (\"optimize_skipped\": not") _T_RE_EOL \
+    _T("  optimized because of bitwise operators). Calc_OptimizeHits is 0 (off)") _T_RE_EOL \
+    _T("  by default, as the optimizer may turn a domain error into a value") _T_RE_EOL \
+    _T("  (e.g. sqrt(x)^2 gives x even for x < 0).") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  npe_benchmark start set_loop") _T_RE_EOL \
+    _T("  for i = 1 to 1000") _T_RE_EOL \
+    _T("    set local x ~ $(i) * 2") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("  npe_benchmark stop") _T_RE_EOL \
+    _T("  npe_benchmark report $(SYS.TEMP)\\benchmark.json") _T_RE_EOL \
+    _T("  npe_benchmark calc 4") _T_RE_EOL \
+    _T("  npe_benchmark report") _T_RE_EOL \
+    _T("REMARKS:") _T_RE_EOL \
+    _T("  The benchmark suite \"NppExec_Benchmark.txt\" and its sub-script") _T_RE_EOL \
+    _T("  \"NppExec_Benchmark_Sub.txt\" can be found in NppExec's documentation") _T_RE_EOL \
+    _T("  folder.") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  npe_debuglog") _T_RE_EOL
+  },
+
   // NPE_CMDALIAS
   {
     CScriptEngine::DoNpeCmdAliasCommand::Name(),
@@ -1538,6 +1675,44 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  set, echo, npe_console") _T_RE_EOL
   },
 
+  // NPE_PROFILE
+  {
+    CScriptEngine::DoNpeProfileCommand::Name(),
+    _T("COMMAND:  npe_profile") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  npe_profile") _T_RE_EOL \
+    _T("  npe_profile on") _T_RE_EOL \
+    _T("  npe_profile off") _T_RE_EOL \
+    _T("  npe_profile report") _T_RE_EOL \
+    _T("  npe_profile report <file>") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  1. Without parameter - shows whether the script lines are profiled") _T_RE_EOL \
+    _T("  2. 1 or On - clears the collected data and starts profiling the") _T_RE_EOL \
+    _T("     script lines executed after this command") _T_RE_EOL \
+    _T("  3. 0 or Off - stops profiling; the collected data is kept") _T_RE_EOL \
+    _T("  4. report - prints the profiled lines in the Console") _T_RE_EOL \
+    _T("  5. report <file> - saves the profiled lines to the file (UTF-8)") _T_RE_EOL \
+    _T("  For each executed line, the report contains its total time, the") _T_RE_EOL \
+    _T("  number of hits and the parts of the total time spent in child") _T_RE_EOL \
+    _T("  processes, in substitution of vars and in printing to the Console") _T_RE_EOL \
+    _T("  (in ms). The lines are sorted by their total time and identified") _T_RE_EOL \
+    _T("  as <script>:<line number>, where the main script is \"(main)\".") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  npe_profile on") _T_RE_EOL \
+    _T("  npp_exec \"build\"") _T_RE_EOL \
+    _T("  npe_profile off") _T_RE_EOL \
+    _T("  npe_profile report $(SYS.TEMP)\\profile.txt") _T_RE_EOL \
+    _T("REMARKS:") _T_RE_EOL \
+    _T("  The lines of NPP_EXEC'ed scripts are profiled as well; the time of") _T_RE_EOL \
+    _T("  an NPP_EXEC line itself does not include the lines it executes.") _T_RE_EOL \
+    _T("  The lines are identified by their line numbers in the script file or") _T_RE_EOL \
+    _T("  in the saved script, empty lines included. When the script ends, its") _T_RE_EOL \
+    _T("  collected data is kept, so \"npe_profile report\" in the next script") _T_RE_EOL \
+    _T("  reports it until that script collects its own data.") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  npe_benchmark, npe_debuglog") _T_RE_EOL
+  },
+
   // NPE_QUEUE
   {
     CScriptEngine::DoNpeQueueCommand::Name(),
@@ -1825,6 +2000,14 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  a >= b  - greater or equal:  0 >= 0, \"AB\" >= \"AA\"") _T_RE_EOL \
     _T("  a <= b  - less or equal:     1 <= 2, \"A\" <= \"AA\"") _T_RE_EOL \
     _T("  a ~= b  - equal no case:     \"AA\" ~= \"aa\"") _T_RE_EOL \
+    _T("  The conditions can be combined:") _T_RE_EOL \
+    _T("  c1 && c2  - true if both c1 and c2 are true") _T_RE_EOL \
+    _T("  c1 || c2  - true if c1 or c2 is true") _T_RE_EOL \
+    _T("  ! c1      - true if c1 is false, also !(c1); \"!\" followed by other") _T_RE_EOL \
+    _T("              characters is a part of the operand:  if !a == !b") _T_RE_EOL \
+    _T("  (c1)      - grouping:  if ($(a) > 0 || $(b) > 0) && $(c) != 0 goto Label") _T_RE_EOL \
+    _T("  \"&&\" has a higher priority than \"||\". The evaluation stops as soon") _T_RE_EOL \
+    _T("  as the result is known, so the remaining comparisons are skipped.") _T_RE_EOL \
     _T("  * You can use variables and constants as the operands:") _T_RE_EOL \
     _T("    \"if $(var1) == $(var2) goto EqualVars\"") _T_RE_EOL \
     _T("    \"if $(var) != 10 goto NotEqualTo10\"") _T_RE_EOL \
@@ -2039,6 +2222,199 @@ const tCmdItemInfo CONSOLE_CMD_INFO[] = {
     _T("  if, else") _T_RE_EOL
   },
 
+  // WHILE
+  {
+    CScriptEngine::DoWhileCommand::Name(),
+    _T("COMMAND:  while") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  while <condition>") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  endwhile") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  Repeats the lines up to ENDWHILE while the condition is true.") _T_RE_EOL \
+    _T("  The condition is the same as in IF and is checked before each iteration.") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  set local i ~ 1") _T_RE_EOL \
+    _T("  while $(i) <= 10") _T_RE_EOL \
+    _T("    echo $(i)") _T_RE_EOL \
+    _T("    set local i ~ $(i) + 1") _T_RE_EOL \
+    _T("  endwhile") _T_RE_EOL \
+    _T("REMARKS:") _T_RE_EOL \
+    _T("  Each WHILE loop may perform up to GoTo_MaxCount iterations before") _T_RE_EOL \
+    _T("  NppExec asks whether to abort the script. Unlike GOTO, the iterations") _T_RE_EOL \
+    _T("  of different loops are counted separately.") _T_RE_EOL \
+    _T("  WHILE, ENDWHILE, FOR and ENDFOR are matched once, before the script") _T_RE_EOL \
+    _T("  is executed, so they can not be results of macro-variables.") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  endwhile, break, continue, for, if") _T_RE_EOL
+  },
+
+  // ENDWHILE
+  {
+    CScriptEngine::DoEndWhileCommand::Name(),
+    _T("COMMAND:  endwhile") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  while <condition>") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  endwhile") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  The end of the WHILE ... ENDWHILE loop.") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  see: while") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  while, break, continue") _T_RE_EOL
+  },
+
+  // FOR
+  {
+    CScriptEngine::DoForCommand::Name(),
+    _T("COMMAND:  for") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  for <var> = <a> to <b>") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("  for <var> = <a> to <b> step <s>") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("  for each <var> in <arr>") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  Repeats the lines up to ENDFOR for each value of the local variable") _T_RE_EOL \
+    _T("  <var> from <a> to <b> with the step <s> (1 by default).") _T_RE_EOL \
+    _T("  <a>, <b> and <s> are integer numbers or macro-variables containing") _T_RE_EOL \
+    _T("  integer numbers; they are calculated once, when FOR starts.") _T_RE_EOL \
+    _T("  \"for each\" sets <var> to each item of the array <arr> in turn.") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  for $(i) = 1 to 10") _T_RE_EOL \
+    _T("    echo $(i)") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("  for i = 10 to 0 step -2") _T_RE_EOL \
+    _T("    echo $(i)") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("  set files[] = a.txt") _T_RE_EOL \
+    _T("  set files[] = b.txt") _T_RE_EOL \
+    _T("  for each f in files") _T_RE_EOL \
+    _T("    echo $(f)") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("REMARKS:") _T_RE_EOL \
+    _T("  The loop is not executed when the range is empty (e.g. from 1 to 0).") _T_RE_EOL \
+    _T("  \"for each\" iterates over the items the array had when FOR started;") _T_RE_EOL \
+    _T("  modifying the array inside the loop does not affect the iterations.") _T_RE_EOL \
+    _T("  Changing the value of <var> inside the loop does not affect the") _T_RE_EOL \
+    _T("  number of iterations: ENDFOR sets <var> to the next value.") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  endfor, break, continue, while, set") _T_RE_EOL
+  },
+
+  // ENDFOR
+  {
+    CScriptEngine::DoEndForCommand::Name(),
+    _T("COMMAND:  endfor") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  for <var> = <a> to <b>") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  The end of the FOR ... ENDFOR loop.") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  see: for") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  for, break, continue") _T_RE_EOL
+  },
+
+  // BREAK
+  {
+    CScriptEngine::DoBreakCommand::Name(),
+    _T("COMMAND:  break") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  break") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  Leaves the innermost WHILE or FOR loop.") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  for $(i) = 1 to 100") _T_RE_EOL \
+    _T("    if \"$(LAST_CMD_RESULT)\" == \"0\" then") _T_RE_EOL \
+    _T("      break") _T_RE_EOL \
+    _T("    endif") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  continue, while, for") _T_RE_EOL
+  },
+
+  // CONTINUE
+  {
+    CScriptEngine::DoContinueCommand::Name(),
+    _T("COMMAND:  continue") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  continue") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  Goes to the next iteration of the innermost WHILE or FOR loop.") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  for $(i) = 1 to 10") _T_RE_EOL \
+    _T("    if $(i) == 5 then") _T_RE_EOL \
+    _T("      continue") _T_RE_EOL \
+    _T("    endif") _T_RE_EOL \
+    _T("    echo $(i)") _T_RE_EOL \
+    _T("  endfor") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  break, while, for") _T_RE_EOL
+  },
+
+  // PARALLEL
+  {
+    CScriptEngine::DoParallelCommand::Name(),
+    _T("COMMAND:  parallel") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  parallel") _T_RE_EOL \
+    _T("    <command line 1>") _T_RE_EOL \
+    _T("    <command line 2>") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  join") _T_RE_EOL \
+    _T("  parallel <max_jobs>") _T_RE_EOL \
+    _T("    ...") _T_RE_EOL \
+    _T("  join") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  Starts each command line between PARALLEL and JOIN as a child process,") _T_RE_EOL \
+    _T("  running up to <max_jobs> of them at once, and waits for all of them.") _T_RE_EOL \
+    _T("  The output of the Nth job is printed with the \"[N] \" prefix.") _T_RE_EOL \
+    _T("  When all the jobs are finished:") _T_RE_EOL \
+    _T("  $(EXITCODE[N]) is the exit code of the Nth job (-1 if it was not started);") _T_RE_EOL \
+    _T("  $(OUTPUT[N]) is the output of the Nth job (see \"npe_console v+\");") _T_RE_EOL \
+    _T("  $(EXITCODE) is the first non-zero exit code of the jobs or 0.") _T_RE_EOL \
+    _T("EXAMPLES:") _T_RE_EOL \
+    _T("  parallel 2") _T_RE_EOL \
+    _T("    gcc -c a.c") _T_RE_EOL \
+    _T("    gcc -c b.c") _T_RE_EOL \
+    _T("    gcc -c c.c") _T_RE_EOL \
+    _T("  join") _T_RE_EOL \
+    _T("  if $(EXITCODE) != 0 then") _T_RE_EOL \
+    _T("    exit") _T_RE_EOL \
+    _T("  endif") _T_RE_EOL \
+    _T("REMARKS:") _T_RE_EOL \
+    _T("  Only child processes can be started between PARALLEL and JOIN; the vars") _T_RE_EOL \
+    _T("  in their command lines are substituted before the first job is started.") _T_RE_EOL \
+    _T("  PARALLEL blocks can't be nested. The jobs do not receive the Console\'s") _T_RE_EOL \
+    _T("  input, and $(PID) is not set for them.") _T_RE_EOL \
+    _T("  Without <max_jobs>, the value of ChildProcess_MaxParallel in NppExec.ini") _T_RE_EOL \
+    _T("  is used; its default value 0 means the number of processors.") _T_RE_EOL \
+    _T("  When the script is aborted, all the running jobs are stopped.") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  join, npp_run, npe_console") _T_RE_EOL
+  },
+
+  // JOIN
+  {
+    CScriptEngine::DoJoinCommand::Name(),
+    _T("COMMAND:  join") _T_RE_EOL \
+    _T("USAGE:") _T_RE_EOL \
+    _T("  join") _T_RE_EOL \
+    _T("DESCRIPTION:") _T_RE_EOL \
+    _T("  Ends the PARALLEL block. See \"help parallel\".") _T_RE_EOL \
+    _T("SEE ALSO:") _T_RE_EOL \
+    _T("  parallel") _T_RE_EOL
+  },
+
   // EXIT
   {
     CScriptEngine::DoExitCommand::Name(),
@@ -4703,6 +5079,10 @@ void ConsoleDlg::loadCmdVarsList()
     if ( S == CScriptEngine::DoGoToCommand::Name() ||
          S == CScriptEngine::DoElseCommand::Name() ||
          S == CScriptEngine::DoEndIfCommand::Name() ||
+         S == CScriptEngine::DoEndWhileCommand::Name() ||
+         S == CScriptEngine::DoEndForCommand::Name() ||
+         S == CScriptEngine::DoBreakCommand::Name() ||
+         S == CScriptEngine::DoContinueCommand::Name() ||
          S == CScriptEngine::DoLabelCommand::Name() )
       continue;
 
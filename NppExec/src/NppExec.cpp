@@ -254,6 +254,8 @@ const TCHAR INI_SECTION_RESTORE[]          = _T("Restore");
 
 const TCHAR SCRIPTFILE_TEMP[]              = _T("npes_temp.txt");
 const TCHAR SCRIPTFILE_SAVED[]             = _T("npes_saved.txt");
+const TCHAR USERVARS_SNAPSHOT[]            = _T("npes_uservars.bin");
+const TCHAR FPCONSTS_CACHE[]               = _T("npes_fpconsts.bin");
 TCHAR       CMDHISTORY_FILENAME[100]       = _T("npec_cmdhistory.txt\0");
 const TCHAR PROP_NPPEXEC_DLL[]             = _T("NppExec_dll_exists");
 
@@ -262,6 +264,7 @@ const int   DEFAULT_CHILDP_CYCLETIMEOUT_MS    = 120;
 const int   DEFAULT_CHILDP_EXITTIMEOUT_MS     = 2000;
 const int   DEFAULT_CHILDP_KILLTIMEOUT_MS     = 500;
 const int   DEFAULT_CHILDP_RUNPOLICY          = 0;
+const int   DEFAULT_CHILDP_MAXPARALLEL        = 0; // number of processors
 const int   DEFAULT_CHILDS_SYNCTIMEOUT_MS     = 200;
 const int   DEFAULT_EXITS_TIMEOUT_MS          = 4000;
 const int   DEFAULT_PATH_AUTODBLQUOTES        = 0;
@@ -271,6 +274,7 @@ const int   DEFAULT_GOTO_MAXCOUNT             = 10000;
 const int   DEFAULT_RICHEDIT_MAXTEXTLEN       = 4*1024*1024; // 4 MB
 const int   DEFAULT_SENDMSG_MAXBUFLEN         = 4*1024*1024; // 4 M symbols
 const int   DEFAULT_UTF8_DETECT_LENGTH        = 16384;
+const int   DEFAULT_CALC_OPTIMIZEHITS         = 0; // opt-in, see "NppExec_TechInfo.txt"
 const TCHAR DEFAULT_COMMENTDELIMITER[]        = _T("//");
 const TCHAR DEFAULT_HELPFILE[]                = _T("doc\\NppExec\\NppExec_Manual.chm");
 const TCHAR DEFAULT_LOGSDIR[]                 = _T("");
@@ -326,6 +330,9 @@ const CStaticOptionsManager::OPT_ITEM optArray[OPT_COUNT] = {
     { OPTS_CALC_PRECISION, OPTT_STR | OPTF_READWRITE,
       INI_SECTION_CONSOLE, _T("Calc_Precision"),
       0, NULL }, // see "NppExecEngine.cpp", calc_precision
+    { OPTI_CALC_OPTIMIZEHITS, OPTT_INT | OPTF_READWRITE,
+      INI_SECTION_CONSOLE, _T("Calc_OptimizeHits"),
+      DEFAULT_CALC_OPTIMIZEHITS, NULL }, // see "NppExecEngine.cpp", FParserConsts
     { OPTS_COMMENTDELIMITER, OPTT_STR | OPTF_READWRITE, 
       INI_SECTION_CONSOLE, _T("CommentDelimiter"), 
       0, DEFAULT_COMMENTDELIMITER },
@@ -993,6 +1000,9 @@ const CStaticOptionsManager::OPT_ITEM optArray[OPT_COUNT] = {
     { OPTU_PLUGIN_AUTOSAVE_SECONDS, OPTT_INT | OPTF_READONLY,
       INI_SECTION_OPTIONS, _T("AutoSave_Seconds"),
       DEFAULT_AUTOSAVE_SECONDS, NULL },
+    { OPTB_PLUGIN_SAVEUSERVARS, OPTT_BOOL | OPTF_READONLY,
+      INI_SECTION_OPTIONS, _T("SaveUserVars"),
+      0, NULL },
     // [Console]
     { OPTU_CHILDP_STARTUPTIMEOUT_MS, OPTT_INT | OPTF_READONLY,
       INI_SECTION_CONSOLE, _T("ChildProcess_StartupTimeout_ms"), 
@@ -1012,6 +1022,9 @@ const CStaticOptionsManager::OPT_ITEM optArray[OPT_COUNT] = {
     { OPTS_CHILDP_COMSPECSWITCHES, OPTT_STR | OPTF_READONLY,
       INI_SECTION_CONSOLE, _T("ChildProcess_ComSpecSwitches"),
       0, DEFAULT_CHILDP_COMSPECSWITCHES },
+    { OPTI_CHILDP_MAXPARALLEL, OPTT_INT | OPTF_READONLY,
+      INI_SECTION_CONSOLE, _T("ChildProcess_MaxParallel"),
+      DEFAULT_CHILDP_MAXPARALLEL, NULL },
     { OPTU_CHILDS_SYNCTIMEOUT_MS, OPTT_INT | OPTF_READONLY,
       INI_SECTION_CONSOLE, _T("ChildScript_SyncTimeout_ms"),
       DEFAULT_CHILDS_SYNCTIMEOUT_MS, NULL },
@@ -1457,6 +1470,7 @@ extern "C" BOOL APIENTRY DllMain(
       CNppExec::_bIsNppReady = false;
 
       Runtime::GetNppExec().InitPluginName((HMODULE) hInstance);
+      CScriptEngine::InitProfilingTls();
         
       //now in the setInfo:
       //globalInitialize();
@@ -1468,6 +1482,7 @@ extern "C" BOOL APIENTRY DllMain(
     {
       globalUninitialize();
       CNppExec::_bIsNppReady = false;
+      CScriptEngine::FreeProfilingTls();
 
     }
       break;
@@ -1567,6 +1582,18 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification *notifyCode)
         }
         return;
     }
+
+    if ( notifyCode->nmhdr.code == SCN_UPDATEUI )
+    {
+        // the caret, the selection or the text has been changed
+        const NppData& nppData = Runtime::GetNppExec().m_nppData;
+        if ( notifyCode->nmhdr.hwndFrom == nppData._scintillaMainHandle ||
+             notifyCode->nmhdr.hwndFrom == nppData._scintillaSecondHandle )
+        {
+            Runtime::GetNppExec().GetMacroVars().InvalidateNppState();
+        }
+        return;
+    }
   
     if ( notifyCode->nmhdr.hwndFrom == Runtime::GetNppExec().m_nppData._nppHandle )
     {
@@ -1574,10 +1601,21 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification *notifyCode)
         if ( notifyCode->nmhdr.code == NPPN_BUFFERACTIVATED || 
              notifyCode->nmhdr.code == NPPN_FILESAVED )
         {
+            Runtime::GetNppExec().GetMacroVars().InvalidateNppState();
+
             if ( bNppReady )
                 UpdateCurrentDirectory();
         }
 
+        else if ( notifyCode->nmhdr.code == NPPN_FILEOPENED ||
+                  notifyCode->nmhdr.code == NPPN_FILECLOSED ||
+                  notifyCode->nmhdr.code == NPPN_FILERENAMED ||
+                  notifyCode->nmhdr.code == NPPN_DOCORDERCHANGED )
+        {
+            // $(LEFT_VIEW_FILE), $(RIGHT_VIEW_FILE), ...
+            Runtime::GetNppExec().GetMacroVars().InvalidateNppState();
+        }
+
         else if ( notifyCode->nmhdr.code == NPPN_READY )
         {
             CNppExec& NppExec = Runtime::GetNppExec();
@@ -1749,6 +1787,8 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification *notifyCode)
                 NppExec.printConsoleHelpInfo();
             }
 
+            CNppExecMacroVars::StrCalc::PreloadFParserConsts(&NppExec);
+            NppExec.RestoreUserVars();
             NppExec.RunTheStartScript();
 
             if ( Runtime::GetLogger().IsLogFileOpen() )
@@ -1773,6 +1813,7 @@ extern "C" __declspec(dllexport) void beNotified(SCNotification *notifyCode)
             NppExec._consoleIsVisible = false; // stopping every script (except the exit script, if any) & child process
 
             NppExec.RunTheExitScript();
+            NppExec.SaveUserVars();
 
             if ( ::GetProp(NppExec.m_nppData._nppHandle, PROP_NPPEXEC_DLL) )
             {
@@ -2722,6 +2763,7 @@ CChildProcess::CChildProcess(CScriptEngine* pScriptEngine)
 
     m_pNppExec = pScriptEngine->GetNppExec();
     m_pScriptEngine = pScriptEngine;
+    m_nParallelJob = 0;
 
     reset();
 
@@ -2892,39 +2934,39 @@ bool CChildProcess::Create(HWND /*hParentWnd*/, LPCTSTR cszCommandLine)
     // Create the Pipe and get r/w handles
     if ( !::CreatePipe(&m_hStdOutReadPipe, &m_hStdOutWritePipe, &sa, DEFAULT_PIPE_SIZE) )
     {
-        m_pNppExec->GetConsole().PrintError( _T("CreatePipe(<StdOut>) failed") );
+        printError( _T("CreatePipe(<StdOut>) failed") );
         return false;
     }
     if ( m_hStdOutWritePipe == NULL )
     {
         if ( m_hStdOutReadPipe != NULL )
             ::CloseHandle(m_hStdOutReadPipe);
-        m_pNppExec->GetConsole().PrintError( _T("hStdOutWritePipe = NULL") );
+        printError( _T("hStdOutWritePipe = NULL") );
         return false;
     }
     if ( m_hStdOutReadPipe == NULL )
     {
         ::CloseHandle(m_hStdOutWritePipe);
-        m_pNppExec->GetConsole().PrintError( _T("hStdOutReadPipe = NULL") );
+        printError( _T("hStdOutReadPipe = NULL") );
         return false;
     }
 
     if ( !::CreatePipe(&m_hStdInReadPipe, &m_hStdInWritePipe, &sa, DEFAULT_PIPE_SIZE) )
     {
-        m_pNppExec->GetConsole().PrintError( _T("CreatePipe(<StdIn>) failed") );
+        printError( _T("CreatePipe(<StdIn>) failed") );
         return false;
     }
     if ( m_hStdInWritePipe == NULL )
     {
         if ( m_hStdInReadPipe != NULL )
             ::CloseHandle(m_hStdInReadPipe);
-        m_pNppExec->GetConsole().PrintError( _T("hStdInWritePipe = NULL") );
+        printError( _T("hStdInWritePipe = NULL") );
         return false;
     }
     if ( m_hStdInReadPipe == NULL )
     {
         ::CloseHandle(m_hStdInWritePipe);
-        m_pNppExec->GetConsole().PrintError( _T("hStdInReadPipe = NULL") );
+        printError( _T("hStdInReadPipe = NULL") );
         return false;
     }
 
@@ -2979,8 +3021,9 @@ bool CChildProcess::Create(HWND /*hParentWnd*/, LPCTSTR cszCommandLine)
 
         bool isConsoleProcessRunning = true;
     
-        m_pNppExec->GetConsole().PrintMessage( tstr().Format(80, _T("Process started (PID=%u) >>>"), m_ProcessInfo.dwProcessId) );
+        printMessage( tstr().Format(80, _T("Process started (PID=%u) >>>"), m_ProcessInfo.dwProcessId) );
 
+        if ( m_nParallelJob == 0 ) // parallel jobs would overwrite each other's $(PID)
         {
             TCHAR szProcessId[50];
             c_base::_tint2str(GetProcessId(), szProcessId);
@@ -3088,11 +3131,11 @@ bool CChildProcess::Create(HWND /*hParentWnd*/, LPCTSTR cszCommandLine)
                                 break;
                         }
                         Msg += _T('.');
-                        m_pNppExec->GetConsole().PrintMessage( Msg.c_str() );
+                        printMessage( Msg.c_str() );
                     }
                     else
                     {
-                        if (nPrevState != 1 /* new line */ )  m_pNppExec->GetConsole().PrintMessage( _T(""), false );
+                        if (nPrevState != 1 /* new line */ )  printMessage( _T(""), false );
                     }
                 }
                 else
@@ -3105,16 +3148,16 @@ bool CChildProcess::Create(HWND /*hParentWnd*/, LPCTSTR cszCommandLine)
 
                         if ( !m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOINTMSGS) )
                         {
-                            m_pNppExec->GetConsole().PrintMessage( tstr().Format(80, _T("<<< Process has been terminated (PID=%d)."), m_ProcessInfo.dwProcessId) );
+                            printMessage( tstr().Format(80, _T("<<< Process has been terminated (PID=%d)."), m_ProcessInfo.dwProcessId) );
                         }
                         else
                         {
-                            if (nPrevState != 1 /* new line */ )  m_pNppExec->GetConsole().PrintMessage( _T(""), false );
+                            if (nPrevState != 1 /* new line */ )  printMessage( _T(""), false );
                         }
                     }
                     else
                     {
-                        m_pNppExec->GetConsole().PrintError( tstr().Format(80, _T("<<< TerminateProcess() returned FALSE (PID=%d)."), m_ProcessInfo.dwProcessId) );
+                        printError( tstr().Format(80, _T("<<< TerminateProcess() returned FALSE (PID=%d)."), m_ProcessInfo.dwProcessId) );
                     }
                 }
 
@@ -3133,11 +3176,11 @@ bool CChildProcess::Create(HWND /*hParentWnd*/, LPCTSTR cszCommandLine)
         {
             if ( !m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOINTMSGS) )
             {
-                m_pNppExec->GetConsole().PrintMessage( tstr().Format(100, _T("<<< Process finished (PID=%u). (Exit code %d)"), m_ProcessInfo.dwProcessId, m_nExitCode) ); 
+                printMessage( tstr().Format(100, _T("<<< Process finished (PID=%u). (Exit code %d)"), m_ProcessInfo.dwProcessId, m_nExitCode) ); 
             }
             else
             {
-                if (nPrevState != 1 /* new line */ )  m_pNppExec->GetConsole().PrintMessage( _T(""), false );
+                if (nPrevState != 1 /* new line */ )  printMessage( _T(""), false );
             }
         }
 
@@ -3149,16 +3192,51 @@ bool CChildProcess::Create(HWND /*hParentWnd*/, LPCTSTR cszCommandLine)
 
         closePipes();
 
-        if ( m_pScriptEngine )
+        if ( m_nParallelJob != 0 )
+        {
+            printError( cszCommandLine );
+            printError( tstr().Format(100, _T("CreateProcess() failed with error code %lu"), dwErrorCode) );
+        }
+        else
         {
-            m_pNppExec->GetConsole().PrintError( m_pScriptEngine->GetLastLoggedCmd().c_str() );
+            if ( m_pScriptEngine )
+            {
+                printError( m_pScriptEngine->GetLastLoggedCmd().c_str() );
+            }
+            m_pNppExec->GetConsole().PrintSysError( _T("CreateProcess()"), dwErrorCode );
         }
-        m_pNppExec->GetConsole().PrintSysError( _T("CreateProcess()"), dwErrorCode );
 
         return false;
     }
 }
 
+void CChildProcess::printError(const TCHAR* cszMessage)
+{
+    if ( m_nParallelJob != 0 )
+        m_pScriptEngine->AddParallelJobOutput( m_nParallelJob, CScriptEngine::pjoError, cszMessage );
+    else
+        m_pNppExec->GetConsole().PrintError( cszMessage );
+}
+
+void CChildProcess::printMessage(const TCHAR* cszMessage, bool bIsInternalMsg)
+{
+    if ( m_nParallelJob != 0 )
+    {
+        if ( cszMessage[0] != 0 ) // the jobs' lines are always complete
+            m_pScriptEngine->AddParallelJobOutput( m_nParallelJob, bIsInternalMsg ? CScriptEngine::pjoInternalMessage : CScriptEngine::pjoMessage, cszMessage );
+    }
+    else
+        m_pNppExec->GetConsole().PrintMessage( cszMessage, bIsInternalMsg );
+}
+
+void CChildProcess::printOutput(const TCHAR* cszMessage, bool bNewLine)
+{
+    if ( m_nParallelJob != 0 )
+        m_pScriptEngine->AddParallelJobOutput( m_nParallelJob, CScriptEngine::pjoOutput, cszMessage ); // always a complete line
+    else
+        m_pNppExec->GetConsole().PrintOutput( cszMessage, bNewLine );
+}
+
 void CChildProcess::reset()
 {
     m_strOutput.Clear();
@@ -3176,6 +3254,48 @@ bool CChildProcess::isBreaking() const
     return (m_nBreakMethod != CProcessKiller::killNone);
 }
 
+void CChildProcess::SetParallelJob(int nJob)
+{
+    m_nParallelJob = nJob;
+
+    // the job's thread does not access the vars, so the Console filters
+    // are taken as they are when the job starts
+    m_ParallelJobFilters.clear();
+    if ( nJob != 0 )
+    {
+        for ( int i = 0; i < CConsoleOutputFilterDlg::FILTER_ITEMS; i++ )
+        {
+            m_ParallelJobFilters[OPTS_CONFLTR_INCLLINE1 + i] = m_pNppExec->GetOptions().GetStr(OPTS_CONFLTR_INCLLINE1 + i);
+            m_ParallelJobFilters[OPTS_CONFLTR_EXCLLINE1 + i] = m_pNppExec->GetOptions().GetStr(OPTS_CONFLTR_EXCLLINE1 + i);
+        }
+        for ( int i = 0; i < CConsoleOutputFilterDlg::REPLACE_ITEMS; i++ )
+        {
+            m_ParallelJobFilters[OPTS_CONFLTR_R_FIND1 + i] = m_pNppExec->GetOptions().GetStr(OPTS_CONFLTR_R_FIND1 + i);
+            m_ParallelJobFilters[OPTS_CONFLTR_R_RPLC1 + i] = m_pNppExec->GetOptions().GetStr(OPTS_CONFLTR_R_RPLC1 + i);
+        }
+        for ( auto& filter : m_ParallelJobFilters )
+        {
+            m_pNppExec->GetMacroVars().CheckAllMacroVars(m_pScriptEngine, filter.second, false);
+        }
+    }
+}
+
+void CChildProcess::getFilterStr(int nOptId, tstr& S) const
+{
+    if ( m_nParallelJob != 0 )
+    {
+        std::map<int, tstr>::const_iterator itr = m_ParallelJobFilters.find(nOptId);
+        if ( itr != m_ParallelJobFilters.end() )
+            S = itr->second;
+        else
+            S.Clear();
+        return;
+    }
+
+    S = m_pNppExec->GetOptions().GetStr(nOptId);
+    m_pNppExec->GetMacroVars().CheckAllMacroVars(m_pScriptEngine, S, false);
+}
+
 bool CChildProcess::applyOutputFilters(const tstr& _line, bool bOutput)
 {
     const bool bConFltrEnable = m_pNppExec->GetOptions().GetBool(OPTB_CONFLTR_ENABLE);
@@ -3191,14 +3311,9 @@ bool CChildProcess::applyOutputFilters(const tstr& _line, bool bOutput)
         for ( int i = 0; bOutput && 
                (i < CConsoleOutputFilterDlg::FILTER_ITEMS); i++ )
         {
-            int len = 0;
-            const TCHAR* cszLine = m_pNppExec->GetOptions().GetStr(OPTS_CONFLTR_INCLLINE1 + i, &len);
-            sLine = cszLine;
-            if ( m_pNppExec->GetMacroVars().CheckAllMacroVars(m_pScriptEngine, sLine, false) )
-            {
-                cszLine = sLine.c_str();
-                len = sLine.length();
-            }
+            getFilterStr(OPTS_CONFLTR_INCLLINE1 + i, sLine);
+            const TCHAR* cszLine = sLine.c_str();
+            int len = sLine.length();
 
             if ( (nConFltrInclMask & (0x01 << i)) && (len > 0) )
             {
@@ -3210,14 +3325,9 @@ bool CChildProcess::applyOutputFilters(const tstr& _line, bool bOutput)
                 }
             }
 
-            len = 0;
-            cszLine = m_pNppExec->GetOptions().GetStr(OPTS_CONFLTR_EXCLLINE1 + i, &len);
-            sLine = cszLine;
-            if ( m_pNppExec->GetMacroVars().CheckAllMacroVars(m_pScriptEngine, sLine, false) )
-            {
-                cszLine = sLine.c_str();
-                len = sLine.length();
-            }
+            getFilterStr(OPTS_CONFLTR_EXCLLINE1 + i, sLine);
+            cszLine = sLine.c_str();
+            len = sLine.length();
 
             if ( bOutput && (nConFltrExclMask & (0x01 << i)) && (len > 0) )
             {
@@ -3255,28 +3365,18 @@ bool CChildProcess::applyReplaceFilters(tstr& _line, tstr& printLine, bool bOutp
         for ( int i = 0; bOutput && 
                (i < CConsoleOutputFilterDlg::REPLACE_ITEMS); i++ )
         {
-            int lenFind = 0;
-            const TCHAR* cszFind = m_pNppExec->GetOptions().GetStr(OPTS_CONFLTR_R_FIND1 + i, &lenFind);
-            sFind = cszFind;
-            if ( m_pNppExec->GetMacroVars().CheckAllMacroVars(m_pScriptEngine, sFind, false) )
-            {
-                cszFind = sFind.c_str();
-                lenFind = sFind.length();
-            }
+            getFilterStr(OPTS_CONFLTR_R_FIND1 + i, sFind);
+            const TCHAR* cszFind = sFind.c_str();
+            int lenFind = sFind.length();
 
             if ( (nRplcFltrFindMask & (0x01 << i)) && 
                  ( ((lenFind > 0) && (_line.length() > 0)) || 
                    ((lenFind == 0) && (_line.length() == 0)) )
                )
             {
-                int lenRplc = 0;
-                const TCHAR* cszRplc = m_pNppExec->GetOptions().GetStr(OPTS_CONFLTR_R_RPLC1 + i, &lenRplc);
-                sRplc = cszRplc;
-                if ( m_pNppExec->GetMacroVars().CheckAllMacroVars(m_pScriptEngine, sRplc, false) )
-                {
-                    cszRplc = sRplc.c_str();
-                    lenRplc = sRplc.length();
-                }
+                getFilterStr(OPTS_CONFLTR_R_RPLC1 + i, sRplc);
+                const TCHAR* cszRplc = sRplc.c_str();
+                int lenRplc = sRplc.length();
 
                 if ( lenFind > 0 )
                 {
@@ -3565,7 +3665,12 @@ DWORD CChildProcess::readPipesAndOutput(CStrT<char>& bufLine,
                                     
                                 if ( bOutput )
                                 {
-                                    if ( nPrevState == 3 ) // '\r'
+                                    if ( m_nParallelJob != 0 )
+                                    {
+                                        // the lines of the parallel jobs are interleaved,
+                                        // so '\r' and '\b' can't overwrite anything
+                                    }
+                                    else if ( nPrevState == 3 ) // '\r'
                                     {
                                         m_pNppExec->GetConsole().ProcessSlashR();
                                     }
@@ -3576,6 +3681,12 @@ DWORD CChildProcess::readPipesAndOutput(CStrT<char>& bufLine,
                                     
                                     if ( bOutputVar )
                                     {
+                                        const int nNewLength = m_strOutput.length() + printLine.length() + 1;
+                                        if ( nNewLength >= m_strOutput.GetMemSize() )
+                                        {
+                                            // CStrT grows by 1 KB at most, that's O(N^2) for a long build log
+                                            m_strOutput.Reserve( nNewLength + nNewLength/2 );
+                                        }
                                         m_strOutput += printLine;
                                         if ( nIsNewLine == 1 )
                                         {
@@ -3583,7 +3694,7 @@ DWORD CChildProcess::readPipesAndOutput(CStrT<char>& bufLine,
                                         }
                                     }
 
-                                    m_pNppExec->GetConsole().PrintOutput( printLine.c_str(), (nIsNewLine == 1) ? true : false );
+                                    printOutput( printLine.c_str(), (nIsNewLine == 1) ? true : false );
                                 }
 
                                 // if the current line is not over, then the current filter 
@@ -4166,6 +4277,47 @@ void CNppExec::RunTheStartScript()
     }
 }
 
+void CNppExec::RestoreUserVars()
+{
+    if ( !GetOptions().GetBool(OPTB_PLUGIN_SAVEUSERVARS) )
+        return;
+
+    TCHAR path[FILEPATH_BUFSIZE];
+    ExpandToFullConfigPath(path, USERVARS_SNAPSHOT);
+    if ( !GetMacroVars().LoadFromSnapshotFile(path) )
+        return;
+
+    if ( Runtime::GetLogger().IsLogFileOpen() )
+    {
+        Runtime::GetLogger().AddEx( _T("; user vars restored from \"%s\""), path );
+    }
+
+    HMENU hMenu = GetNppMainMenu();
+    if ( hMenu )
+    {
+        CCriticalSectionLockGuard lock(GetMacroVars().GetCsCmdAliases());
+        const bool bEnable = !GetMacroVars().GetCmdAliases().empty();
+        ::EnableMenuItem( hMenu, g_funcItem[N_NOCMDALIASES]._cmdID,
+            MF_BYCOMMAND | (bEnable ? MF_ENABLED : MF_GRAYED) );
+    }
+}
+
+void CNppExec::SaveUserVars()
+{
+    if ( !GetOptions().GetBool(OPTB_PLUGIN_SAVEUSERVARS) )
+        return;
+
+    TCHAR path[FILEPATH_BUFSIZE];
+    ExpandToFullConfigPath(path, USERVARS_SNAPSHOT);
+    if ( !GetMacroVars().SaveToSnapshotFile(path) )
+    {
+        if ( Runtime::GetLogger().IsLogFileOpen() )
+        {
+            Runtime::GetLogger().AddEx( _T("; failed to save user vars to \"%s\""), path );
+        }
+    }
+}
+
 void CNppExec::RunTheExitScript()
 {
     // Note: the Console output is already disabled (see the NPPN_SHUTDOWN handler).
@@ -4608,6 +4760,10 @@ void CNppExec::ReadOptions()
   {
     GetOptions().SetUint(OPTU_CHILDP_RUNPOLICY, DEFAULT_CHILDP_RUNPOLICY);
   }
+  if (GetOptions().GetInt(OPTI_CHILDP_MAXPARALLEL) < 0)
+  {
+    GetOptions().SetInt(OPTI_CHILDP_MAXPARALLEL, DEFAULT_CHILDP_MAXPARALLEL);
+  }
   if (GetOptions().GetInt(OPTU_CHILDS_SYNCTIMEOUT_MS) < 0)
   {
     GetOptions().SetUint(OPTU_CHILDS_SYNCTIMEOUT_MS, DEFAULT_CHILDS_SYNCTIMEOUT_MS);
@@ -5727,6 +5883,7 @@ void CNppExecConsole::PrintError(LPCTSTR cszMessage, bool bLogThisMsg )
 
     if ( !postponeThisCall(scrptEngnId) )
     {
+        CScriptEngine::CProfileScope profileScope(CScriptEngine::pcConsoleOutput);
         _printError(scrptEngnId, cszMessage, bLogThisMsg);
     }
     else
@@ -5772,6 +5929,7 @@ void CNppExecConsole::PrintMessage(LPCTSTR cszMessage, bool bIsInternalMsg , boo
 
     if ( !postponeThisCall(scrptEngnId) )
     {
+        CScriptEngine::CProfileScope profileScope(CScriptEngine::pcConsoleOutput);
         _printMessage(scrptEngnId, cszMessage, bIsInternalMsg, bLogThisMsg);
     }
     else
@@ -5814,6 +5972,7 @@ void CNppExecConsole::PrintOutput(LPCTSTR cszMessage, bool bNewLine , bool bLogT
 
     if ( !postponeThisCall(scrptEngnId) )
     {
+        CScriptEngine::CProfileScope profileScope(CScriptEngine::pcConsoleOutput);
         _printOutput(scrptEngnId, cszMessage, bNewLine, bLogThisMsg);
     }
     else
@@ -5874,6 +6033,7 @@ void CNppExecConsole::PrintStr(LPCTSTR cszStr, bool bNewLine, bool bLogThisMsg )
 
     if ( !postponeThisCall(scrptEngnId) )
     {
+        CScriptEngine::CProfileScope profileScope(CScriptEngine::pcConsoleOutput);
         _printStr(scrptEngnId, cszStr, bNewLine, bLogThisMsg);
     }
     else
@@ -510,6 +510,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "cpp/CStrT.h"
 #include "cpp/CBufT.h"
 #include "cpp/StrSplitT.h"
+#include "cpp/StrHashMapT.h"
 #include "NppScriptList.h"
 #include "CSimpleLogger.h"
 #include "DlgConsole.h"
@@ -587,6 +588,7 @@ enum EPluginOptions {
     OPTU_CHILDP_KILLTIMEOUT_MS,
     OPTU_CHILDP_RUNPOLICY,
     OPTS_CHILDP_COMSPECSWITCHES,
+    OPTI_CHILDP_MAXPARALLEL,
     OPTU_CHILDS_SYNCTIMEOUT_MS,
     OPTU_EXITS_TIMEOUT_MS,
     OPTB_PATH_AUTODBLQUOTES,
@@ -601,6 +603,7 @@ enum EPluginOptions {
     OPTI_RICHEDIT_MAXTEXTLEN,
     OPTI_SENDMSG_MAXBUFLEN,
     OPTS_CALC_PRECISION,
+    OPTI_CALC_OPTIMIZEHITS,
     OPTS_COMMENTDELIMITER,
     OPTI_CONSOLE_VISIBLE,
     OPTB_CONSOLE_SHOWHELP,
@@ -949,6 +952,7 @@ enum EPluginOptions {
     OPTS_PLUGIN_LOGSDIR,
     OPTS_PLUGIN_SCRIPTSDIR,
     OPTU_PLUGIN_AUTOSAVE_SECONDS,
+    OPTB_PLUGIN_SAVEUSERVARS,
 
     OPT_COUNT
 };
@@ -1136,8 +1140,107 @@ public:
         svLocalVar  = 0x02
     };
 
+    // Notepad++'s state cached for $(FULL_CURRENT_PATH), $(CURRENT_WORD), ...
+    enum eNppStateItem
+    {
+        nsiFullCurrentPath = 0,
+        nsiCurrentDirectory,
+        nsiFileName,
+        nsiNamePart,
+        nsiExtPart,
+        nsiNppDirectory,
+        nsiCurrentWord,
+        nsiCurrentLine,
+        nsiCurrentColumn,
+        nsiLeftViewFile,
+        nsiRightViewFile,
+
+        nsiCount
+    };
+
 public:
-    typedef std::map<tstr, tstr> tMacroVars;
+    typedef CStrHashMapT<TCHAR> tMacroVars; // "$(NAME)" -> value, the names are upper-case
+
+    // Array and dictionary vars: "set arr[] = x" appends an item,
+    // "set d[key] = v" adds or modifies the item with this key.
+    // The items are kept in the order of their addition; an integer
+    // index N refers to the Nth item (N=1,2,3...; N<0 counts from the end).
+    typedef struct sMacroVarItems {
+        std::vector<tstr> Keys;   // upper-case, empty for the items appended by "set arr[] = x"
+        std::vector<tstr> Values;
+        CStrHashMapT<TCHAR, int> KeyIndex; // key -> index in Values
+    } tMacroVarItems;
+    typedef std::shared_ptr<tMacroVarItems> PMacroVarItems; // shared by the copies until modified
+    typedef CStrHashMapT<TCHAR, PMacroVarItems> tMacroVarArrays; // "$(NAME)" -> items, the names are upper-case
+
+    // A reader's copy of the shared user macro vars, see RefreshUserMacroVarsSnapshot().
+    // Each snapshot is used by one thread only.
+    class UserMacroVarsSnapshot
+    {
+    public:
+        UserMacroVarsSnapshot() : m_nVersion(0) { }
+
+        const tMacroVars* GetVars() const { return m_pVars.get(); }
+
+    protected:
+        friend class CNppExecMacroVars;
+
+        std::shared_ptr<const tMacroVars> m_pVars;
+        LONG m_nVersion;
+    };
+
+    // The command aliases as they are looked up by CheckCmdAliases():
+    // the leading parts of a command line that end before a space are
+    // searched by name, so the cost depends on the length of the line
+    // rather than on the number of the aliases.
+    typedef struct sCmdAliasIndex {
+        tMacroVars Aliases; // a copy of m_CmdAliases, shares the slots until m_CmdAliases is modified
+        int nMaxNameLength;
+    } tCmdAliasIndex;
+
+    // $(ARGC), $(ARGV...) and $(RARGV...) values of a NPP_EXEC call, prepared once per call
+    typedef struct sCmdArgValues {
+        std::vector<tstr> Argv; // Argv[0] is the script name
+        tstr Args;  // $(ARGV)
+        tstr RArgs; // $(RARGV)
+        tstr Argc;  // $(ARGC)
+    } tCmdArgValues;
+    typedef std::shared_ptr<const tCmdArgValues> PCmdArgValues;
+
+    // A script line with its $(ARGC), $(ARGV...) and $(RARGV...) found once:
+    // the slots are filled in with the values of each NPP_EXEC call by
+    // BindCmdArgs() without searching the line again.
+    typedef struct sCmdArgsTemplate {
+        enum eSlotType {
+            stArgc = 0, // $(ARGC)
+            stArgs,     // $(ARGV)
+            stRArgs,    // $(RARGV)
+            stArgv,     // $(ARGV[N])
+            stRArgv     // $(RARGV[N])
+        };
+        typedef struct sSlot {
+            int nPos;   // position in Text
+            int nType;  // eSlotType
+            int nIndex; // N of $(ARGV[N]) or $(RARGV[N])
+        } tSlot;
+
+        tstr Text; // the line without the slots
+        std::vector<tSlot> Slots;
+    } tCmdArgsTemplate;
+
+    // A reader's copy of the command aliases, see RefreshCmdAliasesSnapshot().
+    // Each snapshot is used by one thread only.
+    class CmdAliasesSnapshot
+    {
+    public:
+        CmdAliasesSnapshot() : m_nVersion(-1) { } // m_nCmdAliasesVersion starts from 0
+
+    protected:
+        friend class CNppExecMacroVars;
+
+        std::shared_ptr<const tCmdAliasIndex> m_pIndex;
+        LONG m_nVersion;
+    };
 
 public:
     CNppExecMacroVars();
@@ -1151,21 +1254,64 @@ public:
     static bool ContainsMacroVar(const tstr& S);
     tMacroVars& GetUserLocalMacroVars(CScriptEngine* pScriptEngine); // use with GetCsUserMacroVars()
     tMacroVars& GetUserConsoleMacroVars(); // use with GetCsUserMacroVars()
-    tMacroVars& GetUserMacroVars(); // use with GetCsUserMacroVars()
+    tMacroVars& GetUserMacroVars(); // use with GetCsUserMacroVars(), modify via SetUserMacroVar()
     tMacroVars& GetCmdAliases(); // use with GetCsCmdAliases()
+    tMacroVarArrays& GetUserLocalMacroArrays(CScriptEngine* pScriptEngine); // use with GetCsUserMacroVars()
+    tMacroVarArrays& GetUserConsoleMacroArrays(); // use with GetCsUserMacroVars()
+    tMacroVarArrays& GetUserMacroArrays(); // use with GetCsUserMacroVars()
 
     CCriticalSection& GetCsUserMacroVars();
     CCriticalSection& GetCsCmdAliases();
 
+    unsigned int GetCmdAliasesVersion() const;
+    void         IncCmdAliasesVersion(); // call it each time m_CmdAliases is modified
+
+    // Updates the snapshot of the shared user macro vars without locking
+    // unless the vars have been modified since the snapshot was taken.
+    // Returns false when the calling thread is the last one that modified
+    // the vars: then GetUserMacroVars() should be read under GetCsUserMacroVars()
+    // rather than copying the vars for each modification.
+    bool         RefreshUserMacroVarsSnapshot(UserMacroVarsSnapshot& snapshot);
+
+    // Updates the snapshot of the command aliases without locking
+    // unless the aliases have been modified since the snapshot was taken.
+    void         RefreshCmdAliasesSnapshot(CmdAliasesSnapshot& snapshot);
+
+    // Reading Notepad++'s state from a script's thread is a SendMessage
+    // round-trip to Notepad++'s thread, so the values are cached until
+    // InvalidateNppState() is called (on Notepad++'s notifications and
+    // after the commands that may change the state).
+    // GetCachedNppState() returns false if the value must be retrieved,
+    // then nVersion is to be passed to SetCachedNppState().
+    bool         GetCachedNppState(eNppStateItem nItem, tstr& value, LONG& nVersion);
+    void         SetCachedNppState(eNppStateItem nItem, LONG nVersion, const tstr& value);
+    void         InvalidateNppState();
+    LONG         GetNppStateRoundTripsSaved() const;
+
     // check macro vars...
     static void CheckCmdArgs(tstr& Cmd, const CStrSplitT<TCHAR>& args);
-    void        CheckCmdAliases(tstr& S, bool useLogging);
+    static void PrepareCmdArgValues(const CStrSplitT<TCHAR>& args, tCmdArgValues& values);
+    static bool CompileCmdArgs(const tstr& Cmd, tCmdArgsTemplate& cmdTemplate); // returns false if there are no slots
+    static void BindCmdArgs(const tCmdArgsTemplate& cmdTemplate, const tCmdArgValues& values, tstr& Cmd);
+    void        CheckCmdAliases(tstr& S, bool useLogging, CmdAliasesSnapshot* pSnapshot = nullptr); // pSnapshot is the caller's one or nullptr
     void        CheckNppMacroVars(tstr& S);
     void        CheckPluginMacroVars(tstr& S);
     bool        CheckUserMacroVars(CScriptEngine* pScriptEngine, tstr& S, int nCmdType = 0);
     static void CheckEmptyMacroVars(CNppExec* pNppExec, tstr& S, int nCmdType = 0);
     bool        CheckAllMacroVars(CScriptEngine* pScriptEngine, tstr& S, bool useLogging, int nCmdType = 0);
     bool        SetUserMacroVar(CScriptEngine* pScriptEngine, tstr& varName, const tstr& varValue, unsigned int nFlags = 0);
+    bool        MoveToUserMacroVar(CScriptEngine* pScriptEngine, tstr& varName, tstr& varValue, unsigned int nFlags = 0); // O(1), varValue gets the previous value
+
+    // array and dictionary vars...
+    static bool IsMacroVarItemName(const tstr& varName); // "name[key]" or "name[]"
+    void        ExpandMacroVarItemKey(CScriptEngine* pScriptEngine, tstr& varName); // "name[$(k)]": substitutes the user vars in the key
+    bool        SetUserMacroVarItem(CScriptEngine* pScriptEngine, tstr& varName, const tstr& varValue, unsigned int nFlags = 0); // "name[key]", "name[]"; svRemoveVar also accepts "name"
+    bool        GetUserMacroVarItem(CScriptEngine* pScriptEngine, const tstr& varNameUpper, tstr& Out); // "$(NAME[KEY])" or "$(NAME.COUNT)", appends the value to Out
+    std::shared_ptr<const tMacroVarItems> GetUserMacroVarItems(CScriptEngine* pScriptEngine, const tstr& varName); // "name" or "$(name)", nullptr if not found
+
+    // persistent snapshot of the shared vars, arrays and command aliases...
+    bool        SaveToSnapshotFile(const TCHAR* cszFileName); // deletes the file if there is nothing to save
+    bool        LoadFromSnapshotFile(const TCHAR* cszFileName); // the existing vars and aliases are kept
 
 public:
     class StrCalc
@@ -1187,13 +1333,25 @@ public:
         };
 
     public:
-        StrCalc(tstr& varValue, CNppExec* pNppExec);
+        StrCalc(tstr& varValue, CNppExec* pNppExec, CScriptEngine* pScriptEngine = nullptr);
         
         StrCalc& operator=(const StrCalc&) = delete;
 
         void Process();
-        
+
+        // Calculates "set x ~ expr" before its user vars are substituted:
+        // the vars are bound to fparser's variables, so that "$(i) + 1"
+        // is parsed once rather than once per value of $(i).
+        // Returns false if the vars are to be substituted first.
+        bool ProcessWithBoundVars();
+
+        // Reads fparser's constants in a background thread, so that
+        // the first calculation does not wait for NppExec\*.h files
+        static void PreloadFParserConsts(CNppExec* pNppExec);
+
     protected:
+        static int getCalcType(tstr& param); // param is made upper-case
+
         void calcFParser();
         void calcStrLen();
         void calcStrCase();
@@ -1206,6 +1364,7 @@ public:
     protected:
         tstr& m_varValue;
         CNppExec* m_pNppExec;
+        CScriptEngine* m_pScriptEngine; // its fparser's evaluator is used if not nullptr
         int m_calcType;
         const TCHAR* m_pVar;
         tstr m_param;
@@ -1215,12 +1374,27 @@ protected:
     // critical sections are created first and destroyed last...
     CCriticalSection m_csUserMacroVars;
     CCriticalSection m_csCmdAliases;
+    CCriticalSection m_csNppState;
     // data...
     CNppExec*  m_pNppExec;
     tMacroVars m_UserLocalMacroVars0; // <-- just in case, actually the vars are inside ScriptContext
     tMacroVars m_UserConsoleMacroVars; // local user macro vars in NppExec's Console (Console only, not scripts!)
     tMacroVars m_UserMacroVars; // shared user macro vars (shared by all NppExec's scripts)
     tMacroVars m_CmdAliases;
+    tMacroVarArrays m_UserLocalMacroArrays0; // <-- just in case, actually the arrays are inside ScriptContext
+    tMacroVarArrays m_UserConsoleMacroArrays; // local arrays in NppExec's Console
+    tMacroVarArrays m_UserMacroArrays; // shared arrays
+    volatile LONG m_nCmdAliasesVersion; // used to invalidate the compiled script lines
+    volatile LONG m_nUserMacroVarsVersion; // incremented each time m_UserMacroVars is modified
+    volatile DWORD m_dwUserMacroVarsWriterThreadId; // the last thread that modified m_UserMacroVars
+    std::shared_ptr<const tMacroVars> m_pUserMacroVarsSnapshot; // under m_csUserMacroVars
+    LONG m_nUserMacroVarsSnapshotVersion; // under m_csUserMacroVars
+    std::shared_ptr<const tCmdAliasIndex> m_pCmdAliasIndex; // under m_csCmdAliases
+    LONG m_nCmdAliasIndexVersion; // under m_csCmdAliases
+    tstr m_NppStateValues[nsiCount]; // under m_csNppState
+    LONG m_NppStateVersions[nsiCount]; // under m_csNppState, a value is valid while its version is current
+    volatile LONG m_nNppStateVersion; // incremented by InvalidateNppState()
+    volatile LONG m_nNppStateRoundTripsSaved; // the values taken from the cache
 };
 
 class CNppExec
@@ -1342,6 +1516,8 @@ public:
 
   void RunTheStartScript();
   void RunTheExitScript();
+  void RestoreUserVars();
+  void SaveUserVars();
 
 #ifdef _SCROLL_TO_LATEST  
   void OnScrollToLatest();
@@ -1417,6 +1593,7 @@ namespace Runtime
 };
 
 extern const TCHAR SCRIPTFILE_SAVED[];
+extern const TCHAR FPCONSTS_CACHE[];
 
 
 //--------------------------------------------------------------------
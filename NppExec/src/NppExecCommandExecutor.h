@@ -76,6 +76,12 @@ class CChildProcess
 
         bool WriteInput(const TCHAR* szLine, bool bFFlush = false);
 
+        // PARALLEL: the output of a job is passed to the script engine
+        // instead of being printed directly; must be called from the
+        // script's thread as it substitutes the vars of the Console filters
+        void SetParallelJob(int nJob);
+        int  GetParallelJob() const { return m_nParallelJob; }
+
         tstr& GetOutput(); // non-const allows to avoid copying at the very end
         int   GetExitCode() const;
         DWORD GetProcessId() const;
@@ -94,8 +100,12 @@ class CChildProcess
         void  reset();
         bool  isBreaking() const;
         void  closePipes();
+        void  printError(const TCHAR* cszMessage);
+        void  printMessage(const TCHAR* cszMessage, bool bIsInternalMsg = true);
+        void  printOutput(const TCHAR* cszMessage, bool bNewLine);
         bool  applyOutputFilters(const tstr& _line, bool bOutput);
         bool  applyReplaceFilters(tstr& _line, tstr& printLine, bool bOutput);
+        void  getFilterStr(int nOptId, tstr& S) const;
         DWORD readPipesAndOutput(CStrT<char>& bufLine, 
                                  bool& bPrevLineEmpty,
                                  int&  nPrevState,
@@ -108,6 +118,8 @@ class CChildProcess
         tstr                m_strInstance;
         tstr                m_strOutput;
         int                 m_nExitCode;
+        int                 m_nParallelJob; // 1-based, 0 if not a PARALLEL job
+        std::map<int, tstr> m_ParallelJobFilters; // PARALLEL: the Console filters by option id, vars substituted
         unsigned int        m_nBreakMethod;
         HANDLE              m_hStdInReadPipe;
         HANDLE              m_hStdInWritePipe; 
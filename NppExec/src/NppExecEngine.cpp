@@ -34,6 +34,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <shellapi.h>
 #include <limits>
+#include <algorithm>
+#include <vector>
+#include <list>
 
 #ifdef UNICODE
   #define _t_sprintf  swprintf
@@ -74,6 +77,7 @@ const TCHAR MACRO_PID[]                 = _T("$(PID)");
 const TCHAR MACRO_OUTPUT[]              = _T("$(OUTPUT)");
 const TCHAR MACRO_OUTPUT1[]             = _T("$(OUTPUT1)");
 const TCHAR MACRO_OUTPUTL[]             = _T("$(OUTPUTL)");
+const TCHAR MACRO_OUTPUT_LINE[]         = _T("$(OUTPUTL[");
 const TCHAR MACRO_MSG_RESULT[]          = _T("$(MSG_RESULT)");
 const TCHAR MACRO_MSG_WPARAM[]          = _T("$(MSG_WPARAM)");
 const TCHAR MACRO_MSG_LPARAM[]          = _T("$(MSG_LPARAM)");
@@ -149,13 +153,13 @@ class PrintMacroVarFunc
 {
     public:
         typedef const CNppExecMacroVars::tMacroVars container_type;
-        typedef container_type::const_iterator iterator_type;
+        typedef const CNppExecMacroVars::tMacroVars::value_type* item_type;
 
         PrintMacroVarFunc(CNppExec* pNppExec) : m_pNppExec(pNppExec)
         {
         }
 
-        bool operator()(iterator_type itrVar, bool isLocalVar)
+        bool operator()(item_type itrVar, bool isLocalVar)
         {
             tstr S = isLocalVar ? _T("local ") : _T("");
             S += itrVar->first;
@@ -178,41 +182,134 @@ class PrintMacroVarFunc
         CNppExec* m_pNppExec;
 };
 
-class SubstituteMacroVarFunc
+static void appendMacroVarValueToShow(tstr& S, const tstr& varValue)
 {
-    public:
-        typedef const CNppExecMacroVars::tMacroVars container_type;
-        typedef container_type::const_iterator iterator_type;
+    if ( varValue.length() > MAX_VAR_LENGTH2SHOW )
+    {
+        S.Append( varValue.c_str(), MAX_VAR_LENGTH2SHOW - 5 );
+        S += _T("(...)");
+    }
+    else
+    {
+        S += varValue;
+    }
+}
+
+// prints "$(ARR[KEY])" or all the items of "$(ARR)"; varName is in upper case
+static bool printMacroVarItems(CNppExec* pNppExec, CScriptEngine* pScriptEngine, const tstr& varName, bool isInternal)
+{
+    CNppExecMacroVars& MacroVars = pNppExec->GetMacroVars();
+    tstr S;
+
+    if ( CNppExecMacroVars::IsMacroVarItemName(varName) )
+    {
+        tstr varValue;
+        if ( !MacroVars.GetUserMacroVarItem(pScriptEngine, varName, varValue) )
+            return false;
+
+        S = varName;
+        S += _T(" = ");
+        appendMacroVarValueToShow(S, varValue);
+        pNppExec->GetConsole().PrintMessage( S.c_str(), isInternal );
+        return true;
+    }
+
+    std::shared_ptr<const CNppExecMacroVars::tMacroVarItems> pItems = MacroVars.GetUserMacroVarItems(pScriptEngine, varName);
+    if ( !pItems )
+        return false;
 
-        SubstituteMacroVarFunc(tstr& Value) : m_Value(Value)
+    const tstr arrName( varName.c_str(), varName.length() - 1 ); // without the ')'
+    TCHAR szNum[50];
+    ::wsprintf( szNum, _T("%d"), static_cast<int>(pItems->Values.size()) );
+    S = arrName;
+    S += _T(".COUNT) = ");
+    S += szNum;
+    pNppExec->GetConsole().PrintMessage( S.c_str(), isInternal );
+
+    for ( size_t i = 0; i < pItems->Values.size(); ++i )
+    {
+        S = arrName;
+        S += _T('[');
+        if ( pItems->Keys[i].IsEmpty() )
         {
-            m_ValueUpper = Value;
-            NppExecHelpers::StrUpper(m_ValueUpper);
+            ::wsprintf( szNum, _T("%d"), static_cast<int>(i + 1) );
+            S += szNum;
         }
+        else
+            S += pItems->Keys[i];
+        S += _T("]) = ");
+        appendMacroVarValueToShow(S, pItems->Values[i]);
+        pNppExec->GetConsole().PrintMessage( S.c_str(), isInternal );
+    }
 
-        SubstituteMacroVarFunc& operator=(const SubstituteMacroVarFunc&) = delete;
+    return true;
+}
 
-        bool operator()(iterator_type itrVar, bool /*isLocalVar*/)
-        {
-            int pos = m_ValueUpper.Find(_T("$("), 0);
-            if ( pos < 0 )
-                return false;
+// Substitutes the "$(...)" vars in one left-to-right scan: each var is
+// tokenized once, the inner vars of its name (e.g. "$(x$(i))") are
+// expanded first, then the name is resolved via m_Handlers (Notepad++'s
+// and plugin's vars) and then via the user's local and shared vars.
+// The substituted values are not scanned again.
+class MacroVarsExpander
+{
+    public:
+        enum eScope {
+            esNppVars     = 0x01, // $(FULL_CURRENT_PATH), $(CURRENT_WORD), ...
+            esPluginVars  = 0x02, // $(#N), $(SYS.<var>), $(CWD), ...
+            esUserVars    = 0x04, // the user's local and shared vars
+            esNoEmptyVars = 0x08, // removes the unknown vars
+            esAllVars     = esNppVars | esPluginVars | esUserVars
+        };
 
-            const tstr& varName = itrVar->first;
-            while ( (pos = m_ValueUpper.Find(varName, pos)) >= 0 )
-            {
-                const tstr& varValue = itrVar->second;
-                m_ValueUpper.Replace( pos, varName.length(), varValue.c_str(), varValue.length() );
-                m_Value.Replace( pos, varName.length(), varValue.c_str(), varValue.length() );
-                pos += varValue.length();
-            }
+        MacroVarsExpander(CNppExecMacroVars& MacroVars, CScriptEngine* pScriptEngine, unsigned int nScopes);
 
-            return true;
-        }
+        MacroVarsExpander& operator=(const MacroVarsExpander&) = delete;
+
+        void Expand(tstr& S);
+
+    protected:
+        typedef struct sMacroVarHandler {
+            const TCHAR* szName;   // "$(NAME)" or a prefix such as "$(SYS."
+            bool         isPrefix;
+            unsigned int nScope;
+            void (MacroVarsExpander::*getValue)(const struct sMacroVarHandler& handler); // sets m_varValue
+            int          nParam;   // e.g. NPPM_GETFULLCURRENTPATH
+            int          nNppStateItem; // CNppExecMacroVars::eNppStateItem or -1 if not cached there
+        } tMacroVarHandler;
+
+        enum eConsts {
+            HANDLERS_COUNT = 19
+        };
+
+        const TCHAR* expandText(const TCHAR* p, tstr& Out, bool isVarName);
+        const TCHAR* expandVar(const TCHAR* p, tstr& Out);
+        bool resolve(const tstr& varName, tstr& Out); // appends the value to Out
+
+        void getNppString(const tMacroVarHandler& handler);
+        void getNppInt(const tMacroVarHandler& handler);
+        void getDocNumber(const tMacroVarHandler& handler);
+        void getSysVar(const tMacroVarHandler& handler);
+        void getViewFile(const tMacroVarHandler& handler);
+        void getCwd(const tMacroVarHandler& handler);
+        void getConfigDir(const tMacroVarHandler& handler);
+        void getClipboard(const tMacroVarHandler& handler);
+        void getHwnd(const tMacroVarHandler& handler);
+        void getOutputLine(const tMacroVarHandler& handler);
 
     protected:
-        tstr& m_Value;
-        tstr m_ValueUpper;
+        static const tMacroVarHandler m_Handlers[HANDLERS_COUNT];
+
+        CNppExecMacroVars& m_MacroVars;
+        CNppExec* m_pNppExec;
+        CScriptEngine* m_pScriptEngine;
+        CNppExecMacroVars::UserMacroVarsSnapshot* m_pUserVarsSnapshot; // the script's one or m_UserVarsSnapshot
+        CNppExecMacroVars::UserMacroVarsSnapshot m_UserVarsSnapshot;
+        unsigned int m_nScopes;
+        bool m_isFileNamesOK; // npp_bufFileNames contains all the files
+        bool m_isCached[HANDLERS_COUNT]; // each Notepad++'s var is retrieved once per string
+        tstr m_CachedValues[HANDLERS_COUNT];
+        tstr m_varNameUpper;
+        tstr m_varValue;
 };
 
 template<class MacroVarFunc> void IterateUserMacroVars(
@@ -220,32 +317,23 @@ template<class MacroVarFunc> void IterateUserMacroVars(
     typename MacroVarFunc::container_type& userLocalMacroVars,
     MacroVarFunc func)
 {
-    bool isLocalVars = true;
-    typename MacroVarFunc::iterator_type itrVar = userLocalMacroVars.begin();
-    for ( ; ; ++itrVar )
+    // the vars are not ordered in their containers, so they are sorted by name
+    std::vector<typename MacroVarFunc::item_type> sortedVars;
+
+    userLocalMacroVars.GetSortedItems(sortedVars);
+    for ( typename MacroVarFunc::item_type pVar : sortedVars )
     {
-        if ( isLocalVars )
-        {
-            if ( itrVar == userLocalMacroVars.end() )
-            {
-                itrVar = userMacroVars.begin();
-                if ( itrVar != userMacroVars.end() )
-                    isLocalVars = false;
-                else
-                    break;
-            }
-        }
-        else
-        {
-            if ( itrVar == userMacroVars.end() )
-                break;
-        }
+        if ( !func(pVar, true) )
+            return;
+    }
 
-        if ( isLocalVars ||
-             (userLocalMacroVars.find(itrVar->first) == userLocalMacroVars.end()) )
+    userMacroVars.GetSortedItems(sortedVars);
+    for ( typename MacroVarFunc::item_type pVar : sortedVars )
+    {
+        if ( userLocalMacroVars.find(pVar->first) == userLocalMacroVars.end() )
         {
-            if ( !func(itrVar, isLocalVars) )
-                break;
+            if ( !func(pVar, false) )
+                return;
         }
     }
 }
@@ -479,481 +567,1595 @@ static tstr getQueuedCommand(const tstr& params, bool& bUseSeparateScript)
     return Cmd;
 }
 
+// The binary snapshot files: the user vars (see CNppExecMacroVars::SaveToSnapshotFile)
+// and fparser's constants (see FParserWrapper::initFParserConsts)
+static void appendSnapshotDword(CBufT<char>& buf, DWORD dw)
+{
+  buf.Append( reinterpret_cast<const char*>(&dw), static_cast<int>(sizeof(DWORD)) );
+}
+
+static void appendSnapshotDouble(CBufT<char>& buf, double d)
+{
+  buf.Append( reinterpret_cast<const char*>(&d), static_cast<int>(sizeof(double)) );
+}
+
+template<typename T> static void appendSnapshotStr(CBufT<char>& buf, const CStrT<T>& S)
+{
+  appendSnapshotDword( buf, static_cast<DWORD>(S.length()) );
+  buf.Append( reinterpret_cast<const char*>(S.c_str()), S.length()*static_cast<int>(sizeof(T)) );
+}
+
+// reads the mapped snapshot file, each length is checked against the end of the data
+class CSnapshotReader
+{
+public:
+  CSnapshotReader(const char* pData, DWORD dwSize) : m_p(pData), m_pEnd(pData + dwSize) { }
+
+  bool ReadDword(DWORD& dw)
+  {
+    if ( m_pEnd - m_p < static_cast<ptrdiff_t>(sizeof(DWORD)) )
+      return false;
+    ::CopyMemory( &dw, m_p, sizeof(DWORD) );
+    m_p += sizeof(DWORD);
+    return true;
+  }
+
+  bool ReadDouble(double& d)
+  {
+    if ( m_pEnd - m_p < static_cast<ptrdiff_t>(sizeof(double)) )
+      return false;
+    ::CopyMemory( &d, m_p, sizeof(double) );
+    m_p += sizeof(double);
+    return true;
+  }
+
+  template<typename T> bool ReadStr(CStrT<T>& S)
+  {
+    DWORD dwLen = 0;
+    if ( !ReadDword(dwLen) )
+      return false;
+    if ( dwLen > static_cast<DWORD>((m_pEnd - m_p)/sizeof(T)) )
+      return false;
+    S.Copy( reinterpret_cast<const T*>(m_p), static_cast<int>(dwLen) );
+    m_p += dwLen*sizeof(T);
+    return true;
+  }
+
+  bool ReadVars(DWORD dwCount, CNppExecMacroVars::tMacroVars& vars)
+  {
+    tstr Name, Value;
+    for ( DWORD i = 0; i < dwCount; ++i )
+    {
+      if ( !ReadStr(Name) || !ReadStr(Value) )
+        return false;
+      vars[Name].Swap(Value);
+    }
+    return true;
+  }
+
+  bool ReadArrays(DWORD dwCount, CNppExecMacroVars::tMacroVarArrays& arrays)
+  {
+    tstr Name;
+    for ( DWORD i = 0; i < dwCount; ++i )
+    {
+      DWORD dwItems = 0;
+      if ( !ReadStr(Name) || !ReadDword(dwItems) )
+        return false;
+      if ( dwItems > static_cast<DWORD>((m_pEnd - m_p)/(2*sizeof(DWORD))) )
+        return false; // each item takes 2 lengths at least
+
+      CNppExecMacroVars::PMacroVarItems pItems = std::make_shared<CNppExecMacroVars::tMacroVarItems>();
+      pItems->Keys.resize(dwItems);
+      pItems->Values.resize(dwItems);
+      for ( DWORD k = 0; k < dwItems; ++k )
+      {
+        if ( !ReadStr(pItems->Keys[k]) || !ReadStr(pItems->Values[k]) )
+          return false;
+        if ( !pItems->Keys[k].IsEmpty() )
+          pItems->KeyIndex[pItems->Keys[k]] = static_cast<int>(k);
+      }
+      arrays[Name] = pItems;
+    }
+    return true;
+  }
+
+  bool IsAtEnd() const  { return (m_p == m_pEnd); }
+
+protected:
+  const char* m_p;
+  const char* m_pEnd;
+};
+
 /**/
-class FParserWrapper
+// fparser's constants (read from "NppExec\*.h") and the calc precision:
+// initialized once and then added to each thread's FParserWrapper
+class FParserConsts
 {
     public:
         typedef FunctionParser fparser_type;
 
-    public:
-        typedef struct sUserConst {
+        typedef struct sConst {
             CStrT<char> constName;
-            tstr        constValue;
-            int         nLine;
-        } tUserConst;
+            fparser_type::value_type constValue;
+        } tConst;
+        typedef std::vector<tConst> tConsts;
 
     public:
-        FParserWrapper()
-          : m_fp(nullptr)
-          , m_hasConsts(false)
-          , m_calc_precision(0.000001)
+        FParserConsts() : m_nInitialized(0), m_nNoHeadersWarning(0), m_calc_precision(0.000001), m_nOptimizeHits(0)
         {
             lstrcpy( m_szCalcDefaultFmt, _T("%.6f") );
             lstrcpy( m_szCalcSmallFmt,   _T("%.6G") );
             lstrcpy( m_szCalcBigFmt,     _T("%.7G") );
         }
 
-        ~FParserWrapper()
+        bool IsInitialized() const { return (m_nInitialized != 0); }
+
+        // the initialization is done by one FParserWrapper under this lock
+        CCriticalSection& GetLock() { return m_cs; }
+
+        void SetInitialized() { ::InterlockedExchange(&m_nInitialized, 1); }
+
+        // no *.h files in the folder: the warning is printed by the first calculation
+        void SetNoHeadersWarning(const tstr& folder)
         {
-            if ( m_fp != nullptr )
-                delete m_fp;
+            m_sNoHeadersFolder = folder;
+            ::InterlockedExchange(&m_nNoHeadersWarning, 1);
         }
 
-        bool Calculate(CNppExec* pNppExec, const tstr& func, tstr& calcError, tstr& ret)
+        // called when IsInitialized(), returns true once
+        bool TakeNoHeadersWarning(tstr& folder)
         {
-            return calc2(pNppExec, func, calcError, ret);
+            if ( m_nNoHeadersWarning == 0 || ::InterlockedExchange(&m_nNoHeadersWarning, 0) == 0 )
+                return false;
+
+            folder = m_sNoHeadersFolder;
+            return true;
         }
 
-    private:
-        void readConstsFromFile(CNppExec* pNppExec, const tstr& path)
+        void InitPrecision(CNppExec* pNppExec)
         {
-            CFileBufT<char>    fbuf;
-            CStrT<char>        line;
-            tUserConst         userConst;
-            CListT<tUserConst> unparsedUserConstsList;
-
-            if ( fbuf.LoadFromFile(path.c_str(), true, pNppExec->GetOptions().GetInt(OPTI_UTF8_DETECT_LENGTH)) )
+            int len = 0;
+            const TCHAR* pPrecision = pNppExec->GetOptions().GetStr(OPTS_CALC_PRECISION, &len);
+            if ( len > 0 )
             {
-                int nItemsOK = 0;
+                double precision = _t_str2f(pPrecision);
+                precision = abs_val(precision);
+                if ( precision > 0.0 )
+                {
+                    int d = 0;
 
-                Runtime::GetLogger().Add(   path.c_str() );
-                Runtime::GetLogger().Add(   _T("(") );
-                Runtime::GetLogger().IncIndentLevel();
+                    m_calc_precision = precision;
 
-                while ( fbuf.GetLine(line) >= 0 )
-                {
-                    if ( line.length() > 0 )
+                    while ( precision < 0.99 )
                     {
-                        int i = line.Find("//");
-                        if ( i >= 0 )
-                            line.Delete(i, -1);
+                        precision *= 10;
+                        ++d;
+                    }
+                    wsprintf(m_szCalcDefaultFmt, _T("%%.%df"), d);
+                    wsprintf(m_szCalcSmallFmt,   _T("%%.%dG"), d);
+                    wsprintf(m_szCalcBigFmt,     _T("%%.%dG"), d + 1);
+                }
+            }
+        }
 
-                        NppExecHelpers::StrDelLeadingTabSpaces(line);
+        void InitOptimizeHits(CNppExec* pNppExec)
+        {
+            const int nHits = pNppExec->GetOptions().GetInt(OPTI_CALC_OPTIMIZEHITS);
+            m_nOptimizeHits = (nHits > 0) ? nHits : 0;
+        }
 
-                        if ( line.length() > 0 && line.StartsWith("#define") )
-                        {
-                            line.Delete(0, 7); // delete "#define"
-                            NppExecHelpers::StrDelLeadingTabSpaces(line);
-                            if ( line.length() > 0 )
-                            {
-                                userConst.constName.Clear();
-                                userConst.constValue.Clear();
-                                userConst.nLine = fbuf.GetLineNumber() - 1;
+        void AddConst(const char* constName, fparser_type::value_type value)
+        {
+            m_Consts.push_back( tConst{CStrT<char>(constName), value} );
+        }
 
-                                i = 0;
-                                while ( i < line.length() && !NppExecHelpers::IsTabSpaceChar(line[i]) )
-                                {
-                                    userConst.constName += line[i];
-                                    ++i;
-                                }
+        // sorts the constants by name, called before SetInitialized()
+        void BuildIndex()
+        {
+            m_SortedConsts.resize(m_Consts.size());
+            for ( size_t i = 0; i < m_Consts.size(); ++i )
+            {
+                m_SortedConsts[i] = i;
+            }
+            std::stable_sort( m_SortedConsts.begin(), m_SortedConsts.end(),
+                [this](size_t i1, size_t i2) { return (::strcmp(m_Consts[i1].constName.c_str(), m_Consts[i2].constName.c_str()) < 0); } );
+        }
 
-                                line.Delete(0, i); // delete const name
-                                NppExecHelpers::StrDelLeadingTabSpaces(line);
-                                NppExecHelpers::StrDelTrailingTabSpaces(line);
-                                if ( line.length() > 0 )
-                                {
-                                    double val = 0;
-                                    bool isVal = false;
+        // called when IsInitialized(); the last definition of a name is
+        // found as it overrides the previous ones in fparser
+        const tConst* FindConst(const char* cszName) const
+        {
+            std::vector<size_t>::const_iterator itr = std::upper_bound( m_SortedConsts.begin(), m_SortedConsts.end(), cszName,
+                [this](const char* s, size_t i) { return (::strcmp(s, m_Consts[i].constName.c_str()) < 0); } );
+            if ( itr == m_SortedConsts.begin() )
+                return nullptr;
 
-                                  #ifdef UNICODE
-                                    wchar_t* p = SysUniConv::newMultiByteToUnicode(line.c_str());
-                                    if ( p )
-                                    {
-                                        userConst.constValue = p;
-                                        delete [] p;
-                                    }
-                                  #else
-                                    userConst.constValue = line;
-                                  #endif
+            const tConst& c = m_Consts[*(itr - 1)];
+            return ( ::strcmp(c.constName.c_str(), cszName) == 0 ) ? &c : nullptr;
+        }
 
-                                    /*if ( isDecNumChar(constValue.GetAt(0)) )
-                                    {
-                                    val = c_base::_tstr2uint(constValue.c_str());
-                                    isVal = true;
-                                    }
-                                    else*/
-                                    {
-                                        tstr calcErr;
+        // called when IsInitialized(), the constants are not modified anymore
+        void AddTo(fparser_type& fp) const
+        {
+            for ( const tConst& c : m_Consts )
+            {
+                fp.AddConstant(c.constName.c_str(), c.constValue);
+            }
+        }
 
-                                        Runtime::GetLogger().Activate(false); // temporary disable
+        double GetPrecision() const { return m_calc_precision; }
+        int GetOptimizeHits() const { return m_nOptimizeHits; } // 0 - never optimize
+        const TCHAR* GetDefaultFmt() const { return m_szCalcDefaultFmt; }
+        const TCHAR* GetSmallFmt() const { return m_szCalcSmallFmt; }
+        const TCHAR* GetBigFmt() const { return m_szCalcBigFmt; }
 
-                                        isVal = calc2(pNppExec, userConst.constValue, calcErr, userConst.constValue);
+    private:
+        CCriticalSection m_cs;
+        volatile LONG m_nInitialized;
+        volatile LONG m_nNoHeadersWarning;
+        tstr m_sNoHeadersFolder;
+        tConsts m_Consts;
+        std::vector<size_t> m_SortedConsts; // indexes of m_Consts
+        double m_calc_precision;
+        TCHAR  m_szCalcDefaultFmt[12];
+        TCHAR  m_szCalcSmallFmt[12];
+        TCHAR  m_szCalcBigFmt[12];
+        int    m_nOptimizeHits;
+};
 
-                                        Runtime::GetLogger().Activate(true);  // enable again
+static FParserConsts g_fpConsts;
 
-                                        if ( isVal )
-                                        {
-                                            if ( userConst.constValue.Find(_T('.')) >= 0 )
-                                                val = _t_str2f(userConst.constValue.c_str());
-                                            else
-                                                val = c_base::_tstr2uint(userConst.constValue.c_str());
-                                        }
-                                        else
-                                        {
-                                            unparsedUserConstsList.Add(userConst);
-                                        }
-                                    }
+// Integer math of "set <var> ~ <math expression>" without FunctionParser:
+// the expressions of integer numbers (decimal or "0x" hex), integer
+// constants, hex() and the operators + - * / % ^ & | << >> ~ are
+// calculated in 64-bit integers. The operators have fparser's meaning
+// and precedence ("^" is power, "& | << >>" are one level below "+ -"),
+// so the result is fparser's one, just exact beyond 2**53.
+// Calculate() returns false when fparser is needed: a non-integer number,
+// an unknown name or operator, an inexact division, a negative operand of
+// a bitwise operator or an overflow.
+class CInt64Calc
+{
+    public:
+        typedef FunctionParser::value_type value_type;
 
-                                    if ( isVal )
-                                    {
-                                        m_fp->AddConstant(userConst.constName.c_str(), fparser_type::value_type(val));
-                                        ++nItemsOK;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
+    public:
+        // pVars are the values of "_npe_v1", "_npe_v2", ... (see FParserWrapper)
+        static bool Calculate(const TCHAR* cszExpr, const value_type* pVars, int nVars, __int64& result)
+        {
+            CInt64Calc calc(cszExpr, pVars, nVars);
+            if ( !calc.parseBitwise(result) )
+                return false;
 
-                if ( !unparsedUserConstsList.IsEmpty() )
-                {
-                    tstr calcErr;
+            calc.skipSpaces();
+            return ( *calc.m_p == 0 );
+        }
 
-                    CListItemT<tUserConst>* pItem = unparsedUserConstsList.GetFirst();
-                    while ( pItem )
-                    {
-                        tUserConst& uc = pItem->GetItem();
-                        bool isVal = false;
+        // szNum must hold 24 TCHARs at least; returns the length
+        static int FormatResult(__int64 value, bool isHex, TCHAR* szNum)
+        {
+            if ( !isHex )
+                return c_base::_tint64_to_str(value, szNum);
 
-                        Runtime::GetLogger().Activate(false); // temporary disable
+            TCHAR szHex[20];
+            int n = 0;
+            unsigned __int64 u = static_cast<unsigned __int64>(value);
+            do {
+                const unsigned int d = static_cast<unsigned int>(u & 0x0F);
+                szHex[n++] = static_cast<TCHAR>( (d < 10) ? (_T('0') + d) : (_T('A') + d - 10) );
+                u >>= 4;
+            } while ( u != 0 );
 
-                        isVal = calc2(pNppExec, uc.constValue, calcErr, uc.constValue);
+            int len = 0;
+            szNum[len++] = _T('0');
+            szNum[len++] = _T('x');
+            while ( n > 0 )
+            {
+                szNum[len++] = szHex[--n];
+            }
+            szNum[len] = 0;
+            return len;
+        }
 
-                        Runtime::GetLogger().Activate(true);  // enable again
+    private:
+        enum eConsts {
+            MAX_NAME_LEN = 64
+        };
 
-                        if ( isVal )
-                        {
-                            double val = 0;
-                            if ( uc.constValue.Find(_T('.')) >= 0 )
-                                val = _t_str2f(uc.constValue.c_str());
-                            else
-                                val = c_base::_tstr2uint(uc.constValue.c_str());
-
-                            m_fp->AddConstant(uc.constName.c_str(), fparser_type::value_type(val));
-                            ++nItemsOK;
-                        }
-                        else
-                        {
-
-                            Runtime::GetLogger().AddEx( _T("error at line %d: \"%s\""), uc.nLine, uc.constValue.c_str() );
-                            Runtime::GetLogger().AddEx( _T(" - %s"), calcErr.c_str() );
+        CInt64Calc(const TCHAR* cszExpr, const value_type* pVars, int nVars)
+          : m_p(cszExpr), m_pVars(pVars), m_nVars(nVars)
+        {
+        }
 
-                        }
+        static bool isNameChar(TCHAR ch)
+        {
+            return ( (ch >= _T('a') && ch <= _T('z')) || (ch >= _T('A') && ch <= _T('Z')) ||
+                     (ch >= _T('0') && ch <= _T('9')) || (ch == _T('_')) );
+        }
 
-                        pItem = pItem->GetNext();
-                    }
-                }
+        static bool toInt64(double d, __int64& n)
+        {
+            // exact integers only, as 'double' is exact up to 2**53
+            const double max_accurate_value = 9007199254740992.0; // 2**53
+            if ( d > max_accurate_value || d < -max_accurate_value )
+                return false;
 
-                Runtime::GetLogger().AddEx( _T("%d definitions added."), nItemsOK );
-                Runtime::GetLogger().DecIndentLevel();
-                Runtime::GetLogger().Add(   _T(")") );
+            n = static_cast<__int64>(d);
+            return ( static_cast<double>(n) == d );
+        }
 
+        static bool mulInt64(__int64 a, __int64 b, __int64& r)
+        {
+            const __int64 i64max = (std::numeric_limits<__int64>::max)();
+            const __int64 i64min = (std::numeric_limits<__int64>::min)();
+            if ( a > 0 )
+            {
+                if ( b > 0 ? (a > i64max / b) : (b < i64min / a) )
+                    return false;
+            }
+            else if ( a < 0 )
+            {
+                if ( b > 0 ? (a < i64min / b) : (b != 0 && b < i64max / a) )
+                    return false;
             }
+            r = a * b;
+            return true;
         }
 
-        void initFParserConsts(CNppExec* pNppExec)
+        static bool powInt64(__int64 a, __int64 b, __int64& r)
         {
-
-            Runtime::GetLogger().Add(   _T("initFParserConsts()") );
-            Runtime::GetLogger().Add(   _T("{") );
-            Runtime::GetLogger().IncIndentLevel();
-
-            m_fp->AddConstant("WM_COMMAND", fparser_type::value_type(WM_COMMAND));
-            m_fp->AddConstant("WM_USER", fparser_type::value_type(WM_USER));
-            m_fp->AddConstant("NPPMSG", fparser_type::value_type(NPPMSG));
-
-            CDirFileLister FileLst;
-            tstr           path;
-
-            path = pNppExec->getPluginDllPath();
-            path += _T("\\NppExec\\*.h");
-            if ( FileLst.FindNext(path.c_str(), CDirFileLister::ESF_FILES | CDirFileLister::ESF_SORTED) )
+            if ( b < 0 )
+                return false; // a fraction
+            r = 1;
+            if ( b == 0 )
+                return true;
+            if ( a == 0 || a == 1 || a == -1 )
             {
-                do {
-                    path = pNppExec->getPluginDllPath();
-                    path += _T("\\NppExec\\");
-                    path += FileLst.GetItem();
-
-                    readConstsFromFile(pNppExec, path);
-                } 
-                while ( FileLst.GetNext() );
+                r = (a == -1 && b % 2 == 0) ? 1 : a;
+                return true;
             }
-            else
+            while ( b-- > 0 )
             {
-                path = pNppExec->getPluginDllPath();
-                path += _T("\\NppExec");
-
-                Runtime::GetLogger().AddEx( _T("; no *.h files found in \"%s\""), path.c_str() );
-
-                pNppExec->GetConsole().PrintMessage( _T("- Warning: fparser's constants have not been initialized because"), false );
-                pNppExec->GetConsole().PrintMessage( _T("the following folder either does not exist or is empty:"), false );
-                pNppExec->GetConsole().PrintMessage( path.c_str(), false );
+                if ( !mulInt64(r, a, r) )
+                    return false;
             }
+            return true;
+        }
 
-            Runtime::GetLogger().DecIndentLevel();
-            Runtime::GetLogger().Add(   _T("}") );
-
+        void skipSpaces()
+        {
+            while ( *m_p == _T(' ') || *m_p == _T('\t') )  ++m_p;
         }
 
-        static fparser_type::value_type fp_hex(const fparser_type::value_type* p)
+        bool isOperator(TCHAR ch)
         {
-            return p[0];
+            skipSpaces();
+            if ( *m_p != ch )
+                return false;
+            ++m_p;
+            return true;
         }
 
-        void initFParserFuncs()
+        // "&", "|", "<<" or ">>", but not "&&" or "||"
+        TCHAR getBitwiseOperator()
         {
-            m_fp->AddFunction("hex", fp_hex, 1);
+            skipSpaces();
+            const TCHAR ch = m_p[0];
+            if ( ch == _T('<') || ch == _T('>') )
+                return ( m_p[1] == ch ) ? ch : 0;
+            if ( ch == _T('&') || ch == _T('|') )
+                return ( m_p[1] != ch ) ? ch : 0;
+            return 0;
         }
 
-        fparser_type::value_type calc(CNppExec* pNppExec, const tstr& func, tstr& calcError)
+        // bitwise: additive { ("&" | "|" | "<<" | ">>") additive }
+        bool parseBitwise(__int64& value)
         {
-            if ( func.IsEmpty() )
-            {
-                calcError = _T("Input function is empty");
-                return fparser_type::value_type(0);
-            }
+            if ( !parseAdditive(value) )
+                return false;
 
-            /*
+            for ( ; ; )
             {
-                TCHAR szNum[50];
-                // pre-parse for '0x...' numbers 
-                int pos = func.Find( _T("0x") );
-                while ( pos >= 0 )
-                {
-                    const TCHAR ch = func.GetAt(pos + 2);
-                    if ( isHexNumChar(ch) )
-                    {
-                        const int nn = c_base::_tstr2int( func.c_str() + pos );
-                        int hexLen = 2;
-                        while ( isHexNumChar(func.GetAt(pos + hexLen)) )  ++hexLen;
-                        int decLen = c_base::_tint2str(nn, szNum);
-                        func.Replace(pos, hexLen, szNum, decLen);
-                        pos += decLen;
-                    }
-                    pos = func.Find( _T("0x"), pos );
-                }
+                const TCHAR op = getBitwiseOperator();
+                if ( op == 0 )
+                    return true;
+                m_p += (op == _T('<') || op == _T('>')) ? 2 : 1;
+
+                __int64 n = 0;
+                if ( !parseAdditive(n) || value < 0 || n < 0 )
+                    return false;
+
+                if ( op == _T('&') )
+                    value &= n;
+                else if ( op == _T('|') )
+                    value |= n;
+                else if ( n > 62 )
+                    return false;
+                else if ( op == _T('>') )
+                    value >>= n;
+                else if ( value > ((std::numeric_limits<__int64>::max)() >> n) )
+                    return false; // fparser reports the error
+                else
+                    value <<= n;
             }
-            */
+        }
 
-          #ifdef UNICODE
-            char* pFunc = SysUniConv::newUnicodeToMultiByte( func.c_str() );
-          #else
-            const char* pFunc = func.c_str();
-          #endif
+        // additive: multiplicative { ("+" | "-") multiplicative }
+        bool parseAdditive(__int64& value)
+        {
+            if ( !parseMultiplicative(value) )
+                return false;
 
+            for ( ; ; )
             {
-                CCriticalSectionLockGuard lock(m_cs);
+                const bool isPlus = isOperator(_T('+'));
+                if ( !isPlus && !isOperator(_T('-')) )
+                    return true;
 
-                if ( !m_hasConsts )
-                {
-                    m_fp = new fparser_type();
-                    int len = 0;
-                    const TCHAR* pPrecision = pNppExec->GetOptions().GetStr(OPTS_CALC_PRECISION, &len);
-                    if ( len > 0 )
-                    {
-                        double precision = _t_str2f(pPrecision);
-                        precision = abs_val(precision);
-                        if ( precision > 0.0 )
-                        {
-                            int d = 0;
-
-                            m_calc_precision = precision;
-
-                            while ( precision < 0.99 )
-                            {
-                                precision *= 10;
-                                ++d;
-                            }
-                            wsprintf(m_szCalcDefaultFmt, _T("%%.%df"), d);
-                            wsprintf(m_szCalcSmallFmt,   _T("%%.%dG"), d);
-                            wsprintf(m_szCalcBigFmt,     _T("%%.%dG"), d + 1);
-                        }
-                    }
+                __int64 n = 0;
+                if ( !parseMultiplicative(n) )
+                    return false;
 
-                    m_hasConsts = true;
-                    initFParserConsts(pNppExec);
-                    initFParserFuncs();
+                const __int64 i64max = (std::numeric_limits<__int64>::max)();
+                const __int64 i64min = (std::numeric_limits<__int64>::min)();
+                if ( !isPlus )
+                {
+                    if ( n == i64min )
+                        return false;
+                    n = -n;
                 }
+                if ( (n > 0 && value > i64max - n) || (n < 0 && value < i64min - n) )
+                    return false;
+                value += n;
             }
+        }
 
-            int errPos;
-            fparser_type::value_type ret(0);
-
-            calcError.Clear();
+        // multiplicative: unary { ("*" | "/" | "%") unary }
+        bool parseMultiplicative(__int64& value)
+        {
+            if ( !parseUnary(value) )
+                return false;
 
+            for ( ; ; )
             {
-                CCriticalSectionLockGuard lock(m_cs);
+                skipSpaces();
+                const TCHAR op = *m_p;
+                if ( op != _T('*') && op != _T('/') && op != _T('%') )
+                    return true;
+                ++m_p;
 
-                errPos = m_fp->Parse(pFunc, "");
-                if ( errPos == -1 )
-                {
-                    fparser_type::value_type var(0);
+                __int64 n = 0;
+                if ( !parseUnary(n) )
+                    return false;
 
-                    var = m_fp->Eval( &var );
-                    int err = m_fp->EvalError();
-                    if ( err == 0 )
-                        ret = var;
-                    else
-                        calcError.Format(50, _T("Eval error (%d)"), err);
+                if ( op == _T('*') )
+                {
+                    if ( !mulInt64(value, n, value) )
+                        return false;
                 }
                 else
                 {
-                    const char* pErr = m_fp->ErrorMsg();
-                  #ifdef UNICODE
-                    TCHAR* pErrW = SysUniConv::newMultiByteToUnicode( pErr );
-                    calcError = pErrW; // store a copy of the error message
-                    delete [] pErrW;
-                  #else
-                    calcError = pErr; // store a copy of the error message
-                  #endif
+                    if ( n == 0 )
+                        return false; // fparser reports the error
+                    if ( n == -1 )
+                    {
+                        if ( op == _T('%') )
+                            value = 0;
+                        else if ( !mulInt64(value, -1, value) )
+                            return false;
+                    }
+                    else if ( op == _T('%') )
+                        value %= n; // the sign of fmod()
+                    else if ( value % n != 0 )
+                        return false; // a fraction
+                    else
+                        value /= n;
                 }
             }
-
-            if ( errPos != -1 )
-            {
-                TCHAR szNum[50];
-
-                calcError += _T(" at pos ");
-                c_base::_tint2str(errPos, szNum);
-                calcError += szNum;
-            }
-
-          #ifdef UNICODE
-            delete [] pFunc;
-          #endif
-
-            return ret;
         }
 
-        template<typename T> void format_result(const std::complex<T>& val, tstr& ret, const tstr& func)
+        // unary: ("-" | "~") unary | power
+        bool parseUnary(__int64& value)
         {
-            if ( val.imag() == 0 )
+            if ( isOperator(_T('-')) )
             {
-                format_result(val.real(), ret, func);
+                if ( !parseUnary(value) || value == (std::numeric_limits<__int64>::min)() )
+                    return false;
+                value = -value;
+                return true;
             }
-            else
+            if ( isOperator(_T('~')) )
             {
-                TCHAR szNum[120];
-                // ha-ha, wsprintf does not support neither "%f" nor "%G"
-                _t_sprintf(szNum, _T("%g %c %gi"), val.real(), val.imag() < 0 ? '-' : '+', std::abs(val.imag()));
-                ret = szNum;
+                // fparser's "~" inverts 32 bits
+                if ( !parseUnary(value) || value < 0 || value > 0xFFFFFFFFLL )
+                    return false;
+                value = ~static_cast<unsigned int>(value);
+                return true;
             }
+            return parsePower(value);
         }
 
-        template<typename T> void format_result(const T& val, tstr& ret, const tstr& func)
+        // power: primary [ "^" unary ], e.g. "-2^2" is "-(2^2)" as in fparser
+        bool parsePower(__int64& value)
         {
-            // Note: 
-            // As we are using FunctionParser that operates with 'double',
-            // its accuracy with regards to 64-bit integers is limited by
-            // the mantissa of a 'double'.
-          #ifndef __MINGW32__
-            const __int64 max_accurate_i64_value = (1i64) << std::numeric_limits<T>::digits; // 2**53 for the 'double' type
-          #else
-            const long long max_accurate_i64_value = (1LL) << std::numeric_limits<T>::digits; // 2**53 for the 'double' type
-          #endif
+            if ( !parsePrimary(value) )
+                return false;
 
-            TCHAR szNum[80];
-            szNum[0] = 0;
+            if ( !isOperator(_T('^')) )
+                return true;
 
-            if ( (func.StartsWith(_T("hex(")) || func.StartsWith(_T("hex ("))) &&
-                 (abs_val(val) < max_accurate_i64_value) )
+            __int64 n = 0;
+            if ( !parseUnary(n) )
+                return false;
+
+            return powInt64(value, n, value);
+        }
+
+        // primary: number | name | "hex(" bitwise ")" | "(" bitwise ")"
+        bool parsePrimary(__int64& value)
+        {
+            skipSpaces();
+
+            if ( *m_p == _T('(') )
             {
-                unsigned __int64 n = static_cast<unsigned __int64>(val);
-                _t_sprintf( szNum, _T("0x%I64X"), n );
+                ++m_p;
+                return ( parseBitwise(value) && isOperator(_T(')')) );
             }
-            else if ( abs_val(val) > m_calc_precision*100 )
+
+            if ( *m_p >= _T('0') && *m_p <= _T('9') )
+                return parseNumber(value);
+
+            char szName[MAX_NAME_LEN + 1];
+            int len = 0;
+            while ( isNameChar(*m_p) )
             {
-                if ( abs_val(val) < max_accurate_i64_value )
-                {
-                    __int64 n = static_cast<__int64>(val);
-                    double  diff = static_cast<double>(val - n);
+                if ( len == MAX_NAME_LEN )
+                    return false;
+                szName[len++] = static_cast<char>(*m_p++);
+            }
+            if ( len == 0 )
+                return false;
+            szName[len] = 0;
 
-                    if ( abs_val(diff) < m_calc_precision )
-                    {
-                        // result can be rounded
-                        _t_sprintf( szNum, _T("%I64d"), n ); 
-                        // ha-ha, wsprintf does not support neither "%I64d" nor "%f"
-                    }
-                    else
-                    {
-                        int nn = _t_sprintf( szNum, m_szCalcDefaultFmt, val );
-                        if ( nn > 0 )
-                        {
-                            while ( nn > 0 && szNum[--nn] == _T('0') ) ;
-                            if ( szNum[nn] == _T('.') )  ++nn; // keep one '0' after '.'
-                            szNum[nn + 1] = 0; // exclude all trailing '0' after '.'
-                        }
-                    }
-                }
-                else
-                {
-                    // result is too big
-                    _t_sprintf( szNum, m_szCalcBigFmt, val );
-                }
+            if ( isOperator(_T('(')) )
+            {
+                // hex(x) is x formatted as hex, see FParserWrapper::calcInt64()
+                if ( ::strcmp(szName, "hex") != 0 )
+                    return false;
+                return ( parseBitwise(value) && isOperator(_T(')')) );
             }
-            else
+
+            if ( len > 6 && ::memcmp(szName, "_npe_v", 6) == 0 )
             {
-                // result is too small
-                _t_sprintf( szNum, m_szCalcSmallFmt, val );
-                // ha-ha, wsprintf does not support neither "%f" nor "%G"
+                int nVar = 0;
+                for ( int i = 6; i < len; ++i )
+                {
+                    if ( szName[i] < '0' || szName[i] > '9' || nVar > m_nVars )
+                        return false;
+                    nVar = nVar*10 + (szName[i] - '0');
+                }
+                --nVar; // "_npe_v1" is m_pVars[0]
+                return ( nVar >= 0 && nVar < m_nVars && toInt64(m_pVars[nVar], value) );
             }
 
-            ret = szNum;
+            const FParserConsts::tConst* pConst = g_fpConsts.FindConst(szName);
+            return ( pConst != nullptr && toInt64(pConst->constValue, value) );
         }
 
-        bool calc2(CNppExec* pNppExec, const tstr& func, tstr& calcError, tstr& ret)
+        bool parseNumber(__int64& value)
         {
-            fparser_type::value_type fret = calc(pNppExec, func, calcError);
+            unsigned __int64 u = 0;
 
-            if ( calcError.IsEmpty() )
+            if ( m_p[0] == _T('0') && (m_p[1] == _T('x') || m_p[1] == _T('X')) )
             {
-                format_result(fret, ret, func);
+                m_p += 2;
+                int nDigits = 0;
+                for ( ; ; ++m_p, ++nDigits )
+                {
+                    const TCHAR ch = *m_p;
+                    unsigned int d;
+                    if ( ch >= _T('0') && ch <= _T('9') )
+                        d = ch - _T('0');
+                    else if ( ch >= _T('a') && ch <= _T('f') )
+                        d = ch - _T('a') + 10;
+                    else if ( ch >= _T('A') && ch <= _T('F') )
+                        d = ch - _T('A') + 10;
+                    else
+                        break;
+                    if ( u > (0x7FFFFFFFFFFFFFFFULL >> 4) )
+                        return false;
+                    u = (u << 4) | d;
+                }
+                if ( nDigits == 0 )
+                    return false;
+            }
+            else
+            {
+                while ( *m_p >= _T('0') && *m_p <= _T('9') )
+                {
+                    const unsigned int d = *m_p++ - _T('0');
+                    if ( u > (0x7FFFFFFFFFFFFFFFULL - d) / 10 )
+                        return false;
+                    u = u*10 + d;
+                }
+                if ( *m_p == _T('.') || *m_p == _T('e') || *m_p == _T('E') )
+                    return false; // not an integer number
             }
 
-            return calcError.IsEmpty();
+            if ( isNameChar(*m_p) )
+                return false; // e.g. "2x"
+
+            value = static_cast<__int64>(u);
+            return true;
         }
 
     private:
-        CCriticalSection m_cs;
-        fparser_type* m_fp;
-        bool   m_hasConsts;
-        double m_calc_precision;
-        TCHAR  m_szCalcDefaultFmt[12];
-        TCHAR  m_szCalcSmallFmt[12];
-        TCHAR  m_szCalcBigFmt[12];
+        const TCHAR* m_p;
+        const value_type* m_pVars;
+        int m_nVars;
 };
 
-static FParserWrapper g_fp;
-/**/
+// Note: FParserWrapper is not thread-safe.
+// Each script has its own one (see CScriptEngine::GetFParser), so the
+// scripts running in parallel do not wait for each other's calculations;
+// FParserAccess falls back to the shared one under a lock.
+class FParserWrapper
+{
+    public:
+        typedef FunctionParser fparser_type;
 
-/*
- * CScriptEngine
- *
- *
- * Internal Commands:
- * ------------------
- * cls
- *   - clear Console screen
- * cd
- *   - shows current path
- * cd <path>
- *   - changes current directory (absolute or relative)
- * cd <drive:\path>
- *   - changes current drive and directory
- * dir
- *   - lists subdirs and files
- * dir <mask>
- *   - lists subdirs and files matched the mask
+    public:
+        typedef struct sUserConst {
+            CStrT<char> constName;
+            tstr        constValue;
+            int         nLine;
+        } tUserConst;
+
+    public:
+        FParserWrapper() : m_fp(nullptr), m_pHeaderConsts(nullptr), m_nOptimizeHits(-1)
+        {
+        }
+
+        ~FParserWrapper()
+        {
+            if ( m_fp != nullptr )
+                delete m_fp;
+        }
+
+        // bInt64: integer expressions are calculated by CInt64Calc
+        bool Calculate(CNppExec* pNppExec, const tstr& func, tstr& calcError, tstr& ret, bool bInt64 = true)
+        {
+            if ( bInt64 && calcInt64(pNppExec, func, nullptr, 0, ret) )
+                return true;
+
+            return calc2(pNppExec, func, calcError, ret);
+        }
+
+        // The variables of func ("_npe_v1", "_npe_v2", ...) are bound to vars,
+        // so func is parsed once and then evaluated with different values.
+        // Returns false if func can't be parsed or evaluated this way, then
+        // the values are to be substituted and passed to Calculate().
+        bool CalculateBound(CNppExec* pNppExec, const tstr& func, const std::vector<fparser_type::value_type>& vars, tstr& ret, bool bInt64 = true)
+        {
+            if ( bInt64 && calcInt64(pNppExec, func, vars.data(), static_cast<int>(vars.size()), ret) )
+                return true;
+
+            initFParser(pNppExec);
+
+            fparser_type* pfp = getCachedParser(func, static_cast<int>(vars.size()));
+            if ( pfp == nullptr )
+                return false;
+
+            fparser_type::value_type fret = pfp->Eval( vars.data() );
+            if ( pfp->EvalError() != 0 )
+                return false;
+
+            format_result(fret, ret, func);
+            return true;
+        }
+
+        // summed up for all the FParserWrappers
+        static LONG GetCacheHits()  { return m_nCacheHits; }
+        static LONG GetCacheMisses()  { return m_nCacheMisses; }
+        static LONG GetInt64Calcs()  { return m_nInt64Calcs; }
+        static LONG GetOptimizedExprs()  { return m_nOptimizedExprs; }
+        static LONG GetOptimizeSkipped()  { return m_nOptimizeSkipped; }
+        static LONG GetOptimizedEvals()  { return m_nOptimizedEvals; }
+
+        // overrides Calc_OptimizeHits for this FParserWrapper; -1 - as in the options
+        void SetOptimizeHits(int nHits) { m_nOptimizeHits = nHits; }
+
+        static void GetBoundVarName(int nVar, tstr& varName)
+        {
+            TCHAR szName[20];
+            ::wsprintf( szName, _T("_npe_v%d"), nVar + 1 );
+            varName = szName;
+        }
+
+        // initializes fparser's constants, to be called from a background thread
+        static void Preload(CNppExec* pNppExec)
+        {
+            FParserWrapper fpw;
+            fpw.initFParser(pNppExec, false);
+        }
+
+    private:
+        bool calcInt64(CNppExec* pNppExec, const tstr& func, const fparser_type::value_type* pVars, int nVars, tstr& ret)
+        {
+            initFParser(pNppExec); // the constants
+
+            __int64 n = 0;
+            if ( !CInt64Calc::Calculate(func.c_str(), pVars, nVars, n) )
+                return false;
+
+            const bool isHex = ( func.StartsWith(_T("hex(")) || func.StartsWith(_T("hex (")) );
+            if ( !isHex && (abs_val(static_cast<double>(n)) <= g_fpConsts.GetPrecision()*100) )
+            {
+                // the same format as for fparser's result, see format_result()
+                format_result(static_cast<fparser_type::value_type>(n), ret, func);
+            }
+            else
+            {
+                TCHAR szNum[24];
+                CInt64Calc::FormatResult(n, isHex, szNum);
+                ret = szNum;
+            }
+
+            ::InterlockedIncrement(&m_nInt64Calcs);
+            return true;
+        }
+
+        // the parsed expressions, the most recently used first
+        typedef struct sCachedExpr {
+            tstr         Expr;
+            fparser_type Parser;
+            int          nHits;
+            bool         isOptimizeChecked; // the hits threshold has been reached
+            bool         isOptimized;
+        } tCachedExpr;
+        typedef std::list<tCachedExpr> tCachedExprList;
+
+        enum eConsts {
+            MAX_CACHED_EXPRS = 256
+        };
+
+        fparser_type* getCachedParser(const tstr& func, int nVars)
+        {
+            CStrHashMapT<TCHAR, tCachedExprList::iterator>::iterator itr = m_CachedExprIndex.find(func);
+            if ( itr != m_CachedExprIndex.end() )
+            {
+                // the list's iterators remain valid
+                m_CachedExprs.splice( m_CachedExprs.begin(), m_CachedExprs, itr->second );
+                ::InterlockedIncrement(&m_nCacheHits);
+
+                tCachedExpr& cachedExpr = *itr->second;
+                if ( cachedExpr.isOptimized )
+                {
+                    ::InterlockedIncrement(&m_nOptimizedEvals);
+                }
+                else if ( !cachedExpr.isOptimizeChecked )
+                {
+                    const int nOptimizeHits = (m_nOptimizeHits >= 0) ? m_nOptimizeHits : g_fpConsts.GetOptimizeHits();
+                    if ( nOptimizeHits > 0 && ++cachedExpr.nHits >= nOptimizeHits )
+                        optimizeCachedExpr(cachedExpr);
+                }
+
+                return &cachedExpr.Parser;
+            }
+
+            ::InterlockedIncrement(&m_nCacheMisses);
+
+            tstr vars;
+            tstr varName;
+            for ( int i = 0; i < nVars; ++i )
+            {
+                GetBoundVarName(i, varName);
+                if ( i != 0 )
+                    vars += _T(',');
+                vars += varName;
+            }
+
+          #ifdef UNICODE
+            char* pFunc = SysUniConv::newUnicodeToMultiByte( func.c_str() );
+            char* pVars = SysUniConv::newUnicodeToMultiByte( vars.c_str() );
+          #else
+            const char* pFunc = func.c_str();
+            const char* pVars = vars.c_str();
+          #endif
+
+            m_CachedExprs.emplace_front();
+            tCachedExpr& cachedExpr = m_CachedExprs.front();
+            cachedExpr.Parser = *m_fp; // shares the constants and the functions within this thread
+            cachedExpr.nHits = 0;
+            cachedExpr.isOptimizeChecked = false;
+            cachedExpr.isOptimized = false;
+            const int errPos = cachedExpr.Parser.Parse(pFunc, pVars);
+
+          #ifdef UNICODE
+            delete [] pFunc;
+            delete [] pVars;
+          #endif
+
+            if ( errPos != -1 )
+            {
+                m_CachedExprs.pop_front();
+                return nullptr;
+            }
+
+            cachedExpr.Expr = func;
+            m_CachedExprIndex[func] = m_CachedExprs.begin();
+
+            if ( m_CachedExprs.size() > MAX_CACHED_EXPRS )
+            {
+                // the least recently used one
+                m_CachedExprIndex.erase( m_CachedExprIndex.find(m_CachedExprs.back().Expr) );
+                m_CachedExprs.pop_back();
+            }
+
+            return &cachedExpr.Parser;
+        }
+
+        // fpoptimizer does not know the bitwise opcodes added to NppExec's fparser
+        static bool hasBitwiseOps(const tstr& func)
+        {
+            for ( const TCHAR* p = func.c_str(); *p != 0; ++p )
+            {
+                switch ( *p )
+                {
+                    case _T('~'):
+                        return true;
+
+                    case _T('<'):
+                    case _T('>'):
+                        if ( *(p + 1) == *p )
+                            return true; // "<<" or ">>"
+                        break;
+
+                    case _T('&'):
+                    case _T('|'):
+                        if ( *(p + 1) != *p )
+                            return true; // not "&&" or "||"
+                        ++p;
+                        break;
+                }
+            }
+            return false;
+        }
+
+        // the optimized bytecode replaces the parsed one and stays in the cache
+        void optimizeCachedExpr(tCachedExpr& cachedExpr)
+        {
+            cachedExpr.isOptimizeChecked = true;
+
+            if ( hasBitwiseOps(cachedExpr.Expr) )
+            {
+                ::InterlockedIncrement(&m_nOptimizeSkipped);
+                return;
+            }
+
+            cachedExpr.Parser.Optimize();
+            cachedExpr.isOptimized = true;
+            ::InterlockedIncrement(&m_nOptimizedExprs);
+            ::InterlockedIncrement(&m_nOptimizedEvals);
+        }
+
+        void readConstsFromFile(CNppExec* pNppExec, const tstr& path)
+        {
+            CFileBufT<char>    fbuf;
+            CStrT<char>        line;
+            tUserConst         userConst;
+            CListT<tUserConst> unparsedUserConstsList;
+
+            if ( fbuf.LoadFromFile(path.c_str(), true, pNppExec->GetOptions().GetInt(OPTI_UTF8_DETECT_LENGTH)) )
+            {
+                int nItemsOK = 0;
+
+                Runtime::GetLogger().Add(   path.c_str() );
+                Runtime::GetLogger().Add(   _T("(") );
+                Runtime::GetLogger().IncIndentLevel();
+
+                while ( fbuf.GetLine(line) >= 0 )
+                {
+                    if ( line.length() > 0 )
+                    {
+                        int i = line.Find("//");
+                        if ( i >= 0 )
+                            line.Delete(i, -1);
+
+                        NppExecHelpers::StrDelLeadingTabSpaces(line);
+
+                        if ( line.length() > 0 && line.StartsWith("#define") )
+                        {
+                            line.Delete(0, 7); // delete "#define"
+                            NppExecHelpers::StrDelLeadingTabSpaces(line);
+                            if ( line.length() > 0 )
+                            {
+                                userConst.constName.Clear();
+                                userConst.constValue.Clear();
+                                userConst.nLine = fbuf.GetLineNumber() - 1;
+
+                                i = 0;
+                                while ( i < line.length() && !NppExecHelpers::IsTabSpaceChar(line[i]) )
+                                {
+                                    userConst.constName += line[i];
+                                    ++i;
+                                }
+
+                                line.Delete(0, i); // delete const name
+                                NppExecHelpers::StrDelLeadingTabSpaces(line);
+                                NppExecHelpers::StrDelTrailingTabSpaces(line);
+                                if ( line.length() > 0 )
+                                {
+                                    double val = 0;
+                                    bool isVal = false;
+
+                                  #ifdef UNICODE
+                                    wchar_t* p = SysUniConv::newMultiByteToUnicode(line.c_str());
+                                    if ( p )
+                                    {
+                                        userConst.constValue = p;
+                                        delete [] p;
+                                    }
+                                  #else
+                                    userConst.constValue = line;
+                                  #endif
+
+                                    /*if ( isDecNumChar(constValue.GetAt(0)) )
+                                    {
+                                    val = c_base::_tstr2uint(constValue.c_str());
+                                    isVal = true;
+                                    }
+                                    else*/
+                                    {
+                                        tstr calcErr;
+
+                                        Runtime::GetLogger().Activate(false); // temporary disable
+
+                                        isVal = calc2(pNppExec, userConst.constValue, calcErr, userConst.constValue);
+
+                                        Runtime::GetLogger().Activate(true);  // enable again
+
+                                        if ( isVal )
+                                        {
+                                            if ( userConst.constValue.Find(_T('.')) >= 0 )
+                                                val = _t_str2f(userConst.constValue.c_str());
+                                            else
+                                                val = c_base::_tstr2uint(userConst.constValue.c_str());
+                                        }
+                                        else
+                                        {
+                                            unparsedUserConstsList.Add(userConst);
+                                        }
+                                    }
+
+                                    if ( isVal )
+                                    {
+                                        addConst(userConst.constName.c_str(), fparser_type::value_type(val));
+                                        ++nItemsOK;
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+
+                if ( !unparsedUserConstsList.IsEmpty() )
+                {
+                    tstr calcErr;
+
+                    CListItemT<tUserConst>* pItem = unparsedUserConstsList.GetFirst();
+                    while ( pItem )
+                    {
+                        tUserConst& uc = pItem->GetItem();
+                        bool isVal = false;
+
+                        Runtime::GetLogger().Activate(false); // temporary disable
+
+                        isVal = calc2(pNppExec, uc.constValue, calcErr, uc.constValue);
+
+                        Runtime::GetLogger().Activate(true);  // enable again
+
+                        if ( isVal )
+                        {
+                            double val = 0;
+                            if ( uc.constValue.Find(_T('.')) >= 0 )
+                                val = _t_str2f(uc.constValue.c_str());
+                            else
+                                val = c_base::_tstr2uint(uc.constValue.c_str());
+
+                            addConst(uc.constName.c_str(), fparser_type::value_type(val));
+                            ++nItemsOK;
+                        }
+                        else
+                        {
+
+                            Runtime::GetLogger().AddEx( _T("error at line %d: \"%s\""), uc.nLine, uc.constValue.c_str() );
+                            Runtime::GetLogger().AddEx( _T(" - %s"), calcErr.c_str() );
+
+                        }
+
+                        pItem = pItem->GetNext();
+                    }
+                }
+
+                Runtime::GetLogger().AddEx( _T("%d definitions added."), nItemsOK );
+                Runtime::GetLogger().DecIndentLevel();
+                Runtime::GetLogger().Add(   _T(")") );
+
+            }
+        }
+
+        // The cache file of the constants read from "NppExec\*.h":
+        //   header: signature, format version, sizeof(TCHAR), number of *.h files
+        //   *.h:    path, size (2 DWORDs), last write time (2 DWORDs), number of
+        //           constants, then name (chars) and value (double) of each one
+        // The numbers are DWORDs, a string is its length (DWORD) and its chars.
+        enum eConstsCache {
+            CONSTS_CACHE_SIGNATURE = 0x4346584E, // "NXFC"
+            CONSTS_CACHE_VERSION = 1
+        };
+
+        typedef struct sHeaderConsts {
+            tstr     Path;
+            DWORD    dwSizeLow;
+            DWORD    dwSizeHigh;
+            FILETIME ftLastWrite;
+            FParserConsts::tConsts Consts;
+        } tHeaderConsts;
+        typedef std::vector<tHeaderConsts> tHeadersConsts;
+
+        static bool isSameHeader(const tHeaderConsts& h1, const tHeaderConsts& h2)
+        {
+            return ( h1.Path == h2.Path &&
+                     h1.dwSizeLow == h2.dwSizeLow &&
+                     h1.dwSizeHigh == h2.dwSizeHigh &&
+                     ::CompareFileTime(&h1.ftLastWrite, &h2.ftLastWrite) == 0 );
+        }
+
+        static bool isSameConsts(const FParserConsts::tConsts& c1, const FParserConsts::tConsts& c2)
+        {
+            if ( c1.size() != c2.size() )
+                return false;
+
+            for ( size_t i = 0; i < c1.size(); ++i )
+            {
+                if ( c1[i].constValue != c2[i].constValue || c1[i].constName != c2[i].constName )
+                    return false;
+            }
+            return true;
+        }
+
+        static bool loadConstsCache(const TCHAR* cszFileName, tHeadersConsts& headers)
+        {
+            HANDLE hFile = ::CreateFile( cszFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+            if ( hFile == INVALID_HANDLE_VALUE )
+                return false;
+
+            bool bLoaded = false;
+
+            const DWORD dwSize = ::GetFileSize(hFile, NULL);
+            if ( (dwSize != INVALID_FILE_SIZE) && (dwSize >= 4*sizeof(DWORD)) )
+            {
+                HANDLE hMapping = ::CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+                if ( hMapping != NULL )
+                {
+                    const char* pData = static_cast<const char*>( ::MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) );
+                    if ( pData != NULL )
+                    {
+                        CSnapshotReader reader(pData, dwSize);
+                        DWORD dwSignature = 0, dwVersion = 0, dwCharSize = 0, dwHeaders = 0;
+
+                        reader.ReadDword(dwSignature);
+                        reader.ReadDword(dwVersion);
+                        reader.ReadDword(dwCharSize);
+                        reader.ReadDword(dwHeaders);
+
+                        if ( (dwSignature == CONSTS_CACHE_SIGNATURE) &&
+                             (dwVersion == CONSTS_CACHE_VERSION) &&
+                             (dwCharSize == sizeof(TCHAR)) &&
+                             (dwHeaders <= dwSize/(6*sizeof(DWORD))) )
+                        {
+                            bLoaded = true;
+                            headers.resize(dwHeaders);
+                            for ( tHeaderConsts& header : headers )
+                            {
+                                DWORD dwConsts = 0;
+                                if ( !reader.ReadStr(header.Path) ||
+                                     !reader.ReadDword(header.dwSizeLow) ||
+                                     !reader.ReadDword(header.dwSizeHigh) ||
+                                     !reader.ReadDword(header.ftLastWrite.dwLowDateTime) ||
+                                     !reader.ReadDword(header.ftLastWrite.dwHighDateTime) ||
+                                     !reader.ReadDword(dwConsts) ||
+                                     dwConsts > dwSize/(sizeof(DWORD) + sizeof(double)) )
+                                {
+                                    bLoaded = false;
+                                    break;
+                                }
+
+                                header.Consts.resize(dwConsts);
+                                for ( FParserConsts::tConst& c : header.Consts )
+                                {
+                                    double value = 0;
+                                    if ( !reader.ReadStr(c.constName) || !reader.ReadDouble(value) )
+                                    {
+                                        bLoaded = false;
+                                        break;
+                                    }
+                                    c.constValue = fparser_type::value_type(value);
+                                }
+                                if ( !bLoaded )
+                                    break;
+                            }
+                            if ( bLoaded )
+                                bLoaded = reader.IsAtEnd();
+                        }
+
+                        ::UnmapViewOfFile(pData);
+                    }
+                    ::CloseHandle(hMapping);
+                }
+            }
+
+            ::CloseHandle(hFile);
+
+            if ( !bLoaded )
+                headers.clear();
+            return bLoaded;
+        }
+
+        static bool saveConstsCache(const TCHAR* cszFileName, const tHeadersConsts& headers)
+        {
+            if ( headers.empty() )
+            {
+                ::DeleteFile(cszFileName);
+                return true;
+            }
+
+            CBufT<char> buf;
+            appendSnapshotDword( buf, CONSTS_CACHE_SIGNATURE );
+            appendSnapshotDword( buf, CONSTS_CACHE_VERSION );
+            appendSnapshotDword( buf, static_cast<DWORD>(sizeof(TCHAR)) );
+            appendSnapshotDword( buf, static_cast<DWORD>(headers.size()) );
+
+            for ( const tHeaderConsts& header : headers )
+            {
+                appendSnapshotStr( buf, header.Path );
+                appendSnapshotDword( buf, header.dwSizeLow );
+                appendSnapshotDword( buf, header.dwSizeHigh );
+                appendSnapshotDword( buf, header.ftLastWrite.dwLowDateTime );
+                appendSnapshotDword( buf, header.ftLastWrite.dwHighDateTime );
+                appendSnapshotDword( buf, static_cast<DWORD>(header.Consts.size()) );
+                for ( const FParserConsts::tConst& c : header.Consts )
+                {
+                    appendSnapshotStr( buf, c.constName );
+                    appendSnapshotDouble( buf, static_cast<double>(c.constValue) );
+                }
+            }
+
+            HANDLE hFile = ::CreateFile( cszFileName, GENERIC_WRITE, 0, NULL,
+                                         CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+            if ( hFile == INVALID_HANDLE_VALUE )
+                return false;
+
+            DWORD dwWritten = 0;
+            const DWORD dwSize = static_cast<DWORD>(buf.GetCount());
+            const bool bSaved = ( ::WriteFile(hFile, buf.GetData(), dwSize, &dwWritten, NULL) && (dwWritten == dwSize) );
+            ::CloseHandle(hFile);
+
+            if ( !bSaved )
+                ::DeleteFile(cszFileName); // a partial cache would be rejected anyway
+            return bSaved;
+        }
+
+        void initFParserConsts(CNppExec* pNppExec)
+        {
+
+            Runtime::GetLogger().Add(   _T("initFParserConsts()") );
+            Runtime::GetLogger().Add(   _T("{") );
+            Runtime::GetLogger().IncIndentLevel();
+
+            addConst("WM_COMMAND", fparser_type::value_type(WM_COMMAND));
+            addConst("WM_USER", fparser_type::value_type(WM_USER));
+            addConst("NPPMSG", fparser_type::value_type(NPPMSG));
+
+            TCHAR cachePath[FILEPATH_BUFSIZE];
+            pNppExec->ExpandToFullConfigPath(cachePath, FPCONSTS_CACHE);
+
+            tHeadersConsts cachedHeaders;
+            tHeadersConsts headers;
+            bool isCacheChanged = false;
+            loadConstsCache(cachePath, cachedHeaders);
+
+            CDirFileLister FileLst;
+            tstr           path;
+
+            path = pNppExec->getPluginDllPath();
+            path += _T("\\NppExec\\*.h");
+            if ( FileLst.FindNext(path.c_str(), CDirFileLister::ESF_FILES | CDirFileLister::ESF_SORTED) )
+            {
+                // The constants of a *.h file may use the constants of the previous
+                // ones, so the cached constants of a *.h file are used while the
+                // *.h files before it have been read with the same constants
+                bool isPrevChanged = false;
+
+                do {
+                    path = pNppExec->getPluginDllPath();
+                    path += _T("\\NppExec\\");
+                    path += FileLst.GetItem();
+
+                    const size_t nHeader = headers.size();
+                    headers.push_back( tHeaderConsts() );
+                    tHeaderConsts& header = headers.back();
+                    header.Path = path;
+
+                    WIN32_FILE_ATTRIBUTE_DATA fad;
+                    bool hasAttr = ( ::GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &fad) != FALSE );
+                    header.dwSizeLow = hasAttr ? fad.nFileSizeLow : 0;
+                    header.dwSizeHigh = hasAttr ? fad.nFileSizeHigh : 0;
+                    header.ftLastWrite.dwLowDateTime = hasAttr ? fad.ftLastWriteTime.dwLowDateTime : 0;
+                    header.ftLastWrite.dwHighDateTime = hasAttr ? fad.ftLastWriteTime.dwHighDateTime : 0;
+
+                    const tHeaderConsts* pCached = (nHeader < cachedHeaders.size()) ? &cachedHeaders[nHeader] : nullptr;
+                    if ( pCached && pCached->Path != path )
+                        pCached = nullptr; // a *.h file has been added or removed
+
+                    m_pHeaderConsts = &header.Consts;
+
+                    if ( hasAttr && pCached && !isPrevChanged && isSameHeader(*pCached, header) )
+                    {
+                        for ( const FParserConsts::tConst& c : pCached->Consts )
+                        {
+                            addConst(c.constName.c_str(), c.constValue);
+                        }
+
+                        Runtime::GetLogger().AddEx( _T("%s - %d cached definitions added."), path.c_str(), static_cast<int>(header.Consts.size()) );
+                    }
+                    else
+                    {
+                        readConstsFromFile(pNppExec, path);
+
+                        if ( !pCached || !isSameConsts(pCached->Consts, header.Consts) )
+                            isPrevChanged = true;
+                        if ( isPrevChanged || !isSameHeader(*pCached, header) )
+                            isCacheChanged = true;
+                    }
+
+                    m_pHeaderConsts = nullptr;
+                } 
+                while ( FileLst.GetNext() );
+            }
+            else
+            {
+                path = pNppExec->getPluginDllPath();
+                path += _T("\\NppExec");
+
+                Runtime::GetLogger().AddEx( _T("; no *.h files found in \"%s\""), path.c_str() );
+
+                g_fpConsts.SetNoHeadersWarning(path);
+            }
+
+            if ( headers.size() != cachedHeaders.size() )
+                isCacheChanged = true; // a *.h file has been added or removed
+
+            if ( isCacheChanged && !saveConstsCache(cachePath, headers) )
+            {
+                Runtime::GetLogger().AddEx( _T("; failed to save fparser's constants to \"%s\""), cachePath );
+            }
+
+            Runtime::GetLogger().DecIndentLevel();
+            Runtime::GetLogger().Add(   _T("}") );
+
+        }
+
+        static fparser_type::value_type fp_hex(const fparser_type::value_type* p)
+        {
+            return p[0];
+        }
+
+        void initFParserFuncs()
+        {
+            m_fp->AddFunction("hex", fp_hex, 1);
+        }
+
+        // adds the constant to this FParserWrapper and to g_fpConsts
+        void addConst(const char* constName, fparser_type::value_type value)
+        {
+            m_fp->AddConstant(constName, value);
+            g_fpConsts.AddConst(constName, value);
+            if ( m_pHeaderConsts != nullptr )
+            {
+                m_pHeaderConsts->push_back( FParserConsts::tConst{CStrT<char>(constName), value} );
+            }
+        }
+
+        void initFParser(CNppExec* pNppExec, bool bConsoleWarnings = true)
+        {
+            if ( m_fp != nullptr )
+                return;
+
+            m_fp = new fparser_type();
+            initFParserFuncs();
+
+            bool isInitializedHere = false;
+            if ( !g_fpConsts.IsInitialized() )
+            {
+                // waits for Preload(), if it is running
+                CCriticalSectionLockGuard lock(g_fpConsts.GetLock());
+
+                if ( !g_fpConsts.IsInitialized() )
+                {
+                    // the constants are calculated by this FParserWrapper
+                    g_fpConsts.InitPrecision(pNppExec);
+                    g_fpConsts.InitOptimizeHits(pNppExec);
+                    initFParserConsts(pNppExec);
+                    g_fpConsts.BuildIndex();
+                    g_fpConsts.SetInitialized();
+                    isInitializedHere = true;
+                }
+            }
+
+            if ( !isInitializedHere )
+                g_fpConsts.AddTo(*m_fp);
+
+            tstr path;
+            if ( bConsoleWarnings && g_fpConsts.TakeNoHeadersWarning(path) )
+            {
+                pNppExec->GetConsole().PrintMessage( _T("- Warning: fparser's constants have not been initialized because"), false );
+                pNppExec->GetConsole().PrintMessage( _T("the following folder either does not exist or is empty:"), false );
+                pNppExec->GetConsole().PrintMessage( path.c_str(), false );
+            }
+        }
+
+        fparser_type::value_type calc(CNppExec* pNppExec, const tstr& func, tstr& calcError)
+        {
+            if ( func.IsEmpty() )
+            {
+                calcError = _T("Input function is empty");
+                return fparser_type::value_type(0);
+            }
+
+            /*
+            {
+                TCHAR szNum[50];
+                // pre-parse for '0x...' numbers 
+                int pos = func.Find( _T("0x") );
+                while ( pos >= 0 )
+                {
+                    const TCHAR ch = func.GetAt(pos + 2);
+                    if ( isHexNumChar(ch) )
+                    {
+                        const int nn = c_base::_tstr2int( func.c_str() + pos );
+                        int hexLen = 2;
+                        while ( isHexNumChar(func.GetAt(pos + hexLen)) )  ++hexLen;
+                        int decLen = c_base::_tint2str(nn, szNum);
+                        func.Replace(pos, hexLen, szNum, decLen);
+                        pos += decLen;
+                    }
+                    pos = func.Find( _T("0x"), pos );
+                }
+            }
+            */
+
+          #ifdef UNICODE
+            char* pFunc = SysUniConv::newUnicodeToMultiByte( func.c_str() );
+          #else
+            const char* pFunc = func.c_str();
+          #endif
+
+            initFParser(pNppExec);
+
+            fparser_type::value_type ret(0);
+
+            calcError.Clear();
+
+            const int errPos = m_fp->Parse(pFunc, "");
+            if ( errPos == -1 )
+            {
+                fparser_type::value_type var(0);
+
+                var = m_fp->Eval( &var );
+                int err = m_fp->EvalError();
+                if ( err == 0 )
+                    ret = var;
+                else
+                    calcError.Format(50, _T("Eval error (%d)"), err);
+            }
+            else
+            {
+                const char* pErr = m_fp->ErrorMsg();
+              #ifdef UNICODE
+                TCHAR* pErrW = SysUniConv::newMultiByteToUnicode( pErr );
+                calcError = pErrW; // store a copy of the error message
+                delete [] pErrW;
+              #else
+                calcError = pErr; // store a copy of the error message
+              #endif
+            }
+
+            if ( errPos != -1 )
+            {
+                TCHAR szNum[50];
+
+                calcError += _T(" at pos ");
+                c_base::_tint2str(errPos, szNum);
+                calcError += szNum;
+            }
+
+          #ifdef UNICODE
+            delete [] pFunc;
+          #endif
+
+            return ret;
+        }
+
+        template<typename T> void format_result(const std::complex<T>& val, tstr& ret, const tstr& func)
+        {
+            if ( val.imag() == 0 )
+            {
+                format_result(val.real(), ret, func);
+            }
+            else
+            {
+                TCHAR szNum[120];
+                // ha-ha, wsprintf does not support neither "%f" nor "%G"
+                _t_sprintf(szNum, _T("%g %c %gi"), val.real(), val.imag() < 0 ? '-' : '+', std::abs(val.imag()));
+                ret = szNum;
+            }
+        }
+
+        template<typename T> void format_result(const T& val, tstr& ret, const tstr& func)
+        {
+            // Note: 
+            // As we are using FunctionParser that operates with 'double',
+            // its accuracy with regards to 64-bit integers is limited by
+            // the mantissa of a 'double'.
+          #ifndef __MINGW32__
+            const __int64 max_accurate_i64_value = (1i64) << std::numeric_limits<T>::digits; // 2**53 for the 'double' type
+          #else
+            const long long max_accurate_i64_value = (1LL) << std::numeric_limits<T>::digits; // 2**53 for the 'double' type
+          #endif
+            const double calc_precision = g_fpConsts.GetPrecision();
+
+            TCHAR szNum[80];
+            szNum[0] = 0;
+
+            if ( (func.StartsWith(_T("hex(")) || func.StartsWith(_T("hex ("))) &&
+                 (abs_val(val) < max_accurate_i64_value) )
+            {
+                unsigned __int64 n = static_cast<unsigned __int64>(val);
+                _t_sprintf( szNum, _T("0x%I64X"), n );
+            }
+            else if ( abs_val(val) > calc_precision*100 )
+            {
+                if ( abs_val(val) < max_accurate_i64_value )
+                {
+                    __int64 n = static_cast<__int64>(val);
+                    double  diff = static_cast<double>(val - n);
+
+                    if ( abs_val(diff) < calc_precision )
+                    {
+                        // result can be rounded
+                        _t_sprintf( szNum, _T("%I64d"), n ); 
+                        // ha-ha, wsprintf does not support neither "%I64d" nor "%f"
+                    }
+                    else
+                    {
+                        int nn = _t_sprintf( szNum, g_fpConsts.GetDefaultFmt(), val );
+                        if ( nn > 0 )
+                        {
+                            while ( nn > 0 && szNum[--nn] == _T('0') ) ;
+                            if ( szNum[nn] == _T('.') )  ++nn; // keep one '0' after '.'
+                            szNum[nn + 1] = 0; // exclude all trailing '0' after '.'
+                        }
+                    }
+                }
+                else
+                {
+                    // result is too big
+                    _t_sprintf( szNum, g_fpConsts.GetBigFmt(), val );
+                }
+            }
+            else
+            {
+                // result is too small
+                _t_sprintf( szNum, g_fpConsts.GetSmallFmt(), val );
+                // ha-ha, wsprintf does not support neither "%f" nor "%G"
+            }
+
+            ret = szNum;
+        }
+
+        bool calc2(CNppExec* pNppExec, const tstr& func, tstr& calcError, tstr& ret)
+        {
+            fparser_type::value_type fret = calc(pNppExec, func, calcError);
+
+            if ( calcError.IsEmpty() )
+            {
+                format_result(fret, ret, func);
+            }
+
+            return calcError.IsEmpty();
+        }
+
+    private:
+        fparser_type* m_fp;
+        FParserConsts::tConsts* m_pHeaderConsts; // the constants of the *.h file being read
+        tCachedExprList m_CachedExprs;
+        CStrHashMapT<TCHAR, tCachedExprList::iterator> m_CachedExprIndex;
+        int m_nOptimizeHits;
+        static volatile LONG m_nCacheHits;
+        static volatile LONG m_nCacheMisses;
+        static volatile LONG m_nInt64Calcs;
+        static volatile LONG m_nOptimizedExprs;
+        static volatile LONG m_nOptimizeSkipped;
+        static volatile LONG m_nOptimizedEvals;
+};
+
+volatile LONG FParserWrapper::m_nCacheHits = 0;
+volatile LONG FParserWrapper::m_nCacheMisses = 0;
+volatile LONG FParserWrapper::m_nInt64Calcs = 0;
+volatile LONG FParserWrapper::m_nOptimizedExprs = 0;
+volatile LONG FParserWrapper::m_nOptimizeSkipped = 0;
+volatile LONG FParserWrapper::m_nOptimizedEvals = 0;
+
+// used when there is no script's FParserWrapper, under g_csSharedFParser
+static FParserWrapper g_fpShared;
+static CCriticalSection g_csSharedFParser;
+
+// the script's FParserWrapper if called from the script's thread,
+// otherwise the shared one (locked while FParserAccess exists)
+class FParserAccess
+{
+    public:
+        explicit FParserAccess(CScriptEngine* pScriptEngine)
+          : m_pfp(pScriptEngine ? pScriptEngine->GetFParser() : nullptr)
+          , m_pcs(nullptr)
+        {
+            if ( m_pfp == nullptr )
+            {
+                m_pcs = &g_csSharedFParser;
+                m_pcs->Lock();
+                m_pfp = &g_fpShared;
+            }
+        }
+
+        ~FParserAccess()
+        {
+            if ( m_pcs != nullptr )
+                m_pcs->Unlock();
+        }
+
+        FParserAccess(const FParserAccess&) = delete;
+        FParserAccess& operator=(const FParserAccess&) = delete;
+
+        FParserWrapper* operator->() const { return m_pfp; }
+        FParserWrapper* Get() const { return m_pfp; }
+
+    private:
+        FParserWrapper* m_pfp;
+        CCriticalSection* m_pcs;
+};
+/**/
+
+/*
+ * CScriptEngine
+ *
+ *
+ * Internal Commands:
+ * ------------------
+ * cls
+ *   - clear Console screen
+ * cd
+ *   - shows current path
+ * cd <path>
+ *   - changes current directory (absolute or relative)
+ * cd <drive:\path>
+ *   - changes current drive and directory
+ * dir
+ *   - lists subdirs and files
+ * dir <mask>
+ *   - lists subdirs and files matched the mask
  * dir <path\mask>
  *   - lists subdirs and files matched the mask
  * echo <text>
@@ -1201,5926 +2403,9393 @@ static FParserWrapper g_fp;
  *
  */
 
-CScriptEngine::CScriptCommandRegistry CScriptEngine::m_CommandRegistry;
+CScriptEngine::CScriptCommandRegistry CScriptEngine::m_CommandRegistry;
+CCriticalSection CScriptEngine::m_csLastProfile;
+CScriptEngine::tProfileLines CScriptEngine::m_LastProfileLines;
+volatile LONG CScriptEngine::m_nProfilingEngines = 0;
+DWORD CScriptEngine::m_dwProfilingTlsIndex = TLS_OUT_OF_INDEXES;
+
+CScriptEngine::CScriptEngine(CNppExec* pNppExec, const CListT<tstr>& CmdList, const tstr& id)
+{
+    m_strInstance = NppExecHelpers::GetInstanceAsString(this);
+
+    m_pNppExec = pNppExec;
+    m_CmdList.Copy(CmdList); // own m_CmdList
+    m_id = id;
+
+    m_nCmdType = CMDTYPE_UNKNOWN;
+    m_nRunFlags = 0;
+    m_dwThreadId = 0;
+    m_bTriedExitCmd = false;
+    m_isClosingConsole = false;
+
+    m_CompiledCmds.nCmdAliasesVersion = 0;
+    m_CompiledCmds.bNoCmdAliases = false;
+
+    m_Benchmark.nStartTicks = 0;
+    m_Benchmark.isMeasuring = false;
+
+    m_Profile.nStartTicks = 0;
+    for ( int i = 0; i < pcTotalCount; ++i )
+    {
+        m_Profile.LineCounterTicks[i] = 0;
+        m_Profile.CounterDepth[i] = 0;
+    }
+    m_Profile.isProfiling = false;
+
+    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine - create (instance = %s)"), GetInstanceStr() );
+}
+
+CScriptEngine::~CScriptEngine()
+{
+    stopProfiling();
+
+    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine - destroy (instance = %s)"), GetInstanceStr() );
+}
+
+const TCHAR* CScriptEngine::GetInstanceStr() const
+{
+    return m_strInstance.c_str();
+}
+
+FParserWrapper* CScriptEngine::GetFParser()
+{
+    if ( m_dwThreadId != ::GetCurrentThreadId() )
+        return nullptr;
+
+    if ( !m_pFParser )
+        m_pFParser = std::make_shared<FParserWrapper>();
+
+    return m_pFParser.get();
+}
+
+#define INVALID_TSTR_LIST_ITEM ((CListItemT<tstr>*)(-1))
+
+void CScriptEngine::Run(unsigned int nRunFlags)
+{
+    m_nRunFlags = nRunFlags;
+    m_dwThreadId = ::GetCurrentThreadId();
+    m_bTriedExitCmd = false;
+    m_isClosingConsole = false;
+
+    if ( m_eventRunIsDone.IsNull() )
+        m_eventRunIsDone.Create(NULL, TRUE, FALSE, NULL); // manual reset, non-signaled
+    else
+        m_eventRunIsDone.Reset();
+
+    if ( m_eventAbortTheScript.IsNull() )
+        m_eventAbortTheScript.Create(NULL, TRUE, FALSE, NULL); // manual reset, non-signaled
+    else
+        m_eventAbortTheScript.Reset();
+
+    m_pNppExec->GetConsole().OnScriptEngineStarted();
+
+    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::Run - start (instance = %s)"), GetInstanceStr() );
+
+    tstr S;
+    bool isNppExec = false;
+    bool isFirstCmd = true;
+
+    m_execState.nExecCounter = 0;
+    m_execState.nExecMaxCount = m_pNppExec->GetOptions().GetInt(OPTI_EXEC_MAXCOUNT);
+    m_execState.nGoToCounter = 0;
+    m_execState.nGoToMaxCount = m_pNppExec->GetOptions().GetInt(OPTI_GOTO_MAXCOUNT);
+    m_execState.pScriptLineCurrent = NULL;
+    m_execState.SetScriptLineNext(INVALID_TSTR_LIST_ITEM);
+    m_execState.pChildProcess.reset();
+
+    // SCN_UPDATEUI may be still pending (e.g. the caret was moved right before
+    // the script was started), so Notepad++'s state is retrieved anew
+    m_pNppExec->GetMacroVars().InvalidateNppState();
+
+    m_execState.ScriptContextList.Add( ScriptContext() );
+    {
+        ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+        currentScript.CmdRange.pBegin = m_CmdList.GetFirst();
+        currentScript.CmdRange.pEnd = 0;
+        currentScript.IsNppExeced = false;
+        if ( m_nRunFlags & rfShareLocalVars )
+        {
+            if ( m_pParentScriptEngine )
+            {
+                // inheriting parent script's local variables
+                CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
+                currentScript.LocalMacroVars = m_pParentScriptEngine->GetExecState().GetCurrentScriptContext().LocalMacroVars;
+                currentScript.LocalMacroArrays = m_pParentScriptEngine->GetExecState().GetCurrentScriptContext().LocalMacroArrays;
+                // We could use swap() instead of copying here, but if something
+                // goes wrong in that case we risk to end with empty local vars
+                // in the parent script. So copying is safer.
+                // The copy is cheap: the vars are shared until one of the scripts
+                // modifies them (see CStrHashMapT), so the parent and the child
+                // do not hold two copies of the vars unless they differ.
+            }
+        }
+        else if ( m_nRunFlags & rfConsoleLocalVarsRead )
+        {
+            // inheriting Console's local variables (shared until modified)
+            CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
+            currentScript.LocalMacroVars = m_pNppExec->GetMacroVars().GetUserConsoleMacroVars();
+            currentScript.LocalMacroArrays = m_pNppExec->GetMacroVars().GetUserConsoleMacroArrays();
+        }
+        if ( ((m_nRunFlags & rfShareConsoleState) != 0) || 
+             (!m_pParentScriptEngine) || (!m_pParentScriptEngine->IsCollateral()) )
+        {
+            // inheriting Console's enabled state
+            CNppExecConsole& Console = m_pNppExec->GetConsole();
+            DWORD scrptEngnId = 0;
+            if ( ((m_nRunFlags & rfConsoleLocalVars) == 0) && m_pParentScriptEngine )
+                scrptEngnId = m_pParentScriptEngine->GetThreadId();
+            int nEnabled = Console.GetOutputEnabledDirectly(scrptEngnId);
+            Console.SetOutputEnabledDirectly(m_dwThreadId, nEnabled);
+        }
+    }
+
+    CListItemT<tstr>* p = m_CmdList.GetFirst();
+    if ( !buildScriptIndex(m_execState.GetCurrentScriptContext()) )
+    {
+        p = NULL; // the script is not executed at all
+    }
+    while ( p && ContinueExecution() )
+    {
+        eCmdType nCmdType = CMDTYPE_COMMENT_OR_EMPTY;
+
+        const bool isBenchmarking = m_Benchmark.isMeasuring;
+        const bool isProfiling = m_Profile.isProfiling;
+        tProfileLine* pProfileLine = NULL;
+        if ( isProfiling )
+            pProfileLine = getProfileLine(p, m_execState.GetCurrentScriptContext());
+        LARGE_INTEGER liLineStart;
+        liLineStart.QuadPart = 0;
+        if ( isBenchmarking || isProfiling )
+            ::QueryPerformanceCounter(&liLineStart);
+
+        m_execState.pScriptLineCurrent = p;
+        m_execState.SetScriptLineNext(INVALID_TSTR_LIST_ITEM);
+
+        S = p->GetItem();
+
+        if ( S.length() > 0 )
+        {
+
+            CSimpleLogger& logger = Runtime::GetLogger();
+            if ( logger.IsLogging() ) // one check instead of checking each line below
+            {
+                if ( (m_nRunFlags & rfCollateralScript) == 0 )
+                {
+                    logger.Clear();
+                }
+                logger.Add(   _T("; command info") );
+                logger.AddEx( _T("Current command item:  p = 0x%X"), p );
+                logger.Add(   _T("{") );
+                logger.IncIndentLevel();
+                logger.AddEx( _T("_item  = \"%s\""), p->GetItem().c_str() );
+                logger.AddEx( _T("_prev  = 0x%X"), p->GetPrev() );
+                if ( p->GetPrev() )
+                {
+                    const CListItemT<tstr>* pPrev = p->GetPrev();
+                    logger.Add(   _T("{") );
+                    logger.IncIndentLevel();
+                    logger.AddEx( _T("_item = \"%s\""), pPrev->GetItem().c_str() );
+                    logger.AddEx( _T("_prev = 0x%X;  _next = 0x%X;  _owner = 0x%X"), 
+                        pPrev->GetPrev(), pPrev->GetNext(), pPrev->GetOwner() );
+                    logger.DecIndentLevel();
+                    logger.Add(   _T("}") );
+                }
+                logger.AddEx( _T("_next  = 0x%X"), p->GetNext() ); 
+                if ( p->GetNext() )
+                {
+                    const CListItemT<tstr>* pNext = p->GetNext();
+                    logger.Add(   _T("{") );
+                    logger.IncIndentLevel();
+                    logger.AddEx( _T("_item = \"%s\""), pNext->GetItem().c_str() );
+                    logger.AddEx( _T("_prev = 0x%X;  _next = 0x%X;  _owner = 0x%X"), 
+                        pNext->GetPrev(), pNext->GetNext(), pNext->GetOwner() );
+                    logger.DecIndentLevel();
+                    logger.Add(   _T("}") );
+                }
+                logger.AddEx( _T("_owner = 0x%X"), p->GetOwner() );
+                logger.DecIndentLevel();
+                logger.Add(   _T("}") );
+        
+                logger.Add(   _T("; executing ModifyCommandLine") );
+            }
+
+            ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+            const int ifDepth = currentScript.GetIfDepth();
+            const eIfState ifState = currentScript.GetIfState();
+            const CListItemT<tstr>* pCmdItem = p;
+
+            if ( currentScript.IsNppExeced )
+            {
+                // the arguments are bound to this NPP_EXEC call, the shared line itself is not modified
+                if ( bindCmdArgs(p, currentScript, S) )
+                    pCmdItem = NULL; // depends on the arguments, so it is not compiled
+            }
+
+            nCmdType = modifyCommandLine(this, S, ifState, pCmdItem);
+            if ( nCmdType != CMDTYPE_COMMENT_OR_EMPTY )
+            {
+                if ( isSkippingThisCommandDueToIfState(nCmdType, ifState) )
+                {
+                    if ( Runtime::GetLogger().IsLogging() )
+                    {
+                        Runtime::GetLogger().AddEx( _T("; skipping - waiting for %s"),
+                            (ifState == IF_WANT_ENDIF || ifState == IF_WANT_SILENT_ENDIF || ifState == IF_EXECUTING) ? DoEndIfCommand::Name() : DoElseCommand::Name() );
+                    }
+                
+                    if ( nCmdType == CMDTYPE_IF )
+                    {
+                        // nested IF inside a conditional block that is being skipped
+                        currentScript.PushIfState(IF_WANT_SILENT_ENDIF);
+                        // skip the nested IF...ENDIF block as well - mark it as "silent"
+                    }
+                    else if ( nCmdType == CMDTYPE_ENDIF )
+                    {
+                        // nested ENDIF inside a conditional block that is being skipped
+                        if ( ifState == IF_WANT_SILENT_ENDIF ) // <-- this condition is redundant, but let it be just in case
+                        {
+                            // nested "silent" IF...ENDIF block is completed
+                            currentScript.PopIfState();
+                        }
+                    }
+                    else if ( nCmdType == CMDTYPE_ELSE )
+                    {
+                        if ( ifState == IF_EXECUTING )
+                        {
+                            // the IF...ELSE block completed
+                            currentScript.SetIfState(IF_WANT_ENDIF);
+                            jumpToIfTarget(currentScript.IfJumpToEndIf, p);
+                        }
+                    }
+                }
+                else
+                {
+                    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+                    if ( nCmdType == CMDTYPE_COLLATERAL_FORCED )
+                    {
+                        CListT<tstr> CmdList(S);
+                        if ( !m_pNppExec->GetCommandExecutor().ExecuteCollateralScript(CmdList, tstr()) )
+                            nCmdResult = CMDRESULT_FAILED;
+                    }
+                    else
+                    {
+                        m_nCmdType = nCmdType;
+                        if ( isFirstCmd && (m_nCmdType == CMDTYPE_NPPEXEC) )
+                        {
+                            isNppExec = true;
+                        }
+                        else 
+                        {
+                            if ( isFirstCmd )
+                            {
+                                isFirstCmd = false;
+
+                                if ( m_nCmdType == CMDTYPE_NPPCONSOLE )
+                                {
+                                    int param = getOnOffParam(S);
+                                    if ( param == PARAM_ENABLE || param == PARAM_DISABLE )
+                                    {
+                                        if ( !m_pNppExec->isConsoleDialogVisible() )
+                                        {
+                                            m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, 0);
+                                        }
+                                    }
+                                }
+                            }
+                            if ( isNppExec )
+                            {
+                                if ( m_nCmdType != CMDTYPE_NPPCONSOLE )
+                                {
+                                    m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, 0);
+                                }
+                                isNppExec = false;
+                            }
+                        }
+
+                        m_sCmdParams = S;
+                        EXECFUNC pCmdExecFunc = m_CommandRegistry.GetCmdExecFunc(m_nCmdType);
+                        nCmdResult = pCmdExecFunc(this, S);
+                    }
+
+                    if ( !isKeepingNppState(nCmdType) )
+                    {
+                        // e.g. NPP_OPEN or SCI_SENDMSG: Scintilla's SCN_UPDATEUI comes later
+                        m_pNppExec->GetMacroVars().InvalidateNppState();
+                    }
+
+                    // The same currentScript object is used here to handle NPP_EXEC as well
+                    // (it's safe because ScriptContextList.DeleteLast() is not called before)
+                    if ( (ifState == IF_MAYBE_ELSE) &&
+                         (currentScript.GetIfState() == IF_MAYBE_ELSE) &&
+                         (currentScript.GetIfDepth() == ifDepth) )
+                    {
+                        // The IfState was not changed, so remove IF_MAYBE_ELSE
+                        currentScript.SetIfState(IF_NONE);
+                    }
+
+                    if ( ((nCmdType == CMDTYPE_IF) || (nCmdType == CMDTYPE_ELSE)) &&
+                         (currentScript.GetIfState() == IF_WANT_ELSE) )
+                    {
+                        // the condition is false, no need to go through the lines up to ELSE or ENDIF
+                        jumpToIfTarget(currentScript.IfJumpToElse, p);
+                    }
+
+                    {
+                        TCHAR szCmdResult[50];
+                        c_base::_tint2str(nCmdResult, szCmdResult);
+
+                        tstr varName = MACRO_LAST_CMD_RESULT;
+                        m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, szCmdResult, CNppExecMacroVars::svLocalVar ); // local var
+                    }
+                }
+            }
+
+            Runtime::GetLogger().Add(   _T("") );
+        }
+
+        if ( isBenchmarking && m_Benchmark.isMeasuring )
+        {
+            // "npe_benchmark start" and "npe_benchmark stop" are not counted
+            addBenchmarkSample(nCmdType, liLineStart.QuadPart);
+        }
+
+        if ( isProfiling && m_Profile.isProfiling )
+        {
+            // "npe_profile on" and "npe_profile off" are not counted
+            addProfileSample(pProfileLine, liLineStart.QuadPart);
+        }
+
+        if ( m_execState.pScriptLineNext == INVALID_TSTR_LIST_ITEM )
+        {
+            p = p->GetNext();
+            if ( !p && m_execState.GetCurrentScriptContext().IsNppExeced )
+            {
+                // end of the NPP_EXEC'ed script body
+                p = m_execState.GetCurrentScriptContext().CmdRange.pEnd;
+            }
+        }
+        else
+            p = m_execState.pScriptLineNext;
+
+        // several NPP_EXEC'ed scripts may end at the same line
+        while ( m_execState.GetCurrentScriptContext().IsNppExeced &&
+                p == m_execState.GetCurrentScriptContext().CmdRange.pEnd )
+        {
+            popScriptContext();
+        }
+    } // while
+
+    if ( isNppExec )
+    {
+        // the whole script contains just NPP_EXEC commands
+        // the Console is still hidden, it must be shown
+        m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, 0);
+    }
+
+    if ( !m_pNppExec->GetCommandExecutor().GetRunningScriptEngine() )
+    {
+        // a collateral script may be running
+        m_pNppExec->_consoleIsVisible = m_pNppExec->isConsoleDialogVisible();
+    }
+
+    stopProfiling();
+    if ( !m_Profile.Lines.empty() )
+    {
+        // this engine is about to be destroyed, the data is kept for "npe_profile report"
+        CCriticalSectionLockGuard lock(m_csLastProfile);
+        m_LastProfileLines = m_Profile.Lines;
+    }
+
+    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::Run - end (instance = %s)"), GetInstanceStr() );
+
+    if ( m_nRunFlags & rfShareLocalVars )
+    {
+        if ( m_pParentScriptEngine )
+        {
+            ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+            CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
+            m_pParentScriptEngine->GetExecState().GetCurrentScriptContext().LocalMacroVars.swap(currentScript.LocalMacroVars);
+            m_pParentScriptEngine->GetExecState().GetCurrentScriptContext().LocalMacroArrays.swap(currentScript.LocalMacroArrays);
+        }
+    }
+    else if ( m_nRunFlags & rfConsoleLocalVarsWrite )
+    {
+        ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+        CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
+        m_pNppExec->GetMacroVars().GetUserConsoleMacroVars().swap(currentScript.LocalMacroVars);
+        m_pNppExec->GetMacroVars().GetUserConsoleMacroArrays().swap(currentScript.LocalMacroArrays);
+    }
+    if ( m_nRunFlags & rfShareConsoleState ) // <-- another script can enable the output, but usually that does not affect the parent's state
+    {
+        CNppExecConsole& Console = m_pNppExec->GetConsole();
+        int nEnabled = Console.GetOutputEnabledDirectly(m_dwThreadId);
+        DWORD scrptEngnId = 0;
+        if ( ((m_nRunFlags & rfConsoleLocalVars) == 0) && m_pParentScriptEngine )
+            scrptEngnId = m_pParentScriptEngine->GetThreadId();
+        Console.SetOutputEnabledDirectly(scrptEngnId, nEnabled);
+    }
+
+    m_pNppExec->GetConsole().OnScriptEngineFinished();
+
+    m_eventRunIsDone.Set();
+}
+
+bool CScriptEngine::IsParentOf(const std::shared_ptr<CScriptEngine> pScriptEngine) const
+{
+    std::shared_ptr<CScriptEngine> pEngine = GetChildScriptEngine();
+    while ( pEngine )
+    {
+        if ( pEngine == pScriptEngine )
+            return true;
+
+        pEngine = pEngine->GetChildScriptEngine();
+    }
+    return false;
+}
+
+bool CScriptEngine::IsChildOf(const std::shared_ptr<CScriptEngine> pScriptEngine) const
+{
+    std::shared_ptr<CScriptEngine> pEngine = GetParentScriptEngine();
+    while ( pEngine )
+    {
+        if ( pEngine == pScriptEngine )
+            return true;
+
+        pEngine = pEngine->GetParentScriptEngine();
+    }
+    return false;
+}
+
+bool CScriptEngine::ContinueExecution() const
+{
+    return (m_pNppExec->_consoleIsVisible || ((m_nRunFlags & rfExitScript) != 0 && !m_pNppExec->_bStopTheExitScript)); 
+}
+
+void CScriptEngine::ScriptError(eErrorType type, const TCHAR* cszErrorMessage)
+{
+    switch ( type )
+    {
+        case ET_REPORT:
+            m_pNppExec->GetConsole().PrintError( GetLastLoggedCmd().c_str() );
+            m_pNppExec->GetConsole().PrintError( cszErrorMessage );
+            break;
+
+        case ET_ABORT:
+          #if SCRPTENGNID_DEBUG_OUTPUT
+            {
+                tstr S;
+                S.Format(1020, _T("CScriptEngine::ScriptError - scrptEngnId=%u\n"), m_dwThreadId);
+                ::OutputDebugString(S.c_str());
+            }
+          #endif
+            m_execState.pScriptLineNext = NULL; // stop the script
+            m_eventAbortTheScript.Set();
+            m_pNppExec->GetConsole().OnScriptEngineAborting(m_dwThreadId);
+            Runtime::GetLogger().Add_WithoutOutput( cszErrorMessage );
+            Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::ScriptError(ET_ABORT) (instance = %s)"), GetInstanceStr() );
+            break;
+
+        case ET_UNPREDICTABLE:
+            m_execState.pScriptLineNext = NULL; // stop the script
+            m_eventAbortTheScript.Set();
+            // do not call it here: m_pNppExec->GetConsole().OnScriptEngineAborting(m_dwThreadId);
+            m_pNppExec->GetConsole().PrintError( GetLastLoggedCmd().c_str() );
+            m_pNppExec->GetConsole().PrintError( cszErrorMessage );
+            m_pNppExec->GetConsole().PrintError( _T("To prevent unpredictable behavior, the script is stopped.") );
+            Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::ScriptError(ET_UNPREDICTABLE)  (instance = %s)"), GetInstanceStr() );
+            break;
+    }
+}
+
+void CScriptEngine::UndoAbort(const TCHAR* cszMessage)
+{
+    m_execState.pScriptLineNext = m_execState.pScriptLineNextBackupCopy;
+    m_eventAbortTheScript.Reset();
+
+    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::UndoAbort() (instance = %s) : %s"), GetInstanceStr(), cszMessage );
+}
+
+std::shared_ptr<CChildProcess> CScriptEngine::GetRunningChildProcess()
+{
+    std::shared_ptr<CChildProcess> pChildProc;
+    std::shared_ptr<CScriptEngine> pScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine(); // shared_ptr(this)
+    while ( pScriptEngine && !pChildProc )
+    {
+        pChildProc = pScriptEngine->GetExecState().GetRunningChildProcess();
+        pScriptEngine = pScriptEngine->GetParentScriptEngine();
+    }
+    return pChildProc;
+}
+
+bool CScriptEngine::IsChildProcessRunning() const
+{
+    bool isChildProcRunning = false;
+    std::shared_ptr<CScriptEngine> pScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine(); // shared_ptr(this)
+    while ( pScriptEngine && !isChildProcRunning )
+    {
+        isChildProcRunning = pScriptEngine->GetExecState().IsChildProcessRunning();
+        pScriptEngine = pScriptEngine->GetParentScriptEngine();
+    }
+    return isChildProcRunning;
+}
+
+void CScriptEngine::ChildProcessMustBreakAll()
+{
+    std::shared_ptr<CScriptEngine> pScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine(); // shared_ptr(this)
+    while ( pScriptEngine )
+    {
+        std::shared_ptr<CChildProcess> pChildProc = pScriptEngine->GetExecState().GetRunningChildProcess();
+        if ( pChildProc )
+            pChildProc->MustBreak(CProcessKiller::killCtrlBreak);
+        pScriptEngine->ParallelJobsMustBreak(CProcessKiller::killCtrlBreak);
+        pScriptEngine = pScriptEngine->GetParentScriptEngine();
+    }
+}
+
+bool CScriptEngine::WaitUntilDone(DWORD dwTimeoutMs) const
+{
+    return (m_eventRunIsDone.IsNull() || (m_eventRunIsDone.Wait(dwTimeoutMs) == WAIT_OBJECT_0));
+}
+
+CScriptEngine::eNppExecCmdPrefix CScriptEngine::checkNppExecCmdPrefix(CNppExec* pNppExec, tstr& Cmd, bool bRemovePrefix)
+{
+    eNppExecCmdPrefix ret = CmdPrefixNone;
+    int nPrefixLen = 0;
+    const TCHAR* pszPrefix = pNppExec->GetOptions().GetStr(OPTS_NPPEXEC_CMD_PREFIX, &nPrefixLen);
+    if ( nPrefixLen != 0 )
+    {
+        if ( Cmd.StartsWith(pszPrefix) )
+        {
+            ret = CmdPrefixCollateralOrRegular;
+            if ( Cmd.GetAt(nPrefixLen) == pszPrefix[nPrefixLen - 1] ) // is the last symbol doubled?
+            {
+                // if the prefix is "nppexec:" (default), then "nppexec::" is expected here
+                // if the prefix was changed to e.g. "npe-", then "npe--" is expected here
+                ++nPrefixLen;
+                ret = CmdPrefixCollateralForced;
+            }
+            if ( bRemovePrefix )
+            {
+                Cmd.Delete(0, nPrefixLen);
+                NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
+            }
+        }
+    }
+    return ret;
+}
+
+CScriptEngine::eCmdType CScriptEngine::getCmdType(CNppExec* pNppExec, tstr& Cmd, unsigned int nFlags, CNppExecMacroVars::CmdAliasesSnapshot* pAliasesSnapshot)
+{
+    const bool useLogging = ((nFlags & ctfUseLogging) != 0);
+    const bool ignorePrefix = ((nFlags & ctfIgnorePrefix) != 0);
+    const bool noErrors = ((nFlags & ctfNoErrors) != 0);
+    
+    if ( useLogging )
+    {
+        Runtime::GetLogger().Add(   _T("GetCmdType()") );
+        Runtime::GetLogger().Add(   _T("{") );
+        Runtime::GetLogger().IncIndentLevel();
+        Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), Cmd.c_str() );
+    }
+
+    NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
+    NppExecHelpers::StrDelTrailingTabSpaces(Cmd);
+
+    CScriptEngine::eNppExecCmdPrefix cmdPrefix = checkNppExecCmdPrefix(pNppExec, Cmd);
+
+    if ( Cmd.IsEmpty() )
+    {
+        if ( useLogging )
+        {
+            Runtime::GetLogger().AddEx( _T("[ret] %d (empty command)"), CMDTYPE_COMMENT_OR_EMPTY );
+            Runtime::GetLogger().DecIndentLevel();
+            Runtime::GetLogger().Add(   _T("}") );
+        }
+
+        return CMDTYPE_COMMENT_OR_EMPTY;
+    }
+
+    if ( (!ignorePrefix) && (cmdPrefix == CmdPrefixCollateralForced) )
+    {
+        if ( useLogging )
+        {
+            Runtime::GetLogger().AddEx( _T("[ret] %d (forced collateral command)"), CMDTYPE_COLLATERAL_FORCED );
+            Runtime::GetLogger().DecIndentLevel();
+            Runtime::GetLogger().Add(   _T("}") );
+        }
+
+        return CMDTYPE_COLLATERAL_FORCED;
+    }
+
+    const TCHAR* pAliasNppExec = pNppExec->GetOptions().GetStr(OPTS_ALIAS_CMD_NPPEXEC);
+    if ( pAliasNppExec && pAliasNppExec[0] )
+    {
+        if ( pAliasNppExec[0] == Cmd.GetAt(0) ) // the alias is one character
+        {
+            if ( (Cmd.GetAt(0) != _T('\\') || Cmd.GetAt(1) != _T('\\')) &&  // not "\\..."
+                 (Cmd.GetAt(0) != _T('/') || Cmd.GetAt(1) != _T('/')) )     // not "//..."
+            {
+                Cmd.Delete(0, 1);
+
+                if ( useLogging )
+                {
+                    Runtime::GetLogger().AddEx( _T("[ret] 0x%X (%s)"), CMDTYPE_NPPEXEC, DoNppExecCommand::Name() );
+                    Runtime::GetLogger().DecIndentLevel();
+                    Runtime::GetLogger().Add(   _T("}") );
+                }
+
+                return CMDTYPE_NPPEXEC;
+            }
+        }
+    }
+
+    pNppExec->GetMacroVars().CheckCmdAliases(Cmd, useLogging, pAliasesSnapshot);
+
+    if ( Cmd.GetAt(0) == _T(':') && Cmd.GetAt(1) == _T(':') )
+    {
+        if ( !noErrors )
+            pNppExec->GetConsole().PrintError( _T("- can not use \"::\" at the beginning of line!") );
+
+        if ( useLogging )
+        {
+            Runtime::GetLogger().AddEx( _T("[ret] %d (command starts with ::)"), CMDTYPE_COMMENT_OR_EMPTY );
+            Runtime::GetLogger().DecIndentLevel();
+            Runtime::GetLogger().Add(   _T("}") );
+        }
+
+        return CMDTYPE_COMMENT_OR_EMPTY;
+    }
+
+    if ( DEFAULT_ALIAS_CMD_LABEL == Cmd.GetAt(0) )
+    {
+        Cmd.Delete(0, 1);
+
+        if ( useLogging )
+        {
+            Runtime::GetLogger().AddEx( _T("[ret] 0x%X (%s)"), CMDTYPE_LABEL, DoLabelCommand::Name() );
+            Runtime::GetLogger().DecIndentLevel();
+            Runtime::GetLogger().Add(   _T("}") );
+        }
+
+        return CMDTYPE_LABEL;
+    }
+
+    tstr S = Cmd;
+    NppExecHelpers::StrUpper(S);
+  
+    eCmdType nCmdType = CMDTYPE_UNKNOWN;
+    if ( S.StartsWith(DoCdCommand::Name()) )
+    {
+        int i = lstrlen(DoCdCommand::Name());
+        const TCHAR next_ch = S.GetAt(i);
+        if ( IsTabSpaceOrEmptyChar(next_ch) || next_ch == _T('\\') || next_ch == _T('/') || next_ch == _T('.') )
+        {
+            nCmdType = DoCdCommand::Type();
+            Cmd.Delete(0, i);
+        }
+    }
+    if ( nCmdType == CMDTYPE_UNKNOWN )
+    {
+        int i = S.FindOneOf(_T(" \t"));
+        S.Delete(i);
+        nCmdType = m_CommandRegistry.GetCmdTypeByName(S);
+        if ( nCmdType != CMDTYPE_UNKNOWN )
+            Cmd.Delete(0, i);
+    }
+
+    if ( useLogging )
+    {
+        if ( nCmdType != CMDTYPE_UNKNOWN )
+        {
+            Runtime::GetLogger().AddEx( _T("[ret] 0x%X (%s)"), nCmdType, m_CommandRegistry.GetCmdNameByType(nCmdType) );
+        }
+        else
+        {
+            Runtime::GetLogger().AddEx( _T("[ret] 0x%X (unknown)"), nCmdType );
+        }
+        Runtime::GetLogger().DecIndentLevel();
+        Runtime::GetLogger().Add(   _T("}") );
+    }
+  
+    return nCmdType;
+}
+
+bool CScriptEngine::isSkippingThisCommandDueToIfState(eCmdType cmdType, eIfState ifState)
+{
+    return ( (ifState == IF_WANT_SILENT_ENDIF) ||
+             ((ifState == IF_WANT_ENDIF) && (cmdType != CMDTYPE_ENDIF)) ||
+             ((ifState == IF_WANT_ELSE) && (cmdType != CMDTYPE_ELSE && cmdType != CMDTYPE_ENDIF)) || 
+             ((ifState == IF_EXECUTING) && (cmdType == CMDTYPE_ELSE)) );
+}
+
+bool CScriptEngine::isKeepingNppState(eCmdType cmdType)
+{
+    // These commands do not change Notepad++'s state, so the cached values
+    // of $(FULL_CURRENT_PATH), $(CURRENT_WORD), ... remain valid after them.
+    // Anything else (including a child process that may send a message to
+    // Notepad++ or Scintilla) invalidates the cache.
+    switch ( cmdType )
+    {
+        case CMDTYPE_CLS:
+        case CMDTYPE_CD:
+        case CMDTYPE_DIR:
+        case CMDTYPE_CONLOADFROM:
+        case CMDTYPE_CONSAVETO:
+        case CMDTYPE_ECHO:
+        case CMDTYPE_NPEDEBUGLOG:
+        case CMDTYPE_SET:
+        case CMDTYPE_UNSET:
+        case CMDTYPE_NPENOEMPTYVARS:
+        case CMDTYPE_ENVSET:
+        case CMDTYPE_ENVUNSET:
+        case CMDTYPE_NPECONSOLE:
+        case CMDTYPE_NPECMDALIAS:
+        case CMDTYPE_CONCOLOUR:
+        case CMDTYPE_CONFILTER:
+        case CMDTYPE_IF:
+        case CMDTYPE_LABEL:
+        case CMDTYPE_GOTO:
+        case CMDTYPE_ELSE:
+        case CMDTYPE_ENDIF:
+        case CMDTYPE_CLIPSETTEXT:
+        case CMDTYPE_NPESENDMSGBUFLEN:
+        case CMDTYPE_WHILE:
+        case CMDTYPE_ENDWHILE:
+        case CMDTYPE_FOR:
+        case CMDTYPE_ENDFOR:
+        case CMDTYPE_BREAK:
+        case CMDTYPE_CONTINUE:
+        case CMDTYPE_NPEBENCHMARK:
+        case CMDTYPE_NPEPROFILE:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
+CScriptEngine::eCmdType CScriptEngine::compileCommandLine(CNppExec* pNppExec, tstr& Cmd, bool& bCacheable, CNppExecMacroVars::CmdAliasesSnapshot* pAliasesSnapshot)
+{
+    bCacheable = true;
+
+    CScriptEngine::eNppExecCmdPrefix cmdPrefix = checkNppExecCmdPrefix(pNppExec, Cmd);
+
+    if ( isCommentOrEmpty(pNppExec, Cmd) )
+    {
+        Runtime::GetLogger().Add(   _T("; it\'s a comment or empty string") );
+
+        return CMDTYPE_COMMENT_OR_EMPTY;
+    }
+
+    if ( cmdPrefix == CmdPrefixCollateralForced )
+    {
+        Runtime::GetLogger().Add(   _T("; it\'s a forced collateral command") );
+
+        return CMDTYPE_COLLATERAL_FORCED;
+    }
+  
+    // ... checking commands ...
+
+    eCmdType nCmdType = getCmdType(pNppExec, Cmd, ctfUseLogging, pAliasesSnapshot);
+
+    if ( nCmdType == CMDTYPE_COMMENT_OR_EMPTY )
+    {
+        // getCmdType() may report an error here, it must be reported each time
+        bCacheable = false;
+    }
+    else
+    {
+        NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
+    }
+
+    return nCmdType;
+}
+
+CScriptEngine::eCmdType CScriptEngine::getCompiledCmd(const CListItemT<tstr>* pCmdItem, tstr& Cmd, bool& bHasMacroVars)
+{
+    CNppExec* pNppExec = GetNppExec();
+    const unsigned int nCmdAliasesVersion = pNppExec->GetMacroVars().GetCmdAliasesVersion();
+    const bool bNoCmdAliases = pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOCMDALIASES);
+    const TCHAR* pszCommentDelimiter = pNppExec->GetOptions().GetStr(OPTS_COMMENTDELIMITER);
+
+    if ( (m_CompiledCmds.nCmdAliasesVersion != nCmdAliasesVersion) ||
+         (m_CompiledCmds.bNoCmdAliases != bNoCmdAliases) ||
+         (m_CompiledCmds.sCommentDelimiter != pszCommentDelimiter) )
+    {
+        // the command aliases or the options have been changed
+        m_CompiledCmds.Items.clear();
+        m_CompiledCmds.nCmdAliasesVersion = nCmdAliasesVersion;
+        m_CompiledCmds.bNoCmdAliases = bNoCmdAliases;
+        m_CompiledCmds.sCommentDelimiter = pszCommentDelimiter;
+    }
+
+    auto itr = m_CompiledCmds.Items.find(pCmdItem);
+    if ( itr != m_CompiledCmds.Items.end() )
+    {
+        const tCompiledCmd& compiledCmd = itr->second;
+        Cmd = compiledCmd.sCmdParams;
+        bHasMacroVars = (compiledCmd.nMacroVarPos >= 0);
+
+        Runtime::GetLogger().Add(   _T("; using the compiled command line") );
+
+        return compiledCmd.nCmdType;
+    }
+
+    bool bCacheable = true;
+    Cmd = pCmdItem->GetItem();
+    eCmdType nCmdType = compileCommandLine(pNppExec, Cmd, bCacheable, GetCmdAliasesSnapshot());
+    const int nMacroVarPos = Cmd.Find(_T("$("));
+    bHasMacroVars = (nMacroVarPos >= 0);
+
+    if ( bCacheable )
+    {
+        tCompiledCmd& compiledCmd = m_CompiledCmds.Items[pCmdItem];
+        compiledCmd.nCmdType = nCmdType;
+        compiledCmd.sCmdParams = Cmd;
+        compiledCmd.nMacroVarPos = nMacroVarPos;
+    }
+
+    return nCmdType;
+}
+
+void CScriptEngine::removeCompiledCmd(const CListItemT<tstr>* pCmdItem)
+{
+    m_CompiledCmds.Items.erase(pCmdItem);
+    m_CompiledConditions.erase(pCmdItem);
+    m_CmdArgsTemplates.erase(pCmdItem);
+    m_Profile.LineByItem.erase(pCmdItem);
+}
+
+bool CScriptEngine::buildScriptIndex(ScriptContext& scriptContext)
+{
+    // One pass through all the lines of the script: the labels (including
+    // the ones located before the current line) and the matching IF, ELSE
+    // and ENDIF lines are found here. Similar to skipping the lines in Run(),
+    // any nested IF (even "IF ... GOTO") is expected to have its ENDIF.
+    // The same is done for WHILE ... ENDWHILE and FOR ... ENDFOR.
+
+    typedef struct sIfBlock {
+        CListItemT<tstr>* pBranch; // IF or the last ELSE of this block
+        std::list<CListItemT<tstr>*> Elses;
+        bool isDynamic; // the block contains a command that is known only at runtime
+    } tIfBlock;
+
+    typedef struct sLoopBlock {
+        CListItemT<tstr>* pBegin; // WHILE or FOR
+        eCmdType nEndCmdType;     // the expected ENDWHILE or ENDFOR
+    } tLoopBlock;
+
+    std::list<tIfBlock> IfBlocks; // the innermost block is the last one
+    std::list<tLoopBlock> LoopBlocks; // the innermost loop is the last one
+    CListItemT<tstr>* pParallel = NULL; // PARALLEL blocks can't be nested
+    bool isDynamic = false;
+    const TCHAR* cszError = NULL;
+    const CListItemT<tstr>* pErrorLine = NULL;
+    tstr Cmd;
+
+    Runtime::GetLogger().Activate(false);
+
+    CListItemT<tstr>* p = scriptContext.CmdRange.pBegin;
+    for ( ; p && (p != scriptContext.CmdRange.pEnd) && !cszError; p = p->GetNext() )
+    {
+        Cmd = p->GetItem();
+        if ( checkNppExecCmdPrefix(m_pNppExec, Cmd) == CmdPrefixCollateralForced )
+            continue;
+
+        if ( isCommentOrEmpty(m_pNppExec, Cmd) )
+            continue;
+
+        const eCmdType nCmdType = getCmdType(m_pNppExec, Cmd, ctfNoErrors, GetCmdAliasesSnapshot());
+        if ( pParallel != NULL )
+        {
+            // the lines of PARALLEL ... JOIN are the child processes' command lines
+            if ( nCmdType == CMDTYPE_JOIN )
+            {
+                scriptContext.ParallelJumpToJoin[pParallel] = p;
+                pParallel = NULL;
+            }
+            else if ( nCmdType == CMDTYPE_PARALLEL )
+            {
+                cszError = _T("- Nested PARALLEL found, PARALLEL blocks can't be nested.");
+                pErrorLine = p;
+            }
+            continue;
+        }
+
+        switch ( nCmdType )
+        {
+            case CMDTYPE_LABEL:
+                if ( scriptContext.IsNppExeced && CNppExecMacroVars::ContainsMacroVar(Cmd) )
+                    break; // may depend on $(ARGV), DoGoTo() finds it with the arguments applied
+                NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
+                NppExecHelpers::StrDelTrailingTabSpaces(Cmd);
+                NppExecHelpers::StrUpper(Cmd);
+                if ( scriptContext.Labels.find(Cmd) == scriptContext.Labels.end() )
+                {
+                    scriptContext.Labels[Cmd] = p->GetNext(); // label points to the next command
+                }
+                break;
+
+            case CMDTYPE_IF:
+                {
+                    tIfBlock ifBlock;
+                    ifBlock.pBranch = p;
+                    ifBlock.isDynamic = false;
+                    IfBlocks.push_back(ifBlock);
+                }
+                break;
+
+            case CMDTYPE_ELSE:
+                if ( IfBlocks.empty() )
+                {
+                    if ( !isDynamic )
+                    {
+                        cszError = _T("- Unexpected ELSE found, without preceding IF.");
+                        pErrorLine = p;
+                    }
+                }
+                else
+                {
+                    tIfBlock& ifBlock = IfBlocks.back();
+                    if ( !ifBlock.isDynamic )
+                    {
+                        scriptContext.IfJumpToElse[ifBlock.pBranch] = p;
+                    }
+                    ifBlock.pBranch = p;
+                    ifBlock.Elses.push_back(p);
+                }
+                break;
+
+            case CMDTYPE_ENDIF:
+                if ( IfBlocks.empty() )
+                {
+                    if ( !isDynamic )
+                    {
+                        cszError = _T("- Unexpected ENDIF found, without preceding IF.");
+                        pErrorLine = p;
+                    }
+                }
+                else
+                {
+                    const tIfBlock& ifBlock = IfBlocks.back();
+                    if ( !ifBlock.isDynamic )
+                    {
+                        scriptContext.IfJumpToElse[ifBlock.pBranch] = p;
+                        for ( CListItemT<tstr>* pElse : ifBlock.Elses )
+                        {
+                            scriptContext.IfJumpToEndIf[pElse] = p;
+                        }
+                    }
+                    IfBlocks.pop_back();
+                }
+                break;
+
+            case CMDTYPE_WHILE:
+            case CMDTYPE_FOR:
+                {
+                    tLoopBlock loopBlock;
+                    loopBlock.pBegin = p;
+                    loopBlock.nEndCmdType = (nCmdType == CMDTYPE_WHILE) ? CMDTYPE_ENDWHILE : CMDTYPE_ENDFOR;
+                    LoopBlocks.push_back(loopBlock);
+                }
+                break;
+
+            case CMDTYPE_ENDWHILE:
+            case CMDTYPE_ENDFOR:
+                if ( LoopBlocks.empty() || (LoopBlocks.back().nEndCmdType != nCmdType) )
+                {
+                    if ( !isDynamic )
+                    {
+                        cszError = (nCmdType == CMDTYPE_ENDWHILE) ?
+                          _T("- Unexpected ENDWHILE found, without preceding WHILE.") :
+                          _T("- Unexpected ENDFOR found, without preceding FOR.");
+                        pErrorLine = p;
+                    }
+                }
+                else
+                {
+                    CListItemT<tstr>* pBegin = LoopBlocks.back().pBegin;
+                    scriptContext.LoopJumpToEnd[pBegin] = p;
+                    scriptContext.LoopJumpToBegin[p] = pBegin;
+                    LoopBlocks.pop_back();
+                }
+                break;
+
+            case CMDTYPE_PARALLEL:
+                pParallel = p;
+                break;
+
+            case CMDTYPE_JOIN:
+                cszError = _T("- Unexpected JOIN found, without preceding PARALLEL.");
+                pErrorLine = p;
+                break;
+
+            case CMDTYPE_UNKNOWN:
+                if ( Cmd.StartsWith(_T("$(")) )
+                {
+                    // the command type will be known after the macro-vars substitution,
+                    // so these IF-blocks will be processed line by line
+                    isDynamic = true;
+                    for ( tIfBlock& ifBlock : IfBlocks )
+                    {
+                        ifBlock.isDynamic = true;
+                    }
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    Runtime::GetLogger().Activate(true);
+
+    if ( pParallel && !cszError )
+    {
+        cszError = _T("- PARALLEL found without its JOIN.");
+        pErrorLine = pParallel;
+    }
+
+    if ( cszError )
+    {
+        m_sLoggedCmd.Format( 1020, _T("; checking the script: %.960s"), pErrorLine->GetItem().c_str() );
+        ScriptError( ET_UNPREDICTABLE, cszError );
+        return false;
+    }
+
+    Runtime::GetLogger().AddEx( _T("; script index: %u label(s), %u IF/ELSE jump(s), %u loop(s), %u PARALLEL block(s)"), 
+        (unsigned int) scriptContext.Labels.size(), 
+        (unsigned int) (scriptContext.IfJumpToElse.size() + scriptContext.IfJumpToEndIf.size()),
+        (unsigned int) scriptContext.LoopJumpToEnd.size(),
+        (unsigned int) scriptContext.ParallelJumpToJoin.size() );
+
+    return true;
+}
+
+bool CScriptEngine::jumpToIfTarget(const tIfJumps& ifJumps, const CListItemT<tstr>* pCmdItem)
+{
+    if ( m_execState.pScriptLineNext != INVALID_TSTR_LIST_ITEM )
+        return false; // GOTO or the script is being stopped
+
+    tIfJumps::const_iterator itrJump = ifJumps.find(pCmdItem);
+    if ( itrJump == ifJumps.end() )
+        return false; // the lines will be skipped one by one
+
+    m_execState.SetScriptLineNext(itrJump->second);
+
+    if ( Runtime::GetLogger().IsLogging() )
+    {
+        Runtime::GetLogger().AddEx( _T("; Jumping to command item p = 0x%X { \"%s\" }"),
+            m_execState.pScriptLineNext, m_execState.pScriptLineNext->GetItem().c_str() );
+    }
+
+    return true;
+}
+
+const CScriptEngine::tNppExecArgs& CScriptEngine::getNppExecArgs(const tstr& params)
+{
+    tNppExecArgsCache::iterator itrArgs = m_NppExecArgsCache.find(params);
+    if ( itrArgs != m_NppExecArgsCache.end() )
+        return itrArgs->second;
+
+    if ( m_NppExecArgsCache.size() >= 256 )
+        m_NppExecArgsCache.clear(); // e.g. "npp_exec script $(i)" in a long loop
+
+    tNppExecArgs& nppExecArgs = m_NppExecArgsCache[params];
+    nppExecArgs.Args.SplitToArgs(params);
+    std::shared_ptr<CNppExecMacroVars::tCmdArgValues> pArgValues = std::make_shared<CNppExecMacroVars::tCmdArgValues>();
+    CNppExecMacroVars::PrepareCmdArgValues(nppExecArgs.Args, *pArgValues);
+    nppExecArgs.pArgValues = pArgValues;
+    return nppExecArgs;
+}
+
+bool CScriptEngine::bindCmdArgs(const CListItemT<tstr>* pCmdItem, const ScriptContext& scriptContext, tstr& Cmd)
+{
+    // The line is searched for $(ARGC), $(ARGV) and $(RARGV) once,
+    // then each NPP_EXEC call just fills in its own arguments.
+    // Returns true if Cmd depends on the arguments.
+    tCmdArgsTemplates::const_iterator itrTemplate = m_CmdArgsTemplates.find(pCmdItem);
+    if ( itrTemplate == m_CmdArgsTemplates.end() )
+    {
+        CNppExecMacroVars::tCmdArgsTemplate& cmdTemplate = m_CmdArgsTemplates[pCmdItem];
+        CNppExecMacroVars::CompileCmdArgs(pCmdItem->GetItem(), cmdTemplate);
+        itrTemplate = m_CmdArgsTemplates.find(pCmdItem);
+    }
+
+    const CNppExecMacroVars::tCmdArgsTemplate& cmdTemplate = itrTemplate->second;
+    if ( cmdTemplate.Slots.empty() )
+        return false;
+
+    if ( scriptContext.ArgValues )
+    {
+        CNppExecMacroVars::BindCmdArgs(cmdTemplate, *scriptContext.ArgValues, Cmd);
+    }
+    else
+    {
+        Cmd = pCmdItem->GetItem();
+        CNppExecMacroVars::CheckCmdArgs(Cmd, scriptContext.Args);
+    }
+    return true;
+}
+
+bool CScriptEngine::pushScriptBody(const tstr& scriptName, const PNppScriptBody& pScriptBody, const PNppScriptLineNumbers& pLineNumbers, bool isSharedBody, const tNppExecArgs& nppExecArgs)
+{
+    // The lines are executed right from pScriptBody: nothing is copied
+    // to m_CmdList, the script context just returns to the line after
+    // NPP_EXEC when the body is over.
+    const ScriptContext& parentScript = m_execState.GetCurrentScriptContext();
+    CListItemT<tstr>* pReturnLine = m_execState.pScriptLineCurrent->GetNext();
+    if ( !pReturnLine && parentScript.IsNppExeced )
+    {
+        pReturnLine = parentScript.CmdRange.pEnd; // NPP_EXEC is the last line of the parent body
+    }
+
+    m_execState.ScriptContextList.Add( ScriptContext() );
+
+    ScriptContext& scriptContext = m_execState.GetCurrentScriptContext();
+    scriptContext.ScriptName = scriptName;
+    scriptContext.CmdRange.pBegin = pScriptBody->GetFirst();
+    scriptContext.CmdRange.pEnd = pReturnLine;
+    scriptContext.ScriptBody = pScriptBody;
+    scriptContext.LineNumbers = pLineNumbers;
+    scriptContext.Args = nppExecArgs.Args;
+    scriptContext.ArgValues = nppExecArgs.pArgValues;
+    scriptContext.IsNppExeced = true;
+
+    Runtime::GetLogger().AddEx( _T("; script context added: { Name = \"%s\"; CmdRange = [0x%X, 0x%X) }"), 
+        scriptContext.ScriptName.c_str(), scriptContext.CmdRange.pBegin, scriptContext.CmdRange.pEnd ); 
+
+    if ( isSharedBody )
+    {
+        tScriptBodies::const_iterator itrBody = m_ScriptBodies.find(pScriptBody.get());
+        if ( itrBody != m_ScriptBodies.end() )
+        {
+            const tScriptBodyIndex& bodyIndex = itrBody->second;
+            scriptContext.Labels = bodyIndex.Labels;
+            scriptContext.IfJumpToElse = bodyIndex.IfJumpToElse;
+            scriptContext.IfJumpToEndIf = bodyIndex.IfJumpToEndIf;
+            scriptContext.LoopJumpToEnd = bodyIndex.LoopJumpToEnd;
+            scriptContext.LoopJumpToBegin = bodyIndex.LoopJumpToBegin;
+            scriptContext.ParallelJumpToJoin = bodyIndex.ParallelJumpToJoin;
+
+            Runtime::GetLogger().Add(   _T("; script index: already built") );
+
+            return true;
+        }
+    }
+
+    if ( !buildScriptIndex(scriptContext) )
+        return false;
+
+    if ( isSharedBody )
+    {
+        // the same body is executed again without re-indexing and re-compiling its lines
+        tScriptBodyIndex& bodyIndex = m_ScriptBodies[pScriptBody.get()];
+        bodyIndex.pScriptBody = pScriptBody;
+        bodyIndex.Labels = scriptContext.Labels;
+        bodyIndex.IfJumpToElse = scriptContext.IfJumpToElse;
+        bodyIndex.IfJumpToEndIf = scriptContext.IfJumpToEndIf;
+        bodyIndex.LoopJumpToEnd = scriptContext.LoopJumpToEnd;
+        bodyIndex.LoopJumpToBegin = scriptContext.LoopJumpToBegin;
+        bodyIndex.ParallelJumpToJoin = scriptContext.ParallelJumpToJoin;
+    }
+
+    return true;
+}
+
+void CScriptEngine::popScriptContext()
+{
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+
+    Runtime::GetLogger().AddEx( _T("; script context removed: { Name = \"%s\"; CmdRange = [0x%X, 0x%X) }"), 
+        currentScript.ScriptName.c_str(), currentScript.CmdRange.pBegin, currentScript.CmdRange.pEnd ); 
+
+    if ( currentScript.ScriptBody &&
+         m_ScriptBodies.find(currentScript.ScriptBody.get()) == m_ScriptBodies.end() )
+    {
+        // the body (e.g. loaded from a file) is released together with the context
+        for ( const CListItemT<tstr>* pItem = currentScript.ScriptBody->GetFirst(); pItem; pItem = pItem->GetNext() )
+        {
+            removeCompiledCmd(pItem);
+        }
+    }
+    m_execState.ScriptContextList.DeleteLast();
+
+    Runtime::GetLogger().Add(   _T("") );
+}
+
+CScriptEngine::eCmdType CScriptEngine::modifyCommandLine(CScriptEngine* pScriptEngine, tstr& Cmd, eIfState ifState, const CListItemT<tstr>* pCmdItem)
+{
+    if ( Runtime::GetLogger().IsLogging() )
+    {
+        Runtime::GetLogger().Add(   _T("ModifyCommandLine()") );
+        Runtime::GetLogger().Add(   _T("{") );
+        Runtime::GetLogger().IncIndentLevel();
+        Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), Cmd.c_str() );
+    }
+
+    CNppExec* pNppExec = pScriptEngine->GetNppExec();
+    eCmdType nCmdType = CMDTYPE_UNKNOWN;
+    bool bHasMacroVars = true;
+
+    if ( pCmdItem != NULL )
+    {
+        // Cmd is taken from the compiled pCmdItem
+        nCmdType = pScriptEngine->getCompiledCmd(pCmdItem, Cmd, bHasMacroVars);
+    }
+    else
+    {
+        bool bCacheable = false;
+        nCmdType = compileCommandLine(pNppExec, Cmd, bCacheable, pScriptEngine->GetCmdAliasesSnapshot());
+    }
+
+    if ( nCmdType == CMDTYPE_COMMENT_OR_EMPTY )
+    {
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().Add(   _T("; command argument(s):") );
+            Runtime::GetLogger().AddEx( _T("[out] \"%s\""), Cmd.c_str() );
+            Runtime::GetLogger().Add(   _T("; command type:") );
+            Runtime::GetLogger().AddEx( _T("[ret] %d"), CMDTYPE_COMMENT_OR_EMPTY );
+            Runtime::GetLogger().DecIndentLevel();
+            Runtime::GetLogger().Add(   _T("}") );
+        }
+
+        return CMDTYPE_COMMENT_OR_EMPTY;
+    }
+
+    if ( nCmdType == CMDTYPE_COLLATERAL_FORCED )
+    {
+        Runtime::GetLogger().Add(   _T("; command type:") );
+        Runtime::GetLogger().AddEx( _T("[ret] %d (forced collateral command)"), CMDTYPE_COLLATERAL_FORCED );
+        Runtime::GetLogger().DecIndentLevel();
+        Runtime::GetLogger().Add(   _T("}") );
+
+        return CMDTYPE_COLLATERAL_FORCED;
+    }
+
+    if ( (nCmdType != CMDTYPE_UNKNOWN) && 
+         isSkippingThisCommandDueToIfState(nCmdType, ifState) )
+    {
+        Runtime::GetLogger().DecIndentLevel();
+        Runtime::GetLogger().Add(   _T("}") );
+
+        return nCmdType;
+    }
+
+    if ( Cmd.IsEmpty() || (nCmdType == CMDTYPE_CLS) )
+    {
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().Add(   _T("; no arguments given") );
+            Runtime::GetLogger().Add(   _T("; command argument(s):") );
+            Runtime::GetLogger().AddEx( _T("[out] \"%s\""), Cmd.c_str() );
+            Runtime::GetLogger().Add(   _T("; command type:") );
+            Runtime::GetLogger().AddEx( _T("[ret] 0x%X"), nCmdType );
+            Runtime::GetLogger().DecIndentLevel();
+            Runtime::GetLogger().Add(   _T("}") );
+        }
+      
+        return nCmdType;
+    }
+  
+    if ( (nCmdType != CMDTYPE_SET) &&
+         (nCmdType != CMDTYPE_UNSET) &&
+         (nCmdType != CMDTYPE_NPPSENDMSG) &&
+         (nCmdType != CMDTYPE_NPPSENDMSGEX) &&
+         (nCmdType != CMDTYPE_SCISENDMSG) &&
+         (nCmdType != CMDTYPE_SCIFIND) &&
+         (nCmdType != CMDTYPE_SCIREPLACE) &&
+         (nCmdType != CMDTYPE_NPECMDALIAS) &&
+         (nCmdType != CMDTYPE_NPEQUEUE) &&
+         (nCmdType != CMDTYPE_CONFILTER) &&
+         (nCmdType != CMDTYPE_IF) &&
+         (nCmdType != CMDTYPE_ELSE) &&
+         (nCmdType != CMDTYPE_WHILE) &&
+         (nCmdType != CMDTYPE_FOR) )
+    {
+        // no need to substitute anything when there are no macro-vars
+        if ( bHasMacroVars )
+        {
+            bool bCmdStartsWithMacroVar = Cmd.StartsWith(_T("$("));
+
+            CNppExecMacroVars& MacroVars = pNppExec->GetMacroVars();
+
+            // ... checking script's arguments ...
+            const CStrSplitT<TCHAR> args;
+            MacroVars.CheckCmdArgs(Cmd, args);
+
+            // ... checking all the macro-variables ...
+            MacroVars.CheckAllMacroVars(pScriptEngine, Cmd, true);
+        
+            if ( bCmdStartsWithMacroVar && (nCmdType == CMDTYPE_UNKNOWN) )
+            {
+                // re-check nCmdType after macro-var substitution
+                nCmdType = getCmdType(pNppExec, Cmd, ctfUseLogging, pScriptEngine->GetCmdAliasesSnapshot());
+                if ( nCmdType == CMDTYPE_COLLATERAL_FORCED )
+                {
+                    Runtime::GetLogger().Add(   _T("; it\'s a forced collateral command") );
+                    Runtime::GetLogger().Add(   _T("; command type:") );
+                    Runtime::GetLogger().AddEx( _T("[ret] %d (forced collateral command)"), CMDTYPE_COLLATERAL_FORCED );
+                    Runtime::GetLogger().DecIndentLevel();
+                    Runtime::GetLogger().Add(   _T("}") );
+
+                    return CMDTYPE_COLLATERAL_FORCED;
+                }
+            
+                if ( nCmdType != CMDTYPE_UNKNOWN )
+                {
+                    NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
+                }
+            }
+        }
+
+        if ( isSkippingThisCommandDueToIfState(nCmdType, ifState) )
+        {
+            Runtime::GetLogger().DecIndentLevel();
+            Runtime::GetLogger().Add(   _T("}") );
+
+            return nCmdType;
+        }
+    }
+    // we have to process macro-vars inside doSendMsg()
+    // because macro-var's string may contain double-quotes;
+    // the operands of IF/ELSE IF/WHILE conditions are substituted
+    // inside isConditionTrue()
+  
+    // ... do we need "" around the command's argument? ...
+    
+    bool bDone = false;
+    if ( (nCmdType == CMDTYPE_SET) ||
+         (nCmdType == CMDTYPE_UNSET) ||
+         (nCmdType == CMDTYPE_NPECMDALIAS) ||
+         (nCmdType == CMDTYPE_NPPSENDMSG) ||
+         (nCmdType == CMDTYPE_NPPSENDMSGEX) || 
+         (nCmdType == CMDTYPE_SCISENDMSG) ||
+         (nCmdType == CMDTYPE_SCIFIND) ||
+         (nCmdType == CMDTYPE_SCIREPLACE) ||
+         (nCmdType == CMDTYPE_CONCOLOUR) ||
+         (nCmdType == CMDTYPE_CONFILTER) ||
+         (nCmdType == CMDTYPE_IF) || 
+         (nCmdType == CMDTYPE_GOTO) || 
+         (nCmdType == CMDTYPE_ELSE) ||
+         (nCmdType == CMDTYPE_WHILE) ||
+         (nCmdType == CMDTYPE_FOR) ||
+         (nCmdType == CMDTYPE_SLEEP) ||
+         (nCmdType == CMDTYPE_NPEQUEUE) )
+    {
+        bDone = true;
+    }
+    else if ( (nCmdType != 0) &&
+              (nCmdType != CMDTYPE_NPPRUN) &&
+              (nCmdType != CMDTYPE_NPPEXEC) &&
+              (nCmdType != CMDTYPE_ECHO) &&
+              (nCmdType != CMDTYPE_SELSAVETO) &&
+              (nCmdType != CMDTYPE_INPUTBOX) &&
+              (nCmdType != CMDTYPE_MESSAGEBOX) )
+    {
+        NppExecHelpers::StrUnquote(Cmd);
+
+        bDone = true; // we don't need '\"' in file_name
+    }
+
+    // ... adding '\"' to the command if it's needed ...
+    if ( !bDone )
+    {
+        bool bHasSpaces = false;
+        // disabled by default  because of problems 
+        // for executables without extension i.e. 
+        // "cmd /c app.exe"  <-- "cmd" is without extension
+        if (pNppExec->GetOptions().GetBool(OPTB_PATH_AUTODBLQUOTES))
+        {
+            if (!bDone && (Cmd.GetAt(0) != _T('\"')))
+            {
+                int i = 0;
+                int j = 0;
+                while (!bDone && (i < Cmd.length()))
+                {
+                    if (Cmd[i] == _T(' '))
+                    {
+                        bHasSpaces = true;
+                        j = i - 1;
+                        while (!bDone && j >= 0)
+                        {
+                            const TCHAR ch = Cmd[j];
+                            if (ch == _T('.'))
+                            {
+                                Cmd.Insert(i, _T('\"'));
+                                Cmd.Insert(0, _T('\"'));
+                                bDone = true;
+                            }
+                            else if (ch == _T('\\') || ch == _T('/'))
+                            {
+                                j = 0; // j-- makes j<0 so this loop is over
+                            }
+                            j--;
+                        }
+                    }
+                    i++;
+                }
+            }
+        }
+    }
+    
+    if ( Runtime::GetLogger().IsLogging() )
+    {
+        Runtime::GetLogger().Add(   _T("; command argument(s):") );
+        Runtime::GetLogger().AddEx( _T("[out] \"%s\""), Cmd.c_str() );
+        Runtime::GetLogger().Add(   _T("; command type:") );
+        Runtime::GetLogger().AddEx( _T("[ret] 0x%X"), nCmdType );
+        Runtime::GetLogger().DecIndentLevel();
+        Runtime::GetLogger().Add(   _T("}") );
+    }
+
+    return nCmdType;
+}
+
+int CScriptEngine::getOnOffParam(const tstr& param)
+{
+    if ( param.IsEmpty() )
+        return PARAM_EMPTY; // no param
+    
+    if ( param == _T("1") )
+        return PARAM_ON;
+
+    if ( param == _T("0") )
+        return PARAM_OFF;
+
+    if ( param == _T("?") )
+        return PARAM_KEEP;
+
+    if ( param == _T("+") )
+        return PARAM_ENABLE;
+
+    if ( param == _T("-") )
+        return PARAM_DISABLE;
+
+    tstr S = param;
+    NppExecHelpers::StrUpper(S);
+
+    if ( (S == _T("ON")) || (S == _T("TRUE")) )
+        return PARAM_ON;
+
+    if ( (S == _T("OFF")) || (S == _T("FALSE")) )
+        return PARAM_OFF;
+
+    if ( S == _T("KEEP") )
+        return PARAM_KEEP;
+
+    if ( S == _T("ENABLE") )
+        return PARAM_ENABLE;
+
+    if ( S == _T("DISABLE") )
+        return PARAM_DISABLE;
+
+    return PARAM_UNKNOWN; // unknown
+}
+
+bool CScriptEngine::isCommentOrEmpty(CNppExec* pNppExec, tstr& Cmd)
+{
+    const tstr comment = pNppExec->GetOptions().GetStr(OPTS_COMMENTDELIMITER);
+    if (comment.length() > 0)
+    {
+        int i = Cmd.Find(comment.c_str()); // comment
+        if ((i >= 0) && 
+            ((comment != _T("//")) || (Cmd.GetAt(i-1) != _T(':')))) // skip :// e.g. http://
+        {
+            Cmd.Delete(i, -1); // delete all after "//"
+
+            if ( Runtime::GetLogger().IsLogging() )
+            {
+                Runtime::GetLogger().AddEx( _T("; comment removed: everything after %s"), comment.c_str() );
+            }
+
+        }
+    }
+  
+    NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
+    NppExecHelpers::StrDelTrailingTabSpaces(Cmd);
+
+    return Cmd.IsEmpty();
+}
+
+void CScriptEngine::errorCmdNotEnoughParams(const TCHAR* cszCmd, const TCHAR* cszErrorMessage)
+{
+    if ( cszErrorMessage )
+        Runtime::GetLogger().AddEx( _T("; %s"), cszErrorMessage );
+    else
+        Runtime::GetLogger().Add(   _T("; argument(s) expected, but none given") );
+
+    tstr Cmd = cszCmd;
+    tstr Err = Cmd;
+    Err += _T(':');
+    m_pNppExec->GetConsole().PrintMessage( Err.c_str(), false );
+    NppExecHelpers::StrLower(Cmd);
+    Err.Format( 250, _T("- %s; type \"help %s\" for help"), cszErrorMessage ? cszErrorMessage : _T("empty command (no parameters given)"), Cmd.c_str() );
+    m_pNppExec->GetConsole().PrintError( Err.c_str() );
+
+    m_nCmdType = CMDTYPE_UNKNOWN;
+}
+
+void CScriptEngine::errorCmdNoParam(const TCHAR* cszCmd)
+{
+    errorCmdNotEnoughParams(cszCmd, NULL);
+}
+
+void CScriptEngine::messageConsole(const TCHAR* cszCmd, const TCHAR* cszParams)
+{
+    tstr S = cszCmd;
+    S += _T(": ");
+    S += cszParams;
+    m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+}
+
+bool CScriptEngine::reportCmdAndParams(const TCHAR* cszCmd, const tstr& params, unsigned int uFlags)
+{
+    if ( params.IsEmpty() )
+    {
+        if ( uFlags & fReportEmptyParam )
+            errorCmdNoParam(cszCmd);
+
+        if ( uFlags & fFailIfEmptyParam )
+            return false;
+    
+        Runtime::GetLogger().AddEx( _T("; executing: %s"), cszCmd );
+        m_sLoggedCmd.Format( 1020, _T("; executing: %.960s"), cszCmd );
+    }
+    else
+    {
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( _T("; executing: %s %s"), cszCmd, params.c_str() );
+        }
+        m_sLoggedCmd.Format( 1020, _T("; executing: %.480s %.480s"), cszCmd, params.c_str() );
+    }
+
+    if ( uFlags & fMessageToConsole )
+    {
+        if ( params.length() > MAX_VAR_LENGTH2SHOW )
+        {
+            tstr S;
+
+            S.Append( params.c_str(), MAX_VAR_LENGTH2SHOW - 5 );
+            S += _T("(...)");
+            messageConsole( cszCmd, S.c_str() );
+        }
+        else
+        {
+            if ( params.IsEmpty() )
+                m_pNppExec->GetConsole().PrintMessage( cszCmd );
+            else
+                messageConsole( cszCmd, params.c_str() );
+        }
+    }
+
+    return true;
+}
+
+void CScriptEngine::updateFocus()
+{
+    if ( (!m_pNppExec->m_hFocusedWindowBeforeScriptStarted) ||
+         (m_pNppExec->m_hFocusedWindowBeforeScriptStarted == m_pNppExec->GetConsole().GetConsoleWnd()) ||
+         (m_pNppExec->m_hFocusedWindowBeforeScriptStarted == m_pNppExec->GetConsole().GetDialogWnd()) ||
+         (m_pNppExec->m_hFocusedWindowBeforeScriptStarted == m_pNppExec->GetScintillaHandle()) )
+    {
+        ::SendMessage( m_pNppExec->GetScintillaHandle(), WM_SETFOCUS, 0, 0 );
+        m_pNppExec->m_hFocusedWindowBeforeScriptStarted = m_pNppExec->GetScintillaHandle();
+    }
+}
+
+CScriptEngine::eCmdResult CScriptEngine::Do(const tstr& params)
+{
+    if ( params.IsEmpty() )
+    {
+        return CMDRESULT_INVALIDPARAM;
+    }
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+    Runtime::GetLogger().AddEx( _T("; about to start a child process: \"%s\""), params.c_str() );
+    m_sLoggedCmd.Format( 1020, _T("; about to start a child process: \"%.960s\""), params.c_str() );
+
+    m_pNppExec->GetConsole().PrintMessage( params.c_str() );
+
+    std::shared_ptr<CChildProcess> proc(new CChildProcess(this));
+    m_execState.pChildProcess = proc;
+    {
+        CProfileScope profileScope(pcChildProcess);
+
+        // Note: proc->Create() does not return until the child process exits
+        if ( proc->Create(m_pNppExec->GetConsole().GetDialogWnd(), params.c_str()) )
+        {
+            Runtime::GetLogger().Add(   _T("; child process finished") );
+        }
+        else
+        {
+            Runtime::GetLogger().Add(   _T("; failed to start a child process") );
+
+            nCmdResult = CMDRESULT_FAILED;
+        }
+    }
+
+    TCHAR szExitCode[50];
+    c_base::_tint2str(proc->GetExitCode(), szExitCode);
+
+    tstr varName = MACRO_EXITCODE;
+    m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, szExitCode, CNppExecMacroVars::svLocalVar ); // local var
+
+    if ( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_SETOUTPUTVAR) )
+    {
+        tstr& OutputVar = proc->GetOutput();
+        if ( OutputVar.GetLastChar() == _T('\n') )
+            OutputVar.SetSize(OutputVar.length() - 1);
+        if ( OutputVar.GetFirstChar() == _T('\n') )
+            OutputVar.Delete(0, 1);
+        
+        // $(OUTPUTL)
+        varName = MACRO_OUTPUTL;
+
+        int i = OutputVar.RFind( _T('\n') );
+        if ( i >= 0 )
+        {
+            tstr varValue;
+
+            ++i;
+            varValue.Copy( OutputVar.c_str() + i, OutputVar.length() - i );
+            m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, varValue, CNppExecMacroVars::svLocalVar ); // local var
+        }
+        else
+            m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, OutputVar, CNppExecMacroVars::svLocalVar ); // local var
+
+        // $(OUTPUT1)
+        varName = MACRO_OUTPUT1;
+
+        i = OutputVar.Find( _T('\n') );
+        if ( i >= 0 )
+        {
+            tstr varValue;
+
+            varValue.Copy( OutputVar.c_str(), i );
+            m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, varValue, CNppExecMacroVars::svLocalVar ); // local var
+        }
+        else
+            m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, OutputVar, CNppExecMacroVars::svLocalVar ); // local var
+
+        // $(OUTPUT) - the last one, as OutputVar is moved to it (the output may be huge)
+        varName = MACRO_OUTPUT;
+        m_pNppExec->GetMacroVars().MoveToUserMacroVar( this, varName, OutputVar, CNppExecMacroVars::svLocalVar ); // local var
+    }
+
+    m_execState.pChildProcess.reset();
+
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoCd(const tstr& params)
+{
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    TCHAR szPath[FILEPATH_BUFSIZE];
+
+    reportCmdAndParams( DoCdCommand::Name(), params, fMessageToConsole );
+
+    // changing current directory
+
+    if ( params.length() > 0 )
+    {
+        if ( ((params[0] == _T('\\')) && (params.GetAt(1) != _T('\\'))) || 
+            ((params[0] == _T('/')) && (params.GetAt(1) != _T('/'))) )
+        {
+            // root directory of current drive e.g. 'C:\', 'D:\' etc.
+            GetCurrentDirectory( FILEPATH_BUFSIZE - 1, szPath );
+            if ( szPath[1] == _T(':') )
+            {
+                szPath[2] = _T('\\');
+                szPath[3] = 0;
+              
+                Runtime::GetLogger().AddEx( _T("; changed to \"%s%s\""), szPath, params.c_str() + 1 );
+              
+                nCmdResult = SetCurrentDirectory( szPath ) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
+                if ( params[1] )
+                {
+                    nCmdResult = SetCurrentDirectory( params.c_str() + 1 ) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
+                }
+            }
+        }
+        else
+        {
+            int ofs = 0;
+
+            if ( (params[1] == _T(':')) && 
+                 (params[2] == _T('\\') || params[2] == _T('/')) && 
+                 (params[3] != 0) )
+            {
+                // changing the drive
+                szPath[0] = params[0];
+                szPath[1] = params[1];
+                szPath[2] = 0;
+                nCmdResult = SetCurrentDirectory( szPath ) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
+                ofs = 2;
+            }
+            if ( nCmdResult == CMDRESULT_SUCCEEDED ) // the same drive or successfully changed
+            {
+                // set current directory
+                nCmdResult = SetCurrentDirectory( params.c_str() + ofs ) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
+                if ( nCmdResult == CMDRESULT_FAILED )
+                {
+                    // trying to set the parent directory at least...
+                    // (and nCmdResult is still CMDRESULT_FAILED)
+                    for ( int i = params.length() - 1; i > ofs; i-- )
+                    {
+                        if ( params[i] == _T('\\') || params[i] == _T('/') )
+                        {
+                            lstrcpyn( szPath, params.c_str() + ofs, i - ofs + 1 );
+                            szPath[i - ofs + 1] = 0;
+                            SetCurrentDirectory( szPath );
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    GetCurrentDirectory( FILEPATH_BUFSIZE - 1, szPath );
+    tstr S = _T("Current directory: ");
+    S += szPath;
+    m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoCls(const tstr& /*params*/)
+{
+    m_pNppExec->GetConsole().ClearText();
+
+    return CMDRESULT_SUCCEEDED;
+}
+
+static BOOL getColorFromStr(const TCHAR* szColor, COLORREF* pColor)
+{
+    if ( szColor && *szColor )
+    {
+        c_base::byte_t bt[4];
+
+        int n = c_base::_thexstr2buf( szColor, bt, 4 );
+        if ( n >= 3 )
+        {
+            *pColor = RGB( bt[0], bt[1], bt[2] );
+            return TRUE;
+        }
+
+        if ( n <= 1 )
+        {
+            if ( szColor[0] == _T('0') && szColor[1] == 0 )
+            {
+                *pColor = 0; // handle "0" as correct default value
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoConColour(const tstr& params)
+{
+    reportCmdAndParams( DoConColourCommand::Name(), params, fMessageToConsole );
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+    if ( params.length() > 0 )
+    {
+        tstr colorParams = params;
+        NppExecHelpers::StrUpper(colorParams);
+
+        const int posFG = colorParams.Find(_T("FG"));
+        const int posBG = colorParams.Find(_T("BG"));
+
+        if ( posFG >= 0 )
+        {
+            tstr colorFG;
+            int n = (posBG > posFG) ? (posBG - posFG) : (colorParams.length() - posFG);
+            
+            colorFG.Append(colorParams.c_str() + posFG, n);
+            n = colorFG.Find(_T('='));
+            if ( n >= 0 )
+            {
+                COLORREF color;
+
+                colorFG.Delete(0, n + 1);
+                NppExecHelpers::StrDelLeadingTabSpaces(colorFG);
+                NppExecHelpers::StrDelTrailingTabSpaces(colorFG);
+                if ( (!colorFG.IsEmpty()) && getColorFromStr(colorFG.c_str(), &color) )
+                {
+                    m_pNppExec->GetConsole().SetCurrentColorTextNorm(color);
+                }
+                else
+                {
+                    ScriptError( ET_REPORT, _T("- incorrect value of \'FG\'") );
+                    nCmdResult = CMDRESULT_INVALIDPARAM;
+                }
+            }
+            else
+            {
+                ScriptError( ET_REPORT, _T("- \'FG\' found, but no value specified") );
+                nCmdResult = CMDRESULT_INVALIDPARAM;
+            }
+        }
+
+        if ( posBG >= 0 )
+        {
+            tstr colorBG;
+            int n = (posFG > posBG) ? (posFG - posBG) : (colorParams.length() - posBG);
+
+            colorBG.Append(colorParams.c_str() + posBG, n);
+            n = colorBG.Find(_T('='));
+            if ( n >= 0 )
+            {
+                COLORREF color;
+
+                colorBG.Delete(0, n + 1);
+                NppExecHelpers::StrDelLeadingTabSpaces(colorBG);
+                NppExecHelpers::StrDelTrailingTabSpaces(colorBG);
+                if ( (!colorBG.IsEmpty()) && getColorFromStr(colorBG.c_str(), &color) )
+                {
+                    m_pNppExec->GetConsole().SetCurrentColorBkgnd(color);
+                    m_pNppExec->GetConsole().UpdateColours();
+                }
+                else
+                {
+                    ScriptError( ET_REPORT, _T("- incorrect value of \'BG\'") );
+                    nCmdResult = CMDRESULT_INVALIDPARAM;
+                }
+            }
+            else
+            {
+                ScriptError( ET_REPORT, _T("- \'BG\' found, but no value specified") );
+                nCmdResult = CMDRESULT_INVALIDPARAM;
+            }
+        }
+
+        if ( (posFG < 0) && (posBG < 0) )
+        {
+            tstr Err = _T("- unknown parameter: ");
+            Err += params;
+            ScriptError( ET_REPORT, Err.c_str() );
+            nCmdResult = CMDRESULT_INVALIDPARAM;
+        }
+    }
+    else
+    {
+        tstr S;
+        TCHAR buf[16];
+        COLORREF color;
+
+        color = m_pNppExec->GetConsole().GetCurrentColorTextNorm();
+        buf[0] = 0;
+        c_base::_tbuf2hexstr( (const c_base::byte_t*) &color, 3, buf, 16, _T(" ") );
+        S = _T("Foreground (text) colour:  ");
+        S += buf;
+        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+
+        color = m_pNppExec->GetConsole().GetCurrentColorBkgnd();
+        buf[0] = 0;
+        c_base::_tbuf2hexstr( (const c_base::byte_t*) &color, 3, buf, 16, _T(" ") );
+        S = _T("Background colour:         ");
+        S += buf;
+        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+    }
+
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoConFilter(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoConFilterCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    // +(-)i1..5    Include
+    // +(-)x1..5    eXclude
+    // +(-)fr1..4   Find+Replace (case-insensitive)
+    // +(-)frc1..4  Find+Replace (match case)
+    // +(-)h1..10   Highlight
+
+    enum eOptionState {
+        stateUnknown = 0,
+        stateOn,
+        stateOff
+    };
+
+    enum eOptionType {
+        typeUnknown = 0,
+        typeInclude,
+        typeExclude,
+        typeFindReplaceIgnoreCase,
+        typeFindReplaceMatchCase,
+        typeHighlight
+    };
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    bool isHighlightChanged = false;
+
+    tstr sOption;
+    CStrSplitT<TCHAR> args;
+    const int n = args.SplitToArgs(params);
+    for ( int i = 0; i < n; i++ )
+    {
+        sOption = args.GetArg(i);
+        NppExecHelpers::StrUpper(sOption);
+
+        bool bWrongIndex = false;
+        eOptionType type = typeUnknown;
+        eOptionState state = stateUnknown;
+        if ( sOption.GetAt(0) == _T('+') )
+            state = stateOn;
+        else if ( sOption.GetAt(0) == _T('-') )
+            state = stateOff;
+
+        if ( state != stateUnknown )
+        {
+            switch ( sOption.GetAt(1) )
+            {
+                case _T('I'):
+                    type = typeInclude;
+                    break;
+                case _T('X'):
+                    type = typeExclude;
+                    break;
+                case _T('F'):
+                    if ( sOption.GetAt(2) == _T('R') )
+                    {
+                        if ( sOption.GetAt(3) == _T('C') )
+                            type = typeFindReplaceMatchCase;
+                        else
+                            type = typeFindReplaceIgnoreCase;
+                    }
+                    break;
+                case _T('H'):
+                    type = typeHighlight;
+                    break;
+            }
 
-CScriptEngine::CScriptEngine(CNppExec* pNppExec, const CListT<tstr>& CmdList, const tstr& id)
-{
-    m_strInstance = NppExecHelpers::GetInstanceAsString(this);
+            if ( type != typeUnknown )
+            {
+                const TCHAR* pIndex = sOption.c_str();
+                if ( type == typeFindReplaceMatchCase )
+                    pIndex += 4; // skip "+FRC"
+                else if ( type == typeFindReplaceIgnoreCase )
+                    pIndex += 3; // skip "+FR"
+                else
+                    pIndex += 2; // skip "+I" or "+X" or "+H"
 
-    m_pNppExec = pNppExec;
-    m_CmdList.Copy(CmdList); // own m_CmdList
-    m_id = id;
+                const int nIndex = c_base::_tstr2int(pIndex) - 1;
+                const bool bEnable = (state == stateOn) ? true : false;
+                switch ( type )
+                {
+                    case typeInclude:
+                        if ( nIndex >= 0 && nIndex < CConsoleOutputFilterDlg::FILTER_ITEMS )
+                        {
+                            const int nIndexMask = (0x01 << nIndex);
+                            int nConFltrInclMask = m_pNppExec->GetOptions().GetInt(OPTI_CONFLTR_INCLMASK);
+                            nConFltrInclMask |= nIndexMask;
+                            if ( !bEnable )  nConFltrInclMask ^= nIndexMask;
+                            m_pNppExec->GetOptions().SetInt(OPTI_CONFLTR_INCLMASK, nConFltrInclMask);
+                            if ( bEnable )  m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_ENABLE, true);
+                        }
+                        else
+                        {
+                            bWrongIndex = true;
+                        }
+                        break;
+                    case typeExclude:
+                        if ( nIndex >= 0 && nIndex < CConsoleOutputFilterDlg::FILTER_ITEMS )
+                        {
+                            const int nIndexMask = (0x01 << nIndex);
+                            int nConFltrExclMask = m_pNppExec->GetOptions().GetInt(OPTI_CONFLTR_EXCLMASK);
+                            nConFltrExclMask |= nIndexMask;
+                            if ( !bEnable )  nConFltrExclMask ^= nIndexMask;
+                            m_pNppExec->GetOptions().SetInt(OPTI_CONFLTR_EXCLMASK, nConFltrExclMask);
+                            if ( bEnable )  m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_ENABLE, true);
+                        }
+                        else
+                        {
+                            bWrongIndex = true;
+                        }
+                        break;
+                    case typeFindReplaceIgnoreCase:
+                    case typeFindReplaceMatchCase:
+                        if ( nIndex >= 0 && nIndex < CConsoleOutputFilterDlg::REPLACE_ITEMS )
+                        {
+                            const int nIndexMask = (0x01 << nIndex);
+                            const bool bMatchCase = (type == typeFindReplaceMatchCase) ? true : false;
+                            int nRplcFltrFindMask = m_pNppExec->GetOptions().GetInt(OPTI_CONFLTR_R_FINDMASK);
+                            nRplcFltrFindMask |= nIndexMask;
+                            if ( !bEnable )  nRplcFltrFindMask ^= nIndexMask;
+                            m_pNppExec->GetOptions().SetInt(OPTI_CONFLTR_R_FINDMASK, nRplcFltrFindMask);
+                            int nRplcFltrCaseMask = m_pNppExec->GetOptions().GetInt(OPTI_CONFLTR_R_CASEMASK);
+                            nRplcFltrCaseMask |= nIndexMask;
+                            if ( !bMatchCase )  nRplcFltrCaseMask ^= nIndexMask;
+                            m_pNppExec->GetOptions().SetInt(OPTI_CONFLTR_R_CASEMASK, nRplcFltrCaseMask);
+                            if ( bEnable )  m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_R_ENABLE, true);
+                        }
+                        else
+                        {
+                            bWrongIndex = true;
+                        }
+                        break;
+                    case typeHighlight:
+                        if ( nIndex >= 0 && nIndex < CConsoleOutputFilterDlg::RECOGNITION_ITEMS )
+                        {
+                            m_pNppExec->GetWarningAnalyzer().EnableEffect(nIndex, bEnable);
+                            isHighlightChanged = true;
+                        }
+                        else
+                        {
+                            bWrongIndex = true;
+                        }
+                        break;
+                }
+            }
+        }
+        
+        if ( state == stateUnknown || type == typeUnknown )
+        {
+            tstr Err = _T("- unknown option: ");
+            Err += sOption;
+            ScriptError( ET_REPORT, Err.c_str() );
+            nCmdResult = CMDRESULT_INVALIDPARAM;
+        }
+        else if ( bWrongIndex )
+        {
+            tstr Err = _T("- wrong index: ");
+            Err += sOption;
+            ScriptError( ET_REPORT, Err.c_str() );
+            nCmdResult = CMDRESULT_INVALIDPARAM;
+        }
+    }
 
-    m_nCmdType = CMDTYPE_UNKNOWN;
-    m_nRunFlags = 0;
-    m_dwThreadId = 0;
-    m_bTriedExitCmd = false;
-    m_isClosingConsole = false;
+    if ( isHighlightChanged )
+    {
+        m_pNppExec->UpdateGoToErrorMenuItem();
+    }
 
-    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine - create (instance = %s)"), GetInstanceStr() );
+    return nCmdResult;
 }
 
-CScriptEngine::~CScriptEngine()
+CScriptEngine::eCmdResult CScriptEngine::DoConLoadFrom(const tstr& params)
 {
-    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine - destroy (instance = %s)"), GetInstanceStr() );
+    if ( !reportCmdAndParams( DoConLoadFromCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nBytes = m_pNppExec->conLoadFrom(params.c_str());
+    if ( nBytes < 0 )
+    {
+        ScriptError( ET_REPORT, _T("- can not open the file") );
+        nCmdResult = CMDRESULT_FAILED;
+    }
+
+    return nCmdResult;
 }
 
-const TCHAR* CScriptEngine::GetInstanceStr() const
+CScriptEngine::eCmdResult CScriptEngine::DoConSaveTo(const tstr& params)
 {
-    return m_strInstance.c_str();
-}
+    if ( !reportCmdAndParams( DoConSaveToCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
+        
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    tstr S;
+    int  nBytes = m_pNppExec->conSaveTo(params.c_str());
+    if ( nBytes >= 0 )
+      S.Format(120, _T("- OK, %d bytes have been written to \""), nBytes);
+    else
+      S = _T("- failed to write to \"");
+    S += params;
+    S += _T("\"");
+    if ( nBytes >= 0 )
+    {
+        m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+    }
+    else
+    {
+        ScriptError( ET_REPORT, S.c_str() );
+        nCmdResult = CMDRESULT_FAILED;
+    }
 
-#define INVALID_TSTR_LIST_ITEM ((CListItemT<tstr>*)(-1))
+    return nCmdResult;
+}
 
-void CScriptEngine::Run(unsigned int nRunFlags)
+CScriptEngine::eCmdResult CScriptEngine::DoDir(const tstr& params)
 {
-    m_nRunFlags = nRunFlags;
-    m_dwThreadId = ::GetCurrentThreadId();
-    m_bTriedExitCmd = false;
-    m_isClosingConsole = false;
+    const TCHAR* cszPathAndFilter = params.IsEmpty() ? _T("*") : params.c_str();
+    reportCmdAndParams( DoDirCommand::Name(), cszPathAndFilter, fMessageToConsole );
 
-    if ( m_eventRunIsDone.IsNull() )
-        m_eventRunIsDone.Create(NULL, TRUE, FALSE, NULL); // manual reset, non-signaled
-    else
-        m_eventRunIsDone.Reset();
+    tstr Path;
+    tstr Filter;
+    int  nFilterPos = FileFilterPos( cszPathAndFilter );
+    
+    GetPathAndFilter( cszPathAndFilter, nFilterPos, Path, Filter );
 
-    if ( m_eventAbortTheScript.IsNull() )
-        m_eventAbortTheScript.Create(NULL, TRUE, FALSE, NULL); // manual reset, non-signaled
-    else
-        m_eventAbortTheScript.Reset();
+    Runtime::GetLogger().AddEx( _T("; searching \"%s\" for \"%s\""), Path.c_str(), Filter.c_str() );
 
-    m_pNppExec->GetConsole().OnScriptEngineStarted();
+    return ( PrintDirContent(m_pNppExec, Path.c_str(), Filter.c_str()) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED );
+}
 
-    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::Run - start (instance = %s)"), GetInstanceStr() );
+CScriptEngine::eCmdResult CScriptEngine::DoEcho(const tstr& params)
+{
+    reportCmdAndParams( DoEchoCommand::Name(), params, 0 );
+     
+    m_pNppExec->GetConsole().PrintMessage( params.c_str(), false );
 
-    tstr S;
-    bool isNppExec = false;
-    bool isFirstCmd = true;
+    return CMDRESULT_SUCCEEDED;
+}
 
-    m_execState.nExecCounter = 0;
-    m_execState.nExecMaxCount = m_pNppExec->GetOptions().GetInt(OPTI_EXEC_MAXCOUNT);
-    m_execState.nGoToCounter = 0;
-    m_execState.nGoToMaxCount = m_pNppExec->GetOptions().GetInt(OPTI_GOTO_MAXCOUNT);
-    m_execState.pScriptLineCurrent = NULL;
-    m_execState.SetScriptLineNext(INVALID_TSTR_LIST_ITEM);
-    m_execState.pChildProcess.reset();
+CScriptEngine::eCmdResult CScriptEngine::DoElse(const tstr& params)
+{
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    const eIfState ifState = currentScript.GetIfState();
 
-    m_execState.ScriptContextList.Add( ScriptContext() );
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    unsigned int uFlags = 0;
+    if ( ifState == IF_NONE || ifState == IF_WANT_ELSE || ifState == IF_MAYBE_ELSE )
+        uFlags |= fMessageToConsole;
+    reportCmdAndParams( DoElseCommand::Name(), params, uFlags );
+    
+    if ( ifState == IF_NONE )
     {
-        ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-        currentScript.CmdRange.pBegin = m_CmdList.GetFirst();
-        currentScript.CmdRange.pEnd = 0;
-        currentScript.IsNppExeced = false;
-        if ( m_nRunFlags & rfShareLocalVars )
-        {
-            if ( m_pParentScriptEngine )
-            {
-                // inheriting parent script's local variables
-                CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
-                currentScript.LocalMacroVars = m_pParentScriptEngine->GetExecState().GetCurrentScriptContext().LocalMacroVars;
-                // We could use swap() instead of copying here, but if something
-                // goes wrong in that case we risk to end with empty local vars
-                // in the parent script. So copying is safer.
-            }
-        }
-        else if ( m_nRunFlags & rfConsoleLocalVarsRead )
-        {
-            // inheriting Console's local variables
-            CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
-            currentScript.LocalMacroVars = m_pNppExec->GetMacroVars().GetUserConsoleMacroVars();
-        }
-        if ( ((m_nRunFlags & rfShareConsoleState) != 0) || 
-             (!m_pParentScriptEngine) || (!m_pParentScriptEngine->IsCollateral()) )
-        {
-            // inheriting Console's enabled state
-            CNppExecConsole& Console = m_pNppExec->GetConsole();
-            DWORD scrptEngnId = 0;
-            if ( ((m_nRunFlags & rfConsoleLocalVars) == 0) && m_pParentScriptEngine )
-                scrptEngnId = m_pParentScriptEngine->GetThreadId();
-            int nEnabled = Console.GetOutputEnabledDirectly(scrptEngnId);
-            Console.SetOutputEnabledDirectly(m_dwThreadId, nEnabled);
-        }
+        ScriptError( ET_UNPREDICTABLE, _T("- Unexpected ELSE found, without preceding IF.") );
+        nCmdResult = CMDRESULT_FAILED;
     }
-
-    CListItemT<tstr>* p = m_CmdList.GetFirst();
-    while ( p && ContinueExecution() )
+    else if ( ifState == IF_EXECUTING )
     {
-        eCmdType nCmdType = CMDTYPE_COMMENT_OR_EMPTY;
-
-        m_execState.pScriptLineCurrent = p;
-        m_execState.SetScriptLineNext(INVALID_TSTR_LIST_ITEM);
+        Runtime::GetLogger().Add(   _T("; IF ... ELSE found, skipping everything up to ENDIF") );
 
-        S = p->GetItem();
+        currentScript.SetIfState(IF_WANT_ENDIF);
+    }
+    else if ( ifState == IF_WANT_ELSE || ifState == IF_MAYBE_ELSE )
+    {
+        Runtime::GetLogger().Add( _T("; ELSE found") );
 
-        if ( S.length() > 0 )
+        if ( params.IsEmpty() )
+        {
+            // ELSE without condition
+            currentScript.SetIfState(IF_EXECUTING);
+        }
+        else
         {
+            // ELSE with condition
+            tstr paramsUpperCase = params;
+            NppExecHelpers::StrUpper(paramsUpperCase);
+
+            static const TCHAR* arrIf[] = {
+                _T("IF "),
+                _T("IF\t"),
+            };
 
-            if ( (m_nRunFlags & rfCollateralScript) == 0 )
+            int n = -1;
+            for ( const TCHAR* const& i : arrIf )
             {
-                Runtime::GetLogger().Clear();
+                n = paramsUpperCase.RFind(i);
+                if ( n >= 0 )
+                    break;
             }
-            Runtime::GetLogger().Add(   _T("; command info") );
-            Runtime::GetLogger().AddEx( _T("Current command item:  p = 0x%X"), p );
-            Runtime::GetLogger().Add(   _T("{") );
-            Runtime::GetLogger().IncIndentLevel();
-            Runtime::GetLogger().AddEx( _T("_item  = \"%s\""), p->GetItem().c_str() );
-            Runtime::GetLogger().AddEx( _T("_prev  = 0x%X"), p->GetPrev() );
-            if ( p->GetPrev() )
+
+            if ( n < 0 )
             {
-                const CListItemT<tstr>* pPrev = p->GetPrev();
-                Runtime::GetLogger().Add(   _T("{") );
-                Runtime::GetLogger().IncIndentLevel();
-                Runtime::GetLogger().AddEx( _T("_item = \"%s\""), pPrev->GetItem().c_str() );
-                Runtime::GetLogger().AddEx( _T("_prev = 0x%X;  _next = 0x%X;  _owner = 0x%X"), 
-                    pPrev->GetPrev(), pPrev->GetNext(), pPrev->GetOwner() );
-                Runtime::GetLogger().DecIndentLevel();
-                Runtime::GetLogger().Add(   _T("}") );
+                ScriptError( ET_UNPREDICTABLE, _T("- ELSE IF expected, but IF was not found.") );
+                nCmdResult = CMDRESULT_FAILED;
             }
-            Runtime::GetLogger().AddEx( _T("_next  = 0x%X"), p->GetNext() ); 
-            if ( p->GetNext() )
+            else
             {
-                const CListItemT<tstr>* pNext = p->GetNext();
-                Runtime::GetLogger().Add(   _T("{") );
-                Runtime::GetLogger().IncIndentLevel();
-                Runtime::GetLogger().AddEx( _T("_item = \"%s\""), pNext->GetItem().c_str() );
-                Runtime::GetLogger().AddEx( _T("_prev = 0x%X;  _next = 0x%X;  _owner = 0x%X"), 
-                    pNext->GetPrev(), pNext->GetNext(), pNext->GetOwner() );
-                Runtime::GetLogger().DecIndentLevel();
-                Runtime::GetLogger().Add(   _T("}") );
+                tstr ifParams;
+                ifParams.Copy( params.c_str() + n + 3 );
+                NppExecHelpers::StrDelLeadingTabSpaces(ifParams);
+                NppExecHelpers::StrDelTrailingTabSpaces(ifParams);
+
+                doIf(ifParams, true);
             }
-            Runtime::GetLogger().AddEx( _T("_owner = 0x%X"), p->GetOwner() );
-            Runtime::GetLogger().DecIndentLevel();
-            Runtime::GetLogger().Add(   _T("}") );
+        }
+    }
+
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoEndIf(const tstr& params)
+{
+    reportCmdAndParams( DoEndIfCommand::Name(), params, fMessageToConsole );
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+    if ( !params.IsEmpty() )
+    {
+        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
+
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    const eIfState ifState = currentScript.GetIfState();
+    if ( ifState == IF_NONE )
+    {
+        ScriptError( ET_UNPREDICTABLE, _T("- Unexpected ENDIF found, without preceding IF.") );
+        nCmdResult = CMDRESULT_FAILED;
+    }
+    else
+    {
+
+        Runtime::GetLogger().Add( _T("; IF ... ENDIF found, done") );
+
+        currentScript.PopIfState();
+    }
+
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoEnvSet(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoEnvSetCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    bool isInternal = false;
+    
+    CStrSplitT<TCHAR> args;
+    if ( args.Split(params, _T("="), 2) == 2 )
+    {
+        isInternal = true;
+        
+        // set the value
+        tstr& varName = args.Arg(0);
+        tstr& varValue = args.Arg(1);
         
-            Runtime::GetLogger().Add(   _T("; executing ModifyCommandLine") );
+        NppExecHelpers::StrDelLeadingTabSpaces(varName);
+        NppExecHelpers::StrDelTrailingTabSpaces(varName);
+        NppExecHelpers::StrDelLeadingTabSpaces(varValue);
+        NppExecHelpers::StrDelTrailingTabSpaces(varValue);
 
-            ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-            const int ifDepth = currentScript.GetIfDepth();
-            const eIfState ifState = currentScript.GetIfState();
+        if ( varName.length() > 0 )
+        {
+            NppExecHelpers::StrUpper(varName);
 
-            nCmdType = modifyCommandLine(this, S, ifState);
-            if ( nCmdType != CMDTYPE_COMMENT_OR_EMPTY )
             {
-                if ( isSkippingThisCommandDueToIfState(nCmdType, ifState) )
+                CCriticalSectionLockGuard lock(g_csEnvVars);
+                if ( g_LocalEnvVarNames.find(varName) == g_LocalEnvVarNames.end() )
                 {
-                    Runtime::GetLogger().AddEx( _T("; skipping - waiting for %s"),
-                        (ifState == IF_WANT_ENDIF || ifState == IF_WANT_SILENT_ENDIF || ifState == IF_EXECUTING) ? DoEndIfCommand::Name() : DoElseCommand::Name() );
-                
-                    if ( nCmdType == CMDTYPE_IF )
-                    {
-                        // nested IF inside a conditional block that is being skipped
-                        currentScript.PushIfState(IF_WANT_SILENT_ENDIF);
-                        // skip the nested IF...ENDIF block as well - mark it as "silent"
-                    }
-                    else if ( nCmdType == CMDTYPE_ENDIF )
+                    // not Local Env Var; maybe Global?
+                    tEnvVars::const_iterator itrGVar = g_GlobalEnvVars.find(varName);
+                    if ( itrGVar == g_GlobalEnvVars.end() )
                     {
-                        // nested ENDIF inside a conditional block that is being skipped
-                        if ( ifState == IF_WANT_SILENT_ENDIF ) // <-- this condition is redundant, but let it be just in case
+                        // not in the Global Env Vars List; but maybe it's Global?
+                        tstr sValue = NppExecHelpers::GetEnvironmentVariable(varName);
+                        if ( !sValue.IsEmpty() )
                         {
-                            // nested "silent" IF...ENDIF block is completed
-                            currentScript.PopIfState();
+                            g_GlobalEnvVars[varName] = sValue;
+                            itrGVar = g_GlobalEnvVars.find(varName);
                         }
-                    }
-                    else if ( nCmdType == CMDTYPE_ELSE )
-                    {
-                        if ( ifState == IF_EXECUTING )
+                        if ( itrGVar == g_GlobalEnvVars.end() )
                         {
-                            // the IF...ELSE block completed
-                            currentScript.SetIfState(IF_WANT_ENDIF);
+                            // not Global Env Var; add to the Local
+                            g_LocalEnvVarNames[varName] = 0;
                         }
                     }
                 }
-                else
-                {
-                    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+            }
 
-                    if ( nCmdType == CMDTYPE_COLLATERAL_FORCED )
-                    {
-                        CListT<tstr> CmdList(S);
-                        if ( !m_pNppExec->GetCommandExecutor().ExecuteCollateralScript(CmdList, tstr()) )
-                            nCmdResult = CMDRESULT_FAILED;
-                    }
-                    else
-                    {
-                        m_nCmdType = nCmdType;
-                        if ( isFirstCmd && (m_nCmdType == CMDTYPE_NPPEXEC) )
-                        {
-                            isNppExec = true;
-                        }
-                        else 
-                        {
-                            if ( isFirstCmd )
-                            {
-                                isFirstCmd = false;
+            if ( !SetEnvironmentVariable(varName.c_str(), varValue.c_str()) )
+                nCmdResult = CMDRESULT_FAILED;
+        }
+        else
+        {
+            ScriptError( ET_REPORT, _T("- no variable name specified") );
+            return CMDRESULT_INVALIDPARAM;
+        }
+    }
 
-                                if ( m_nCmdType == CMDTYPE_NPPCONSOLE )
-                                {
-                                    int param = getOnOffParam(S);
-                                    if ( param == PARAM_ENABLE || param == PARAM_DISABLE )
-                                    {
-                                        if ( !m_pNppExec->isConsoleDialogVisible() )
-                                        {
-                                            m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, 0);
-                                        }
-                                    }
-                                }
-                            }
-                            if ( isNppExec )
-                            {
-                                if ( m_nCmdType != CMDTYPE_NPPCONSOLE )
-                                {
-                                    m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, 0);
-                                }
-                                isNppExec = false;
-                            }
-                        }
+    // show the value
+    tstr& varName = args.Arg(0);
+        
+    NppExecHelpers::StrDelLeadingTabSpaces(varName);
+    NppExecHelpers::StrDelTrailingTabSpaces(varName);
 
-                        m_sCmdParams = S;
-                        EXECFUNC pCmdExecFunc = m_CommandRegistry.GetCmdExecFunc(m_nCmdType);
-                        nCmdResult = pCmdExecFunc(this, S);
-                    }
+    if ( varName.length() > 0 )
+    {
+        NppExecHelpers::StrUpper(varName);
+            
+        bool  bSysVarOK = false;
+        tstr sValue = NppExecHelpers::GetEnvironmentVariable(varName);
+        if ( !sValue.IsEmpty() )
+        {
+            tstr S = _T("$(SYS.");
+            S += varName;
+            S += _T(") = ");
+            if ( sValue.length() > MAX_VAR_LENGTH2SHOW )
+            {
+                S.Append( sValue.c_str(), MAX_VAR_LENGTH2SHOW - 5 );
+                S += _T("(...)");
+            }
+            else
+            {
+                S += sValue;
+            }
+            m_pNppExec->GetConsole().PrintMessage( S.c_str(), isInternal );
+            bSysVarOK = true;
+        }
+        if ( !bSysVarOK )
+        {
+            tstr S = _T("$(SYS.");
+            S += varName;
+            S += _T(") is empty or does not exist");
+            m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+        }
+    }
+    else
+    {
+        ScriptError( ET_REPORT, _T("- no variable name specified") );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
 
-                    // The same currentScript object is used here to handle NPP_EXEC as well
-                    // (it's safe because ScriptContextList.DeleteLast() is not called before)
-                    if ( (ifState == IF_MAYBE_ELSE) &&
-                         (currentScript.GetIfState() == IF_MAYBE_ELSE) &&
-                         (currentScript.GetIfDepth() == ifDepth) )
-                    {
-                        // The IfState was not changed, so remove IF_MAYBE_ELSE
-                        currentScript.SetIfState(IF_NONE);
-                    }
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoEnvUnset(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoEnvUnsetCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-                    {
-                        TCHAR szCmdResult[50];
-                        c_base::_tint2str(nCmdResult, szCmdResult);
+    // removes the value of environment variable, restores the initial value
 
-                        tstr varName = MACRO_LAST_CMD_RESULT;
-                        m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, szCmdResult, CNppExecMacroVars::svLocalVar ); // local var
-                    }
-                }
-            }
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    tstr varName = params;
+    
+    NppExecHelpers::StrDelLeadingTabSpaces(varName);
+    NppExecHelpers::StrDelTrailingTabSpaces(varName);
 
-            Runtime::GetLogger().Add(   _T("") );
-        }
+    if ( varName.length() > 0 )
+    {
+        NppExecHelpers::StrUpper(varName);
 
-        p = (m_execState.pScriptLineNext == INVALID_TSTR_LIST_ITEM) ? p->GetNext() : m_execState.pScriptLineNext;
+        BOOL bResult = FALSE;
+        BOOL bRemoved = FALSE;
 
-        ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-        if ( currentScript.IsNppExeced )
         {
-            if ( p == currentScript.CmdRange.pEnd )
+            CCriticalSectionLockGuard lock(g_csEnvVars);
+            tEnvVars::iterator itrLVar = g_LocalEnvVarNames.find(varName);
+            if ( itrLVar != g_LocalEnvVarNames.end() )
             {
-                Runtime::GetLogger().AddEx( _T("; script context removed: { Name = \"%s\"; CmdRange = [0x%X, 0x%X) }"), 
-                    currentScript.ScriptName.c_str(), currentScript.CmdRange.pBegin, currentScript.CmdRange.pEnd ); 
-
-                CListItemT<tstr>* pItem = currentScript.CmdRange.pBegin;
-                while ( pItem != currentScript.CmdRange.pEnd )
+                // is Local Env Var; remove
+                bResult = SetEnvironmentVariable( varName.c_str(), NULL );
+                g_LocalEnvVarNames.erase(itrLVar);
+                bRemoved = TRUE;
+            }
+            else
+            {
+                // not Local Env Var; maybe Global?
+                tEnvVars::iterator itrGVar = g_GlobalEnvVars.find(varName);
+                if ( itrGVar != g_GlobalEnvVars.end() )
+                {
+                    // is modified Global Env Var; restore the initial value
+                    bResult = SetEnvironmentVariable( varName.c_str(), itrGVar->second.c_str() );
+                    g_GlobalEnvVars.erase(itrGVar);
+                }
+                else
                 {
-                    CListItemT<tstr>* pNext = pItem->GetNext();
-                    m_CmdList.Delete(pItem);
-                    pItem = pNext;
+                    // unsafe: maybe non-modified Global Env Var
                 }
-                m_execState.ScriptContextList.DeleteLast();
-
-                Runtime::GetLogger().Add(   _T("") );
             }
         }
-    } // while
 
-    if ( isNppExec )
-    {
-        // the whole script contains just NPP_EXEC commands
-        // the Console is still hidden, it must be shown
-        m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, 0);
+        tstr S = _T("$(SYS.");
+        S += varName;
+        if ( bResult )
+        {
+            S += _T(") has been ");
+            S += (bRemoved ? _T("removed") : _T("restored"));
+        }
+        else
+        {
+            S += _T(")");
+            S.Insert(0, _T("- can not unset this environment variable: "));
+            nCmdResult = CMDRESULT_FAILED;
+        }
+        m_pNppExec->GetConsole().PrintMessage( S.c_str(), bResult ? true : false );
     }
-
-    if ( !m_pNppExec->GetCommandExecutor().GetRunningScriptEngine() )
+    else
     {
-        // a collateral script may be running
-        m_pNppExec->_consoleIsVisible = m_pNppExec->isConsoleDialogVisible();
+        ScriptError( ET_REPORT, _T("- no variable name specified") );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
     }
 
-    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::Run - end (instance = %s)"), GetInstanceStr() );
+    return nCmdResult;
+}
 
-    if ( m_nRunFlags & rfShareLocalVars )
+CScriptEngine::eCmdResult CScriptEngine::DoExit(const tstr& params)
+{
+    reportCmdAndParams( DoExitCommand::Name(), params, fMessageToConsole );
+
+    bool bHardExit = false;
+    if ( params.IsEmpty() || params == _T("0") )
     {
-        if ( m_pParentScriptEngine )
-        {
-            ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-            CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
-            m_pParentScriptEngine->GetExecState().GetCurrentScriptContext().LocalMacroVars.swap(currentScript.LocalMacroVars);
-        }
+        bHardExit = false;
     }
-    else if ( m_nRunFlags & rfConsoleLocalVarsWrite )
+    else if ( params == _T("-1") )
     {
-        ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-        CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
-        m_pNppExec->GetMacroVars().GetUserConsoleMacroVars().swap(currentScript.LocalMacroVars);
+        bHardExit = true;
     }
-    if ( m_nRunFlags & rfShareConsoleState ) // <-- another script can enable the output, but usually that does not affect the parent's state
+    else
     {
-        CNppExecConsole& Console = m_pNppExec->GetConsole();
-        int nEnabled = Console.GetOutputEnabledDirectly(m_dwThreadId);
-        DWORD scrptEngnId = 0;
-        if ( ((m_nRunFlags & rfConsoleLocalVars) == 0) && m_pParentScriptEngine )
-            scrptEngnId = m_pParentScriptEngine->GetThreadId();
-        Console.SetOutputEnabledDirectly(scrptEngnId, nEnabled);
+        ScriptError( ET_REPORT, _T("- unknown exit argument; assuming \"exit -1\"") );
+        bHardExit = true;
     }
 
-    m_pNppExec->GetConsole().OnScriptEngineFinished();
+    if ( bHardExit || !m_execState.GetCurrentScriptContext().IsNppExeced )
+    {
+        // stop the whole script
+        m_execState.pScriptLineNext = NULL;
+        m_eventAbortTheScript.Set();
+    }
+    else
+    {
+        // stop only the npp_exec'ed part of the script
+        m_execState.pScriptLineNext = m_execState.GetCurrentScriptContext().CmdRange.pEnd;
+    }
 
-    m_eventRunIsDone.Set();
+    return CMDRESULT_SUCCEEDED;
 }
 
-bool CScriptEngine::IsParentOf(const std::shared_ptr<CScriptEngine> pScriptEngine) const
+
+CScriptEngine::eCmdResult CScriptEngine::DoGoTo(const tstr& params)
 {
-    std::shared_ptr<CScriptEngine> pEngine = GetChildScriptEngine();
-    while ( pEngine )
-    {
-        if ( pEngine == pScriptEngine )
-            return true;
+    if ( !reportCmdAndParams( DoGoToCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-        pEngine = pEngine->GetChildScriptEngine();
-    }
-    return false;
-}
+    tstr labelName = params;
+    NppExecHelpers::StrDelLeadingTabSpaces(labelName);
+    NppExecHelpers::StrDelTrailingTabSpaces(labelName);
+    NppExecHelpers::StrUpper(labelName);
 
-bool CScriptEngine::IsChildOf(const std::shared_ptr<CScriptEngine> pScriptEngine) const
-{
-    std::shared_ptr<CScriptEngine> pEngine = GetParentScriptEngine();
-    while ( pEngine )
+    if ( labelName.IsEmpty() )
     {
-        if ( pEngine == pScriptEngine )
-            return true;
-
-        pEngine = pEngine->GetParentScriptEngine();
+        ScriptError( ET_REPORT, _T("- label name is empty") );
+        return CMDRESULT_INVALIDPARAM;
     }
-    return false;
-}
-
-bool CScriptEngine::ContinueExecution() const
-{
-    return (m_pNppExec->_consoleIsVisible || ((m_nRunFlags & rfExitScript) != 0 && !m_pNppExec->_bStopTheExitScript)); 
-}
 
-void CScriptEngine::ScriptError(eErrorType type, const TCHAR* cszErrorMessage)
-{
-    switch ( type )
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    tLabels& Labels = currentScript.Labels;
+    tLabels::const_iterator itrLabel = Labels.find(labelName);
+    if ( itrLabel == Labels.end() )
     {
-        case ET_REPORT:
-            m_pNppExec->GetConsole().PrintError( GetLastLoggedCmd().c_str() );
-            m_pNppExec->GetConsole().PrintError( cszErrorMessage );
-            break;
+        Runtime::GetLogger().Activate(false);
 
-        case ET_ABORT:
-          #if SCRPTENGNID_DEBUG_OUTPUT
+        tstr Cmd;
+        CListItemT<tstr>* p = m_execState.pScriptLineCurrent->GetNext();
+        while ( p && (p != currentScript.CmdRange.pEnd) )
+        {
+            Cmd = p->GetItem();
+            if ( currentScript.IsNppExeced )
+                bindCmdArgs(p, currentScript, Cmd);
+            if ( getCmdType(m_pNppExec, Cmd, ctfUseLogging, GetCmdAliasesSnapshot()) == CMDTYPE_LABEL )
             {
-                tstr S;
-                S.Format(1020, _T("CScriptEngine::ScriptError - scrptEngnId=%u\n"), m_dwThreadId);
-                ::OutputDebugString(S.c_str());
+                NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
+                NppExecHelpers::StrDelTrailingTabSpaces(Cmd);
+                NppExecHelpers::StrUpper(Cmd);
+                if ( Labels.find(Cmd) == Labels.end() )
+                {
+                    Labels[Cmd] = p->GetNext(); // label points to the next command
+                }
+                if ( Cmd == labelName )
+                {
+                    itrLabel = Labels.find(labelName);
+                    break;
+                }
             }
-          #endif
-            m_execState.pScriptLineNext = NULL; // stop the script
-            m_eventAbortTheScript.Set();
-            m_pNppExec->GetConsole().OnScriptEngineAborting(m_dwThreadId);
-            Runtime::GetLogger().Add_WithoutOutput( cszErrorMessage );
-            Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::ScriptError(ET_ABORT) (instance = %s)"), GetInstanceStr() );
-            break;
+            p = p->GetNext();
+        }
 
-        case ET_UNPREDICTABLE:
-            m_execState.pScriptLineNext = NULL; // stop the script
-            m_eventAbortTheScript.Set();
-            // do not call it here: m_pNppExec->GetConsole().OnScriptEngineAborting(m_dwThreadId);
-            m_pNppExec->GetConsole().PrintError( GetLastLoggedCmd().c_str() );
-            m_pNppExec->GetConsole().PrintError( cszErrorMessage );
-            m_pNppExec->GetConsole().PrintError( _T("To prevent unpredictable behavior, the script is stopped.") );
-            Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::ScriptError(ET_UNPREDICTABLE)  (instance = %s)"), GetInstanceStr() );
-            break;
-    }
-}
+        Runtime::GetLogger().Activate(true);
 
-void CScriptEngine::UndoAbort(const TCHAR* cszMessage)
-{
-    m_execState.pScriptLineNext = m_execState.pScriptLineNextBackupCopy;
-    m_eventAbortTheScript.Reset();
+        if ( itrLabel == Labels.end() )
+        {
+            tstr err = _T("- no label found: ");
+            err += labelName;
+            ScriptError( ET_REPORT, err.c_str() );
+            return CMDRESULT_FAILED;
+        }
+    }
 
-    Runtime::GetLogger().AddEx_WithoutOutput( _T("; CScriptEngine::UndoAbort() (instance = %s) : %s"), GetInstanceStr(), cszMessage );
-}
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    bool bContinue = true;
 
-std::shared_ptr<CChildProcess> CScriptEngine::GetRunningChildProcess()
-{
-    std::shared_ptr<CChildProcess> pChildProc;
-    std::shared_ptr<CScriptEngine> pScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine(); // shared_ptr(this)
-    while ( pScriptEngine && !pChildProc )
+    m_execState.nGoToCounter++;
+    if (m_execState.nGoToCounter > m_execState.nGoToMaxCount)
     {
-        pChildProc = pScriptEngine->GetExecState().GetRunningChildProcess();
-        pScriptEngine = pScriptEngine->GetParentScriptEngine();
-    }
-    return pChildProc;
-}
+        TCHAR szMsg[240];
 
-bool CScriptEngine::IsChildProcessRunning() const
-{
-    bool isChildProcRunning = false;
-    std::shared_ptr<CScriptEngine> pScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine(); // shared_ptr(this)
-    while ( pScriptEngine && !isChildProcRunning )
-    {
-        isChildProcRunning = pScriptEngine->GetExecState().IsChildProcessRunning();
-        pScriptEngine = pScriptEngine->GetParentScriptEngine();
+        m_execState.nGoToCounter = 0;
+        bContinue = false;
+        ::wsprintf(szMsg, 
+            _T("%s was performed more than %d times.\n") \
+            _T("Abort execution of this script?\n") \
+            _T("(Press Yes to abort or No to continue execution)"),
+            DoGoToCommand::Name(),
+            m_execState.nGoToMaxCount
+        );
+        if (::MessageBox(m_pNppExec->m_nppData._nppHandle, szMsg, 
+                _T("NppExec Warning: Possible infinite loop"),
+                  MB_YESNO | MB_ICONWARNING) == IDNO)
+        {
+            bContinue = true;
+        }
     }
-    return isChildProcRunning;
-}
 
-void CScriptEngine::ChildProcessMustBreakAll()
-{
-    std::shared_ptr<CScriptEngine> pScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine(); // shared_ptr(this)
-    while ( pScriptEngine )
+    if ( bContinue )
     {
-        std::shared_ptr<CChildProcess> pChildProc = pScriptEngine->GetExecState().GetRunningChildProcess();
-        if ( pChildProc )
-            pChildProc->MustBreak(CProcessKiller::killCtrlBreak);
-        pScriptEngine = pScriptEngine->GetParentScriptEngine();
-    }
-}
+        if ( m_execState.pScriptLineNext == NULL )
+        {
 
-bool CScriptEngine::WaitUntilDone(DWORD dwTimeoutMs) const
-{
-    return (m_eventRunIsDone.IsNull() || (m_eventRunIsDone.Wait(dwTimeoutMs) == WAIT_OBJECT_0));
-}
+            Runtime::GetLogger().Add( _T("; Ignoring GOTO as the script is being stopped") );
 
-CScriptEngine::eNppExecCmdPrefix CScriptEngine::checkNppExecCmdPrefix(CNppExec* pNppExec, tstr& Cmd, bool bRemovePrefix)
-{
-    eNppExecCmdPrefix ret = CmdPrefixNone;
-    int nPrefixLen = 0;
-    const TCHAR* pszPrefix = pNppExec->GetOptions().GetStr(OPTS_NPPEXEC_CMD_PREFIX, &nPrefixLen);
-    if ( nPrefixLen != 0 )
-    {
-        if ( Cmd.StartsWith(pszPrefix) )
+        }
+        else
         {
-            ret = CmdPrefixCollateralOrRegular;
-            if ( Cmd.GetAt(nPrefixLen) == pszPrefix[nPrefixLen - 1] ) // is the last symbol doubled?
+            CListItemT<tstr>* pLabelNext = itrLabel->second;
+            if ( !pLabelNext && currentScript.IsNppExeced )
             {
-                // if the prefix is "nppexec:" (default), then "nppexec::" is expected here
-                // if the prefix was changed to e.g. "npe-", then "npe--" is expected here
-                ++nPrefixLen;
-                ret = CmdPrefixCollateralForced;
+                pLabelNext = currentScript.CmdRange.pEnd; // the label is the last line of the script body
             }
-            if ( bRemovePrefix )
+            m_execState.SetScriptLineNext(pLabelNext);
+            leaveLoopsByGoTo(currentScript, pLabelNext);
+
+            if ( Runtime::GetLogger().IsLogging() )
             {
-                Cmd.Delete(0, nPrefixLen);
-                NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
+                Runtime::GetLogger().AddEx( _T("; Jumping to command item p = 0x%X { \"%s\" }"),
+                    m_execState.pScriptLineNext, 
+                    m_execState.pScriptLineNext ? m_execState.pScriptLineNext->GetItem().c_str() : _T("<NULL>") );
             }
+
         }
     }
-    return ret;
-}
-
-CScriptEngine::eCmdType CScriptEngine::getCmdType(CNppExec* pNppExec, tstr& Cmd, unsigned int nFlags)
-{
-    const bool useLogging = ((nFlags & ctfUseLogging) != 0);
-    const bool ignorePrefix = ((nFlags & ctfIgnorePrefix) != 0);
-    
-    if ( useLogging )
+    else
     {
-        Runtime::GetLogger().Add(   _T("GetCmdType()") );
-        Runtime::GetLogger().Add(   _T("{") );
-        Runtime::GetLogger().IncIndentLevel();
-        Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), Cmd.c_str() );
+        ScriptError( ET_ABORT, _T("; Script execution aborted by user (from DoGoTo())") );
+        nCmdResult = CMDRESULT_FAILED;
     }
 
-    NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
-    NppExecHelpers::StrDelTrailingTabSpaces(Cmd);
+    return nCmdResult;
+}
 
-    CScriptEngine::eNppExecCmdPrefix cmdPrefix = checkNppExecCmdPrefix(pNppExec, Cmd);
+enum eDecNumberType {
+  DNT_NOTNUMBER = 0,
+  DNT_INTNUMBER,
+  DNT_FLOATNUMBER
+};
 
-    if ( Cmd.IsEmpty() )
+static eDecNumberType isPureDecNumber(const TCHAR* s)
+{
+    if ( s )
     {
-        if ( useLogging )
+        if ( (*s == _T('-')) || (*s == _T('+')) )
         {
-            Runtime::GetLogger().AddEx( _T("[ret] %d (empty command)"), CMDTYPE_COMMENT_OR_EMPTY );
-            Runtime::GetLogger().DecIndentLevel();
-            Runtime::GetLogger().Add(   _T("}") );
+            ++s;
         }
 
-        return CMDTYPE_COMMENT_OR_EMPTY;
-    }
+        if ( !isDecNumChar(*s) )
+            return DNT_NOTNUMBER; // we need at least one numeric char
 
-    if ( (!ignorePrefix) && (cmdPrefix == CmdPrefixCollateralForced) )
-    {
-        if ( useLogging )
+        while ( isDecNumChar( *(++s) ) ) ;
+        
+        if ( *s == 0 )
+            return DNT_INTNUMBER; // OK, we are at the end of string
+
+        // end of floating number's mantissa...
+        if ( *s == _T('.') )
         {
-            Runtime::GetLogger().AddEx( _T("[ret] %d (forced collateral command)"), CMDTYPE_COLLATERAL_FORCED );
-            Runtime::GetLogger().DecIndentLevel();
-            Runtime::GetLogger().Add(   _T("}") );
-        }
+            while ( isDecNumChar( *(++s) ) ) ;
 
-        return CMDTYPE_COLLATERAL_FORCED;
-    }
+            if ( *s == 0 )
+                return DNT_FLOATNUMBER; // e.g. "123." or "123.45"
+        }
 
-    const TCHAR* pAliasNppExec = pNppExec->GetOptions().GetStr(OPTS_ALIAS_CMD_NPPEXEC);
-    if ( pAliasNppExec && pAliasNppExec[0] )
-    {
-        if ( pAliasNppExec[0] == Cmd.GetAt(0) ) // the alias is one character
+        // check for floating number's exponent...
+        if ( (*s == _T('e')) || (*s == _T('E')) )
         {
-            if ( (Cmd.GetAt(0) != _T('\\') || Cmd.GetAt(1) != _T('\\')) &&  // not "\\..."
-                 (Cmd.GetAt(0) != _T('/') || Cmd.GetAt(1) != _T('/')) )     // not "//..."
+            ++s;
+            if ( (*s == _T('-')) || (*s == _T('+')) )
             {
-                Cmd.Delete(0, 1);
-
-                if ( useLogging )
-                {
-                    Runtime::GetLogger().AddEx( _T("[ret] 0x%X (%s)"), CMDTYPE_NPPEXEC, DoNppExecCommand::Name() );
-                    Runtime::GetLogger().DecIndentLevel();
-                    Runtime::GetLogger().Add(   _T("}") );
-                }
+                ++s;
+            }
 
-                return CMDTYPE_NPPEXEC;
+            while ( isDecNumChar(*s) ) 
+            {
+                if ( *(++s) == 0 )
+                    return DNT_FLOATNUMBER; // OK, we are at the end of string
             }
         }
     }
+    return DNT_NOTNUMBER;
+}
+
+enum eCondType {
+    COND_NONE = 0,
+    COND_EQUAL,
+    COND_NOTEQUAL,
+    COND_LESSTHAN,
+    COND_LESSEQUAL,
+    COND_GREATTHAN,
+    COND_GREATEQUAL,
+    COND_EQUALNOCASE
+};
 
-    pNppExec->GetMacroVars().CheckCmdAliases(Cmd, useLogging);
+template<typename T> class OperandComparator
+{
+    public:
+        OperandComparator(const T& t1, const T& t2) : m_t1(t1), m_t2(t2)
+        {
+        }
 
-    if ( Cmd.GetAt(0) == _T(':') && Cmd.GetAt(1) == _T(':') )
-    {
-        pNppExec->GetConsole().PrintError( _T("- can not use \"::\" at the beginning of line!") );
+        OperandComparator& operator=(const OperandComparator&) = delete;
 
-        if ( useLogging )
+        bool compare(int condType)
         {
-            Runtime::GetLogger().AddEx( _T("[ret] %d (command starts with ::)"), CMDTYPE_COMMENT_OR_EMPTY );
-            Runtime::GetLogger().DecIndentLevel();
-            Runtime::GetLogger().Add(   _T("}") );
+            bool ret = false;
+            switch ( condType )
+            {
+                case COND_EQUAL:       ret = eq(); break;
+                case COND_NOTEQUAL:    ret = ne(); break;
+                case COND_LESSTHAN:    ret = lt(); break;
+                case COND_LESSEQUAL:   ret = le(); break;
+                case COND_GREATTHAN:   ret = gt(); break;
+                case COND_GREATEQUAL:  ret = ge(); break;
+                case COND_EQUALNOCASE: ret = eq_i(); break;
+            }
+            return ret;
         }
 
-        return CMDTYPE_COMMENT_OR_EMPTY;
-    }
+        bool eq() const { return (m_t1 == m_t2); }
+        bool ne() const { return (m_t1 != m_t2); }
+        bool lt() const { return (m_t1 < m_t2); }
+        bool le() const { return (m_t1 <= m_t2); }
+        bool gt() const { return (m_t1 > m_t2); }
+        bool ge() const { return (m_t1 >= m_t2); }
+        bool eq_i() const { return (m_t1 == m_t2); }
 
-    if ( DEFAULT_ALIAS_CMD_LABEL == Cmd.GetAt(0) )
-    {
-        Cmd.Delete(0, 1);
+    protected:
+        const T& m_t1;
+        const T& m_t2;
+};
 
-        if ( useLogging )
+template<> bool OperandComparator<tstr>::eq_i() const
+{
+    return ( NppExecHelpers::StrCmpNoCase(m_t1, m_t2) == 0 );
+}
+
+class CondOperand
+{
+    public:
+        CondOperand(const tstr& s) : m_value_str(s), m_value_dbl(0), m_value_int64(0)
         {
-            Runtime::GetLogger().AddEx( _T("[ret] 0x%X (%s)"), CMDTYPE_LABEL, DoLabelCommand::Name() );
-            Runtime::GetLogger().DecIndentLevel();
-            Runtime::GetLogger().Add(   _T("}") );
+            m_type = isPureDecNumber(s.c_str());
+            if ( m_type == DNT_INTNUMBER )
+            {
+                m_value_int64 = c_base::_tstr2int64(s.c_str());
+                m_value_dbl = static_cast<double>(m_value_int64); // to be able to compare as double
+            }
+            else if ( m_type == DNT_FLOATNUMBER )
+            {
+                m_value_dbl = _t_str2f(s.c_str());
+            }
+        }
+
+        const TCHAR* type_as_str() const
+        {
+            switch ( type() )
+            {
+                case DNT_NOTNUMBER:
+                    return _T("str");
+                case DNT_INTNUMBER:
+                    return _T("int");
+                case DNT_FLOATNUMBER:
+                    return _T("dbl");
+            }
+            return _T("");
         }
 
-        return CMDTYPE_LABEL;
-    }
+        inline eDecNumberType type() const { return m_type; }
+        inline const tstr& value_str() const { return m_value_str; }
+        inline double value_dbl() const { return m_value_dbl; }
+        inline __int64 value_int64() const { return m_value_int64; }
+
+    protected:
+        tstr    m_value_str;
+        double  m_value_dbl;
+        __int64 m_value_int64;
+        eDecNumberType m_type;
+};
+
+// splits a single comparison "op1 <cond> op2", returns its COND_ type
+static int splitComparison(const tstr& Condition, tstr& op1, tstr& cond, tstr& op2)
+{
+    CStrSplitT<TCHAR> args;
+
+    typedef struct sCond {
+        const TCHAR* szCond;
+        int          nCondType;
+    } tCond;
+
+    static const tCond arrCond[] = {
+        { _T("=="), COND_EQUAL       },
+        { _T("!="), COND_NOTEQUAL    },
+        { _T("<>"), COND_NOTEQUAL    },
+        { _T(">="), COND_GREATEQUAL  },
+        { _T("<="), COND_LESSEQUAL   },
+        { _T("~="), COND_EQUALNOCASE },
+        { _T("="),  COND_EQUAL       },
+        { _T("<"),  COND_LESSTHAN    },
+        { _T(">"),  COND_GREATTHAN   }
+    };
+
+    int condType = COND_NONE;
 
-    tstr S = Cmd;
-    NppExecHelpers::StrUpper(S);
-  
-    eCmdType nCmdType = CMDTYPE_UNKNOWN;
-    if ( S.StartsWith(DoCdCommand::Name()) )
+    if ( args.SplitToArgs(Condition) == 3 )
     {
-        int i = lstrlen(DoCdCommand::Name());
-        const TCHAR next_ch = S.GetAt(i);
-        if ( IsTabSpaceOrEmptyChar(next_ch) || next_ch == _T('\\') || next_ch == _T('/') || next_ch == _T('.') )
+        cond = args.GetArg(1);
+        op1 = args.GetArg(0);
+        op2 = args.GetArg(2);
+
+        for ( const tCond& c : arrCond )
         {
-            nCmdType = DoCdCommand::Type();
-            Cmd.Delete(0, i);
+            if ( cond == c.szCond )
+            {
+                condType = c.nCondType;
+                break;
+            }
         }
-    }
-    if ( nCmdType == CMDTYPE_UNKNOWN )
-    {
-        int i = S.FindOneOf(_T(" \t"));
-        S.Delete(i);
-        nCmdType = m_CommandRegistry.GetCmdTypeByName(S);
-        if ( nCmdType != CMDTYPE_UNKNOWN )
-            Cmd.Delete(0, i);
-    }
 
-    if ( useLogging )
-    {
-        if ( nCmdType != CMDTYPE_UNKNOWN )
+        if ( condType != COND_NONE )
         {
-            Runtime::GetLogger().AddEx( _T("[ret] 0x%X (%s)"), nCmdType, m_CommandRegistry.GetCmdNameByType(nCmdType) );
+            // restore removed quotes, if any
+            int n = Condition.Find(op1);
+            if ( Condition.GetAt(n - 1) == _T('\"') )
+            {
+                op1.Insert(0, _T('\"'));
+                op1 += _T('\"');
+            }
+
+            n = Condition.RFind(op2);
+            if ( Condition.GetAt(n - 1) == _T('\"') )
+            {
+                op2.Insert(0, _T('\"'));
+                op2 += _T('\"');
+            }
         }
-        else
+    }
+    else
+    {
+        for ( const tCond& c : arrCond )
         {
-            Runtime::GetLogger().AddEx( _T("[ret] 0x%X (unknown)"), nCmdType );
+            int n = Condition.Find(c.szCond);
+            if ( n >= 0 )
+            {
+                condType = c.nCondType;
+                cond = c.szCond;
+                op1.Copy(Condition.c_str(), n);
+                op2.Copy(Condition.c_str() + n + lstrlen(c.szCond));
+
+                NppExecHelpers::StrDelLeadingTabSpaces(op1);
+                NppExecHelpers::StrDelTrailingTabSpaces(op1);
+
+                NppExecHelpers::StrDelLeadingTabSpaces(op2);
+                NppExecHelpers::StrDelTrailingTabSpaces(op2);
+                break;
+            }
         }
-        Runtime::GetLogger().DecIndentLevel();
-        Runtime::GetLogger().Add(   _T("}") );
     }
-  
-    return nCmdType;
-}
 
-bool CScriptEngine::isSkippingThisCommandDueToIfState(eCmdType cmdType, eIfState ifState)
-{
-    return ( (ifState == IF_WANT_SILENT_ENDIF) ||
-             ((ifState == IF_WANT_ENDIF) && (cmdType != CMDTYPE_ENDIF)) ||
-             ((ifState == IF_WANT_ELSE) && (cmdType != CMDTYPE_ELSE && cmdType != CMDTYPE_ENDIF)) || 
-             ((ifState == IF_EXECUTING) && (cmdType == CMDTYPE_ELSE)) );
+    return condType;
 }
 
-CScriptEngine::eCmdType CScriptEngine::modifyCommandLine(CScriptEngine* pScriptEngine, tstr& Cmd, eIfState ifState)
+// IF/ELSE IF/WHILE condition, compiled once per script line:
+//   condition := and_expr { "||" and_expr }
+//   and_expr  := unary { "&&" unary }
+//   unary     := "!" unary | "(" condition ")" | op1 <cond> op2
+// The operands without macro-vars are parsed (typed) once, the operands
+// with macro-vars are substituted and parsed on each evaluation.
+// "&&" and "||" are evaluated from left to right with short-circuit.
+class CCompiledCondition
 {
-    Runtime::GetLogger().Add(   _T("ModifyCommandLine()") );
-    Runtime::GetLogger().Add(   _T("{") );
-    Runtime::GetLogger().IncIndentLevel();
-    Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), Cmd.c_str() );
-
-    CNppExec* pNppExec = pScriptEngine->GetNppExec();
-    CScriptEngine::eNppExecCmdPrefix cmdPrefix = checkNppExecCmdPrefix(pNppExec, Cmd);
-
-    if ( isCommentOrEmpty(pNppExec, Cmd) )
-    {
-        Runtime::GetLogger().Add(   _T("; it\'s a comment or empty string") );
-        Runtime::GetLogger().Add(   _T("; command argument(s):") );
-        Runtime::GetLogger().AddEx( _T("[out] \"%s\""), Cmd.c_str() );
-        Runtime::GetLogger().Add(   _T("; command type:") );
-        Runtime::GetLogger().AddEx( _T("[ret] %d"), CMDTYPE_COMMENT_OR_EMPTY );
-        Runtime::GetLogger().DecIndentLevel();
-        Runtime::GetLogger().Add(   _T("}") );
-      
-        return CMDTYPE_COMMENT_OR_EMPTY;
-    }
-
-    if ( cmdPrefix == CmdPrefixCollateralForced )
-    {
-        Runtime::GetLogger().Add(   _T("; it\'s a forced collateral command") );
-        Runtime::GetLogger().Add(   _T("; command type:") );
-        Runtime::GetLogger().AddEx( _T("[ret] %d (forced collateral command)"), CMDTYPE_COLLATERAL_FORCED );
-        Runtime::GetLogger().DecIndentLevel();
-        Runtime::GetLogger().Add(   _T("}") );
-
-        return CMDTYPE_COLLATERAL_FORCED;
-    }
-  
-    // ... checking commands ...
+    public:
+        // returns NULL if the condition can't be compiled
+        static std::shared_ptr<const CCompiledCondition> Compile(const tstr& Condition);
 
-    eCmdType nCmdType = getCmdType(pNppExec, Cmd);
-    
-    if ( nCmdType == CMDTYPE_COMMENT_OR_EMPTY )
-    {
-        Runtime::GetLogger().DecIndentLevel();
-        Runtime::GetLogger().Add(   _T("}") );
+        bool Evaluate(CScriptEngine* pScriptEngine) const;
 
-        return nCmdType;
-    }
+    protected:
+        enum eNodeType {
+            NODE_COMPARE = 0,
+            NODE_NOT,
+            NODE_AND,
+            NODE_OR
+        };
 
-    if ( (nCmdType != CMDTYPE_UNKNOWN) && 
-         isSkippingThisCommandDueToIfState(nCmdType, ifState) )
-    {
-        Runtime::GetLogger().DecIndentLevel();
-        Runtime::GetLogger().Add(   _T("}") );
+        typedef struct sCondOperand {
+            sCondOperand(const tstr& s) : value(s), hasMacroVars(CNppExecMacroVars::ContainsMacroVar(s))
+            {
+            }
 
-        return nCmdType;
-    }
+            CondOperand value; // value.value_str() is the original operand
+            bool        hasMacroVars;
+        } tCondOperand;
 
-    NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
-    if ( Cmd.IsEmpty() || (nCmdType == CMDTYPE_CLS) )
-    {
-        Runtime::GetLogger().Add(   _T("; no arguments given") );
-        Runtime::GetLogger().Add(   _T("; command argument(s):") );
-        Runtime::GetLogger().AddEx( _T("[out] \"%s\""), Cmd.c_str() );
-        Runtime::GetLogger().Add(   _T("; command type:") );
-        Runtime::GetLogger().AddEx( _T("[ret] 0x%X"), nCmdType );
-        Runtime::GetLogger().DecIndentLevel();
-        Runtime::GetLogger().Add(   _T("}") );
-      
-        return nCmdType;
-    }
-  
-    if ( (nCmdType != CMDTYPE_SET) &&
-         (nCmdType != CMDTYPE_UNSET) &&
-         (nCmdType != CMDTYPE_NPPSENDMSG) &&
-         (nCmdType != CMDTYPE_NPPSENDMSGEX) &&
-         (nCmdType != CMDTYPE_SCISENDMSG) &&
-         (nCmdType != CMDTYPE_SCIFIND) &&
-         (nCmdType != CMDTYPE_SCIREPLACE) &&
-         (nCmdType != CMDTYPE_NPECMDALIAS) &&
-         (nCmdType != CMDTYPE_NPEQUEUE) &&
-         (nCmdType != CMDTYPE_CONFILTER) )
-    {
-        bool bCmdStartsWithMacroVar = Cmd.StartsWith(_T("$("));
+        typedef struct sCondNode {
+            sCondNode(eNodeType type) : nType(type), nCondType(COND_NONE)
+            {
+            }
 
-        CNppExecMacroVars& MacroVars = pNppExec->GetMacroVars();
+            eNodeType nType;
+            int       nCondType; // NODE_COMPARE
+            tstr      sCond;     // NODE_COMPARE
+            std::unique_ptr<tCondOperand> pOp1;   // NODE_COMPARE
+            std::unique_ptr<tCondOperand> pOp2;   // NODE_COMPARE
+            std::unique_ptr<sCondNode>    pLeft;  // NODE_NOT, NODE_AND, NODE_OR
+            std::unique_ptr<sCondNode>    pRight; // NODE_AND, NODE_OR
+        } tCondNode;
 
-        // ... checking script's arguments ...
-        const CStrSplitT<TCHAR> args;
-        MacroVars.CheckCmdArgs(Cmd, args);
+        typedef std::unique_ptr<tCondNode> PCondNode;
 
-        // ... checking all the macro-variables ...
-        MacroVars.CheckAllMacroVars(pScriptEngine, Cmd, true);
-        
-        if ( bCmdStartsWithMacroVar && (nCmdType == CMDTYPE_UNKNOWN) )
-        {
-            // re-check nCmdType after macro-var substitution
-            nCmdType = getCmdType(pNppExec, Cmd);
-            if ( nCmdType == CMDTYPE_COLLATERAL_FORCED )
-            {
-                Runtime::GetLogger().Add(   _T("; it\'s a forced collateral command") );
-                Runtime::GetLogger().Add(   _T("; command type:") );
-                Runtime::GetLogger().AddEx( _T("[ret] %d (forced collateral command)"), CMDTYPE_COLLATERAL_FORCED );
-                Runtime::GetLogger().DecIndentLevel();
-                Runtime::GetLogger().Add(   _T("}") );
+        PCondNode m_pRoot;
 
-                return CMDTYPE_COLLATERAL_FORCED;
-            }
-            
-            if ( nCmdType != CMDTYPE_UNKNOWN )
-            {
-                NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
-            }
-        }
+        static PCondNode parseOr(const tstr& S, int& pos);
+        static PCondNode parseAnd(const tstr& S, int& pos);
+        static PCondNode parseUnary(const tstr& S, int& pos);
+        static PCondNode compileComparison(const tstr& S);
+        static int  findComparisonEnd(const tstr& S, int pos);
+        static void skipTabSpaces(const tstr& S, int& pos);
 
-        if ( isSkippingThisCommandDueToIfState(nCmdType, ifState) )
-        {
-            Runtime::GetLogger().DecIndentLevel();
-            Runtime::GetLogger().Add(   _T("}") );
+        static bool evaluateNode(CScriptEngine* pScriptEngine, const tCondNode& node);
+        static const CondOperand& getOperand(CScriptEngine* pScriptEngine, const tCondOperand& op, CondOperand& substitutedOp);
+};
 
-            return nCmdType;
-        }
-    }
-    // we have to process macro-vars inside doSendMsg()
-    // because macro-var's string may contain double-quotes
-  
-    // ... do we need "" around the command's argument? ...
-    
-    bool bDone = false;
-    if ( (nCmdType == CMDTYPE_SET) ||
-         (nCmdType == CMDTYPE_UNSET) ||
-         (nCmdType == CMDTYPE_NPECMDALIAS) ||
-         (nCmdType == CMDTYPE_NPPSENDMSG) ||
-         (nCmdType == CMDTYPE_NPPSENDMSGEX) || 
-         (nCmdType == CMDTYPE_SCISENDMSG) ||
-         (nCmdType == CMDTYPE_SCIFIND) ||
-         (nCmdType == CMDTYPE_SCIREPLACE) ||
-         (nCmdType == CMDTYPE_CONCOLOUR) ||
-         (nCmdType == CMDTYPE_CONFILTER) ||
-         (nCmdType == CMDTYPE_IF) || 
-         (nCmdType == CMDTYPE_GOTO) || 
-         (nCmdType == CMDTYPE_ELSE) ||
-         (nCmdType == CMDTYPE_SLEEP) ||
-         (nCmdType == CMDTYPE_NPEQUEUE) )
-    {
-        bDone = true;
-    }
-    else if ( (nCmdType != 0) &&
-              (nCmdType != CMDTYPE_NPPRUN) &&
-              (nCmdType != CMDTYPE_NPPEXEC) &&
-              (nCmdType != CMDTYPE_ECHO) &&
-              (nCmdType != CMDTYPE_SELSAVETO) &&
-              (nCmdType != CMDTYPE_INPUTBOX) &&
-              (nCmdType != CMDTYPE_MESSAGEBOX) )
+std::shared_ptr<const CCompiledCondition> CCompiledCondition::Compile(const tstr& Condition)
+{
+    int pos = 0;
+    PCondNode pRoot = parseOr(Condition, pos);
+    if ( pRoot )
     {
-        NppExecHelpers::StrUnquote(Cmd);
-
-        bDone = true; // we don't need '\"' in file_name
+        skipTabSpaces(Condition, pos);
+        if ( pos < Condition.length() )
+            pRoot.reset();
     }
 
-    // ... adding '\"' to the command if it's needed ...
-    if ( !bDone )
+    if ( !pRoot )
     {
-        bool bHasSpaces = false;
-        // disabled by default  because of problems 
-        // for executables without extension i.e. 
-        // "cmd /c app.exe"  <-- "cmd" is without extension
-        if (pNppExec->GetOptions().GetBool(OPTB_PATH_AUTODBLQUOTES))
-        {
-            if (!bDone && (Cmd.GetAt(0) != _T('\"')))
-            {
-                int i = 0;
-                int j = 0;
-                while (!bDone && (i < Cmd.length()))
-                {
-                    if (Cmd[i] == _T(' '))
-                    {
-                        bHasSpaces = true;
-                        j = i - 1;
-                        while (!bDone && j >= 0)
-                        {
-                            const TCHAR ch = Cmd[j];
-                            if (ch == _T('.'))
-                            {
-                                Cmd.Insert(i, _T('\"'));
-                                Cmd.Insert(0, _T('\"'));
-                                bDone = true;
-                            }
-                            else if (ch == _T('\\') || ch == _T('/'))
-                            {
-                                j = 0; // j-- makes j<0 so this loop is over
-                            }
-                            j--;
-                        }
-                    }
-                    i++;
-                }
-            }
-        }
+        // not a compound condition, e.g. "(1) == (1)" or "a == b && c";
+        // as before, the whole condition is a single comparison then
+        pRoot = compileComparison(Condition);
+        if ( !pRoot )
+            return std::shared_ptr<const CCompiledCondition>();
     }
-    
-    Runtime::GetLogger().Add(   _T("; command argument(s):") );
-    Runtime::GetLogger().AddEx( _T("[out] \"%s\""), Cmd.c_str() );
-    Runtime::GetLogger().Add(   _T("; command type:") );
-    Runtime::GetLogger().AddEx( _T("[ret] 0x%X"), nCmdType );
-    Runtime::GetLogger().DecIndentLevel();
-    Runtime::GetLogger().Add(   _T("}") );
 
-    return nCmdType;
+    std::shared_ptr<CCompiledCondition> pCondition(new CCompiledCondition);
+    pCondition->m_pRoot = std::move(pRoot);
+    return pCondition;
+}
+
+CCompiledCondition::PCondNode CCompiledCondition::parseOr(const tstr& S, int& pos)
+{
+    PCondNode pNode = parseAnd(S, pos);
+    while ( pNode )
+    {
+        skipTabSpaces(S, pos);
+        if ( S.GetAt(pos) != _T('|') || S.GetAt(pos + 1) != _T('|') )
+            break;
+
+        pos += 2;
+        PCondNode pRight = parseAnd(S, pos);
+        if ( !pRight )
+            return PCondNode();
+
+        PCondNode pOr(new tCondNode(NODE_OR));
+        pOr->pLeft = std::move(pNode);
+        pOr->pRight = std::move(pRight);
+        pNode = std::move(pOr);
+    }
+    return pNode;
 }
 
-int CScriptEngine::getOnOffParam(const tstr& param)
+CCompiledCondition::PCondNode CCompiledCondition::parseAnd(const tstr& S, int& pos)
 {
-    if ( param.IsEmpty() )
-        return PARAM_EMPTY; // no param
-    
-    if ( param == _T("1") )
-        return PARAM_ON;
+    PCondNode pNode = parseUnary(S, pos);
+    while ( pNode )
+    {
+        skipTabSpaces(S, pos);
+        if ( S.GetAt(pos) != _T('&') || S.GetAt(pos + 1) != _T('&') )
+            break;
 
-    if ( param == _T("0") )
-        return PARAM_OFF;
+        pos += 2;
+        PCondNode pRight = parseUnary(S, pos);
+        if ( !pRight )
+            return PCondNode();
 
-    if ( param == _T("?") )
-        return PARAM_KEEP;
+        PCondNode pAnd(new tCondNode(NODE_AND));
+        pAnd->pLeft = std::move(pNode);
+        pAnd->pRight = std::move(pRight);
+        pNode = std::move(pAnd);
+    }
+    return pNode;
+}
 
-    if ( param == _T("+") )
-        return PARAM_ENABLE;
+CCompiledCondition::PCondNode CCompiledCondition::parseUnary(const tstr& S, int& pos)
+{
+    skipTabSpaces(S, pos);
+    if ( pos >= S.length() )
+        return PCondNode();
 
-    if ( param == _T("-") )
-        return PARAM_DISABLE;
+    // "!" is NOT only when followed by a space or '(', otherwise
+    // it is a character of the operand, as in "if !a == !b"
+    const TCHAR ch = S.GetAt(pos);
+    const TCHAR chNext = S.GetAt(pos + 1);
+    if ( ch == _T('!') && (chNext == _T(' ') || chNext == _T('\t') || chNext == _T('(')) )
+    {
+        ++pos;
+        PCondNode pOperand = parseUnary(S, pos);
+        if ( !pOperand )
+            return PCondNode();
 
-    tstr S = param;
-    NppExecHelpers::StrUpper(S);
+        PCondNode pNot(new tCondNode(NODE_NOT));
+        pNot->pLeft = std::move(pOperand);
+        return pNot;
+    }
 
-    if ( (S == _T("ON")) || (S == _T("TRUE")) )
-        return PARAM_ON;
+    if ( ch == _T('(') )
+    {
+        ++pos;
+        PCondNode pNode = parseOr(S, pos);
+        if ( !pNode )
+            return PCondNode();
 
-    if ( (S == _T("OFF")) || (S == _T("FALSE")) )
-        return PARAM_OFF;
+        skipTabSpaces(S, pos);
+        if ( S.GetAt(pos) != _T(')') )
+            return PCondNode();
 
-    if ( S == _T("KEEP") )
-        return PARAM_KEEP;
+        ++pos;
+        return pNode;
+    }
 
-    if ( S == _T("ENABLE") )
-        return PARAM_ENABLE;
+    const int end = findComparisonEnd(S, pos);
+    tstr comparison;
+    comparison.Copy( S.c_str() + pos, end - pos );
+    NppExecHelpers::StrDelTrailingTabSpaces(comparison);
+    pos = end;
+    return compileComparison(comparison);
+}
 
-    if ( S == _T("DISABLE") )
-        return PARAM_DISABLE;
+CCompiledCondition::PCondNode CCompiledCondition::compileComparison(const tstr& S)
+{
+    tstr op1, cond, op2;
+    const int condType = splitComparison(S, op1, cond, op2);
+    if ( condType == COND_NONE )
+        return PCondNode();
 
-    return PARAM_UNKNOWN; // unknown
+    // As the original quotes around op1 and op2 are kept (if any),
+    // we treat "123" as a string and 123 as a number
+    PCondNode pNode(new tCondNode(NODE_COMPARE));
+    pNode->nCondType = condType;
+    pNode->sCond = cond;
+    pNode->pOp1.reset( new tCondOperand(op1) );
+    pNode->pOp2.reset( new tCondOperand(op2) );
+    return pNode;
 }
 
-bool CScriptEngine::isCommentOrEmpty(CNppExec* pNppExec, tstr& Cmd)
+int CCompiledCondition::findComparisonEnd(const tstr& S, int pos)
 {
-    const tstr comment = pNppExec->GetOptions().GetStr(OPTS_COMMENTDELIMITER);
-    if (comment.length() > 0)
+    // the comparison ends with "&&", "||" or unpaired ')'
+    // that are not inside of "..." or $(...)
+    const int len = S.length();
+    int  macroDepth = 0;
+    int  parenDepth = 0;
+    bool isInQuotes = false;
+    for ( ; pos < len; ++pos )
     {
-        int i = Cmd.Find(comment.c_str()); // comment
-        if ((i >= 0) && 
-            ((comment != _T("//")) || (Cmd.GetAt(i-1) != _T(':')))) // skip :// e.g. http://
+        const TCHAR ch = S.GetAt(pos);
+        if ( isInQuotes )
         {
-            Cmd.Delete(i, -1); // delete all after "//"
-
-            Runtime::GetLogger().AddEx( _T("; comment removed: everything after %s"), comment.c_str() );
-
+            if ( ch == _T('\"') )
+                isInQuotes = false;
+        }
+        else if ( ch == _T('\"') )
+        {
+            isInQuotes = true;
+        }
+        else if ( macroDepth != 0 )
+        {
+            if ( ch == _T('(') )
+                ++macroDepth;
+            else if ( ch == _T(')') )
+                --macroDepth;
+        }
+        else if ( ch == _T('$') && S.GetAt(pos + 1) == _T('(') )
+        {
+            macroDepth = 1;
+            ++pos;
+        }
+        else if ( ch == _T('(') )
+        {
+            ++parenDepth;
+        }
+        else if ( ch == _T(')') )
+        {
+            if ( parenDepth == 0 )
+                break;
+            --parenDepth;
+        }
+        else if ( parenDepth == 0 && 
+                  ((ch == _T('&') && S.GetAt(pos + 1) == _T('&')) || 
+                   (ch == _T('|') && S.GetAt(pos + 1) == _T('|'))) )
+        {
+            break;
         }
     }
-  
-    NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
-    NppExecHelpers::StrDelTrailingTabSpaces(Cmd);
+    return pos;
+}
 
-    return Cmd.IsEmpty();
+void CCompiledCondition::skipTabSpaces(const tstr& S, int& pos)
+{
+    while ( pos < S.length() && NppExecHelpers::IsTabSpaceChar(S.GetAt(pos)) )
+    {
+        ++pos;
+    }
 }
 
-void CScriptEngine::errorCmdNotEnoughParams(const TCHAR* cszCmd, const TCHAR* cszErrorMessage)
+bool CCompiledCondition::Evaluate(CScriptEngine* pScriptEngine) const
 {
-    if ( cszErrorMessage )
-        Runtime::GetLogger().AddEx( _T("; %s"), cszErrorMessage );
-    else
-        Runtime::GetLogger().Add(   _T("; argument(s) expected, but none given") );
+    Runtime::GetLogger().Add(   _T("IsConditionTrue()") );
+    Runtime::GetLogger().Add(   _T("{") );
+    Runtime::GetLogger().IncIndentLevel();
 
-    tstr Cmd = cszCmd;
-    tstr Err = Cmd;
-    Err += _T(':');
-    m_pNppExec->GetConsole().PrintMessage( Err.c_str(), false );
-    NppExecHelpers::StrLower(Cmd);
-    Err.Format( 250, _T("- %s; type \"help %s\" for help"), cszErrorMessage ? cszErrorMessage : _T("empty command (no parameters given)"), Cmd.c_str() );
-    m_pNppExec->GetConsole().PrintError( Err.c_str() );
+    const bool ret = evaluateNode(pScriptEngine, *m_pRoot);
 
-    m_nCmdType = CMDTYPE_UNKNOWN;
+    Runtime::GetLogger().DecIndentLevel();
+    Runtime::GetLogger().Add(   _T("}") );
+
+    return ret;
 }
 
-void CScriptEngine::errorCmdNoParam(const TCHAR* cszCmd)
+bool CCompiledCondition::evaluateNode(CScriptEngine* pScriptEngine, const tCondNode& node)
 {
-    errorCmdNotEnoughParams(cszCmd, NULL);
+    switch ( node.nType )
+    {
+        case NODE_NOT:
+            return !evaluateNode(pScriptEngine, *node.pLeft);
+
+        case NODE_AND:
+            return ( evaluateNode(pScriptEngine, *node.pLeft) && evaluateNode(pScriptEngine, *node.pRight) );
+
+        case NODE_OR:
+            return ( evaluateNode(pScriptEngine, *node.pLeft) || evaluateNode(pScriptEngine, *node.pRight) );
+
+        default:
+            break;
+    }
+
+    const tstr emptyOp;
+    CondOperand substitutedOp1(emptyOp);
+    CondOperand substitutedOp2(emptyOp);
+    const CondOperand& co1 = getOperand(pScriptEngine, *node.pOp1, substitutedOp1);
+    const CondOperand& co2 = getOperand(pScriptEngine, *node.pOp2, substitutedOp2);
+
+    if ( Runtime::GetLogger().IsLogging() )
+    {
+        Runtime::GetLogger().AddEx( _T("op1 (%s) :  %s"), co1.type_as_str(), co1.value_str().c_str() );
+        Runtime::GetLogger().AddEx( _T("op2 (%s) :  %s"), co2.type_as_str(), co2.value_str().c_str() );
+        Runtime::GetLogger().AddEx( _T("condition :  %s"), node.sCond.c_str() );
+    }
+
+    bool ret = false;
+    if ( (co1.type() == DNT_NOTNUMBER) || (co2.type() == DNT_NOTNUMBER) )
+    {
+        // compare as string values
+        ret = OperandComparator<tstr>(co1.value_str(), co2.value_str()).compare(node.nCondType);
+    }
+    else if ( (co1.type() == DNT_FLOATNUMBER) || (co2.type() == DNT_FLOATNUMBER) )
+    {
+        // compare as floating-point values
+        ret = OperandComparator<double>(co1.value_dbl(), co2.value_dbl()).compare(node.nCondType);
+    }
+    else
+    {
+        // compare as integer values
+        ret = OperandComparator<__int64>(co1.value_int64(), co2.value_int64()).compare(node.nCondType);
+    }
+    return ret;
 }
 
-void CScriptEngine::messageConsole(const TCHAR* cszCmd, const TCHAR* cszParams)
+const CondOperand& CCompiledCondition::getOperand(CScriptEngine* pScriptEngine, const tCondOperand& op, CondOperand& substitutedOp)
 {
-    tstr S = cszCmd;
-    S += _T(": ");
-    S += cszParams;
-    m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+    if ( !op.hasMacroVars )
+        return op.value;
+
+    tstr S = op.value.value_str();
+    const CStrSplitT<TCHAR> args;
+    CNppExecMacroVars& MacroVars = pScriptEngine->GetNppExec()->GetMacroVars();
+    MacroVars.CheckCmdArgs(S, args);
+    MacroVars.CheckAllMacroVars(pScriptEngine, S, true);
+    NppExecHelpers::StrDelLeadingTabSpaces(S);
+    NppExecHelpers::StrDelTrailingTabSpaces(S);
+
+    substitutedOp = CondOperand(S);
+    return substitutedOp;
 }
 
-bool CScriptEngine::reportCmdAndParams(const TCHAR* cszCmd, const tstr& params, unsigned int uFlags)
+bool CScriptEngine::isConditionTrue(const tstr& Condition, bool* pHasSyntaxError)
 {
-    if ( params.IsEmpty() )
+    if ( pHasSyntaxError )  *pHasSyntaxError = false;
+
+    std::shared_ptr<const CCompiledCondition> pCondition;
+    const CListItemT<tstr>* pCmdItem = m_execState.pScriptLineCurrent;
+    tCompiledConditions::const_iterator itr = m_CompiledConditions.find(pCmdItem);
+    if ( itr != m_CompiledConditions.end() && itr->second.sCondition == Condition )
     {
-        if ( uFlags & fReportEmptyParam )
-            errorCmdNoParam(cszCmd);
+        pCondition = itr->second.pCondition;
 
-        if ( uFlags & fFailIfEmptyParam )
-            return false;
-    
-        Runtime::GetLogger().AddEx( _T("; executing: %s"), cszCmd );
-        m_sLoggedCmd.Format( 1020, _T("; executing: %.960s"), cszCmd );
+        Runtime::GetLogger().Add(   _T("; using the compiled condition") );
     }
     else
     {
-        Runtime::GetLogger().AddEx( _T("; executing: %s %s"), cszCmd, params.c_str() );
-        m_sLoggedCmd.Format( 1020, _T("; executing: %.480s %.480s"), cszCmd, params.c_str() );
+        pCondition = CCompiledCondition::Compile(Condition);
+
+        tCompiledCondition& compiledCondition = m_CompiledConditions[pCmdItem];
+        compiledCondition.sCondition = Condition;
+        compiledCondition.pCondition = pCondition;
+    }
+
+    if ( !pCondition && CNppExecMacroVars::ContainsMacroVar(Condition) )
+    {
+        // e.g. "$(COND)" or "$(X) $(OP) $(Y)": the comparison itself
+        // comes from macro-vars, so it can be compiled only after
+        // the substitution
+        tstr S = Condition;
+        const CStrSplitT<TCHAR> args;
+        m_pNppExec->GetMacroVars().CheckCmdArgs(S, args);
+        m_pNppExec->GetMacroVars().CheckAllMacroVars(this, S, true);
+        if ( !CNppExecMacroVars::ContainsMacroVar(S) )
+            pCondition = CCompiledCondition::Compile(S);
+    }
+
+    if ( !pCondition )
+    {
+        if ( pHasSyntaxError )  *pHasSyntaxError = true;
+        return false;
+    }
+
+    return pCondition->Evaluate(this);
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoIf(const tstr& params)
+{
+    return doIf(params, false);
+}
+
+CScriptEngine::eCmdResult CScriptEngine::doIf(const tstr& params, bool isElseIf)
+{
+    enum eIfMode {
+        IF_GOTO = 0,
+        IF_THEN
+    };
+
+    if ( !reportCmdAndParams( DoIfCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    tstr paramsUpperCase = params;
+    NppExecHelpers::StrUpper(paramsUpperCase);
+
+    static const TCHAR* arrGoTo[] = {
+        _T(" GOTO "),
+        _T("\tGOTO\t"),
+        _T("\tGOTO "),
+        _T(" GOTO\t")
+    };
+
+    static const TCHAR* arrThen[] = {
+        _T(" THEN"),
+        _T("\tTHEN")
+    };
+
+    int mode = IF_GOTO;
+    int n = -1;
+    for ( const TCHAR* const& i : arrGoTo )
+    {
+        n = paramsUpperCase.RFind(i);
+        if ( n >= 0 )
+            break;
+    }
+
+    if ( n < 0 )
+    {
+        if ( paramsUpperCase.EndsWith(_T(" GOTO")) || paramsUpperCase.EndsWith(_T("\tGOTO")) )
+        {
+            ScriptError( ET_UNPREDICTABLE, _T("- Empty goto-label specified.") );
+            return CMDRESULT_INVALIDPARAM;
+        }
+
+        mode = IF_THEN;
+        for ( const TCHAR* const& i : arrThen )
+        {
+            n = paramsUpperCase.RFind(i);
+            if ( n >= 0 )
+                break;
+        }
+
+        if ( n < 0 )
+            Runtime::GetLogger().Add(   _T("- no \"goto\" or \"then\" specified, assuming \"then\"") );
+    }
+
+    tstr ifCondition;
+    ifCondition.Copy( params.c_str(), n );
+    NppExecHelpers::StrDelLeadingTabSpaces(ifCondition);
+    NppExecHelpers::StrDelTrailingTabSpaces(ifCondition);
+
+    if ( ifCondition.IsEmpty() )
+    {
+        ScriptError( ET_UNPREDICTABLE, _T("- Empty if-condition specified.") );
+        return CMDRESULT_INVALIDPARAM;
+    }
+
+    tstr labelName;
+
+    if ( mode == IF_GOTO )
+    {
+        labelName.Copy( params.c_str() + n + 6 );
+        if ( CNppExecMacroVars::ContainsMacroVar(labelName) )
+        {
+            const CStrSplitT<TCHAR> args;
+            m_pNppExec->GetMacroVars().CheckCmdArgs(labelName, args);
+            m_pNppExec->GetMacroVars().CheckAllMacroVars(this, labelName, true);
+        }
+        NppExecHelpers::StrDelLeadingTabSpaces(labelName);
+        NppExecHelpers::StrDelTrailingTabSpaces(labelName);
+        NppExecHelpers::StrUpper(labelName);
+
+        if ( labelName.IsEmpty() )
+        {
+            ScriptError( ET_UNPREDICTABLE, _T("- Empty goto-label specified.") );
+            return CMDRESULT_INVALIDPARAM;
+        }
+    }
+
+    bool hasSyntaxError = false;
+    bool isConditionOK = isConditionTrue(ifCondition, &hasSyntaxError);
+
+    if ( hasSyntaxError )
+    {
+        ScriptError( ET_UNPREDICTABLE, _T("- Syntax error in the if-condition.") );
+        return CMDRESULT_FAILED;
     }
 
-    if ( uFlags & fMessageToConsole )
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    if ( mode == IF_GOTO )
+    {
+        if ( isConditionOK )
+        {
+
+            Runtime::GetLogger().Add(   _T("; The condition is true.") );
+
+            DoGoTo(labelName);
+        }
+        else
+        {
+
+            Runtime::GetLogger().Add(   _T("; The condition is false; proceeding to next line") );
+
+            if ( !isElseIf )
+                currentScript.PushIfState(IF_MAYBE_ELSE); // ELSE may appear after IF ... GOTO
+            else
+                currentScript.SetIfState(IF_MAYBE_ELSE);
+        }
+    }
+    else // IF_THEN
     {
-        if ( params.length() > MAX_VAR_LENGTH2SHOW )
+        if ( isConditionOK )
         {
-            tstr S;
 
-            S.Append( params.c_str(), MAX_VAR_LENGTH2SHOW - 5 );
-            S += _T("(...)");
-            messageConsole( cszCmd, S.c_str() );
+            Runtime::GetLogger().Add(   _T("; The condition is true; executing lines under the IF") );
+
+            if ( !isElseIf )
+                currentScript.PushIfState(IF_EXECUTING);
+            else
+                currentScript.SetIfState(IF_EXECUTING);
         }
         else
         {
-            if ( params.IsEmpty() )
-                m_pNppExec->GetConsole().PrintMessage( cszCmd );
+
+            Runtime::GetLogger().Add(   _T("; The condition is false; waiting for ELSE or ENDIF") );
+
+            if ( !isElseIf )
+                currentScript.PushIfState(IF_WANT_ELSE);
             else
-                messageConsole( cszCmd, params.c_str() );
+                currentScript.SetIfState(IF_WANT_ELSE);
         }
     }
 
-    return true;
+    return CMDRESULT_SUCCEEDED;
 }
 
-void CScriptEngine::updateFocus()
+CScriptEngine::tLoopState* CScriptEngine::enterLoop(ScriptContext& currentScript, eCmdType loopCmdType)
 {
-    if ( (!m_pNppExec->m_hFocusedWindowBeforeScriptStarted) ||
-         (m_pNppExec->m_hFocusedWindowBeforeScriptStarted == m_pNppExec->GetConsole().GetConsoleWnd()) ||
-         (m_pNppExec->m_hFocusedWindowBeforeScriptStarted == m_pNppExec->GetConsole().GetDialogWnd()) ||
-         (m_pNppExec->m_hFocusedWindowBeforeScriptStarted == m_pNppExec->GetScintillaHandle()) )
+    CListItemT<tstr>* pLoopBegin = m_execState.pScriptLineCurrent;
+    tLoopJumps::const_iterator itrEnd = currentScript.LoopJumpToEnd.find(pLoopBegin);
+    if ( itrEnd == currentScript.LoopJumpToEnd.end() )
     {
-        ::SendMessage( m_pNppExec->GetScintillaHandle(), WM_SETFOCUS, 0, 0 );
-        m_pNppExec->m_hFocusedWindowBeforeScriptStarted = m_pNppExec->GetScintillaHandle();
+        ScriptError( ET_UNPREDICTABLE, (loopCmdType == CMDTYPE_WHILE) ? 
+          _T("- WHILE without ENDWHILE.") : _T("- FOR without ENDFOR.") );
+        return NULL;
     }
-}
 
-CScriptEngine::eCmdResult CScriptEngine::Do(const tstr& params)
-{
-    if ( params.IsEmpty() )
+    // the same loop is entered again (e.g. GOTO from inside the loop):
+    // its previous state and the states of its inner loops are not needed
+    CListT<tLoopState>& LoopState = currentScript.LoopState;
+    for ( CListItemT<tLoopState>* pItem = LoopState.GetFirst(); pItem; pItem = pItem->GetNext() )
     {
-        return CMDRESULT_INVALIDPARAM;
+        if ( pItem->GetItem().pLoopBegin == pLoopBegin )
+        {
+            while ( LoopState.GetLast() != pItem )
+            {
+                LoopState.DeleteLast();
+            }
+            LoopState.DeleteLast();
+            break;
+        }
     }
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-
-    Runtime::GetLogger().AddEx( _T("; about to start a child process: \"%s\""), params.c_str() );
-    m_sLoggedCmd.Format( 1020, _T("; about to start a child process: \"%.960s\""), params.c_str() );
+    tLoopState loopState;
+    loopState.pLoopBegin = pLoopBegin;
+    loopState.pLoopEnd = itrEnd->second;
+    loopState.nIfDepth = currentScript.GetIfDepth();
+    loopState.nIterations = 0;
+    loopState.isIterating = false;
+    loopState.isBreaking = false;
+    loopState.nValue = 0;
+    loopState.nLastValue = 0;
+    loopState.nStep = 0;
+    LoopState.Add(loopState);
 
-    m_pNppExec->GetConsole().PrintMessage( params.c_str() );
+    return &LoopState.GetLast()->GetItem();
+}
 
-    std::shared_ptr<CChildProcess> proc(new CChildProcess(this));
-    m_execState.pChildProcess = proc;
-    // Note: proc->Create() does not return until the child process exits
-    if ( proc->Create(m_pNppExec->GetConsole().GetDialogWnd(), params.c_str()) )
+CScriptEngine::tLoopState* CScriptEngine::getLoopStateByEnd(ScriptContext& currentScript, eCmdType endCmdType)
+{
+    CListT<tLoopState>& LoopState = currentScript.LoopState;
+    CListItemT<tLoopState>* pItem = LoopState.GetLast();
+    while ( pItem && (pItem->GetItem().pLoopEnd != m_execState.pScriptLineCurrent) )
     {
-        Runtime::GetLogger().Add(   _T("; child process finished") );
+        pItem = pItem->GetPrev();
     }
-    else
-    {
-        Runtime::GetLogger().Add(   _T("; failed to start a child process") );
 
-        nCmdResult = CMDRESULT_FAILED;
+    if ( !pItem )
+    {
+        ScriptError( ET_UNPREDICTABLE, (endCmdType == CMDTYPE_ENDWHILE) ? 
+          _T("- Unexpected ENDWHILE found, without preceding WHILE.") : 
+          _T("- Unexpected ENDFOR found, without preceding FOR.") );
+        return NULL;
     }
 
-    TCHAR szExitCode[50];
-    c_base::_tint2str(proc->GetExitCode(), szExitCode);
+    // inner loops left via GOTO
+    while ( LoopState.GetLast() != pItem )
+    {
+        LoopState.DeleteLast();
+    }
 
-    tstr varName = MACRO_EXITCODE;
-    m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, szExitCode, CNppExecMacroVars::svLocalVar ); // local var
+    return &pItem->GetItem();
+}
 
-    if ( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_SETOUTPUTVAR) )
+void CScriptEngine::leaveLoopsByGoTo(ScriptContext& currentScript, const CListItemT<tstr>* pGoToLine)
+{
+    // BREAK and CONTINUE use the last loop state, so the states of the loops
+    // left via GOTO are removed here; an outer loop contains its inner loops
+    CListT<tLoopState>& LoopState = currentScript.LoopState;
+    CListItemT<tLoopState>* pLastLoopItem;
+    while ( (pLastLoopItem = LoopState.GetLast()) != NULL )
     {
-        tstr& OutputVar = proc->GetOutput();
-        if ( OutputVar.GetLastChar() == _T('\n') )
-            OutputVar.SetSize(OutputVar.length() - 1);
-        if ( OutputVar.GetFirstChar() == _T('\n') )
-            OutputVar.Delete(0, 1);
-        
-        // $(OUTPUT)
-        varName = MACRO_OUTPUT;
-        m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, OutputVar, CNppExecMacroVars::svLocalVar ); // local var
+        const tLoopState& loopState = pLastLoopItem->GetItem();
+        if ( pGoToLine == loopState.pLoopBegin )
+            return; // the loop is entered again, see enterLoop()
 
-        // $(OUTPUTL)
-        varName = MACRO_OUTPUTL;
-
-        int i = OutputVar.RFind( _T('\n') );
-        if ( i >= 0 )
+        for ( const CListItemT<tstr>* p = loopState.pLoopBegin->GetNext(); p != NULL; p = p->GetNext() )
         {
-            tstr varValue;
-
-            ++i;
-            varValue.Copy( OutputVar.c_str() + i, OutputVar.length() - i );
-            m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, varValue, CNppExecMacroVars::svLocalVar ); // local var
+            if ( p == pGoToLine )
+                return; // inside this loop
+            if ( p == loopState.pLoopEnd )
+                break;
         }
-        else
-            m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, OutputVar, CNppExecMacroVars::svLocalVar ); // local var
-
-        // $(OUTPUT1)
-        varName = MACRO_OUTPUT1;
 
-        i = OutputVar.Find( _T('\n') );
-        if ( i >= 0 )
-        {
-            tstr varValue;
+        Runtime::GetLogger().Add(   _T("; GOTO leaves the loop") );
 
-            varValue.Copy( OutputVar.c_str(), i );
-            m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, varValue, CNppExecMacroVars::svLocalVar ); // local var
-        }
-        else
-            m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, OutputVar, CNppExecMacroVars::svLocalVar ); // local var
+        LoopState.DeleteLast();
     }
-
-    m_execState.pChildProcess.reset();
-
-    return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoCd(const tstr& params)
+bool CScriptEngine::jumpToLoopEnd(tLoopState& loopState, bool isBreaking)
 {
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    TCHAR szPath[FILEPATH_BUFSIZE];
+    if ( m_execState.pScriptLineNext != INVALID_TSTR_LIST_ITEM )
+        return false; // GOTO or the script is being stopped
 
-    reportCmdAndParams( DoCdCommand::Name(), params, fMessageToConsole );
-
-    // changing current directory
+    // ENDWHILE or ENDFOR either leaves the loop or starts the next iteration
+    loopState.isBreaking = isBreaking;
+    m_execState.SetScriptLineNext(loopState.pLoopEnd);
 
-    if ( params.length() > 0 )
+    if ( Runtime::GetLogger().IsLogging() )
     {
-        if ( ((params[0] == _T('\\')) && (params.GetAt(1) != _T('\\'))) || 
-            ((params[0] == _T('/')) && (params.GetAt(1) != _T('/'))) )
-        {
-            // root directory of current drive e.g. 'C:\', 'D:\' etc.
-            GetCurrentDirectory( FILEPATH_BUFSIZE - 1, szPath );
-            if ( szPath[1] == _T(':') )
-            {
-                szPath[2] = _T('\\');
-                szPath[3] = 0;
-              
-                Runtime::GetLogger().AddEx( _T("; changed to \"%s%s\""), szPath, params.c_str() + 1 );
-              
-                nCmdResult = SetCurrentDirectory( szPath ) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
-                if ( params[1] )
-                {
-                    nCmdResult = SetCurrentDirectory( params.c_str() + 1 ) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
-                }
-            }
-        }
-        else
-        {
-            int ofs = 0;
-
-            if ( (params[1] == _T(':')) && 
-                 (params[2] == _T('\\') || params[2] == _T('/')) && 
-                 (params[3] != 0) )
-            {
-                // changing the drive
-                szPath[0] = params[0];
-                szPath[1] = params[1];
-                szPath[2] = 0;
-                nCmdResult = SetCurrentDirectory( szPath ) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
-                ofs = 2;
-            }
-            if ( nCmdResult == CMDRESULT_SUCCEEDED ) // the same drive or successfully changed
-            {
-                // set current directory
-                nCmdResult = SetCurrentDirectory( params.c_str() + ofs ) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
-                if ( nCmdResult == CMDRESULT_FAILED )
-                {
-                    // trying to set the parent directory at least...
-                    // (and nCmdResult is still CMDRESULT_FAILED)
-                    for ( int i = params.length() - 1; i > ofs; i-- )
-                    {
-                        if ( params[i] == _T('\\') || params[i] == _T('/') )
-                        {
-                            lstrcpyn( szPath, params.c_str() + ofs, i - ofs + 1 );
-                            szPath[i - ofs + 1] = 0;
-                            SetCurrentDirectory( szPath );
-                            break;
-                        }
-                    }
-                }
-            }
-        }
+        Runtime::GetLogger().AddEx( _T("; Jumping to command item p = 0x%X { \"%s\" }"),
+            m_execState.pScriptLineNext, m_execState.pScriptLineNext->GetItem().c_str() );
     }
-    GetCurrentDirectory( FILEPATH_BUFSIZE - 1, szPath );
-    tstr S = _T("Current directory: ");
-    S += szPath;
-    m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
-
-    return nCmdResult;
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoCls(const tstr& /*params*/)
-{
-    m_pNppExec->GetConsole().ClearText();
 
-    return CMDRESULT_SUCCEEDED;
+    return true;
 }
 
-static BOOL getColorFromStr(const TCHAR* szColor, COLORREF* pColor)
+static void setLoopVar(CScriptEngine* pScriptEngine, CScriptEngine::tLoopState& loopState)
 {
-    if ( szColor && *szColor )
+    if ( loopState.pItems )
     {
-        c_base::byte_t bt[4];
-
-        int n = c_base::_thexstr2buf( szColor, bt, 4 );
-        if ( n >= 3 )
-        {
-            *pColor = RGB( bt[0], bt[1], bt[2] );
-            return TRUE;
-        }
-
-        if ( n <= 1 )
-        {
-            if ( szColor[0] == _T('0') && szColor[1] == 0 )
-            {
-                *pColor = 0; // handle "0" as correct default value
-                return TRUE;
-            }
-        }
+        // FOR EACH: the items are not affected by modifications of the array inside the loop
+        pScriptEngine->GetNppExec()->GetMacroVars().SetUserMacroVar( pScriptEngine, loopState.sVarName, loopState.pItems->Values[static_cast<size_t>(loopState.nValue)], CNppExecMacroVars::svLocalVar ); // local var
+        return;
     }
 
-    return FALSE;
+    TCHAR szValue[3*sizeof(__int64) + 2];
+    c_base::_tint64_to_str(loopState.nValue, szValue);
+
+    // sVarName is normalized by SetUserMacroVar on the first call
+    pScriptEngine->GetNppExec()->GetMacroVars().SetUserMacroVar( pScriptEngine, loopState.sVarName, szValue, CNppExecMacroVars::svLocalVar ); // local var
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoConColour(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoWhile(const tstr& params)
 {
-    reportCmdAndParams( DoConColourCommand::Name(), params, fMessageToConsole );
-
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    if ( !reportCmdAndParams( DoWhileCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-    if ( params.length() > 0 )
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    tLoopState* pLoopState = NULL;
+    CListItemT<tLoopState>* pLastLoopItem = currentScript.LoopState.GetLast();
+    if ( pLastLoopItem && 
+         pLastLoopItem->GetItem().isIterating &&
+         pLastLoopItem->GetItem().pLoopBegin == m_execState.pScriptLineCurrent )
     {
-        tstr colorParams = params;
-        NppExecHelpers::StrUpper(colorParams);
-
-        const int posFG = colorParams.Find(_T("FG"));
-        const int posBG = colorParams.Find(_T("BG"));
+        // ENDWHILE -> WHILE
+        pLoopState = &pLastLoopItem->GetItem();
+        pLoopState->isIterating = false;
 
-        if ( posFG >= 0 )
+        // each loop has its own limit, GOTOs are not counted here
+        if ( ++pLoopState->nIterations > m_execState.nGoToMaxCount )
         {
-            tstr colorFG;
-            int n = (posBG > posFG) ? (posBG - posFG) : (colorParams.length() - posFG);
-            
-            colorFG.Append(colorParams.c_str() + posFG, n);
-            n = colorFG.Find(_T('='));
-            if ( n >= 0 )
-            {
-                COLORREF color;
+            TCHAR szMsg[240];
 
-                colorFG.Delete(0, n + 1);
-                NppExecHelpers::StrDelLeadingTabSpaces(colorFG);
-                NppExecHelpers::StrDelTrailingTabSpaces(colorFG);
-                if ( (!colorFG.IsEmpty()) && getColorFromStr(colorFG.c_str(), &color) )
-                {
-                    m_pNppExec->GetConsole().SetCurrentColorTextNorm(color);
-                }
-                else
-                {
-                    ScriptError( ET_REPORT, _T("- incorrect value of \'FG\'") );
-                    nCmdResult = CMDRESULT_INVALIDPARAM;
-                }
-            }
-            else
-            {
-                ScriptError( ET_REPORT, _T("- \'FG\' found, but no value specified") );
-                nCmdResult = CMDRESULT_INVALIDPARAM;
+            pLoopState->nIterations = 0;
+            ::wsprintf(szMsg, 
+                _T("%s was performed more than %d times.\n") \
+                _T("Abort execution of this script?\n") \
+                _T("(Press Yes to abort or No to continue execution)"),
+                DoWhileCommand::Name(),
+                m_execState.nGoToMaxCount
+            );
+            if (::MessageBox(m_pNppExec->m_nppData._nppHandle, szMsg, 
+                    _T("NppExec Warning: Possible infinite loop"),
+                      MB_YESNO | MB_ICONWARNING) != IDNO)
+            {
+                ScriptError( ET_ABORT, _T("; Script execution aborted by user (from DoWhile())") );
+                return CMDRESULT_FAILED;
             }
         }
+    }
+    else
+    {
+        pLoopState = enterLoop(currentScript, CMDTYPE_WHILE);
+        if ( !pLoopState )
+            return CMDRESULT_FAILED;
+    }
 
-        if ( posBG >= 0 )
-        {
-            tstr colorBG;
-            int n = (posFG > posBG) ? (posFG - posBG) : (colorParams.length() - posBG);
+    bool hasSyntaxError = false;
+    bool isConditionOK = isConditionTrue(params, &hasSyntaxError);
 
-            colorBG.Append(colorParams.c_str() + posBG, n);
-            n = colorBG.Find(_T('='));
-            if ( n >= 0 )
-            {
-                COLORREF color;
+    if ( hasSyntaxError )
+    {
+        ScriptError( ET_UNPREDICTABLE, _T("- Syntax error in the while-condition.") );
+        return CMDRESULT_FAILED;
+    }
 
-                colorBG.Delete(0, n + 1);
-                NppExecHelpers::StrDelLeadingTabSpaces(colorBG);
-                NppExecHelpers::StrDelTrailingTabSpaces(colorBG);
-                if ( (!colorBG.IsEmpty()) && getColorFromStr(colorBG.c_str(), &color) )
-                {
-                    m_pNppExec->GetConsole().SetCurrentColorBkgnd(color);
-                    m_pNppExec->GetConsole().UpdateColours();
-                }
-                else
-                {
-                    ScriptError( ET_REPORT, _T("- incorrect value of \'BG\'") );
-                    nCmdResult = CMDRESULT_INVALIDPARAM;
-                }
-            }
-            else
-            {
-                ScriptError( ET_REPORT, _T("- \'BG\' found, but no value specified") );
-                nCmdResult = CMDRESULT_INVALIDPARAM;
-            }
-        }
+    if ( isConditionOK )
+    {
+
+        Runtime::GetLogger().Add(   _T("; The condition is true; executing lines under the WHILE") );
 
-        if ( (posFG < 0) && (posBG < 0) )
-        {
-            tstr Err = _T("- unknown parameter: ");
-            Err += params;
-            ScriptError( ET_REPORT, Err.c_str() );
-            nCmdResult = CMDRESULT_INVALIDPARAM;
-        }
     }
     else
     {
-        tstr S;
-        TCHAR buf[16];
-        COLORREF color;
 
-        color = m_pNppExec->GetConsole().GetCurrentColorTextNorm();
-        buf[0] = 0;
-        c_base::_tbuf2hexstr( (const c_base::byte_t*) &color, 3, buf, 16, _T(" ") );
-        S = _T("Foreground (text) colour:  ");
-        S += buf;
-        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+        Runtime::GetLogger().Add(   _T("; The condition is false; leaving the loop") );
 
-        color = m_pNppExec->GetConsole().GetCurrentColorBkgnd();
-        buf[0] = 0;
-        c_base::_tbuf2hexstr( (const c_base::byte_t*) &color, 3, buf, 16, _T(" ") );
-        S = _T("Background colour:         ");
-        S += buf;
-        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+        jumpToLoopEnd(*pLoopState, true);
+    }
+
+    return CMDRESULT_SUCCEEDED;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoEndWhile(const tstr& params)
+{
+    reportCmdAndParams( DoEndWhileCommand::Name(), params, fMessageToConsole );
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+    if ( !params.IsEmpty() )
+    {
+        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
+
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    tLoopState* pLoopState = getLoopStateByEnd(currentScript, CMDTYPE_ENDWHILE);
+    if ( !pLoopState )
+        return CMDRESULT_FAILED;
+
+    currentScript.RestoreIfDepth(pLoopState->nIfDepth);
+
+    if ( pLoopState->isBreaking )
+    {
+
+        Runtime::GetLogger().Add(   _T("; WHILE ... ENDWHILE found, done") );
+
+        currentScript.LoopState.DeleteLast();
+    }
+    else if ( m_execState.pScriptLineNext == INVALID_TSTR_LIST_ITEM )
+    {
+        pLoopState->isIterating = true;
+        m_execState.SetScriptLineNext(pLoopState->pLoopBegin);
+
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( _T("; Jumping to command item p = 0x%X { \"%s\" }"),
+                m_execState.pScriptLineNext, m_execState.pScriptLineNext->GetItem().c_str() );
+        }
     }
 
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoConFilter(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoFor(const tstr& params)
 {
-    if ( !reportCmdAndParams( DoConFilterCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+    if ( !reportCmdAndParams( DoForCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
         return CMDRESULT_INVALIDPARAM;
 
-    // +(-)i1..5    Include
-    // +(-)x1..5    eXclude
-    // +(-)fr1..4   Find+Replace (case-insensitive)
-    // +(-)frc1..4  Find+Replace (match case)
-    // +(-)h1..10   Highlight
+    {
+        // FOR EACH <var> IN <arr>
+        CStrSplitT<TCHAR> args;
+        if ( (args.SplitToArgs(params) == 4) &&
+             (NppExecHelpers::StrCmpNoCase(args.GetArg(0), _T("EACH")) == 0) &&
+             (NppExecHelpers::StrCmpNoCase(args.GetArg(2), _T("IN")) == 0) )
+        {
+            return doForEach(args.GetArg(1), args.GetArg(3));
+        }
+    }
 
-    enum eOptionState {
-        stateUnknown = 0,
-        stateOn,
-        stateOff
-    };
+    // FOR <var> = <a> TO <b> [STEP <s>]
+    tstr varName;
+    tstr forRange;
+    const int n = params.Find(_T("="));
+    if ( n > 0 )
+    {
+        varName.Copy( params.c_str(), n );
+        NppExecHelpers::StrDelLeadingTabSpaces(varName);
+        NppExecHelpers::StrDelTrailingTabSpaces(varName);
+        forRange.Copy( params.c_str() + n + 1 );
+    }
 
-    enum eOptionType {
-        typeUnknown = 0,
-        typeInclude,
-        typeExclude,
-        typeFindReplaceIgnoreCase,
-        typeFindReplaceMatchCase,
-        typeHighlight
-    };
+    if ( varName.IsEmpty() )
+    {
+        ScriptError( ET_UNPREDICTABLE, _T("- FOR <var> = <a> TO <b> or FOR EACH <var> IN <arr> expected.") );
+        return CMDRESULT_INVALIDPARAM;
+    }
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    bool isHighlightChanged = false;
+    {
+        CNppExecMacroVars& MacroVars = m_pNppExec->GetMacroVars();
+        const CStrSplitT<TCHAR> cmdArgs;
+        MacroVars.CheckCmdArgs(forRange, cmdArgs);
+        MacroVars.CheckAllMacroVars(this, forRange, true);
+    }
 
-    tstr sOption;
     CStrSplitT<TCHAR> args;
-    const int n = args.SplitToArgs(params);
-    for ( int i = 0; i < n; i++ )
+    const int nArgs = args.SplitToArgs(forRange);
+    tstr sTo = args.GetArg(1);
+    tstr sStep = args.GetArg(3);
+    NppExecHelpers::StrUpper(sTo);
+    NppExecHelpers::StrUpper(sStep);
+
+    bool isSyntaxOK = ( (nArgs == 3 || nArgs == 5) && 
+                        (sTo == _T("TO")) && 
+                        (nArgs == 3 || sStep == _T("STEP")) );
+
+    // the counter is a plain integer, no math expressions here
+    __int64 nValues[3] = { 0, 0, 1 }; // <a>, <b>, <s>
+    for ( int i = 0; isSyntaxOK && (2*i < nArgs); ++i )
+    {
+        const tstr& arg = args.GetArg(2*i);
+        if ( isPureDecNumber(arg.c_str()) == DNT_INTNUMBER )
+            nValues[i] = c_base::_tstr2int64(arg.c_str());
+        else
+            isSyntaxOK = false;
+    }
+
+    if ( !isSyntaxOK )
     {
-        sOption = args.GetArg(i);
-        NppExecHelpers::StrUpper(sOption);
+        ScriptError( ET_UNPREDICTABLE, _T("- Syntax error in the for-range: integer <a> TO <b> [STEP <s>] expected.") );
+        return CMDRESULT_INVALIDPARAM;
+    }
 
-        bool bWrongIndex = false;
-        eOptionType type = typeUnknown;
-        eOptionState state = stateUnknown;
-        if ( sOption.GetAt(0) == _T('+') )
-            state = stateOn;
-        else if ( sOption.GetAt(0) == _T('-') )
-            state = stateOff;
+    if ( nValues[2] == 0 )
+    {
+        ScriptError( ET_UNPREDICTABLE, _T("- The for-step is 0.") );
+        return CMDRESULT_INVALIDPARAM;
+    }
 
-        if ( state != stateUnknown )
-        {
-            switch ( sOption.GetAt(1) )
-            {
-                case _T('I'):
-                    type = typeInclude;
-                    break;
-                case _T('X'):
-                    type = typeExclude;
-                    break;
-                case _T('F'):
-                    if ( sOption.GetAt(2) == _T('R') )
-                    {
-                        if ( sOption.GetAt(3) == _T('C') )
-                            type = typeFindReplaceMatchCase;
-                        else
-                            type = typeFindReplaceIgnoreCase;
-                    }
-                    break;
-                case _T('H'):
-                    type = typeHighlight;
-                    break;
-            }
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    tLoopState* pLoopState = enterLoop(currentScript, CMDTYPE_FOR);
+    if ( !pLoopState )
+        return CMDRESULT_FAILED;
 
-            if ( type != typeUnknown )
-            {
-                const TCHAR* pIndex = sOption.c_str();
-                if ( type == typeFindReplaceMatchCase )
-                    pIndex += 4; // skip "+FRC"
-                else if ( type == typeFindReplaceIgnoreCase )
-                    pIndex += 3; // skip "+FR"
-                else
-                    pIndex += 2; // skip "+I" or "+X" or "+H"
+    pLoopState->sVarName = varName;
+    pLoopState->nValue = nValues[0];
+    pLoopState->nLastValue = nValues[1];
+    pLoopState->nStep = nValues[2];
 
-                const int nIndex = c_base::_tstr2int(pIndex) - 1;
-                const bool bEnable = (state == stateOn) ? true : false;
-                switch ( type )
-                {
-                    case typeInclude:
-                        if ( nIndex >= 0 && nIndex < CConsoleOutputFilterDlg::FILTER_ITEMS )
-                        {
-                            const int nIndexMask = (0x01 << nIndex);
-                            int nConFltrInclMask = m_pNppExec->GetOptions().GetInt(OPTI_CONFLTR_INCLMASK);
-                            nConFltrInclMask |= nIndexMask;
-                            if ( !bEnable )  nConFltrInclMask ^= nIndexMask;
-                            m_pNppExec->GetOptions().SetInt(OPTI_CONFLTR_INCLMASK, nConFltrInclMask);
-                            if ( bEnable )  m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_ENABLE, true);
-                        }
-                        else
-                        {
-                            bWrongIndex = true;
-                        }
-                        break;
-                    case typeExclude:
-                        if ( nIndex >= 0 && nIndex < CConsoleOutputFilterDlg::FILTER_ITEMS )
-                        {
-                            const int nIndexMask = (0x01 << nIndex);
-                            int nConFltrExclMask = m_pNppExec->GetOptions().GetInt(OPTI_CONFLTR_EXCLMASK);
-                            nConFltrExclMask |= nIndexMask;
-                            if ( !bEnable )  nConFltrExclMask ^= nIndexMask;
-                            m_pNppExec->GetOptions().SetInt(OPTI_CONFLTR_EXCLMASK, nConFltrExclMask);
-                            if ( bEnable )  m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_ENABLE, true);
-                        }
-                        else
-                        {
-                            bWrongIndex = true;
-                        }
-                        break;
-                    case typeFindReplaceIgnoreCase:
-                    case typeFindReplaceMatchCase:
-                        if ( nIndex >= 0 && nIndex < CConsoleOutputFilterDlg::REPLACE_ITEMS )
-                        {
-                            const int nIndexMask = (0x01 << nIndex);
-                            const bool bMatchCase = (type == typeFindReplaceMatchCase) ? true : false;
-                            int nRplcFltrFindMask = m_pNppExec->GetOptions().GetInt(OPTI_CONFLTR_R_FINDMASK);
-                            nRplcFltrFindMask |= nIndexMask;
-                            if ( !bEnable )  nRplcFltrFindMask ^= nIndexMask;
-                            m_pNppExec->GetOptions().SetInt(OPTI_CONFLTR_R_FINDMASK, nRplcFltrFindMask);
-                            int nRplcFltrCaseMask = m_pNppExec->GetOptions().GetInt(OPTI_CONFLTR_R_CASEMASK);
-                            nRplcFltrCaseMask |= nIndexMask;
-                            if ( !bMatchCase )  nRplcFltrCaseMask ^= nIndexMask;
-                            m_pNppExec->GetOptions().SetInt(OPTI_CONFLTR_R_CASEMASK, nRplcFltrCaseMask);
-                            if ( bEnable )  m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_R_ENABLE, true);
-                        }
-                        else
-                        {
-                            bWrongIndex = true;
-                        }
-                        break;
-                    case typeHighlight:
-                        if ( nIndex >= 0 && nIndex < CConsoleOutputFilterDlg::RECOGNITION_ITEMS )
-                        {
-                            m_pNppExec->GetWarningAnalyzer().EnableEffect(nIndex, bEnable);
-                            isHighlightChanged = true;
-                        }
-                        else
-                        {
-                            bWrongIndex = true;
-                        }
-                        break;
-                }
-            }
-        }
-        
-        if ( state == stateUnknown || type == typeUnknown )
+    if ( (pLoopState->nStep > 0) ? (pLoopState->nValue <= pLoopState->nLastValue) : (pLoopState->nValue >= pLoopState->nLastValue) )
+    {
+
+        Runtime::GetLogger().Add(   _T("; The range is not empty; executing lines under the FOR") );
+
+        setLoopVar(this, *pLoopState);
+    }
+    else
+    {
+
+        Runtime::GetLogger().Add(   _T("; The range is empty; leaving the loop") );
+
+        jumpToLoopEnd(*pLoopState, true);
+    }
+
+    return CMDRESULT_SUCCEEDED;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::doForEach(const tstr& varName, const tstr& arrName)
+{
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    tLoopState* pLoopState = enterLoop(currentScript, CMDTYPE_FOR);
+    if ( !pLoopState )
+        return CMDRESULT_FAILED;
+
+    // the loop iterates over a snapshot of the items (shared until the array is modified)
+    std::shared_ptr<const CNppExecMacroVars::tMacroVarItems> pItems = m_pNppExec->GetMacroVars().GetUserMacroVarItems(this, arrName);
+
+    pLoopState->sVarName = varName;
+    pLoopState->nValue = 0;
+    pLoopState->nLastValue = pItems ? static_cast<__int64>(pItems->Values.size()) - 1 : -1;
+    pLoopState->nStep = 1;
+
+    if ( pLoopState->nLastValue >= 0 )
+    {
+        pLoopState->pItems = pItems;
+
+        if ( Runtime::GetLogger().IsLogging() )
         {
-            tstr Err = _T("- unknown option: ");
-            Err += sOption;
-            ScriptError( ET_REPORT, Err.c_str() );
-            nCmdResult = CMDRESULT_INVALIDPARAM;
+            Runtime::GetLogger().AddEx( _T("; The array has %d item(s); executing lines under the FOR"), static_cast<int>(pItems->Values.size()) );
         }
-        else if ( bWrongIndex )
+
+        setLoopVar(this, *pLoopState);
+    }
+    else
+    {
+
+        if ( Runtime::GetLogger().IsLogging() )
         {
-            tstr Err = _T("- wrong index: ");
-            Err += sOption;
-            ScriptError( ET_REPORT, Err.c_str() );
-            nCmdResult = CMDRESULT_INVALIDPARAM;
+            Runtime::GetLogger().AddEx( _T("; The array %s is empty or does not exist; leaving the loop"), arrName.c_str() );
         }
+
+        jumpToLoopEnd(*pLoopState, true);
     }
 
-    if ( isHighlightChanged )
+    return CMDRESULT_SUCCEEDED;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoEndFor(const tstr& params)
+{
+    reportCmdAndParams( DoEndForCommand::Name(), params, fMessageToConsole );
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+    if ( !params.IsEmpty() )
     {
-        m_pNppExec->UpdateGoToErrorMenuItem();
+        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
+
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    tLoopState* pLoopState = getLoopStateByEnd(currentScript, CMDTYPE_ENDFOR);
+    if ( !pLoopState )
+        return CMDRESULT_FAILED;
+
+    currentScript.RestoreIfDepth(pLoopState->nIfDepth);
+
+    bool isNextValue = false;
+    if ( !pLoopState->isBreaking )
+    {
+        // the distance to <b> and the step are compared as unsigned values
+        // to avoid an overflow near the __int64 limits
+        typedef unsigned __int64 uint64;
+        const __int64 nStep = pLoopState->nStep;
+        const uint64 nRest = (nStep > 0) ?
+          (uint64) pLoopState->nLastValue - (uint64) pLoopState->nValue :
+          (uint64) pLoopState->nValue - (uint64) pLoopState->nLastValue;
+        const uint64 nStepAbs = (nStep > 0) ? (uint64) nStep : (uint64) 0 - (uint64) nStep;
+        isNextValue = (nRest >= nStepAbs);
+    }
+
+    if ( !isNextValue )
+    {
+
+        Runtime::GetLogger().Add(   _T("; FOR ... ENDFOR found, done") );
+
+        currentScript.LoopState.DeleteLast();
+    }
+    else if ( m_execState.pScriptLineNext == INVALID_TSTR_LIST_ITEM )
+    {
+        pLoopState->nValue += pLoopState->nStep;
+        setLoopVar(this, *pLoopState);
+        m_execState.SetScriptLineNext(pLoopState->pLoopBegin->GetNext()); // the FOR itself is not executed again
+
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( _T("; Jumping to command item p = 0x%X { \"%s\" }"),
+                m_execState.pScriptLineNext, m_execState.pScriptLineNext->GetItem().c_str() );
+        }
     }
 
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoConLoadFrom(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoBreak(const tstr& params)
 {
-    if ( !reportCmdAndParams( DoConLoadFromCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+    reportCmdAndParams( DoBreakCommand::Name(), params, fMessageToConsole );
 
     eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    int nBytes = m_pNppExec->conLoadFrom(params.c_str());
-    if ( nBytes < 0 )
+
+    if ( !params.IsEmpty() )
     {
-        ScriptError( ET_REPORT, _T("- can not open the file") );
-        nCmdResult = CMDRESULT_FAILED;
+        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
+
+    CListItemT<tLoopState>* pLoopItem = m_execState.GetCurrentScriptContext().LoopState.GetLast();
+    if ( !pLoopItem )
+    {
+        ScriptError( ET_UNPREDICTABLE, _T("- Unexpected BREAK found, outside of WHILE or FOR.") );
+        return CMDRESULT_FAILED;
     }
 
+    Runtime::GetLogger().Add(   _T("; leaving the loop") );
+
+    jumpToLoopEnd(pLoopItem->GetItem(), true);
+
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoConSaveTo(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoContinue(const tstr& params)
 {
-    if ( !reportCmdAndParams( DoConSaveToCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
-        
+    reportCmdAndParams( DoContinueCommand::Name(), params, fMessageToConsole );
+
     eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    tstr S;
-    int  nBytes = m_pNppExec->conSaveTo(params.c_str());
-    if ( nBytes >= 0 )
-      S.Format(120, _T("- OK, %d bytes have been written to \""), nBytes);
-    else
-      S = _T("- failed to write to \"");
-    S += params;
-    S += _T("\"");
-    if ( nBytes >= 0 )
+
+    if ( !params.IsEmpty() )
     {
-        m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
     }
-    else
+
+    CListItemT<tLoopState>* pLoopItem = m_execState.GetCurrentScriptContext().LoopState.GetLast();
+    if ( !pLoopItem )
     {
-        ScriptError( ET_REPORT, S.c_str() );
-        nCmdResult = CMDRESULT_FAILED;
+        ScriptError( ET_UNPREDICTABLE, _T("- Unexpected CONTINUE found, outside of WHILE or FOR.") );
+        return CMDRESULT_FAILED;
     }
 
+    Runtime::GetLogger().Add(   _T("; going to the next iteration") );
+
+    jumpToLoopEnd(pLoopItem->GetItem(), false);
+
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoDir(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoInputBox(const tstr& params)
 {
-    const TCHAR* cszPathAndFilter = params.IsEmpty() ? _T("*") : params.c_str();
-    reportCmdAndParams( DoDirCommand::Name(), cszPathAndFilter, fMessageToConsole );
+    if ( !reportCmdAndParams( DoInputBoxCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-    tstr Path;
-    tstr Filter;
-    int  nFilterPos = FileFilterPos( cszPathAndFilter );
-    
-    GetPathAndFilter( cszPathAndFilter, nFilterPos, Path, Filter );
+    runInputBox(this, params);
 
-    Runtime::GetLogger().AddEx( _T("; searching \"%s\" for \"%s\""), Path.c_str(), Filter.c_str() );
+    return CMDRESULT_SUCCEEDED;
+}
 
-    return ( PrintDirContent(m_pNppExec, Path.c_str(), Filter.c_str()) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED );
+CScriptEngine::eCmdResult CScriptEngine::DoMessageBox(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoMessageBoxCommand::Name(), params, fMessageToConsole ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    return runMessageBox(this, params);
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoEcho(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoJoin(const tstr& params)
 {
-    reportCmdAndParams( DoEchoCommand::Name(), params, 0 );
-     
-    m_pNppExec->GetConsole().PrintMessage( params.c_str(), false );
+    reportCmdAndParams( DoJoinCommand::Name(), params, fMessageToConsole );
+
+    // PARALLEL jumps here when all its jobs are finished
+    if ( !params.IsEmpty() )
+    {
+        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
+        return CMDRESULT_INVALIDPARAM;
+    }
 
     return CMDRESULT_SUCCEEDED;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoElse(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoLabel(const tstr& params)
 {
-    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-    const eIfState ifState = currentScript.GetIfState();
+    if ( !reportCmdAndParams( DoLabelCommand::Name(), params, fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    unsigned int uFlags = 0;
-    if ( ifState == IF_NONE || ifState == IF_WANT_ELSE || ifState == IF_MAYBE_ELSE )
-        uFlags |= fMessageToConsole;
-    reportCmdAndParams( DoElseCommand::Name(), params, uFlags );
-    
-    if ( ifState == IF_NONE )
+    tstr labelName = params;
+    NppExecHelpers::StrDelLeadingTabSpaces(labelName);
+    NppExecHelpers::StrDelTrailingTabSpaces(labelName);
+    NppExecHelpers::StrUpper(labelName);
+
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    tLabels& Labels = currentScript.Labels;
+    tLabels::const_iterator itrLabel = Labels.find(labelName);
+    if ( itrLabel != Labels.end() )
     {
-        ScriptError( ET_UNPREDICTABLE, _T("- Unexpected ELSE found, without preceding IF.") );
-        nCmdResult = CMDRESULT_FAILED;
+        if ( itrLabel->second != m_execState.pScriptLineCurrent->GetNext() )
+        {
+            tstr err = _T("- duplicated label found: ");
+            err += labelName;
+            ScriptError( ET_REPORT, err.c_str() );
+            return CMDRESULT_FAILED;
+        }
     }
-    else if ( ifState == IF_EXECUTING )
+
+    CListItemT<tstr>* p = m_execState.pScriptLineCurrent->GetNext();
+    Labels[labelName] = p; // label points to the next command
+
+    if ( Runtime::GetLogger().IsLogging() )
     {
-        Runtime::GetLogger().Add(   _T("; IF ... ELSE found, skipping everything up to ENDIF") );
+        Runtime::GetLogger().AddEx( _T("; label %s -> command item p = 0x%X { \"%s\" }"), 
+            labelName.c_str(), p, p ? p->GetItem().c_str() : _T("<NULL>") );
+    }
 
-        currentScript.SetIfState(IF_WANT_ENDIF);
+    return CMDRESULT_SUCCEEDED;
+}
+
+static void appendOnOff(bool bOn, tstr& S1, tstr& S2)
+{
+    if ( bOn )
+    {
+        S1 += _T("+");
+        S2 += _T("on");
     }
-    else if ( ifState == IF_WANT_ELSE || ifState == IF_MAYBE_ELSE )
+    else
     {
-        Runtime::GetLogger().Add( _T("; ELSE found") );
+        S1 += _T("-");
+        S2 += _T("off");
+    }
+}
 
-        if ( params.IsEmpty() )
-        {
-            // ELSE without condition
-            currentScript.SetIfState(IF_EXECUTING);
-        }
-        else
-        {
-            // ELSE with condition
-            tstr paramsUpperCase = params;
-            NppExecHelpers::StrUpper(paramsUpperCase);
+typedef struct sIntMapping {
+    int n;
+    const TCHAR* str;
+} tIntMapping;
 
-            static const TCHAR* arrIf[] = {
-                _T("IF "),
-                _T("IF\t"),
-            };
+static void appendInt(int n, tstr& S1, tstr& S2, const tIntMapping* mappings)
+{
+    TCHAR num[16];
 
-            int n = -1;
-            for ( const TCHAR* const& i : arrIf )
-            {
-                n = paramsUpperCase.RFind(i);
-                if ( n >= 0 )
-                    break;
-            }
+    wsprintf( num, _T("%u"), n );
+    S1 += num;
+    for ( ; mappings->str != NULL; ++mappings )
+    {
+        if ( mappings->n == n )
+        {
+            S2 += mappings->str;
+            break;
+        }
+    }
+}
 
-            if ( n < 0 )
-            {
-                ScriptError( ET_UNPREDICTABLE, _T("- ELSE IF expected, but IF was not found.") );
-                nCmdResult = CMDRESULT_FAILED;
-            }
-            else
-            {
-                tstr ifParams;
-                ifParams.Copy( params.c_str() + n + 3 );
-                NppExecHelpers::StrDelLeadingTabSpaces(ifParams);
-                NppExecHelpers::StrDelTrailingTabSpaces(ifParams);
+static void appendEnc(unsigned int enc_opt, bool bInput, tstr& S1, tstr& S2)
+{
+    unsigned int enc;
+    const TCHAR* encName;
+    TCHAR        encNum[5];
 
-                doIf(ifParams, true);
-            }
-        }
+    if ( bInput )
+    {
+        enc = CConsoleEncodingDlg::getInputEncoding(enc_opt);
+        encName = CConsoleEncodingDlg::getInputEncodingName(enc_opt);
+    }
+    else
+    {
+        enc = CConsoleEncodingDlg::getOutputEncoding(enc_opt);
+        encName = CConsoleEncodingDlg::getOutputEncodingName(enc_opt);
     }
 
-    return nCmdResult;
+    wsprintf( encNum, _T("%u"), enc );
+
+    S1 += encNum;
+    S2 += encName;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoEndIf(const tstr& params)
+void CScriptEngine::addBenchmarkSample(eCmdType nCmdType, __int64 nLineStartTicks)
 {
-    reportCmdAndParams( DoEndIfCommand::Name(), params, fMessageToConsole );
+    LARGE_INTEGER liNow;
+    ::QueryPerformanceCounter(&liNow);
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    if ( nLineStartTicks < m_Benchmark.nStartTicks )
+        return; // this line has started the workload
 
-    if ( !params.IsEmpty() )
-    {
-        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
-        nCmdResult = CMDRESULT_INVALIDPARAM;
-    }
+    const __int64 nLineTicks = liNow.QuadPart - nLineStartTicks;
+    tBenchmarkWorkload& workload = m_Benchmark.Workloads.back();
+    workload.LineTicks[nCmdType + BENCHMARK_CMDTYPE_OFFSET].Append( 
+      (nLineTicks < UINT_MAX) ? static_cast<unsigned int>(nLineTicks) : UINT_MAX );
+    ++workload.nLines;
+}
 
-    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-    const eIfState ifState = currentScript.GetIfState();
-    if ( ifState == IF_NONE )
-    {
-        ScriptError( ET_UNPREDICTABLE, _T("- Unexpected ENDIF found, without preceding IF.") );
-        nCmdResult = CMDRESULT_FAILED;
-    }
-    else
+void CScriptEngine::stopBenchmarkWorkload()
+{
+    if ( m_Benchmark.isMeasuring )
     {
+        LARGE_INTEGER liNow;
+        ::QueryPerformanceCounter(&liNow);
 
-        Runtime::GetLogger().Add( _T("; IF ... ENDIF found, done") );
-
-        currentScript.PopIfState();
+        m_Benchmark.Workloads.back().nElapsedTicks = liNow.QuadPart - m_Benchmark.nStartTicks;
+        m_Benchmark.isMeasuring = false;
     }
-
-    return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoEnvSet(const tstr& params)
+static void appendJsonStr(tstr& S, const TCHAR* cszValue)
 {
-    if ( !reportCmdAndParams( DoEnvSetCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
-
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    bool isInternal = false;
-    
-    CStrSplitT<TCHAR> args;
-    if ( args.Split(params, _T("="), 2) == 2 )
+    S += _T('\"');
+    for ( ; *cszValue != 0; ++cszValue )
     {
-        isInternal = true;
-        
-        // set the value
-        tstr& varName = args.Arg(0);
-        tstr& varValue = args.Arg(1);
-        
-        NppExecHelpers::StrDelLeadingTabSpaces(varName);
-        NppExecHelpers::StrDelTrailingTabSpaces(varName);
-        NppExecHelpers::StrDelLeadingTabSpaces(varValue);
-        NppExecHelpers::StrDelTrailingTabSpaces(varValue);
-
-        if ( varName.length() > 0 )
+        const TCHAR ch = *cszValue;
+        if ( ch == _T('\"') || ch == _T('\\') )
         {
-            NppExecHelpers::StrUpper(varName);
-
-            {
-                CCriticalSectionLockGuard lock(g_csEnvVars);
-                if ( g_LocalEnvVarNames.find(varName) == g_LocalEnvVarNames.end() )
-                {
-                    // not Local Env Var; maybe Global?
-                    tEnvVars::const_iterator itrGVar = g_GlobalEnvVars.find(varName);
-                    if ( itrGVar == g_GlobalEnvVars.end() )
-                    {
-                        // not in the Global Env Vars List; but maybe it's Global?
-                        tstr sValue = NppExecHelpers::GetEnvironmentVariable(varName);
-                        if ( !sValue.IsEmpty() )
-                        {
-                            g_GlobalEnvVars[varName] = sValue;
-                            itrGVar = g_GlobalEnvVars.find(varName);
-                        }
-                        if ( itrGVar == g_GlobalEnvVars.end() )
-                        {
-                            // not Global Env Var; add to the Local
-                            g_LocalEnvVarNames[varName] = 0;
-                        }
-                    }
-                }
-            }
-
-            if ( !SetEnvironmentVariable(varName.c_str(), varValue.c_str()) )
-                nCmdResult = CMDRESULT_FAILED;
+            S += _T('\\');
+            S += ch;
         }
-        else
+        else if ( static_cast<unsigned int>(ch) < 0x20 )
         {
-            ScriptError( ET_REPORT, _T("- no variable name specified") );
-            return CMDRESULT_INVALIDPARAM;
+            TCHAR szCh[8];
+            ::wsprintf( szCh, _T("\\u%04X"), static_cast<unsigned int>(ch) );
+            S += szCh;
         }
+        else
+            S += ch;
     }
+    S += _T('\"');
+}
 
-    // show the value
-    tstr& varName = args.Arg(0);
-        
-    NppExecHelpers::StrDelLeadingTabSpaces(varName);
-    NppExecHelpers::StrDelTrailingTabSpaces(varName);
+static void appendJsonNum(tstr& S, double value)
+{
+    TCHAR szNum[64];
+    _t_sprintf( szNum, _T("%.3f"), value );
+    S += szNum;
+}
 
-    if ( varName.length() > 0 )
+static void appendJsonInt(tstr& S, __int64 value)
+{
+    TCHAR szNum[64];
+    c_base::_tint64_to_str( value, szNum );
+    S += szNum;
+}
+
+void CScriptEngine::getBenchmarkReport(tstr& Report) const
+{
+    LARGE_INTEGER liFreq;
+    ::QueryPerformanceFrequency(&liFreq);
+    const double dTicksPerUs = static_cast<double>(liFreq.QuadPart) / 1000000.0;
+
+    Report = _T("{\n");
+    Report += _T("  \"nppexec\": ");
+    appendJsonStr(Report, NPPEXEC_VER_STR);
+    Report += _T(",\n");
+    Report += _T("  \"workloads\": [");
+
+    bool isFirstWorkload = true;
+    for ( const tBenchmarkWorkload& workload : m_Benchmark.Workloads )
     {
-        NppExecHelpers::StrUpper(varName);
-            
-        bool  bSysVarOK = false;
-        tstr sValue = NppExecHelpers::GetEnvironmentVariable(varName);
-        if ( !sValue.IsEmpty() )
+        const double dElapsedUs = static_cast<double>(workload.nElapsedTicks) / dTicksPerUs;
+
+        Report += isFirstWorkload ? _T("\n") : _T(",\n");
+        Report += _T("    {\n");
+        Report += _T("      \"name\": ");
+        appendJsonStr(Report, workload.sName.c_str());
+        Report += _T(",\n");
+        Report += _T("      \"lines\": ");
+        appendJsonInt(Report, workload.nLines);
+        Report += _T(",\n");
+        Report += _T("      \"elapsed_ms\": ");
+        appendJsonNum(Report, dElapsedUs / 1000.0);
+        Report += _T(",\n");
+        Report += _T("      \"lines_per_sec\": ");
+        appendJsonNum(Report, (dElapsedUs > 0) ? (static_cast<double>(workload.nLines) * 1000000.0 / dElapsedUs) : 0.0);
+        Report += _T(",\n");
+        Report += _T("      \"commands\": [");
+
+        bool isFirstCmd = true;
+        for ( int i = 0; i < BENCHMARK_CMDTYPE_COUNT; ++i )
         {
-            tstr S = _T("$(SYS.");
-            S += varName;
-            S += _T(") = ");
-            if ( sValue.length() > MAX_VAR_LENGTH2SHOW )
-            {
-                S.Append( sValue.c_str(), MAX_VAR_LENGTH2SHOW - 5 );
-                S += _T("(...)");
-            }
+            const CBufT<unsigned int>& lineTicks = workload.LineTicks[i];
+            const int nCount = lineTicks.size();
+            if ( nCount == 0 )
+                continue;
+
+            const TCHAR* cszCmdName = NULL;
+            const eCmdType nCmdType = static_cast<eCmdType>(i - BENCHMARK_CMDTYPE_OFFSET);
+            if ( nCmdType == CMDTYPE_COLLATERAL_FORCED )
+                cszCmdName = _T("(collateral)");
+            else if ( nCmdType == CMDTYPE_COMMENT_OR_EMPTY )
+                cszCmdName = _T("(comment or empty)");
+            else if ( nCmdType == CMDTYPE_UNKNOWN )
+                cszCmdName = _T("(child process)");
             else
+                cszCmdName = m_CommandRegistry.GetCmdNameByType(nCmdType);
+
+            // percentiles by the nearest rank
+            CBufT<unsigned int> sortedTicks(lineTicks);
+            unsigned int* pTicks = sortedTicks.GetData();
+            std::sort( pTicks, pTicks + nCount );
+            double dTotalTicks = 0;
+            for ( int n = 0; n < nCount; ++n )
             {
-                S += sValue;
+                dTotalTicks += pTicks[n];
             }
-            m_pNppExec->GetConsole().PrintMessage( S.c_str(), isInternal );
-            bSysVarOK = true;
-        }
-        if ( !bSysVarOK )
+            const unsigned int nP50 = pTicks[(nCount*50 + 99)/100 - 1];
+            const unsigned int nP99 = pTicks[(nCount*99 + 99)/100 - 1];
+
+            Report += isFirstCmd ? _T("\n") : _T(",\n");
+            Report += _T("        { \"command\": ");
+            appendJsonStr(Report, cszCmdName);
+            Report += _T(", \"count\": ");
+            appendJsonInt(Report, nCount);
+            Report += _T(", \"total_us\": ");
+            appendJsonNum(Report, dTotalTicks / dTicksPerUs);
+            Report += _T(", \"p50_us\": ");
+            appendJsonNum(Report, nP50 / dTicksPerUs);
+            Report += _T(", \"p99_us\": ");
+            appendJsonNum(Report, nP99 / dTicksPerUs);
+            Report += _T(" }");
+            isFirstCmd = false;
+        }
+
+        Report += isFirstCmd ? _T("]\n") : _T("\n      ]\n");
+        Report += _T("    }");
+        isFirstWorkload = false;
+    }
+
+    Report += isFirstWorkload ? _T("],\n") : _T("\n  ],\n");
+    Report += _T("  \"fparser_cache\": { \"hits\": ");
+    appendJsonInt(Report, FParserWrapper::GetCacheHits());
+    Report += _T(", \"misses\": ");
+    appendJsonInt(Report, FParserWrapper::GetCacheMisses());
+    Report += _T(", \"optimized\": ");
+    appendJsonInt(Report, FParserWrapper::GetOptimizedExprs());
+    Report += _T(", \"optimize_skipped\": ");
+    appendJsonInt(Report, FParserWrapper::GetOptimizeSkipped());
+    Report += _T(", \"optimized_evals\": ");
+    appendJsonInt(Report, FParserWrapper::GetOptimizedEvals());
+    Report += _T(" },\n");
+    Report += _T("  \"int64_calc\": { \"count\": ");
+    appendJsonInt(Report, FParserWrapper::GetInt64Calcs());
+    Report += _T(" }\n");
+    Report += _T("}\n");
+}
+
+static void printReportToConsole(CNppExec* pNppExec, const tstr& Report)
+{
+    // line by line
+    tstr Line;
+    const TCHAR* pLine = Report.c_str();
+    for ( const TCHAR* pEol = _tcschr(pLine, _T('\n')); pEol != NULL; pEol = _tcschr(pLine, _T('\n')) )
+    {
+        Line.Copy( pLine, static_cast<int>(pEol - pLine) );
+        pNppExec->GetConsole().PrintOutput( Line.c_str() );
+        pLine = pEol + 1;
+    }
+}
+
+static bool saveReportToFile(const tstr& fileName, const tstr& Report)
+{
+    // as UTF-8
+    bool isSaved = false;
+  #ifdef UNICODE
+    int nLen = 0;
+    char* pText = SysUniConv::newUnicodeToUTF8( Report.c_str(), Report.length(), &nLen );
+  #else
+    int nLen = 0;
+    char* pText = SysUniConv::newMultiByteToUTF8( Report.c_str(), Report.length(), CP_ACP, &nLen );
+  #endif
+    if ( pText )
+    {
+        FILE* f = CFileBufT<TCHAR>::openfile(fileName.c_str(), true);
+        if ( f != NULL )
         {
-            tstr S = _T("$(SYS.");
-            S += varName;
-            S += _T(") is empty or does not exist");
-            m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+            isSaved = CFileBufT<TCHAR>::writefile(f, pText, nLen);
+            CFileBufT<TCHAR>::closefile(f);
         }
+        delete [] pText;
     }
-    else
+    return isSaved;
+}
+
+// "npe_benchmark calc": one thread's evaluations
+typedef struct sCalcBenchmarkJob {
+    CNppExec* pNppExec;
+    int       nEvaluations;
+    bool      isShared;  // the shared FParserWrapper under its lock
+    int       nFailed;
+    HANDLE    hThread;
+} tCalcBenchmarkJob;
+
+static DWORD WINAPI CalcBenchmarkThreadProc(LPVOID lpParam)
+{
+    tCalcBenchmarkJob* pJob = (tCalcBenchmarkJob *) lpParam;
+
+    FParserWrapper fp; // this thread's own one
+    const tstr Expr = _T("(_npe_v1*3 + _npe_v2)/2 - _npe_v1%7");
+    std::vector<FunctionParser::value_type> vars(2);
+    tstr ret;
+
+    for ( int i = 0; i < pJob->nEvaluations; ++i )
     {
-        ScriptError( ET_REPORT, _T("- no variable name specified") );
-        nCmdResult = CMDRESULT_INVALIDPARAM;
+        vars[0] = FunctionParser::value_type(i);
+        vars[1] = FunctionParser::value_type(pJob->nEvaluations - i);
+
+        // bInt64 is false: this measures fparser itself, not CInt64Calc
+        const bool isOK = pJob->isShared ?
+          FParserAccess(nullptr)->CalculateBound(pJob->pNppExec, Expr, vars, ret, false) :
+          fp.CalculateBound(pJob->pNppExec, Expr, vars, ret, false);
+        if ( !isOK )
+            ++pJob->nFailed;
     }
 
-    return nCmdResult;
+    return 0;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoEnvUnset(const tstr& params)
+// returns the elapsed ticks or -1 if the threads can't be started
+static __int64 runCalcBenchmark(CNppExec* pNppExec, int nThreads, int nEvaluations, bool isShared, int& nFailed)
 {
-    if ( !reportCmdAndParams( DoEnvUnsetCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
-
-    // removes the value of environment variable, restores the initial value
+    std::vector<tCalcBenchmarkJob> Jobs(nThreads);
+    std::vector<HANDLE> Threads;
+    LARGE_INTEGER liStart;
+    LARGE_INTEGER liNow;
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    tstr varName = params;
-    
-    NppExecHelpers::StrDelLeadingTabSpaces(varName);
-    NppExecHelpers::StrDelTrailingTabSpaces(varName);
+    ::QueryPerformanceCounter(&liStart);
 
-    if ( varName.length() > 0 )
+    for ( tCalcBenchmarkJob& job : Jobs )
     {
-        NppExecHelpers::StrUpper(varName);
+        job.pNppExec = pNppExec;
+        job.nEvaluations = nEvaluations;
+        job.isShared = isShared;
+        job.nFailed = 0;
+        job.hThread = NULL;
+        if ( !NppExecHelpers::CreateNewThread(CalcBenchmarkThreadProc, &job, &job.hThread) )
+            break;
+        Threads.push_back(job.hThread);
+    }
 
-        BOOL bResult = FALSE;
-        BOOL bRemoved = FALSE;
+    if ( !Threads.empty() )
+        ::WaitForMultipleObjects( static_cast<DWORD>(Threads.size()), Threads.data(), TRUE, INFINITE );
 
-        {
-            CCriticalSectionLockGuard lock(g_csEnvVars);
-            tEnvVars::iterator itrLVar = g_LocalEnvVarNames.find(varName);
-            if ( itrLVar != g_LocalEnvVarNames.end() )
-            {
-                // is Local Env Var; remove
-                bResult = SetEnvironmentVariable( varName.c_str(), NULL );
-                g_LocalEnvVarNames.erase(itrLVar);
-                bRemoved = TRUE;
-            }
-            else
-            {
-                // not Local Env Var; maybe Global?
-                tEnvVars::iterator itrGVar = g_GlobalEnvVars.find(varName);
-                if ( itrGVar != g_GlobalEnvVars.end() )
-                {
-                    // is modified Global Env Var; restore the initial value
-                    bResult = SetEnvironmentVariable( varName.c_str(), itrGVar->second.c_str() );
-                    g_GlobalEnvVars.erase(itrGVar);
-                }
-                else
-                {
-                    // unsafe: maybe non-modified Global Env Var
-                }
-            }
-        }
+    ::QueryPerformanceCounter(&liNow);
 
-        tstr S = _T("$(SYS.");
-        S += varName;
-        if ( bResult )
-        {
-            S += _T(") has been ");
-            S += (bRemoved ? _T("removed") : _T("restored"));
-        }
-        else
-        {
-            S += _T(")");
-            S.Insert(0, _T("- can not unset this environment variable: "));
-            nCmdResult = CMDRESULT_FAILED;
-        }
-        m_pNppExec->GetConsole().PrintMessage( S.c_str(), bResult ? true : false );
+    nFailed = 0;
+    for ( HANDLE hThread : Threads )
+    {
+        ::CloseHandle(hThread);
     }
-    else
+    for ( const tCalcBenchmarkJob& job : Jobs )
     {
-        ScriptError( ET_REPORT, _T("- no variable name specified") );
-        nCmdResult = CMDRESULT_INVALIDPARAM;
+        nFailed += job.nFailed;
     }
 
-    return nCmdResult;
+    return ( static_cast<int>(Threads.size()) == nThreads ) ? (liNow.QuadPart - liStart.QuadPart) : -1;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoExit(const tstr& params)
+// "npe_benchmark int64": integer expressions calculated by CInt64Calc or by fparser
+static const TCHAR* const cszInt64BenchmarkExprs[] = {
+    _T("NPPMSG + 35"),
+    _T("hex(0x1F00 | WM_USER)"),
+    _T("(12345*7 - 0x10) % 1000"),
+    _T("(WM_USER << 4) & 0xFFF0"),
+    _T("2^20/16 + 1")
+};
+
+// returns the elapsed ticks; results are the results of the first pass
+static __int64 runInt64Benchmark(FParserWrapper* pFParser, CNppExec* pNppExec, int nCount, bool bInt64, std::vector<tstr>& results)
 {
-    reportCmdAndParams( DoExitCommand::Name(), params, fMessageToConsole );
+    const int nExprs = static_cast<int>(sizeof(cszInt64BenchmarkExprs)/sizeof(cszInt64BenchmarkExprs[0]));
+    std::vector<tstr> exprs(cszInt64BenchmarkExprs, cszInt64BenchmarkExprs + nExprs);
+    const tstr boundExpr = _T("_npe_v1*4 + 1"); // as "set i ~ $(i)*4 + 1"
+    std::vector<FunctionParser::value_type> vars(1);
+    tstr calcError;
+    tstr ret;
+    LARGE_INTEGER liStart;
+    LARGE_INTEGER liNow;
 
-    bool bHardExit = false;
-    if ( params.IsEmpty() || params == _T("0") )
+    results.resize(nExprs + 1);
+
+    ::QueryPerformanceCounter(&liStart);
+
+    for ( int i = 0; i < nCount; ++i )
     {
-        bHardExit = false;
+        for ( int k = 0; k < nExprs; ++k )
+        {
+            pFParser->Calculate(pNppExec, exprs[k], calcError, ret, bInt64);
+            if ( i == 0 )
+                results[k] = ret;
+        }
+
+        vars[0] = FunctionParser::value_type(i);
+        pFParser->CalculateBound(pNppExec, boundExpr, vars, ret, bInt64);
+        if ( i == 0 )
+            results[nExprs] = ret;
     }
-    else if ( params == _T("-1") )
+
+    ::QueryPerformanceCounter(&liNow);
+
+    return (liNow.QuadPart - liStart.QuadPart);
+}
+
+// "npe_benchmark optimize": bound expressions evaluated by fparser's parsed or optimized bytecode
+static const TCHAR* const cszOptimizeBenchmarkExprs[] = {
+    _T("sin(_npe_v1)^2 + cos(_npe_v1)^2"),
+    _T("(_npe_v1 + _npe_v2)*(_npe_v1 + _npe_v2)*(_npe_v1 + _npe_v2)"),
+    _T("exp(log(_npe_v1 + 1)) + _npe_v2*_npe_v2*_npe_v2"),
+    _T("(_npe_v1*3 + _npe_v2)/2 - _npe_v1%7")
+};
+
+// returns the elapsed ticks or -1 on a calc error; results are the results of the last pass
+static __int64 runOptimizeBenchmark(CNppExec* pNppExec, int nCount, bool bOptimize, std::vector<tstr>& results)
+{
+    const int nExprs = static_cast<int>(sizeof(cszOptimizeBenchmarkExprs)/sizeof(cszOptimizeBenchmarkExprs[0]));
+    std::vector<tstr> exprs(cszOptimizeBenchmarkExprs, cszOptimizeBenchmarkExprs + nExprs);
+    std::vector<FunctionParser::value_type> vars(2);
+    tstr ret;
+    LARGE_INTEGER liStart;
+    LARGE_INTEGER liNow;
+
+    FParserWrapper fp;
+    fp.SetOptimizeHits(bOptimize ? 1 : 0); // optimized by the first cache hit
+
+    // parsed (and optimized) before the measurement
+    for ( int i = 0; i < 2; ++i )
     {
-        bHardExit = true;
+        for ( int k = 0; k < nExprs; ++k )
+        {
+            if ( !fp.CalculateBound(pNppExec, exprs[k], vars, ret, false) )
+                return -1;
+        }
     }
-    else
+
+    results.resize(nExprs);
+
+    ::QueryPerformanceCounter(&liStart);
+
+    for ( int i = 0; i < nCount; ++i )
     {
-        ScriptError( ET_REPORT, _T("- unknown exit argument; assuming \"exit -1\"") );
-        bHardExit = true;
+        vars[0] = FunctionParser::value_type(i % 1000);
+        vars[1] = FunctionParser::value_type(i % 100);
+
+        for ( int k = 0; k < nExprs; ++k )
+        {
+            if ( !fp.CalculateBound(pNppExec, exprs[k], vars, ret, false) )
+                return -1;
+            if ( i == nCount - 1 )
+                results[k] = ret;
+        }
     }
 
-    if ( bHardExit || !m_execState.GetCurrentScriptContext().IsNppExeced )
+    ::QueryPerformanceCounter(&liNow);
+
+    return (liNow.QuadPart - liStart.QuadPart);
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoNpeBenchmark(const tstr& params)
+{
+    reportCmdAndParams( DoNpeBenchmarkCommand::Name(), params, fMessageToConsole );
+
+    tstr mode;
+    tstr arg = get_param( params.c_str(), mode, SEP_TABSPACE );
+    NppExecHelpers::StrDelTrailingTabSpaces(arg);
+    NppExecHelpers::StrUpper(mode);
+
+    if ( mode.IsEmpty() )
     {
-        // stop the whole script
-        m_execState.pScriptLineNext = NULL;
-        m_eventAbortTheScript.Set();
+        tstr S;
+        if ( m_Benchmark.isMeasuring )
+        {
+            S = _T("Benchmark: measuring \"");
+            S += m_Benchmark.Workloads.back().sName;
+            S += _T("\"");
+        }
+        else
+        {
+            S.Format( 100, _T("Benchmark: %d workload(s) measured"), static_cast<int>(m_Benchmark.Workloads.size()) );
+        }
+        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
     }
-    else
+    else if ( mode == _T("START") )
     {
-        // stop only the npp_exec'ed part of the script
-        m_execState.pScriptLineNext = m_execState.GetCurrentScriptContext().CmdRange.pEnd;
-    }
-
-    return CMDRESULT_SUCCEEDED;
-}
-
+        NppExecHelpers::StrUnquote(arg);
+        if ( arg.IsEmpty() )
+        {
+            ScriptError( ET_REPORT, _T("- workload name expected: npe_benchmark start <name>") );
+            return CMDRESULT_INVALIDPARAM;
+        }
 
-CScriptEngine::eCmdResult CScriptEngine::DoGoTo(const tstr& params)
-{
-    if ( !reportCmdAndParams( DoGoToCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+        stopBenchmarkWorkload();
 
-    tstr labelName = params;
-    NppExecHelpers::StrDelLeadingTabSpaces(labelName);
-    NppExecHelpers::StrDelTrailingTabSpaces(labelName);
-    NppExecHelpers::StrUpper(labelName);
+        m_Benchmark.Workloads.push_back( tBenchmarkWorkload() );
+        tBenchmarkWorkload& workload = m_Benchmark.Workloads.back();
+        workload.sName = arg;
+        workload.nLines = 0;
+        workload.nElapsedTicks = 0;
 
-    if ( labelName.IsEmpty() )
+        LARGE_INTEGER liNow;
+        ::QueryPerformanceCounter(&liNow);
+        m_Benchmark.nStartTicks = liNow.QuadPart;
+        m_Benchmark.isMeasuring = true; // the next lines are measured in Run()
+    }
+    else if ( mode == _T("STOP") )
     {
-        ScriptError( ET_REPORT, _T("- label name is empty") );
-        return CMDRESULT_INVALIDPARAM;
+        if ( !m_Benchmark.isMeasuring )
+        {
+            ScriptError( ET_REPORT, _T("- no workload is being measured") );
+            return CMDRESULT_FAILED;
+        }
+
+        stopBenchmarkWorkload();
     }
+    else if ( mode == _T("REPORT") )
+    {
+        stopBenchmarkWorkload();
 
-    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-    tLabels& Labels = currentScript.Labels;
-    tLabels::const_iterator itrLabel = Labels.find(labelName);
-    if ( itrLabel == Labels.end() )
+        tstr Report;
+        getBenchmarkReport(Report);
+        m_Benchmark.Workloads.clear();
+
+        NppExecHelpers::StrUnquote(arg);
+        if ( arg.IsEmpty() )
+        {
+            printReportToConsole(m_pNppExec, Report);
+        }
+        else if ( !saveReportToFile(arg, Report) )
+        {
+            tstr Err = _T("- can not write the file: ");
+            Err += arg;
+            ScriptError( ET_REPORT, Err.c_str() );
+            return CMDRESULT_FAILED;
+        }
+    }
+    else if ( mode == _T("CALC") )
     {
-        Runtime::GetLogger().Activate(false);
+        tstr sThreads;
+        tstr sEvaluations = get_param( arg.c_str(), sThreads, SEP_TABSPACE );
+        const int nMaxThreads = c_base::_tstr2int(sThreads.c_str());
+        const int nEvaluations = sEvaluations.IsEmpty() ? 100000 : c_base::_tstr2int(sEvaluations.c_str());
+        if ( nMaxThreads <= 0 || nMaxThreads > MAXIMUM_WAIT_OBJECTS || nEvaluations <= 0 )
+        {
+            ScriptError( ET_REPORT, _T("- usage: npe_benchmark calc <threads> [<evaluations>]") );
+            return CMDRESULT_INVALIDPARAM;
+        }
+
+        stopBenchmarkWorkload();
 
-        tstr Cmd;
-        CListItemT<tstr>* p = m_execState.pScriptLineCurrent->GetNext();
-        while ( p && (p != currentScript.CmdRange.pEnd) )
         {
-            Cmd = p->GetItem();
-            if ( getCmdType(m_pNppExec, Cmd) == CMDTYPE_LABEL )
+            // fparser's constants are initialized before the measurement
+            tstr calcErr;
+            tstr ret;
+            FParserAccess(this)->Calculate(m_pNppExec, _T("1"), calcErr, ret);
+        }
+
+        // each thread's own FParserWrapper vs. the shared one under its lock
+        for ( int nShared = 0; nShared < 2; ++nShared )
+        {
+            for ( int nThreads = 1; nThreads <= nMaxThreads; ++nThreads )
             {
-                NppExecHelpers::StrDelLeadingTabSpaces(Cmd);
-                NppExecHelpers::StrDelTrailingTabSpaces(Cmd);
-                NppExecHelpers::StrUpper(Cmd);
-                if ( Labels.find(Cmd) == Labels.end() )
+                int nFailed = 0;
+                const __int64 nElapsedTicks = runCalcBenchmark(m_pNppExec, nThreads, nEvaluations, nShared != 0, nFailed);
+                if ( nElapsedTicks < 0 )
                 {
-                    Labels[Cmd] = p->GetNext(); // label points to the next command
+                    ScriptError( ET_REPORT, _T("- can not start a new thread") );
+                    return CMDRESULT_FAILED;
                 }
-                if ( Cmd == labelName )
+                if ( nFailed != 0 )
                 {
-                    itrLabel = Labels.find(labelName);
-                    break;
+                    ScriptError( ET_REPORT, _T("- fparser calc error") );
+                    return CMDRESULT_FAILED;
                 }
+
+                m_Benchmark.Workloads.push_back( tBenchmarkWorkload() );
+                tBenchmarkWorkload& workload = m_Benchmark.Workloads.back();
+                workload.sName.Format( 64, nShared ? _T("calc_shared_%d") : _T("calc_threads_%d"), nThreads );
+                workload.nLines = static_cast<__int64>(nThreads) * nEvaluations; // evaluations
+                workload.nElapsedTicks = nElapsedTicks;
             }
-            p = p->GetNext();
         }
 
-        Runtime::GetLogger().Activate(true);
-
-        if ( itrLabel == Labels.end() )
+        tstr S;
+        S.Format( 100, _T("Benchmark: %d workload(s) measured"), static_cast<int>(m_Benchmark.Workloads.size()) );
+        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+    }
+    else if ( mode == _T("INT64") )
+    {
+        const int nCount = arg.IsEmpty() ? 100000 : c_base::_tstr2int(arg.c_str());
+        if ( nCount <= 0 )
         {
-            tstr err = _T("- no label found: ");
-            err += labelName;
-            ScriptError( ET_REPORT, err.c_str() );
-            return CMDRESULT_FAILED;
+            ScriptError( ET_REPORT, _T("- usage: npe_benchmark int64 [<count>]") );
+            return CMDRESULT_INVALIDPARAM;
         }
-    }
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    bool bContinue = true;
+        stopBenchmarkWorkload();
 
-    m_execState.nGoToCounter++;
-    if (m_execState.nGoToCounter > m_execState.nGoToMaxCount)
-    {
-        TCHAR szMsg[240];
+        const int nExprs = static_cast<int>(sizeof(cszInt64BenchmarkExprs)/sizeof(cszInt64BenchmarkExprs[0]));
+        std::vector<tstr> int64Results;
+        std::vector<tstr> fparserResults;
 
-        m_execState.nGoToCounter = 0;
-        bContinue = false;
-        ::wsprintf(szMsg, 
-            _T("%s was performed more than %d times.\n") \
-            _T("Abort execution of this script?\n") \
-            _T("(Press Yes to abort or No to continue execution)"),
-            DoGoToCommand::Name(),
-            m_execState.nGoToMaxCount
-        );
-        if (::MessageBox(m_pNppExec->m_nppData._nppHandle, szMsg, 
-                _T("NppExec Warning: Possible infinite loop"),
-                  MB_YESNO | MB_ICONWARNING) == IDNO)
         {
-            bContinue = true;
+            FParserAccess fpAccess(this);
+
+            // fparser's constants are initialized before the measurement
+            runInt64Benchmark(fpAccess.Get(), m_pNppExec, 1, false, fparserResults);
+
+            for ( int nInt64 = 1; nInt64 >= 0; --nInt64 )
+            {
+                std::vector<tstr>& results = nInt64 ? int64Results : fparserResults;
+                const __int64 nElapsedTicks = runInt64Benchmark(fpAccess.Get(), m_pNppExec, nCount, nInt64 != 0, results);
+
+                m_Benchmark.Workloads.push_back( tBenchmarkWorkload() );
+                tBenchmarkWorkload& workload = m_Benchmark.Workloads.back();
+                workload.sName = nInt64 ? _T("int64_calc") : _T("fparser_calc");
+                workload.nLines = static_cast<__int64>(nCount) * (nExprs + 1); // calculations
+                workload.nElapsedTicks = nElapsedTicks;
+            }
         }
-    }
 
-    if ( bContinue )
+        // both ways must give the same results
+        for ( size_t k = 0; k < int64Results.size(); ++k )
+        {
+            if ( int64Results[k] != fparserResults[k] )
+            {
+                tstr Err;
+                Err.Format( 400, _T("- int64 calc result %s differs from fparser's %s: %s"),
+                    int64Results[k].c_str(), fparserResults[k].c_str(),
+                    (k < static_cast<size_t>(nExprs)) ? cszInt64BenchmarkExprs[k] : _T("$(i)*4 + 1") );
+                ScriptError( ET_REPORT, Err.c_str() );
+                return CMDRESULT_FAILED;
+            }
+        }
+
+        tstr S;
+        S.Format( 100, _T("Benchmark: %d workload(s) measured"), static_cast<int>(m_Benchmark.Workloads.size()) );
+        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+    }
+    else if ( mode == _T("OPTIMIZE") )
     {
-        if ( m_execState.pScriptLineNext == NULL )
+        const int nCount = arg.IsEmpty() ? 100000 : c_base::_tstr2int(arg.c_str());
+        if ( nCount <= 0 )
         {
+            ScriptError( ET_REPORT, _T("- usage: npe_benchmark optimize [<count>]") );
+            return CMDRESULT_INVALIDPARAM;
+        }
 
-            Runtime::GetLogger().Add( _T("; Ignoring GOTO as the script is being stopped") );
+        stopBenchmarkWorkload();
 
+        {
+            // fparser's constants are initialized before the measurement
+            tstr calcErr;
+            tstr ret;
+            FParserAccess(this)->Calculate(m_pNppExec, _T("1"), calcErr, ret);
         }
-        else
+
+        const int nExprs = static_cast<int>(sizeof(cszOptimizeBenchmarkExprs)/sizeof(cszOptimizeBenchmarkExprs[0]));
+        std::vector<tstr> parsedResults;
+        std::vector<tstr> optimizedResults;
+
+        for ( int nOptimize = 0; nOptimize < 2; ++nOptimize )
         {
-            m_execState.SetScriptLineNext(itrLabel->second);
+            std::vector<tstr>& results = nOptimize ? optimizedResults : parsedResults;
+            const __int64 nElapsedTicks = runOptimizeBenchmark(m_pNppExec, nCount, nOptimize != 0, results);
+            if ( nElapsedTicks < 0 )
+            {
+                ScriptError( ET_REPORT, _T("- fparser calc error") );
+                return CMDRESULT_FAILED;
+            }
 
-            Runtime::GetLogger().AddEx( _T("; Jumping to command item p = 0x%X { \"%s\" }"),
-                m_execState.pScriptLineNext, 
-                m_execState.pScriptLineNext ? m_execState.pScriptLineNext->GetItem().c_str() : _T("<NULL>") );
+            m_Benchmark.Workloads.push_back( tBenchmarkWorkload() );
+            tBenchmarkWorkload& workload = m_Benchmark.Workloads.back();
+            workload.sName = nOptimize ? _T("fparser_optimized") : _T("fparser_parsed");
+            workload.nLines = static_cast<__int64>(nCount) * nExprs; // evaluations
+            workload.nElapsedTicks = nElapsedTicks;
+        }
 
+        // the optimized bytecode must give the same results
+        for ( int k = 0; k < nExprs; ++k )
+        {
+            if ( optimizedResults[k] != parsedResults[k] )
+            {
+                tstr Err;
+                Err.Format( 400, _T("- optimized calc result %s differs from %s: %s"),
+                    optimizedResults[k].c_str(), parsedResults[k].c_str(), cszOptimizeBenchmarkExprs[k] );
+                ScriptError( ET_REPORT, Err.c_str() );
+                return CMDRESULT_FAILED;
+            }
         }
+
+        tstr S;
+        S.Format( 100, _T("Benchmark: %d workload(s) measured"), static_cast<int>(m_Benchmark.Workloads.size()) );
+        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
     }
     else
     {
-        ScriptError( ET_ABORT, _T("; Script execution aborted by user (from DoGoTo())") );
-        nCmdResult = CMDRESULT_FAILED;
+        tstr Err = _T("- unknown parameter: ");
+        Err += params;
+        ScriptError( ET_REPORT, Err.c_str() );
+        return CMDRESULT_INVALIDPARAM;
     }
 
-    return nCmdResult;
+    return CMDRESULT_SUCCEEDED;
 }
 
-enum eDecNumberType {
-  DNT_NOTNUMBER = 0,
-  DNT_INTNUMBER,
-  DNT_FLOATNUMBER
-};
-
-static eDecNumberType isPureDecNumber(const TCHAR* s)
+CScriptEngine::eCmdResult CScriptEngine::DoNpeCmdAlias(const tstr& params)
 {
-    if ( s )
+    reportCmdAndParams( DoNpeCmdAliasCommand::Name(), params, fMessageToConsole );
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    tstr aliasName;
+    tstr aliasValue;
+    tstr S;
+
+    CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsCmdAliases());
+    CNppExecMacroVars::tMacroVars& cmdAliases = m_pNppExec->GetMacroVars().GetCmdAliases();
+
+    if ( params.IsEmpty() )
     {
-        if ( (*s == _T('-')) || (*s == _T('+')) )
+
+        Runtime::GetLogger().Add(   _T("; no arguments given - showing all command aliases") );
+
+    }
+    else
+    {
+        CStrSplitT<TCHAR> args;
+        if ( args.Split( substituteMacroVarsIfNotDelayed(this, params, true), _T("="), 2) == 2 )
         {
-            ++s;
+            // set the value
+            aliasName = args.Arg(0);
+            aliasValue = args.Arg(1);
+
+            NppExecHelpers::StrDelLeadingTabSpaces(aliasName);
+            NppExecHelpers::StrDelTrailingTabSpaces(aliasName);
+            NppExecHelpers::StrDelLeadingTabSpaces(aliasValue);
+            NppExecHelpers::StrDelTrailingTabSpaces(aliasValue);
+
+            if ( aliasName.IsEmpty() )
+            {
+                // in case of 'params' is a string which starts with "="
+                if ( args.Split(aliasValue, _T("="), 2) == 2 )
+                {
+                    aliasName = _T("=");
+                    aliasName += args.Arg(0);
+                    aliasValue = args.Arg(1);
+
+                    NppExecHelpers::StrDelTrailingTabSpaces(aliasName);
+                    NppExecHelpers::StrDelLeadingTabSpaces(aliasValue);
+                }
+            }
+            
+            if ( aliasName.length() > 0 )
+            {
+                NppExecHelpers::StrUpper(aliasName);
+
+                CNppExecMacroVars::tMacroVars::iterator itrAlias = cmdAliases.find(aliasName);
+                if ( itrAlias != cmdAliases.end() )
+                {
+                    if ( aliasValue.length() > 0 )
+                    {
+                        // update
+                        itrAlias->second = aliasValue;
+                        
+                        S = aliasName;
+                        S += _T(" -> ");
+                        S += aliasValue;
+                    }
+                    else
+                    {
+                        // remove
+                        cmdAliases.erase(itrAlias);
+
+                        S = _T("- command alias has been removed: ");
+                        S += aliasName;
+                    }
+
+                    m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+                }
+                else
+                {
+                    if ( aliasValue.length() > 0 )
+                    {
+                        // add
+                        cmdAliases[aliasName] = aliasValue;
+
+                        S = aliasName;
+                        S += _T(" -> ");
+                        S += aliasValue;
+                        m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+                    }
+                    else
+                    {
+                        // tried to remove non-existent command alias
+                        S = _T("- no such command alias: ");
+                        S += aliasName;
+                        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+                        nCmdResult = CMDRESULT_FAILED;
+                    }
+                }
+
+                m_pNppExec->GetMacroVars().IncCmdAliasesVersion();
+
+                HMENU hMenu = m_pNppExec->GetNppMainMenu();
+                if ( hMenu )
+                {
+                    const bool bEnable = !cmdAliases.empty();
+                    ::EnableMenuItem( hMenu, g_funcItem[N_NOCMDALIASES]._cmdID,
+                        MF_BYCOMMAND | (bEnable ? MF_ENABLED : MF_GRAYED) );
+                }
+                
+                return nCmdResult;
+            }
+            else
+            {
+                if ( aliasValue.length() > 0 )
+                {
+                    ScriptError( ET_REPORT, _T("- no command alias name specified") );
+                    return CMDRESULT_INVALIDPARAM;
+                }
+                else
+                {
+                    aliasName = _T("=");
+                }
+            }
         }
+        else
+        {
+            aliasName = args.Arg(0);
+            NppExecHelpers::StrDelLeadingTabSpaces(aliasName);
+            NppExecHelpers::StrDelTrailingTabSpaces(aliasName);
 
-        if ( !isDecNumChar(*s) )
-            return DNT_NOTNUMBER; // we need at least one numeric char
-
-        while ( isDecNumChar( *(++s) ) ) ;
+            NppExecHelpers::StrUpper(aliasName);
+        }
         
-        if ( *s == 0 )
-            return DNT_INTNUMBER; // OK, we are at the end of string
+    }
 
-        // end of floating number's mantissa...
-        if ( *s == _T('.') )
+    if ( cmdAliases.empty() )
+    {
+        m_pNppExec->GetConsole().PrintMessage( _T("- no command aliases"), false );
+    }
+    else
+    {
+        if ( aliasName.IsEmpty() )
         {
-            while ( isDecNumChar( *(++s) ) ) ;
-
-            if ( *s == 0 )
-                return DNT_FLOATNUMBER; // e.g. "123." or "123.45"
+            std::vector<const CNppExecMacroVars::tMacroVars::value_type*> sortedAliases;
+            cmdAliases.GetSortedItems(sortedAliases);
+            for ( const CNppExecMacroVars::tMacroVars::value_type* pAlias : sortedAliases )
+            {
+                S = pAlias->first;
+                S += _T(" -> ");
+                S += pAlias->second;
+                m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+            }
         }
-
-        // check for floating number's exponent...
-        if ( (*s == _T('e')) || (*s == _T('E')) )
+        else
         {
-            ++s;
-            if ( (*s == _T('-')) || (*s == _T('+')) )
+            bool bFound = false;
+
+            CNppExecMacroVars::tMacroVars::const_iterator itrAlias = cmdAliases.find(aliasName);
+            if ( itrAlias != cmdAliases.end() )
             {
-                ++s;
+                S = itrAlias->first;
+                S += _T(" -> ");
+                S += itrAlias->second;
+                m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+                bFound = true;
             }
 
-            while ( isDecNumChar(*s) ) 
+            if ( !bFound )
             {
-                if ( *(++s) == 0 )
-                    return DNT_FLOATNUMBER; // OK, we are at the end of string
+                tstr t = _T("- no such command alias: ");
+                t += aliasName;
+                m_pNppExec->GetConsole().PrintMessage( t.c_str(), false );
+                nCmdResult = CMDRESULT_FAILED;
             }
         }
     }
-    return DNT_NOTNUMBER;
-}
 
-enum eCondType {
-    COND_NONE = 0,
-    COND_EQUAL,
-    COND_NOTEQUAL,
-    COND_LESSTHAN,
-    COND_LESSEQUAL,
-    COND_GREATTHAN,
-    COND_GREATEQUAL,
-    COND_EQUALNOCASE
-};
+    return nCmdResult;
+}
 
-template<typename T> class OperandComparator
+CScriptEngine::eCmdResult CScriptEngine::DoNpeConsole(const tstr& params)
 {
-    public:
-        OperandComparator(const T& t1, const T& t2) : m_t1(t1), m_t2(t2)
-        {
-        }
-
-        OperandComparator& operator=(const OperandComparator&) = delete;
+    reportCmdAndParams( DoNpeConsoleCommand::Name(), params, fMessageToConsole );
 
-        bool compare(int condType)
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    bool isSilent = false;
+    
+    if ( params.length() > 0 )
+    {
+        CStrSplitT<TCHAR> args;
+        int n = args.SplitToArgs(params);
+        if ( n > 0 )
         {
-            bool ret = false;
-            switch ( condType )
+            bool isEncChanged = false;
+            bool isFilterChanged = false;
+            
+            for ( int i = 0; i < n; i++ )
             {
-                case COND_EQUAL:       ret = eq(); break;
-                case COND_NOTEQUAL:    ret = ne(); break;
-                case COND_LESSTHAN:    ret = lt(); break;
-                case COND_LESSEQUAL:   ret = le(); break;
-                case COND_GREATTHAN:   ret = gt(); break;
-                case COND_GREATEQUAL:  ret = ge(); break;
-                case COND_EQUALNOCASE: ret = eq_i(); break;
-            }
-            return ret;
-        }
-
-        bool eq() const { return (m_t1 == m_t2); }
-        bool ne() const { return (m_t1 != m_t2); }
-        bool lt() const { return (m_t1 < m_t2); }
-        bool le() const { return (m_t1 <= m_t2); }
-        bool gt() const { return (m_t1 > m_t2); }
-        bool ge() const { return (m_t1 >= m_t2); }
-        bool eq_i() const { return (m_t1 == m_t2); }
-
-    protected:
-        const T& m_t1;
-        const T& m_t2;
-};
+                bool isOK = false;
+                tstr arg = args.GetArg(i);
+                if ( arg.length() == 2 )
+                {
+                    // a+/a-     append mode on/off
+                    // d+/d-     follow current directory on/off
+                    // h+/h-     console commands history on/off
+                    // m+/m-     console internal messages on/off
+                    // q+/q-     command aliases on/off
+                    // v+/v-     set the $(OUTPUT) variable on/off
+                    // f+/f-     console output filter on/off
+                    // r+/r-     console output replace filter on/off
+                    // k0..3     catch NppExec's shortcut keys on/off
+                    // o0/o1/o2  console output encoding: ANSI/OEM/UTF8
+                    // i0/i1/i2  console input encoding: ANSI/OEM/UTF8
+                    // --        silent (don't print Console mode info)
 
-template<> bool OperandComparator<tstr>::eq_i() const
-{
-    return ( NppExecHelpers::StrCmpNoCase(m_t1, m_t2) == 0 );
-}
+                    switch ( arg[0] )
+                    {
+                        case _T('a'):
+                        case _T('A'):
+                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
+                            {
+                                bool bOn = ( arg[1] == _T('+') );
+                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_APPENDMODE, bOn);
+                                isOK = true;
+                            }
+                            break;
 
-class CondOperand
-{
-    public:
-        CondOperand(const tstr& s) : m_value_str(s), m_value_dbl(0), m_value_int64(0)
-        {
-            m_type = isPureDecNumber(s.c_str());
-            if ( m_type == DNT_INTNUMBER )
-            {
-                m_value_int64 = c_base::_tstr2int64(s.c_str());
-                m_value_dbl = static_cast<double>(m_value_int64); // to be able to compare as double
-            }
-            else if ( m_type == DNT_FLOATNUMBER )
-            {
-                m_value_dbl = _t_str2f(s.c_str());
-            }
-        }
+                        case _T('d'):
+                        case _T('D'):
+                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
+                            {
+                                bool bOn = ( arg[1] == _T('+') );
+                                HMENU hMenu = m_pNppExec->GetNppMainMenu();
+                                if ( hMenu )
+                                {
+                                    ::CheckMenuItem(hMenu, g_funcItem[N_CDCURDIR]._cmdID,
+                                        MF_BYCOMMAND | (bOn ? MF_CHECKED : MF_UNCHECKED));
+                                }
+                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_CDCURDIR, bOn);
+                                isOK = true;
+                            }
+                            break;
 
-        const TCHAR* type_as_str() const
-        {
-            switch ( type() )
-            {
-                case DNT_NOTNUMBER:
-                    return _T("str");
-                case DNT_INTNUMBER:
-                    return _T("int");
-                case DNT_FLOATNUMBER:
-                    return _T("dbl");
-            }
-            return _T("");
-        }
+                        case _T('h'):
+                        case _T('H'):
+                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
+                            {
+                                bool bOn = ( arg[1] == _T('+') );
+                                HMENU hMenu = m_pNppExec->GetNppMainMenu();
+                                if ( hMenu )
+                                {
+                                    ::CheckMenuItem(hMenu, g_funcItem[N_CMDHISTORY]._cmdID,
+                                        MF_BYCOMMAND | (bOn ? MF_CHECKED : MF_UNCHECKED));
+                                }
+                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_CMDHISTORY, bOn);
+                                isOK = true;
+                            }
+                            break;
 
-        inline eDecNumberType type() const { return m_type; }
-        inline const tstr& value_str() const { return m_value_str; }
-        inline double value_dbl() const { return m_value_dbl; }
-        inline __int64 value_int64() const { return m_value_int64; }
+                        case _T('m'):
+                        case _T('M'):
+                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
+                            {
+                                bool bOn = ( arg[1] == _T('-') ); // inverse
+                                HMENU hMenu = m_pNppExec->GetNppMainMenu();
+                                if ( hMenu )
+                                {
+                                    ::CheckMenuItem(hMenu, g_funcItem[N_NOINTMSGS]._cmdID,
+                                        MF_BYCOMMAND | (bOn ? MF_CHECKED : MF_UNCHECKED));
+                                }
+                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_NOINTMSGS, bOn);
+                                isOK = true;
+                            }
+                            break;
 
-    protected:
-        tstr    m_value_str;
-        double  m_value_dbl;
-        __int64 m_value_int64;
-        eDecNumberType m_type;
-};
+                        case _T('o'):
+                        case _T('O'):
+                            {
+                                int enc = (int) (arg[1] - _T('0'));
+                                if ( (enc >= CConsoleEncodingDlg::ENC_ANSI) &&
+                                     (enc < CConsoleEncodingDlg::ENC_TOTAL) )
+                                {
+                                    unsigned int enc_opt = m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_ENCODING);
+                                    enc_opt &= 0xFFF0;
+                                    enc_opt |= enc;
+                                    m_pNppExec->GetOptions().SetUint(OPTU_CONSOLE_ENCODING, enc_opt);
+                                    isEncChanged = true;
+                                    isOK = true;
+                                }
+                            }
+                            break;
 
-static bool IsConditionTrue(const tstr& Condition, bool* pHasSyntaxError)
-{
-    if ( pHasSyntaxError )  *pHasSyntaxError = false;
+                        case _T('i'):
+                        case _T('I'):
+                            {
+                                int enc = (int) (arg[1] - _T('0'));
+                                if ( (enc >= CConsoleEncodingDlg::ENC_ANSI) &&
+                                     (enc < CConsoleEncodingDlg::ENC_TOTAL) )
+                                {
+                                    unsigned int enc_opt = m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_ENCODING);
+                                    enc_opt &= 0xFF0F;
+                                    enc_opt |= (enc * 0x10);
+                                    m_pNppExec->GetOptions().SetUint(OPTU_CONSOLE_ENCODING, enc_opt);
+                                    isEncChanged = true;
+                                    isOK = true;
+                                }
+                            }
+                            break;
 
-    CStrSplitT<TCHAR> args;
+                        case _T('q'):
+                        case _T('Q'):
+                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
+                            {
+                                bool bOn = ( arg[1] == _T('-') ); // inverse
+                                HMENU hMenu = m_pNppExec->GetNppMainMenu();
+                                if ( hMenu )
+                                {
+                                    ::CheckMenuItem(hMenu, g_funcItem[N_NOCMDALIASES]._cmdID,
+                                        MF_BYCOMMAND | (bOn ? MF_CHECKED : MF_UNCHECKED));
+                                }
+                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_NOCMDALIASES, bOn);
+                                isOK = true;
+                            }
+                            break;
 
-    typedef struct sCond {
-        const TCHAR* szCond;
-        int          nCondType;
-    } tCond;
+                        case _T('v'):
+                        case _T('V'):
+                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
+                            {
+                                bool bOn = ( arg[1] == _T('+') );
+                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_SETOUTPUTVAR, bOn);
+                                isOK = true;
+                            }
+                            break;
 
-    static const tCond arrCond[] = {
-        { _T("=="), COND_EQUAL       },
-        { _T("!="), COND_NOTEQUAL    },
-        { _T("<>"), COND_NOTEQUAL    },
-        { _T(">="), COND_GREATEQUAL  },
-        { _T("<="), COND_LESSEQUAL   },
-        { _T("~="), COND_EQUALNOCASE },
-        { _T("="),  COND_EQUAL       },
-        { _T("<"),  COND_LESSTHAN    },
-        { _T(">"),  COND_GREATTHAN   }
-    };
+                        case _T('f'):
+                        case _T('F'):
+                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
+                            {
+                                bool bOn = ( arg[1] == _T('+') );
+                                m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_ENABLE, bOn);
+                                isFilterChanged = true;
+                                isOK = true;
+                            }
+                            break;
 
-    int  condType = COND_NONE;
-    tstr cond;
-    tstr op1;
-    tstr op2;
+                        case _T('r'):
+                        case _T('R'):
+                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
+                            {
+                                bool bOn = ( arg[1] == _T('+') );
+                                m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_R_ENABLE, bOn);
+                                isFilterChanged = true;
+                                isOK = true;
+                            }
+                            break;
 
-    if ( args.SplitToArgs(Condition) == 3 )
-    {
-        cond = args.GetArg(1);
-        op1 = args.GetArg(0);
-        op2 = args.GetArg(2);
+                        case _T('k'):
+                        case _T('K'):
+                            {
+                                unsigned int k = (unsigned int) (arg[1] - _T('0'));
+                                if ( (k >= ConsoleDlg::CSK_OFF) &&
+                                     (k <= ConsoleDlg::CSK_ALL) )
+                                {
+                                    m_pNppExec->GetOptions().SetUint(OPTU_CONSOLE_CATCHSHORTCUTKEYS, k);
+                                    isOK = true;
+                                }
+                            }
+                            break;
 
-        for ( const tCond& c : arrCond )
-        {
-            if ( cond == c.szCond )
-            {
-                condType = c.nCondType;
-                break;
+                        case _T('-'):
+                            if ( arg[1] == _T('-') )
+                            {
+                                isSilent = true;
+                                isOK = true;
+                            }
+                            break;
+                    }
+                }
+                if ( !isOK )
+                {
+                    arg.Insert( 0, _T("- unknown parameter: ") );
+                    ScriptError( ET_REPORT, arg.c_str() );
+                    nCmdResult = CMDRESULT_INVALIDPARAM;
+                }
             }
-        }
 
-        if ( condType != COND_NONE )
-        {
-            // restore removed quotes, if any
-            int n = Condition.Find(op1);
-            if ( Condition.GetAt(n - 1) == _T('\"') )
+            if ( isEncChanged )
             {
-                op1.Insert(0, _T('\"'));
-                op1 += _T('\"');
+                unsigned int enc_opt = m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_ENCODING);
+                if ( enc_opt > 0xFF )
+                {
+                    // "input as output" flag is set
+                    unsigned int encIn  = CConsoleEncodingDlg::getInputEncoding(enc_opt);
+                    unsigned int encOut = CConsoleEncodingDlg::getOutputEncoding(enc_opt);
+                    if ( encIn != encOut )
+                    {
+                        // remove the "input as output" flag
+                        m_pNppExec->GetOptions().SetUint(OPTU_CONSOLE_ENCODING, enc_opt & 0xFF);
+                    }
+                }
+                m_pNppExec->UpdateConsoleEncoding();
             }
 
-            n = Condition.RFind(op2);
-            if ( Condition.GetAt(n - 1) == _T('\"') )
+            if ( isFilterChanged )
             {
-                op2.Insert(0, _T('\"'));
-                op2 += _T('\"');
+                m_pNppExec->UpdateOutputFilterMenuItem();
             }
         }
     }
-    else
+
+    if ( !isSilent )
     {
-        for ( const tCond& c : arrCond )
+        tstr S1 = _T("Console mode: ");
+        tstr S2 = _T("; ");
+        // append
+        S1 += _T("a");
+        S2 += _T("append: ");
+        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_APPENDMODE), S1, S2 );
+        // cd_curdir
+        S1 += _T(" d");
+        S2 += _T(", cd_curdir: ");
+        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_CDCURDIR), S1, S2 );
+        // cmd_history
+        S1 += _T(" h");
+        S2 += _T(", cmd_history: ");
+        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_CMDHISTORY), S1, S2 );
+        // int_msgs
+        S1 += _T(" m");
+        S2 += _T_RE_EOL _T("; int_msgs: ");
+        appendOnOff( !m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOINTMSGS), S1, S2 );
+        // cmd_aliases
+        S1 += _T(" q");
+        S2 += _T(", cmd_aliases: ");
+        appendOnOff( !m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOCMDALIASES), S1, S2 );
+        // $(OUTPUT)
+        S1 += _T(" v");
+        S2 += _T(", output_var: ");
+        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_SETOUTPUTVAR), S1, S2 );
+        // filters
+        S1 += _T(" f");
+        S2 += _T_RE_EOL _T("; filter: ");
+        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONFLTR_ENABLE), S1, S2 );
+        S1 += _T(" r");
+        S2 += _T(", replace_filter: ");
+        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONFLTR_R_ENABLE), S1, S2 );
+        // shortcut_keys
+        S1 += _T(" k");
+        S2 += _T_RE_EOL _T("; shortcut_keys: ");
         {
-            int n = Condition.Find(c.szCond);
-            if ( n >= 0 )
-            {
-                condType = c.nCondType;
-                cond = c.szCond;
-                op1.Copy(Condition.c_str(), n);
-                op2.Copy(Condition.c_str() + n + lstrlen(c.szCond));
-
-                NppExecHelpers::StrDelLeadingTabSpaces(op1);
-                NppExecHelpers::StrDelTrailingTabSpaces(op1);
-
-                NppExecHelpers::StrDelLeadingTabSpaces(op2);
-                NppExecHelpers::StrDelTrailingTabSpaces(op2);
-                break;
-            }
+            const tIntMapping mappings[] = {
+                { ConsoleDlg::CSK_OFF, _T("off") },
+                { ConsoleDlg::CSK_STD, _T("std") },
+                { ConsoleDlg::CSK_USR, _T("usr") },
+                { ConsoleDlg::CSK_ALL, _T("std+usr") },
+                { 0x00, NULL } // trailing element with .str=NULL
+            };
+            appendInt( m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_CATCHSHORTCUTKEYS), S1, S2, mappings );
         }
+        // out_enc
+        unsigned int enc_opt = m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_ENCODING);
+        S1 += _T(" o");
+        S2 += _T_RE_EOL _T("; out_enc: ");
+        appendEnc( enc_opt, false, S1, S2 );
+        // in_enc
+        S1 += _T(" i");
+        S2 += _T(", in_enc: ");
+        appendEnc( enc_opt, true, S1, S2 );
+        // finally...
+        m_pNppExec->GetConsole().PrintMessage( S1.c_str(), false );
+        m_pNppExec->GetConsole().PrintMessage( S2.c_str(), false );
     }
 
-    bool ret = false;
-
-    if ( condType != COND_NONE )
-    {
-
-        Runtime::GetLogger().Add(   _T("IsConditionTrue()") );
-        Runtime::GetLogger().Add(   _T("{") );
-        Runtime::GetLogger().IncIndentLevel();
+    return nCmdResult;
+}
 
-        // As the original quotes around op1 and op2 are kept (if any),
-        // we treat "123" as a string and 123 as a number
-        CondOperand co1(op1);
-        CondOperand co2(op2);
+CScriptEngine::eCmdResult CScriptEngine::DoNpeDebugLog(const tstr& params)
+{
+    reportCmdAndParams( DoNpeDebugLogCommand::Name(), params, fMessageToConsole );
 
-        Runtime::GetLogger().AddEx( _T("op1 (%s) :  %s"), co1.type_as_str(), op1.c_str() );
-        Runtime::GetLogger().AddEx( _T("op2 (%s) :  %s"), co2.type_as_str(), op2.c_str() );
-        Runtime::GetLogger().AddEx( _T("condition :  %s"), cond.c_str() );
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nParam = getOnOffParam(params);
+    if (nParam == PARAM_ON)
+    {
+        m_pNppExec->GetOptions().SetBool(OPTB_NPE_DEBUGLOG, true);
+        Runtime::GetLogger().SetOutputMode(true, CNppExec::printScriptString);
+    }
+    else if (nParam == PARAM_OFF)
+    {
+        m_pNppExec->GetOptions().SetBool(OPTB_NPE_DEBUGLOG, false);
+        Runtime::GetLogger().SetOutputMode(false);
+    }
+    else if (nParam != PARAM_EMPTY)
+    {
+        tstr Err = _T("- unknown parameter: ");
+        Err += params;
+        ScriptError( ET_REPORT, Err.c_str() );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
+    m_pNppExec->GetConsole().PrintMessage( m_pNppExec->GetOptions().GetBool(OPTB_NPE_DEBUGLOG) ? 
+        _T("Debug Log is On (1)") : _T("Debug Log is Off (0)"), false );
 
-        if ( (co1.type() == DNT_NOTNUMBER) || (co2.type() == DNT_NOTNUMBER) )
-        {
-            // compare as string values
-            ret = OperandComparator<tstr>(co1.value_str(), co2.value_str()).compare(condType);
-        }
-        else if ( (co1.type() == DNT_FLOATNUMBER) || (co2.type() == DNT_FLOATNUMBER) )
-        {
-            // compare as floating-point values
-            ret = OperandComparator<double>(co1.value_dbl(), co2.value_dbl()).compare(condType);
-        }
-        else
-        {
-            // compare as integer values
-            ret = OperandComparator<__int64>(co1.value_int64(), co2.value_int64()).compare(condType);
-        }
+    return nCmdResult;
+}
 
-        Runtime::GetLogger().DecIndentLevel();
-        Runtime::GetLogger().Add(   _T("}") );
+CScriptEngine::eCmdResult CScriptEngine::DoNpeNoEmptyVars(const tstr& params)
+{
+    reportCmdAndParams( DoNpeNoEmptyVarsCommand::Name(), params, fMessageToConsole );
 
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nParam = getOnOffParam(params);
+    if (nParam == PARAM_ON)
+    {
+        m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_NOEMPTYVARS, true);
     }
-    else
+    else if (nParam == PARAM_OFF)
     {
-        if ( pHasSyntaxError )  *pHasSyntaxError = true;
-        ret = false;
+        m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_NOEMPTYVARS, false);
     }
+    else if (nParam != PARAM_EMPTY)
+    {
+        tstr Err = _T("- unknown parameter: ");
+        Err += params;
+        ScriptError( ET_REPORT, Err.c_str() );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
+    m_pNppExec->GetConsole().PrintMessage( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOEMPTYVARS) ? 
+          _T("Replace empty (uninitialized) vars with empty str:  On (1)") : 
+            _T("Replace empty (uninitialized) vars with empty str:  Off (0)"), false );
 
-    return ret;
+    return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoIf(const tstr& params)
+CScriptEngine::CProfileScope::CProfileScope(eProfileCounter nCounter)
+  : m_pScriptEngine(NULL)
+  , m_nCounter(nCounter)
+  , m_nStartTicks(0)
 {
-    return doIf(params, false);
+    if ( m_nProfilingEngines == 0 )
+        return; // nothing is being profiled - the usual case
+
+    // only the script engine's own thread can find it here,
+    // so it can't be destroyed until this scope ends
+    if ( m_dwProfilingTlsIndex != TLS_OUT_OF_INDEXES )
+        m_pScriptEngine = (CScriptEngine *) ::TlsGetValue(m_dwProfilingTlsIndex);
+    if ( m_pScriptEngine && (m_pScriptEngine->m_Profile.CounterDepth[m_nCounter]++ == 0) )
+    {
+        LARGE_INTEGER liNow;
+        ::QueryPerformanceCounter(&liNow);
+        m_nStartTicks = liNow.QuadPart;
+    }
 }
 
-CScriptEngine::eCmdResult CScriptEngine::doIf(const tstr& params, bool isElseIf)
+CScriptEngine::CProfileScope::~CProfileScope()
 {
-    enum eIfMode {
-        IF_GOTO = 0,
-        IF_THEN
-    };
+    if ( m_pScriptEngine && (--m_pScriptEngine->m_Profile.CounterDepth[m_nCounter] == 0) )
+    {
+        LARGE_INTEGER liNow;
+        ::QueryPerformanceCounter(&liNow);
+        m_pScriptEngine->m_Profile.LineCounterTicks[m_nCounter] += liNow.QuadPart - m_nStartTicks;
+    }
+}
 
-    if ( !reportCmdAndParams( DoIfCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+// Explicit TLS: implicit TLS (thread_local) does not work on Windows XP
+// in a DLL loaded by LoadLibrary, and Notepad++ loads the plugins so
+void CScriptEngine::InitProfilingTls()
+{
+    if ( m_dwProfilingTlsIndex == TLS_OUT_OF_INDEXES )
+        m_dwProfilingTlsIndex = ::TlsAlloc(); // TLS_OUT_OF_INDEXES: the scopes are not profiled
+}
 
-    tstr paramsUpperCase = params;
-    NppExecHelpers::StrUpper(paramsUpperCase);
+void CScriptEngine::FreeProfilingTls()
+{
+    if ( m_dwProfilingTlsIndex != TLS_OUT_OF_INDEXES )
+    {
+        ::TlsFree(m_dwProfilingTlsIndex);
+        m_dwProfilingTlsIndex = TLS_OUT_OF_INDEXES;
+    }
+}
 
-    static const TCHAR* arrGoTo[] = {
-        _T(" GOTO "),
-        _T("\tGOTO\t"),
-        _T("\tGOTO "),
-        _T(" GOTO\t")
-    };
+void CScriptEngine::startProfiling()
+{
+    m_Profile.Lines.clear();
+    m_Profile.LineByItem.clear();
+    for ( int i = 0; i < pcTotalCount; ++i )
+    {
+        m_Profile.LineCounterTicks[i] = 0;
+    }
 
-    static const TCHAR* arrThen[] = {
-        _T(" THEN"),
-        _T("\tTHEN")
-    };
+    LARGE_INTEGER liNow;
+    ::QueryPerformanceCounter(&liNow);
+    m_Profile.nStartTicks = liNow.QuadPart;
 
-    int mode = IF_GOTO;
-    int n = -1;
-    for ( const TCHAR* const& i : arrGoTo )
+    if ( !m_Profile.isProfiling )
     {
-        n = paramsUpperCase.RFind(i);
-        if ( n >= 0 )
-            break;
+        m_Profile.isProfiling = true; // the next lines are profiled in Run()
+
+        // NPE_PROFILE is executed by the script's thread
+        if ( m_dwProfilingTlsIndex != TLS_OUT_OF_INDEXES )
+            ::TlsSetValue(m_dwProfilingTlsIndex, this);
+        ::InterlockedIncrement(&m_nProfilingEngines);
     }
+}
 
-    if ( n < 0 )
+void CScriptEngine::stopProfiling()
+{
+    if ( m_Profile.isProfiling )
     {
-        if ( paramsUpperCase.EndsWith(_T(" GOTO")) || paramsUpperCase.EndsWith(_T("\tGOTO")) )
-        {
-            ScriptError( ET_UNPREDICTABLE, _T("- Empty goto-label specified.") );
-            return CMDRESULT_INVALIDPARAM;
-        }
+        m_Profile.isProfiling = false;
 
-        mode = IF_THEN;
-        for ( const TCHAR* const& i : arrThen )
+        if ( (m_dwProfilingTlsIndex != TLS_OUT_OF_INDEXES) &&
+             (::TlsGetValue(m_dwProfilingTlsIndex) == this) )
         {
-            n = paramsUpperCase.RFind(i);
-            if ( n >= 0 )
-                break;
+            ::TlsSetValue(m_dwProfilingTlsIndex, NULL);
         }
-
-        if ( n < 0 )
-            Runtime::GetLogger().Add(   _T("- no \"goto\" or \"then\" specified, assuming \"then\"") );
+        ::InterlockedDecrement(&m_nProfilingEngines);
     }
+}
 
-    tstr ifCondition;
-    ifCondition.Copy( params.c_str(), n );
-    NppExecHelpers::StrDelLeadingTabSpaces(ifCondition);
-    NppExecHelpers::StrDelTrailingTabSpaces(ifCondition);
+CScriptEngine::tProfileLine* CScriptEngine::getProfileLine(const CListItemT<tstr>* pCmdItem, const ScriptContext& scriptContext)
+{
+    auto itr = m_Profile.LineByItem.find(pCmdItem);
+    if ( itr != m_Profile.LineByItem.end() )
+        return itr->second;
 
-    if ( ifCondition.IsEmpty() )
+    // the first line seen from this script body: all its lines are numbered at once
+    tstr sScriptName = scriptContext.ScriptName;
+    if ( sScriptName.IsEmpty() )
+        sScriptName = _T("(main)");
+
+    // NPP_EXEC'ed bodies have no empty lines, so their source line numbers
+    // are reported; the lines of the main script are just counted
+    const std::vector<int>* pLineNumbers = scriptContext.LineNumbers.get();
+    tProfileLine* pProfileLine = NULL;
+    int nLineIndex = 0;
+    for ( const CListItemT<tstr>* p = scriptContext.CmdRange.pBegin; p != NULL; p = p->GetNext() )
     {
-        ScriptError( ET_UNPREDICTABLE, _T("- Empty if-condition specified.") );
-        return CMDRESULT_INVALIDPARAM;
+        const int nLineNumber = ( pLineNumbers && nLineIndex < (int) pLineNumbers->size() ) ? (*pLineNumbers)[nLineIndex] : nLineIndex + 1;
+        ++nLineIndex;
+        auto ins = m_Profile.Lines.insert( std::make_pair(std::make_pair(sScriptName, nLineNumber), tProfileLine()) );
+        tProfileLine& profileLine = ins.first->second;
+        if ( ins.second )
+        {
+            profileLine.sScriptName = sScriptName;
+            profileLine.nLineNumber = nLineNumber;
+            profileLine.sLine = p->GetItem();
+            NppExecHelpers::StrDelLeadingTabSpaces(profileLine.sLine);
+            profileLine.nHits = 0;
+            profileLine.nTotalTicks = 0;
+            for ( int i = 0; i < pcTotalCount; ++i )
+            {
+                profileLine.CounterTicks[i] = 0;
+            }
+        }
+        m_Profile.LineByItem[p] = &profileLine;
+
+        if ( p == pCmdItem )
+            pProfileLine = &profileLine;
     }
 
-    tstr labelName;
+    return pProfileLine;
+}
 
-    if ( mode == IF_GOTO )
-    {
-        labelName.Copy( params.c_str() + n + 6 );
-        NppExecHelpers::StrDelLeadingTabSpaces(labelName);
-        NppExecHelpers::StrDelTrailingTabSpaces(labelName);
-        NppExecHelpers::StrUpper(labelName);
+void CScriptEngine::addProfileSample(tProfileLine* pProfileLine, __int64 nLineStartTicks)
+{
+    LARGE_INTEGER liNow;
+    ::QueryPerformanceCounter(&liNow);
 
-        if ( labelName.IsEmpty() )
+    if ( pProfileLine && (nLineStartTicks >= m_Profile.nStartTicks) ) // else this line has (re)started the profiling
+    {
+        ++pProfileLine->nHits;
+        pProfileLine->nTotalTicks += liNow.QuadPart - nLineStartTicks;
+        for ( int i = 0; i < pcTotalCount; ++i )
         {
-            ScriptError( ET_UNPREDICTABLE, _T("- Empty goto-label specified.") );
-            return CMDRESULT_INVALIDPARAM;
+            pProfileLine->CounterTicks[i] += m_Profile.LineCounterTicks[i];
         }
     }
 
-    bool hasSyntaxError = false;
-    bool isConditionOK = IsConditionTrue(ifCondition, &hasSyntaxError);
-
-    if ( hasSyntaxError )
+    for ( int i = 0; i < pcTotalCount; ++i )
     {
-        ScriptError( ET_UNPREDICTABLE, _T("- Syntax error in the if-condition.") );
-        return CMDRESULT_FAILED;
+        m_Profile.LineCounterTicks[i] = 0;
     }
+}
 
-    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-    if ( mode == IF_GOTO )
+void CScriptEngine::getProfileReport(tstr& Report) const
+{
+    LARGE_INTEGER liFreq;
+    ::QueryPerformanceFrequency(&liFreq);
+    const double dTicksPerMs = static_cast<double>(liFreq.QuadPart) / 1000.0;
+
+    // without own data, the last profiled script is reported
+    tProfileLines LastProfileLines;
+    if ( m_Profile.Lines.empty() )
     {
-        if ( isConditionOK )
-        {
+        CCriticalSectionLockGuard lock(m_csLastProfile);
+        LastProfileLines = m_LastProfileLines;
+    }
+    const tProfileLines& ProfileLines = m_Profile.Lines.empty() ? LastProfileLines : m_Profile.Lines;
 
-            Runtime::GetLogger().Add(   _T("; The condition is true.") );
+    std::vector<const tProfileLine*> Lines;
+    for ( const auto& line : ProfileLines )
+    {
+        if ( line.second.nHits != 0 )
+            Lines.push_back( &line.second );
+    }
 
-            DoGoTo(labelName);
-        }
-        else
-        {
+    std::stable_sort( Lines.begin(), Lines.end(),
+        [](const tProfileLine* pLine1, const tProfileLine* pLine2) { return (pLine1->nTotalTicks > pLine2->nTotalTicks); } );
 
-            Runtime::GetLogger().Add(   _T("; The condition is false; proceeding to next line") );
+    TCHAR szRow[200];
+    _t_sprintf( szRow, _T("Profile: %d line(s), sorted by total time\n"), static_cast<int>(Lines.size()) );
+    Report = szRow;
+    Report += _T("  total ms      hits    child ms     vars ms  console ms  script:line  command\n");
 
-            if ( !isElseIf )
-                currentScript.PushIfState(IF_MAYBE_ELSE); // ELSE may appear after IF ... GOTO
-            else
-                currentScript.SetIfState(IF_MAYBE_ELSE);
-        }
-    }
-    else // IF_THEN
+    for ( const tProfileLine* pLine : Lines )
     {
-        if ( isConditionOK )
-        {
+        _t_sprintf( szRow, _T("%10.3f %9.0f  %10.3f  %10.3f  %10.3f  "),
+          pLine->nTotalTicks / dTicksPerMs, static_cast<double>(pLine->nHits),
+          pLine->CounterTicks[pcChildProcess] / dTicksPerMs,
+          pLine->CounterTicks[pcMacroVars] / dTicksPerMs,
+          pLine->CounterTicks[pcConsoleOutput] / dTicksPerMs );
+        Report += szRow;
+        Report += pLine->sScriptName;
+        _t_sprintf( szRow, _T(":%d  "), pLine->nLineNumber );
+        Report += szRow;
+        Report += pLine->sLine;
+        Report += _T('\n');
+    }
+}
 
-            Runtime::GetLogger().Add(   _T("; The condition is true; executing lines under the IF") );
+CScriptEngine::eCmdResult CScriptEngine::DoNpeProfile(const tstr& params)
+{
+    reportCmdAndParams( DoNpeProfileCommand::Name(), params, fMessageToConsole );
 
-            if ( !isElseIf )
-                currentScript.PushIfState(IF_EXECUTING);
-            else
-                currentScript.SetIfState(IF_EXECUTING);
-        }
-        else
-        {
+    tstr mode;
+    tstr arg = get_param( params.c_str(), mode, SEP_TABSPACE );
+    NppExecHelpers::StrDelTrailingTabSpaces(arg);
+    NppExecHelpers::StrUpper(mode);
 
-            Runtime::GetLogger().Add(   _T("; The condition is false; waiting for ELSE or ENDIF") );
+    if ( mode == _T("REPORT") )
+    {
+        tstr Report;
+        getProfileReport(Report);
 
-            if ( !isElseIf )
-                currentScript.PushIfState(IF_WANT_ELSE);
-            else
-                currentScript.SetIfState(IF_WANT_ELSE);
+        NppExecHelpers::StrUnquote(arg);
+        if ( arg.IsEmpty() )
+        {
+            printReportToConsole(m_pNppExec, Report);
+        }
+        else if ( !saveReportToFile(arg, Report) )
+        {
+            tstr Err = _T("- can not write the file: ");
+            Err += arg;
+            ScriptError( ET_REPORT, Err.c_str() );
+            return CMDRESULT_FAILED;
         }
+        return CMDRESULT_SUCCEEDED;
     }
 
-    return CMDRESULT_SUCCEEDED;
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nParam = getOnOffParam(params);
+    if (nParam == PARAM_ON)
+    {
+        startProfiling();
+    }
+    else if (nParam == PARAM_OFF)
+    {
+        stopProfiling(); // the collected data is kept for "npe_profile report"
+    }
+    else if (nParam != PARAM_EMPTY)
+    {
+        tstr Err = _T("- unknown parameter: ");
+        Err += params;
+        ScriptError( ET_REPORT, Err.c_str() );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
+    m_pNppExec->GetConsole().PrintMessage( m_Profile.isProfiling ? 
+          _T("Profiling of the script lines:  On (1)") : 
+            _T("Profiling of the script lines:  Off (0)"), false );
+
+    return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoInputBox(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNpeQueue(const tstr& params)
 {
-    if ( !reportCmdAndParams( DoInputBoxCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+    if ( !reportCmdAndParams( DoNpeQueueCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
         return CMDRESULT_INVALIDPARAM;
 
-    runInputBox(this, params);
+    // command to be queued
+    bool bUseSeparateScript = true;
+    tstr Cmd = getQueuedCommand(params, bUseSeparateScript);
+    Cmd = substituteMacroVarsIfNotDelayed(this, Cmd, true);
 
-    return CMDRESULT_SUCCEEDED;
-}
+    if ( bUseSeparateScript && (m_nRunFlags & rfExitScript) == 0 )
+    {
+        // queuing, similar to NppExecPluginInterface's npemExecuteQueuedScript
+        CListT<tstr> CmdList(Cmd);
+        CNppExecCommandExecutor::ScriptableCommand * pCommand = new CNppExecCommandExecutor::DoRunScriptCommand(tstr(), CmdList, 0, CNppExecCommandExecutor::ExpirableCommand::NonExpirable);
+        m_pNppExec->GetCommandExecutor().ExecuteCommand(pCommand);
+    }
+    else
+    {
+        // no queuing, using the very same script
+        m_CmdList.Add(Cmd); // will be executed as the last command of m_CmdList
 
-CScriptEngine::eCmdResult CScriptEngine::DoMessageBox(const tstr& params)
-{
-    if ( !reportCmdAndParams( DoMessageBoxCommand::Name(), params, fMessageToConsole ) )
-        return CMDRESULT_INVALIDPARAM;
+        //m_execState.pScriptLineCurrent->SetItem(tstr()); <-- Don't do this!
+        // If this command is inside a goto-loop, then on the next iteration
+        // of the loop this command would be empty!
+    }
 
-    return runMessageBox(this, params);
+    return CMDRESULT_SUCCEEDED;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoLabel(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNpeSendMsgBufLen(const tstr& params)
 {
-    if ( !reportCmdAndParams( DoLabelCommand::Name(), params, fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+    reportCmdAndParams( DoNpeSendMsgBufLenCommand::Name(), params, fMessageToConsole );
 
-    tstr labelName = params;
-    NppExecHelpers::StrDelLeadingTabSpaces(labelName);
-    NppExecHelpers::StrDelTrailingTabSpaces(labelName);
-    NppExecHelpers::StrUpper(labelName);
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nBufLen = 0;
 
-    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
-    tLabels& Labels = currentScript.Labels;
-    tLabels::const_iterator itrLabel = Labels.find(labelName);
-    if ( itrLabel != Labels.end() )
+    if ( params.IsEmpty() )
     {
-        if ( itrLabel->second != m_execState.pScriptLineCurrent->GetNext() )
+        nBufLen = m_pNppExec->GetOptions().GetInt(OPTI_SENDMSG_MAXBUFLEN);
+    }
+    else
+    {
+        nBufLen = c_base::_tstr2int(params.c_str());
+        if ( nBufLen > 0 )
+        {
+            if ( nBufLen < 0x10000 )
+            {
+                nBufLen = 0x10000;
+
+                Runtime::GetLogger().AddEx( _T("; BufLen adjusted to %d"), nBufLen );
+            }
+
+            m_pNppExec->GetOptions().SetInt(OPTI_SENDMSG_MAXBUFLEN, nBufLen);
+        }
+        else if ( nBufLen == 0 )
+        {
+            ScriptError( ET_REPORT, _T("- must be a non-zero integer value") );
+            nCmdResult = CMDRESULT_INVALIDPARAM;
+        }
+        else if ( nBufLen < 0 )
         {
-            tstr err = _T("- duplicated label found: ");
-            err += labelName;
-            ScriptError( ET_REPORT, err.c_str() );
-            return CMDRESULT_FAILED;
+            ScriptError( ET_REPORT, _T("- must be a non-negative integer value") );
+            nCmdResult = CMDRESULT_INVALIDPARAM;
         }
     }
 
-    CListItemT<tstr>* p = m_execState.pScriptLineCurrent->GetNext();
-    Labels[labelName] = p; // label points to the next command
-
-    Runtime::GetLogger().AddEx( _T("; label %s -> command item p = 0x%X { \"%s\" }"), 
-        labelName.c_str(), p, p ? p->GetItem().c_str() : _T("<NULL>") );
+    if ( nCmdResult == CMDRESULT_SUCCEEDED )
+    {
+        TCHAR szMsg[64];
+        wsprintf(szMsg, _T("SendMsgBufLen = %d"), nBufLen);
+        m_pNppExec->GetConsole().PrintMessage(szMsg, false);
+    }
 
-    return CMDRESULT_SUCCEEDED;
+    return nCmdResult;
 }
 
-static void appendOnOff(bool bOn, tstr& S1, tstr& S2)
+CScriptEngine::eCmdResult CScriptEngine::DoNppClose(const tstr& params)
 {
-    if ( bOn )
+    TCHAR szFileName[FILEPATH_BUFSIZE];
+
+    reportCmdAndParams( DoNppCloseCommand::Name(), params, 0 );
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    bool bCurrentFile = params.IsEmpty();
+    if ( bCurrentFile )
     {
-        S1 += _T("+");
-        S2 += _T("on");
+        Runtime::GetLogger().Add(   _T("; no file name specified - closing current file") );
+
+        // file name is not specified i.e. closing current file
+        m_pNppExec->SendNppMsg(NPPM_GETFULLCURRENTPATH,
+          (WPARAM) (FILEPATH_BUFSIZE - 1), (LPARAM) szFileName);
     }
     else
     {
-        S1 += _T("-");
-        S2 += _T("off");
+        Runtime::GetLogger().Add(   _T("; retrieving full file name") );
     }
-}
-
-typedef struct sIntMapping {
-    int n;
-    const TCHAR* str;
-} tIntMapping;
 
-static void appendInt(int n, tstr& S1, tstr& S2, const tIntMapping* mappings)
-{
-    TCHAR num[16];
+    messageConsole( DoNppCloseCommand::Name(), bCurrentFile ? szFileName : params.c_str() );
 
-    wsprintf( num, _T("%u"), n );
-    S1 += num;
-    for ( ; mappings->str != NULL; ++mappings )
+    if ( bCurrentFile || m_pNppExec->nppSwitchToDocument(params.c_str(), true) )
     {
-        if ( mappings->n == n )
-        {
-            S2 += mappings->str;
-            break;
-        }
+        m_pNppExec->SendNppMsg(NPPM_MENUCOMMAND, 0, IDM_FILE_CLOSE);
+    }
+    else
+    {
+        ScriptError( ET_REPORT, _T("- no such file opened") );
+        nCmdResult = CMDRESULT_FAILED;
     }
+
+    return nCmdResult;
 }
 
-static void appendEnc(unsigned int enc_opt, bool bInput, tstr& S1, tstr& S2)
+CScriptEngine::eCmdResult CScriptEngine::DoNppConsole(const tstr& params)
 {
-    unsigned int enc;
-    const TCHAR* encName;
-    TCHAR        encNum[5];
+    reportCmdAndParams( DoNppConsoleCommand::Name(), params, 0 );
 
-    if ( bInput )
-    {
-        enc = CConsoleEncodingDlg::getInputEncoding(enc_opt);
-        encName = CConsoleEncodingDlg::getInputEncodingName(enc_opt);
-    }
-    else
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+    switch ( getOnOffParam(params) )
     {
-        enc = CConsoleEncodingDlg::getOutputEncoding(enc_opt);
-        encName = CConsoleEncodingDlg::getOutputEncodingName(enc_opt);
+        case PARAM_EMPTY:
+            errorCmdNoParam(DoNppConsoleCommand::Name());
+            nCmdResult = CMDRESULT_INVALIDPARAM;
+            break;
+
+        case PARAM_ON:
+            messageConsole( DoNppConsoleCommand::Name(), _T("On") );
+            m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, CNppExec::scfCmdNppConsole);
+            break;
+
+        case PARAM_OFF:
+            messageConsole( DoNppConsoleCommand::Name(), _T("Off") );
+            //m_pNppExec->verifyConsoleDialogExists();
+            if ( m_pNppExec->isConsoleDialogVisible() )
+            {
+                m_isClosingConsole = true;
+                m_pNppExec->showConsoleDialog(CNppExec::hideIfShown, CNppExec::scfCmdNppConsole);
+                m_isClosingConsole = false;
+            }
+            m_pNppExec->_consoleIsVisible = true;
+            updateFocus();
+            break;
+
+        case PARAM_KEEP:
+            messageConsole( DoNppConsoleCommand::Name(), _T("?") );
+            //m_pNppExec->verifyConsoleDialogExists();
+            if ( !m_pNppExec->isConsoleDialogVisible() )
+            {
+                m_pNppExec->_consoleIsVisible = true;
+                updateFocus();
+            }
+            break;
+
+        case PARAM_ENABLE:
+            messageConsole( DoNppConsoleCommand::Name(), _T("+") );
+            m_pNppExec->GetConsole().SetOutputEnabled(true);
+            m_pNppExec->GetConsole().LockConsoleEndPos();
+            break;
+
+        case PARAM_DISABLE:
+            // messageConsole( DoNppConsoleCommand::Name(), _T("-") );  --  don't output anything
+            m_pNppExec->GetConsole().LockConsoleEndPos();
+            m_pNppExec->GetConsole().SetOutputEnabled(false);
+            break;
+
+        default:
+            // show error
+            m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, CNppExec::scfCmdNppConsole);
+            {
+                tstr Err = _T("- unknown parameter: ");
+                Err += params;
+                ScriptError( ET_REPORT, Err.c_str() );
+                nCmdResult = CMDRESULT_INVALIDPARAM;
+            }
+            break;
     }
 
-    wsprintf( encNum, _T("%u"), enc );
+    Runtime::GetLogger().AddEx( _T("; the Console is %s"), m_pNppExec->isConsoleDialogVisible() ? _T("On") : _T("Off") );
 
-    S1 += encNum;
-    S2 += encName;
+    return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNpeCmdAlias(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNppExec(const tstr& params)
 {
-    reportCmdAndParams( DoNpeCmdAliasCommand::Name(), params, fMessageToConsole );
+    if ( !reportCmdAndParams( DoNppExecCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
+    // executing commands from a script or a file (the lines are not copied to m_CmdList)
+        
     eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    tstr aliasName;
-    tstr aliasValue;
-    tstr S;
-
-    CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsCmdAliases());
-    CNppExecMacroVars::tMacroVars& cmdAliases = m_pNppExec->GetMacroVars().GetCmdAliases();
+    const tNppExecArgs& nppExecArgs = getNppExecArgs(params);
+    const CStrSplitT<TCHAR>& args = nppExecArgs.Args;
 
-    if ( params.IsEmpty() )
+    if ( Runtime::GetLogger().IsLogging() )
     {
-
-        Runtime::GetLogger().Add(   _T("; no arguments given - showing all command aliases") );
-
+        Runtime::GetLogger().Add(   _T("; args") );
+        Runtime::GetLogger().Add(   _T("; {") );
+        const tstr logIndent = Runtime::GetLogger().GetIndentStr();
+        for (int i = 0; i < args.GetArgCount(); i++)
+        {
+            Runtime::GetLogger().AddEx( _T("; %s[%d], \"%s\""), logIndent.c_str(), i, args.GetArg(i).c_str() );
+        }
+        Runtime::GetLogger().Add(   _T("; }") );
     }
-    else
-    {
-        CStrSplitT<TCHAR> args;
-        if ( args.Split( substituteMacroVarsIfNotDelayed(this, params, true), _T("="), 2) == 2 )
+
+    tstr scriptName = args.GetArg(0);
+    NppExecHelpers::StrUpper(scriptName);
+    if (!m_execState.GetScriptContextItemPtr(scriptName))
+    {        
+        bool bContinue = true;
+          
+        m_execState.nExecCounter++;
+        if (m_execState.nExecCounter > m_execState.nExecMaxCount)
         {
-            // set the value
-            aliasName = args.Arg(0);
-            aliasValue = args.Arg(1);
+            TCHAR szMsg[240];
 
-            NppExecHelpers::StrDelLeadingTabSpaces(aliasName);
-            NppExecHelpers::StrDelTrailingTabSpaces(aliasName);
-            NppExecHelpers::StrDelLeadingTabSpaces(aliasValue);
-            NppExecHelpers::StrDelTrailingTabSpaces(aliasValue);
+            m_execState.nExecCounter = 0;
+            bContinue = false;
+            ::wsprintf(szMsg, 
+                _T("%s was performed more than %d times.\n") \
+                _T("Abort execution of this script?\n") \
+                _T("(Press Yes to abort or No to continue execution)"),
+                DoNppExecCommand::Name(),
+                m_execState.nExecMaxCount
+            );
+            if (::MessageBox(m_pNppExec->m_nppData._nppHandle, szMsg, 
+                    _T("NppExec Warning: Possible infinite loop"),
+                      MB_YESNO | MB_ICONWARNING) == IDNO)
+            {
+                bContinue = true;
+            }
+        }
 
-            if ( aliasName.IsEmpty() )
+        if (bContinue)
+        {  
+            CFileBufT<TCHAR> fbuf;
+            PNppScriptBody   pScriptBody;
+            PNppScriptLineNumbers pLineNumbers;
+            tstr             line;
+
+            if (m_pNppExec->m_ScriptsList.GetScriptBody(args.GetArg(0), pScriptBody, &pLineNumbers))
             {
-                // in case of 'params' is a string which starts with "="
-                if ( args.Split(aliasValue, _T("="), 2) == 2 )
+                Runtime::GetLogger().AddEx( _T("; executing commands from the script \"%s\" (%d line(s))"), 
+                    args.GetArg(0).c_str(), pScriptBody->GetCount() );  
+                
+                if (!pScriptBody->IsEmpty())
                 {
-                    aliasName = _T("=");
-                    aliasName += args.Arg(0);
-                    aliasValue = args.Arg(1);
-
-                    NppExecHelpers::StrDelTrailingTabSpaces(aliasName);
-                    NppExecHelpers::StrDelLeadingTabSpaces(aliasValue);
+                    if ( !pushScriptBody(scriptName, pScriptBody, pLineNumbers, true, nppExecArgs) )
+                        nCmdResult = CMDRESULT_FAILED;
                 }
             }
-            
-            if ( aliasName.length() > 0 )
+            else 
             {
-                NppExecHelpers::StrUpper(aliasName);
+                Runtime::GetLogger().AddEx( _T("; there is no script with such name (\"%s\")"), args.GetArg(0).c_str() ); 
+                Runtime::GetLogger().Add(   _T("; trying to load the script from a file") ); 
+              
+                tstr fileName = args.GetArg(0);
 
-                CNppExecMacroVars::tMacroVars::iterator itrAlias = cmdAliases.find(aliasName);
-                if ( itrAlias != cmdAliases.end() )
+                if ( fileName.EndsWith(_T(".exe")) ||
+                     fileName.EndsWith(_T(".com")) ||
+                     fileName.EndsWith(_T(".bat")) ||
+                     fileName.EndsWith(_T(".cmd")) ||
+                     fileName.EndsWith(_T(".ps1")) ||
+                     fileName.EndsWith(_T(".js"))  ||
+                     fileName.EndsWith(_T(".vbs")) )
                 {
-                    if ( aliasValue.length() > 0 )
-                    {
-                        // update
-                        itrAlias->second = aliasValue;
-                        
-                        S = aliasName;
-                        S += _T(" -> ");
-                        S += aliasValue;
-                    }
-                    else
-                    {
-                        // remove
-                        cmdAliases.erase(itrAlias);
-
-                        S = _T("- command alias has been removed: ");
-                        S += aliasName;
-                    }
-
-                    m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+                    // executable or command file
+                    ScriptError( ET_REPORT, _T("- syntax error: NppExec\'s script file expected, executable file given") );
+                    m_pNppExec->GetConsole().PrintError( _T("; If you want to run an executable file, don\'t use NPP_EXEC command!") );
+                    m_pNppExec->GetConsole().PrintError( _T("; (type HELP NPP_EXEC in the Console window for details)") );
+                    m_pNppExec->GetConsole().PrintError( _T("; To run program.exe type just") );
+                    m_pNppExec->GetConsole().PrintError( _T(";     program.exe") );
+                    m_pNppExec->GetConsole().PrintError( _T("; instead of") );
+                    m_pNppExec->GetConsole().PrintError( _T(";     npp_exec program.exe") );
+                    nCmdResult = CMDRESULT_FAILED;
                 }
                 else
                 {
-                    if ( aliasValue.length() > 0 )
+                    // not executable or command file
+
+                    if ( fileName.length() > 1 )
                     {
-                        // add
-                        cmdAliases[aliasName] = aliasValue;
+                        m_pNppExec->nppConvertToFullPathName(fileName, true);
+                    }
 
-                        S = aliasName;
-                        S += _T(" -> ");
-                        S += aliasValue;
-                        m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+                    if ( fbuf.LoadFromFile(fileName.c_str(), true, m_pNppExec->GetOptions().GetInt(OPTI_UTF8_DETECT_LENGTH)) )
+                    {
+                        Runtime::GetLogger().AddEx( _T("; loading the script from a file \"%s\""), fileName.c_str() );
+                  
+                        // the file may be changed between the calls, so its body is not shared
+                        std::shared_ptr<CNppScript> pFileScript(new CNppScript);
+                        std::shared_ptr<std::vector<int>> pFileLineNumbers(new std::vector<int>);
+                        int n = 0;
+                        int nSourceLine = 0;
+                        while (fbuf.GetLine(line) >= 0)
+                        {
+                            ++nSourceLine;
+                            if (line.length() > 0)
+                            {
+                                ++n;
+                    
+                                Runtime::GetLogger().AddEx( _T("; + line %d:  %s"), n, line.c_str() );
+                      
+                                pFileScript->Add(line);
+                                pFileLineNumbers->push_back(nSourceLine);
+                            }
+                        }
+
+                        if (n != 0)
+                        {
+                            pScriptBody = pFileScript;
+                            pLineNumbers = pFileLineNumbers;
+                            if ( !pushScriptBody(scriptName, pScriptBody, pLineNumbers, false, nppExecArgs) )
+                                nCmdResult = CMDRESULT_FAILED;
+                        }
                     }
                     else
                     {
-                        // tried to remove non-existent command alias
-                        S = _T("- no such command alias: ");
-                        S += aliasName;
-                        m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
+                        Runtime::GetLogger().Add(   _T("; there is no file with such name ") ); 
+                  
+                        ScriptError( ET_REPORT, _T("- can not open specified file or it is empty") );
                         nCmdResult = CMDRESULT_FAILED;
                     }
                 }
-
-                HMENU hMenu = m_pNppExec->GetNppMainMenu();
-                if ( hMenu )
-                {
-                    const bool bEnable = !cmdAliases.empty();
-                    ::EnableMenuItem( hMenu, g_funcItem[N_NOCMDALIASES]._cmdID,
-                        MF_BYCOMMAND | (bEnable ? MF_ENABLED : MF_GRAYED) );
-                }
                 
-                return nCmdResult;
-            }
-            else
-            {
-                if ( aliasValue.length() > 0 )
-                {
-                    ScriptError( ET_REPORT, _T("- no command alias name specified") );
-                    return CMDRESULT_INVALIDPARAM;
-                }
-                else
-                {
-                    aliasName = _T("=");
-                }
             }
         }
         else
         {
-            aliasName = args.Arg(0);
-            NppExecHelpers::StrDelLeadingTabSpaces(aliasName);
-            NppExecHelpers::StrDelTrailingTabSpaces(aliasName);
-
-            NppExecHelpers::StrUpper(aliasName);
+            ScriptError( ET_ABORT, _T("; Script execution aborted to prevent possible infinite loop (from DoNppExec())") );
+            nCmdResult = CMDRESULT_FAILED;
         }
-        
-    }
 
-    if ( cmdAliases.empty() )
-    {
-        m_pNppExec->GetConsole().PrintMessage( _T("- no command aliases"), false );
     }
     else
     {
-        if ( aliasName.IsEmpty() )
-        {
-            CNppExecMacroVars::tMacroVars::const_iterator itrAlias = cmdAliases.begin();
-            for ( ; itrAlias != cmdAliases.end(); ++itrAlias )
-            {
-                S = itrAlias->first;
-                S += _T(" -> ");
-                S += itrAlias->second;
-                m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
-            }
-        }
-        else
-        {
-            bool bFound = false;
-
-            CNppExecMacroVars::tMacroVars::const_iterator itrAlias = cmdAliases.find(aliasName);
-            if ( itrAlias != cmdAliases.end() )
-            {
-                S = itrAlias->first;
-                S += _T(" -> ");
-                S += itrAlias->second;
-                m_pNppExec->GetConsole().PrintMessage( S.c_str(), false );
-                bFound = true;
-            }
-
-            if ( !bFound )
-            {
-                tstr t = _T("- no such command alias: ");
-                t += aliasName;
-                m_pNppExec->GetConsole().PrintMessage( t.c_str(), false );
-                nCmdResult = CMDRESULT_FAILED;
-            }
-        }
+        Runtime::GetLogger().Add(   _T("; the script with the same name is being executed") );
+            
+        ScriptError( ET_REPORT, _T("- can\'t exec the same script at the same time") );
+        nCmdResult = CMDRESULT_FAILED;
     }
 
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNpeConsole(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNppMenuCommand(const tstr& params)
 {
-    reportCmdAndParams( DoNpeConsoleCommand::Name(), params, fMessageToConsole );
+    if ( !reportCmdAndParams( DoNppMenuCommandCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
     eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    bool isSilent = false;
-    
-    if ( params.length() > 0 )
+    tstr parsedItemPath, parsedSep;
+    int menuItemId = m_pNppExec->nppGetMenuItemIdByName(params, parsedItemPath, parsedSep);
+    if ( menuItemId > 0 )
     {
-        CStrSplitT<TCHAR> args;
-        int n = args.SplitToArgs(params);
-        if ( n > 0 )
-        {
-            bool isEncChanged = false;
-            bool isFilterChanged = false;
-            
-            for ( int i = 0; i < n; i++ )
-            {
-                bool isOK = false;
-                tstr arg = args.GetArg(i);
-                if ( arg.length() == 2 )
-                {
-                    // a+/a-     append mode on/off
-                    // d+/d-     follow current directory on/off
-                    // h+/h-     console commands history on/off
-                    // m+/m-     console internal messages on/off
-                    // q+/q-     command aliases on/off
-                    // v+/v-     set the $(OUTPUT) variable on/off
-                    // f+/f-     console output filter on/off
-                    // r+/r-     console output replace filter on/off
-                    // k0..3     catch NppExec's shortcut keys on/off
-                    // o0/o1/o2  console output encoding: ANSI/OEM/UTF8
-                    // i0/i1/i2  console input encoding: ANSI/OEM/UTF8
-                    // --        silent (don't print Console mode info)
-
-                    switch ( arg[0] )
-                    {
-                        case _T('a'):
-                        case _T('A'):
-                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
-                            {
-                                bool bOn = ( arg[1] == _T('+') );
-                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_APPENDMODE, bOn);
-                                isOK = true;
-                            }
-                            break;
-
-                        case _T('d'):
-                        case _T('D'):
-                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
-                            {
-                                bool bOn = ( arg[1] == _T('+') );
-                                HMENU hMenu = m_pNppExec->GetNppMainMenu();
-                                if ( hMenu )
-                                {
-                                    ::CheckMenuItem(hMenu, g_funcItem[N_CDCURDIR]._cmdID,
-                                        MF_BYCOMMAND | (bOn ? MF_CHECKED : MF_UNCHECKED));
-                                }
-                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_CDCURDIR, bOn);
-                                isOK = true;
-                            }
-                            break;
-
-                        case _T('h'):
-                        case _T('H'):
-                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
-                            {
-                                bool bOn = ( arg[1] == _T('+') );
-                                HMENU hMenu = m_pNppExec->GetNppMainMenu();
-                                if ( hMenu )
-                                {
-                                    ::CheckMenuItem(hMenu, g_funcItem[N_CMDHISTORY]._cmdID,
-                                        MF_BYCOMMAND | (bOn ? MF_CHECKED : MF_UNCHECKED));
-                                }
-                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_CMDHISTORY, bOn);
-                                isOK = true;
-                            }
-                            break;
-
-                        case _T('m'):
-                        case _T('M'):
-                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
-                            {
-                                bool bOn = ( arg[1] == _T('-') ); // inverse
-                                HMENU hMenu = m_pNppExec->GetNppMainMenu();
-                                if ( hMenu )
-                                {
-                                    ::CheckMenuItem(hMenu, g_funcItem[N_NOINTMSGS]._cmdID,
-                                        MF_BYCOMMAND | (bOn ? MF_CHECKED : MF_UNCHECKED));
-                                }
-                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_NOINTMSGS, bOn);
-                                isOK = true;
-                            }
-                            break;
-
-                        case _T('o'):
-                        case _T('O'):
-                            {
-                                int enc = (int) (arg[1] - _T('0'));
-                                if ( (enc >= CConsoleEncodingDlg::ENC_ANSI) &&
-                                     (enc < CConsoleEncodingDlg::ENC_TOTAL) )
-                                {
-                                    unsigned int enc_opt = m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_ENCODING);
-                                    enc_opt &= 0xFFF0;
-                                    enc_opt |= enc;
-                                    m_pNppExec->GetOptions().SetUint(OPTU_CONSOLE_ENCODING, enc_opt);
-                                    isEncChanged = true;
-                                    isOK = true;
-                                }
-                            }
-                            break;
-
-                        case _T('i'):
-                        case _T('I'):
-                            {
-                                int enc = (int) (arg[1] - _T('0'));
-                                if ( (enc >= CConsoleEncodingDlg::ENC_ANSI) &&
-                                     (enc < CConsoleEncodingDlg::ENC_TOTAL) )
-                                {
-                                    unsigned int enc_opt = m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_ENCODING);
-                                    enc_opt &= 0xFF0F;
-                                    enc_opt |= (enc * 0x10);
-                                    m_pNppExec->GetOptions().SetUint(OPTU_CONSOLE_ENCODING, enc_opt);
-                                    isEncChanged = true;
-                                    isOK = true;
-                                }
-                            }
-                            break;
-
-                        case _T('q'):
-                        case _T('Q'):
-                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
-                            {
-                                bool bOn = ( arg[1] == _T('-') ); // inverse
-                                HMENU hMenu = m_pNppExec->GetNppMainMenu();
-                                if ( hMenu )
-                                {
-                                    ::CheckMenuItem(hMenu, g_funcItem[N_NOCMDALIASES]._cmdID,
-                                        MF_BYCOMMAND | (bOn ? MF_CHECKED : MF_UNCHECKED));
-                                }
-                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_NOCMDALIASES, bOn);
-                                isOK = true;
-                            }
-                            break;
+        Runtime::GetLogger().AddEx( _T("; menu item separator: %s"), 
+            parsedSep.IsEmpty() ? _T("<none>") : parsedSep.c_str() );
+        Runtime::GetLogger().AddEx( _T("; menu item found: id = %d"), menuItemId );
 
-                        case _T('v'):
-                        case _T('V'):
-                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
-                            {
-                                bool bOn = ( arg[1] == _T('+') );
-                                m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_SETOUTPUTVAR, bOn);
-                                isOK = true;
-                            }
-                            break;
+        m_pNppExec->SendNppMsg(NPPM_MENUCOMMAND, 0, menuItemId);
+    }
+    else
+    {
+        tstr err = _T("- the menu item was not found. Parsed item path: ");
+        if ( !parsedItemPath.IsEmpty() )
+            err += parsedItemPath;
+        else
+            err += _T("<none>");
 
-                        case _T('f'):
-                        case _T('F'):
-                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
-                            {
-                                bool bOn = ( arg[1] == _T('+') );
-                                m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_ENABLE, bOn);
-                                isFilterChanged = true;
-                                isOK = true;
-                            }
-                            break;
+        Runtime::GetLogger().AddEx( _T("; menu item separator: %s"), 
+            parsedSep.IsEmpty() ? _T("<none>") : parsedSep.c_str() );
 
-                        case _T('r'):
-                        case _T('R'):
-                            if ( arg[1] == _T('+') || arg[1] == _T('-') )
-                            {
-                                bool bOn = ( arg[1] == _T('+') );
-                                m_pNppExec->GetOptions().SetBool(OPTB_CONFLTR_R_ENABLE, bOn);
-                                isFilterChanged = true;
-                                isOK = true;
-                            }
-                            break;
+        ScriptError( ET_REPORT, err.c_str() );
+        nCmdResult = CMDRESULT_FAILED;
+    }
 
-                        case _T('k'):
-                        case _T('K'):
-                            {
-                                unsigned int k = (unsigned int) (arg[1] - _T('0'));
-                                if ( (k >= ConsoleDlg::CSK_OFF) &&
-                                     (k <= ConsoleDlg::CSK_ALL) )
-                                {
-                                    m_pNppExec->GetOptions().SetUint(OPTU_CONSOLE_CATCHSHORTCUTKEYS, k);
-                                    isOK = true;
-                                }
-                            }
-                            break;
+    return nCmdResult;
+}
 
-                        case _T('-'):
-                            if ( arg[1] == _T('-') )
-                            {
-                                isSilent = true;
-                                isOK = true;
-                            }
-                            break;
-                    }
-                }
-                if ( !isOK )
-                {
-                    arg.Insert( 0, _T("- unknown parameter: ") );
-                    ScriptError( ET_REPORT, arg.c_str() );
-                    nCmdResult = CMDRESULT_INVALIDPARAM;
-                }
-            }
+CScriptEngine::eCmdResult CScriptEngine::DoNppOpen(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoNppOpenCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-            if ( isEncChanged )
+    // opening a file in Notepad++
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nFilterPos = FileFilterPos( params.c_str() );
+    if ( nFilterPos < 0 )
+    {
+        Runtime::GetLogger().Add(   _T("; direct file (path)name specified") );
+        
+        // direct file (path)name
+        if ( !m_pNppExec->SendNppMsg(NPPM_RELOADFILE, (WPARAM) FALSE, (LPARAM) params.c_str()) )
+        {
+            int nFiles = (int) m_pNppExec->SendNppMsg(NPPM_GETNBOPENFILES, 0, 0);
+
+            if ( !m_pNppExec->SendNppMsg(NPPM_DOOPEN, (WPARAM) 0, (LPARAM) params.c_str()) )
             {
-                unsigned int enc_opt = m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_ENCODING);
-                if ( enc_opt > 0xFF )
+                nCmdResult = CMDRESULT_FAILED;
+
+                DWORD dwAttr = ::GetFileAttributes(params.c_str());
+                if ( (dwAttr != INVALID_FILE_ATTRIBUTES) &&
+                     ((dwAttr & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) )
                 {
-                    // "input as output" flag is set
-                    unsigned int encIn  = CConsoleEncodingDlg::getInputEncoding(enc_opt);
-                    unsigned int encOut = CConsoleEncodingDlg::getOutputEncoding(enc_opt);
-                    if ( encIn != encOut )
+                    // NPPM_DOOPEN unexpectedly returns 0 when a folder is specified
+                    // as its argument, though in fact it does open all the files
+                    // from that folder.
+                    int nFilesNow = (int) m_pNppExec->SendNppMsg(NPPM_GETNBOPENFILES, 0, 0);
+                    if ( nFilesNow != nFiles )
                     {
-                        // remove the "input as output" flag
-                        m_pNppExec->GetOptions().SetUint(OPTU_CONSOLE_ENCODING, enc_opt & 0xFF);
+                        nCmdResult = CMDRESULT_SUCCEEDED;
                     }
                 }
-                m_pNppExec->UpdateConsoleEncoding();
             }
+        }
+    }
+    else
+    {
+          
+        Runtime::GetLogger().Add(   _T("; file (path)name mask specified") );
+            
+        // file (path)name mask (e.g. "C:\Documents\*.txt")
+        tstr         Path;
+        tstr         Filter;
+        CListT<tstr> FilesList;
 
-            if ( isFilterChanged )
+        GetPathAndFilter( params.c_str(), nFilterPos, Path, Filter );
+
+        Runtime::GetLogger().AddEx( _T("; searching \"%s\" for \"%s\""), Path.c_str(), Filter.c_str() );
+          
+        GetFilePathNamesList( Path.c_str(), Filter.c_str(), FilesList );
+
+        tstr S;
+        CListItemT<tstr>* ptr = FilesList.GetFirst();
+        while ( ptr )
+        {
+            S = ptr->GetItem();
+            if ( !m_pNppExec->SendNppMsg(NPPM_RELOADFILE, (WPARAM) FALSE, (LPARAM) S.c_str()) )
             {
-                m_pNppExec->UpdateOutputFilterMenuItem();
+                if ( !m_pNppExec->SendNppMsg(NPPM_DOOPEN, (WPARAM) 0, (LPARAM) S.c_str()) )
+                    nCmdResult = CMDRESULT_FAILED;
             }
+            ptr = ptr->GetNext();
         }
     }
 
-    if ( !isSilent )
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoNppRun(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoNppRunCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    // run a command
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    tstr arg1, arg2;
+    if ( SearchPath(NULL, params.c_str(), NULL, 0, NULL, NULL) != 0 )
     {
-        tstr S1 = _T("Console mode: ");
-        tstr S2 = _T("; ");
-        // append
-        S1 += _T("a");
-        S2 += _T("append: ");
-        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_APPENDMODE), S1, S2 );
-        // cd_curdir
-        S1 += _T(" d");
-        S2 += _T(", cd_curdir: ");
-        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_CDCURDIR), S1, S2 );
-        // cmd_history
-        S1 += _T(" h");
-        S2 += _T(", cmd_history: ");
-        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_CMDHISTORY), S1, S2 );
-        // int_msgs
-        S1 += _T(" m");
-        S2 += _T_RE_EOL _T("; int_msgs: ");
-        appendOnOff( !m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOINTMSGS), S1, S2 );
-        // cmd_aliases
-        S1 += _T(" q");
-        S2 += _T(", cmd_aliases: ");
-        appendOnOff( !m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOCMDALIASES), S1, S2 );
-        // $(OUTPUT)
-        S1 += _T(" v");
-        S2 += _T(", output_var: ");
-        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_SETOUTPUTVAR), S1, S2 );
-        // filters
-        S1 += _T(" f");
-        S2 += _T_RE_EOL _T("; filter: ");
-        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONFLTR_ENABLE), S1, S2 );
-        S1 += _T(" r");
-        S2 += _T(", replace_filter: ");
-        appendOnOff( m_pNppExec->GetOptions().GetBool(OPTB_CONFLTR_R_ENABLE), S1, S2 );
-        // shortcut_keys
-        S1 += _T(" k");
-        S2 += _T_RE_EOL _T("; shortcut_keys: ");
-        {
-            const tIntMapping mappings[] = {
-                { ConsoleDlg::CSK_OFF, _T("off") },
-                { ConsoleDlg::CSK_STD, _T("std") },
-                { ConsoleDlg::CSK_USR, _T("usr") },
-                { ConsoleDlg::CSK_ALL, _T("std+usr") },
-                { 0x00, NULL } // trailing element with .str=NULL
-            };
-            appendInt( m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_CATCHSHORTCUTKEYS), S1, S2, mappings );
-        }
-        // out_enc
-        unsigned int enc_opt = m_pNppExec->GetOptions().GetUint(OPTU_CONSOLE_ENCODING);
-        S1 += _T(" o");
-        S2 += _T_RE_EOL _T("; out_enc: ");
-        appendEnc( enc_opt, false, S1, S2 );
-        // in_enc
-        S1 += _T(" i");
-        S2 += _T(", in_enc: ");
-        appendEnc( enc_opt, true, S1, S2 );
-        // finally...
-        m_pNppExec->GetConsole().PrintMessage( S1.c_str(), false );
-        m_pNppExec->GetConsole().PrintMessage( S2.c_str(), false );
+        arg1 = params;
+    }
+    else
+    {
+        CStrSplitT<TCHAR> args;
+        args.SplitToArgs(params, 2);
+        arg1 = args.Arg(0);
+        arg2 = args.Arg(1);
+    }
+
+    Runtime::GetLogger().Add(   _T("; ShellExecute() arguments") ); 
+    Runtime::GetLogger().Add(   _T("; {") );
+    const tstr logIndent = Runtime::GetLogger().GetIndentStr();
+    Runtime::GetLogger().AddEx( _T("; %s[file]   %s"), logIndent.c_str(), arg1.c_str() );
+    Runtime::GetLogger().AddEx( _T("; %s[params] %s"), logIndent.c_str(), arg2.c_str() );
+    Runtime::GetLogger().Add(   _T("; }") );
+    
+    tstr S;
+    int  nResult = (int) (INT_PTR) ShellExecute( NULL, _T("open"), arg1.c_str(), 
+           (arg2.length() > 0) ? arg2.c_str() : NULL, NULL, SW_SHOWNORMAL );
+    switch ( nResult )
+    {
+        case 0:
+            S = _T("- the operating system is out of memory or resources");
+            break;
+        case ERROR_FILE_NOT_FOUND:
+            S = _T("- the specified file was not found");
+            break;
+        case ERROR_PATH_NOT_FOUND:
+            S = _T("- the specified path was not found");
+            break;
+        case ERROR_BAD_FORMAT:
+            S = _T("- the .exe file is invalid (non-Microsoft Win32 .exe or error in .exe image)");
+            break;
+        case SE_ERR_ACCESSDENIED:
+            S = _T("- the operating system denied access to the specified file");
+            break;
+        case SE_ERR_ASSOCINCOMPLETE:
+            S = _T("- the file name association is incomplete or invalid");
+            break; 
+        case SE_ERR_DDEBUSY:
+            S = _T("- the DDE transaction could not be completed because other DDE transactions were being processed");
+            break;
+        case SE_ERR_DDEFAIL:
+            S = _T("- the DDE transaction failed");
+            break;
+        case SE_ERR_DDETIMEOUT:
+            S = _T("- the DDE transaction could not be completed because the request timed out");
+            break;
+        case SE_ERR_DLLNOTFOUND:
+            S = _T("- the specified dynamic-link library (DLL) was not found");
+            break;
+        case SE_ERR_NOASSOC:
+            S = _T("- there is no application associated with the given file name extension");
+            break;
+        case SE_ERR_OOM:
+            S = _T("- there was not enough memory to complete the operation");
+            break;
+        case SE_ERR_SHARE:
+            S = _T("- a sharing violation occurred");
+            break;
+        default:
+            S = _T("");
+            break;
+    }
+    if ( S.length() > 0 )
+    {
+        ScriptError( ET_REPORT, S.c_str() );
+        nCmdResult = CMDRESULT_FAILED;
     }
 
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNpeDebugLog(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNppSave(const tstr& params)
 {
-    reportCmdAndParams( DoNpeDebugLogCommand::Name(), params, fMessageToConsole );
-
     eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    int nParam = getOnOffParam(params);
-    if (nParam == PARAM_ON)
+    TCHAR szFileName[FILEPATH_BUFSIZE];
+
+    reportCmdAndParams( DoNppSaveCommand::Name(), params, 0 );
+          
+    // save a file
+    bool bCurrentFile = params.IsEmpty();
+    if ( bCurrentFile )
     {
-        m_pNppExec->GetOptions().SetBool(OPTB_NPE_DEBUGLOG, true);
-        Runtime::GetLogger().SetOutputMode(true, CNppExec::printScriptString);
+          
+        Runtime::GetLogger().Add(   _T("; no file name specified - saving current file") );
+            
+        // file name is not specified i.e. saving current file
+        m_pNppExec->SendNppMsg( NPPM_GETFULLCURRENTPATH,
+          (WPARAM) (FILEPATH_BUFSIZE - 1), (LPARAM) szFileName );
     }
-    else if (nParam == PARAM_OFF)
+    else
     {
-        m_pNppExec->GetOptions().SetBool(OPTB_NPE_DEBUGLOG, false);
-        Runtime::GetLogger().SetOutputMode(false);
+          
+        Runtime::GetLogger().Add(   _T("; retrieving full file name") );
+            
+        // file name is specified
+        if ( !m_pNppExec->nppSwitchToDocument(params.c_str(), true) )
+        {
+            ScriptError( ET_REPORT, _T("- no such file opened") );
+            return CMDRESULT_FAILED;
+        }
     }
-    else if (nParam != PARAM_EMPTY)
+        
+    messageConsole( DoNppSaveCommand::Name(), bCurrentFile ? szFileName : params.c_str() );
+    
+    Runtime::GetLogger().Add(   _T("; saving") );
+
+    // TODO: use Notepad++'s message to check the document's state
+    HWND hSciWnd = m_pNppExec->GetScintillaHandle();
+    BOOL bModified = (BOOL) ::SendMessage(hSciWnd, SCI_GETMODIFY, 0, 0);
+
+    if ( !m_pNppExec->SendNppMsg(NPPM_SAVECURRENTFILE, 0, 0) )
     {
-        tstr Err = _T("- unknown parameter: ");
-        Err += params;
-        ScriptError( ET_REPORT, Err.c_str() );
-        nCmdResult = CMDRESULT_INVALIDPARAM;
+        if ( bModified )
+        {
+            ScriptError( ET_REPORT, _T("- could not save the file") );
+            nCmdResult = CMDRESULT_FAILED;
+        }
+        // else the document is unmodified - nothing to save
     }
-    m_pNppExec->GetConsole().PrintMessage( m_pNppExec->GetOptions().GetBool(OPTB_NPE_DEBUGLOG) ? 
-        _T("Debug Log is On (1)") : _T("Debug Log is Off (0)"), false );
 
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNpeNoEmptyVars(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNppSaveAs(const tstr& params)
 {
-    reportCmdAndParams( DoNpeNoEmptyVarsCommand::Name(), params, fMessageToConsole );
+    if ( !reportCmdAndParams( DoNppSaveAsCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
     eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    int nParam = getOnOffParam(params);
-    if (nParam == PARAM_ON)
-    {
-        m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_NOEMPTYVARS, true);
-    }
-    else if (nParam == PARAM_OFF)
+
+    Runtime::GetLogger().Add(   _T("; saving") );
+
+    if ( !m_pNppExec->SendNppMsg(NPPM_SAVECURRENTFILEAS, 0, (LPARAM) params.c_str()) )
     {
-        m_pNppExec->GetOptions().SetBool(OPTB_CONSOLE_NOEMPTYVARS, false);
+        ScriptError( ET_REPORT, _T("- failed to save the file") );
+        nCmdResult = CMDRESULT_FAILED;
     }
-    else if (nParam != PARAM_EMPTY)
+
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoNppSaveAll(const tstr& params)
+{
+    reportCmdAndParams( DoNppSaveAllCommand::Name(), params, 0 );
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+    if ( !params.IsEmpty() )
     {
-        tstr Err = _T("- unknown parameter: ");
-        Err += params;
-        ScriptError( ET_REPORT, Err.c_str() );
+        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
         nCmdResult = CMDRESULT_INVALIDPARAM;
     }
-    m_pNppExec->GetConsole().PrintMessage( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOEMPTYVARS) ? 
-          _T("Replace empty (uninitialized) vars with empty str:  On (1)") : 
-            _T("Replace empty (uninitialized) vars with empty str:  Off (0)"), false );
+          
+    m_pNppExec->GetConsole().PrintMessage(DoNppSaveAllCommand::Name());
+    if ( !m_pNppExec->nppSaveAllFiles() )
+        nCmdResult = CMDRESULT_FAILED;
 
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNpeQueue(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNppSwitch(const tstr& params)
 {
-    if ( !reportCmdAndParams( DoNpeQueueCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+    if ( !reportCmdAndParams( DoNppSwitchCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
         return CMDRESULT_INVALIDPARAM;
 
-    // command to be queued
-    bool bUseSeparateScript = true;
-    tstr Cmd = getQueuedCommand(params, bUseSeparateScript);
-    Cmd = substituteMacroVarsIfNotDelayed(this, Cmd, true);
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
 
-    if ( bUseSeparateScript && (m_nRunFlags & rfExitScript) == 0 )
-    {
-        // queuing, similar to NppExecPluginInterface's npemExecuteQueuedScript
-        CListT<tstr> CmdList(Cmd);
-        CNppExecCommandExecutor::ScriptableCommand * pCommand = new CNppExecCommandExecutor::DoRunScriptCommand(tstr(), CmdList, 0, CNppExecCommandExecutor::ExpirableCommand::NonExpirable);
-        m_pNppExec->GetCommandExecutor().ExecuteCommand(pCommand);
-    }
-    else
+    if ( !m_pNppExec->nppSwitchToDocument(params.c_str(), true) )
     {
-        // no queuing, using the very same script
-        m_CmdList.Add(Cmd); // will be executed as the last command of m_CmdList
-
-        //m_execState.pScriptLineCurrent->SetItem(tstr()); <-- Don't do this!
-        // If this command is inside a goto-loop, then on the next iteration
-        // of the loop this command would be empty!
+        ScriptError( ET_REPORT, _T("- no such file opened") );
+        nCmdResult = CMDRESULT_FAILED;
     }
 
-    return CMDRESULT_SUCCEEDED;
+    return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNpeSendMsgBufLen(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNppSetFocus(const tstr& params)
 {
-    reportCmdAndParams( DoNpeSendMsgBufLenCommand::Name(), params, fMessageToConsole );
+    if ( !reportCmdAndParams( DoNppSetFocusCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    int nBufLen = 0;
+    eCmdResult nCmdResult = CMDRESULT_FAILED;
+    tstr type = params;
+    NppExecHelpers::StrUpper(type);
 
-    if ( params.IsEmpty() )
-    {
-        nBufLen = m_pNppExec->GetOptions().GetInt(OPTI_SENDMSG_MAXBUFLEN);
-    }
-    else
+    if ( type == _T("CON") )
     {
-        nBufLen = c_base::_tstr2int(params.c_str());
-        if ( nBufLen > 0 )
+        HWND hConDlg = m_pNppExec->GetConsole().GetDialogWnd();
+        if ( ::IsWindowVisible(hConDlg) )
         {
-            if ( nBufLen < 0x10000 )
+            // Note: since this code is executed in the scope of
+            // CNppExecCommandExecutor::BackgroundExecuteThreadFunc,
+            // it is not straightforward to set the focus
+            HWND hCon = m_pNppExec->GetConsole().GetConsoleWnd();
+            HWND hFocused = ::GetFocus(); // most likely returns NULL
+            if ( hFocused != hCon && hFocused != hConDlg )
             {
-                nBufLen = 0x10000;
-
-                Runtime::GetLogger().AddEx( _T("; BufLen adjusted to %d"), nBufLen );
+                //m_pNppExec->SendNppMsg(NPPM_DMMSHOW, 0, (LPARAM) hConDlg);
+                ::SetFocus(hConDlg);
+                ::SendMessage(hConDlg, WM_SETFOCUS, 0, 0);
             }
-
-            m_pNppExec->GetOptions().SetInt(OPTI_SENDMSG_MAXBUFLEN, nBufLen);
-        }
-        else if ( nBufLen == 0 )
-        {
-            ScriptError( ET_REPORT, _T("- must be a non-zero integer value") );
-            nCmdResult = CMDRESULT_INVALIDPARAM;
+            m_pNppExec->m_hFocusedWindowBeforeScriptStarted = hCon;
+            nCmdResult = CMDRESULT_SUCCEEDED;
         }
-        else if ( nBufLen < 0 )
+    }
+    else if ( type == _T("SCI") )
+    {
+        HWND hSci = m_pNppExec->GetScintillaHandle();
+        if ( ::IsWindowVisible(hSci) )
         {
-            ScriptError( ET_REPORT, _T("- must be a non-negative integer value") );
-            nCmdResult = CMDRESULT_INVALIDPARAM;
+            // Note: since this code is executed in the scope of
+            // CNppExecCommandExecutor::BackgroundExecuteThreadFunc,
+            // it is not straightforward to set the focus
+            HWND hFocused = ::GetFocus(); // most likely returns NULL
+            if ( hFocused != hSci )
+                ::SendMessage(hSci, SCI_SETFOCUS, 1, 0);
+            m_pNppExec->m_hFocusedWindowBeforeScriptStarted = hSci;
+            nCmdResult = CMDRESULT_SUCCEEDED;
         }
     }
-
-    if ( nCmdResult == CMDRESULT_SUCCEEDED )
+    else
     {
-        TCHAR szMsg[64];
-        wsprintf(szMsg, _T("SendMsgBufLen = %d"), nBufLen);
-        m_pNppExec->GetConsole().PrintMessage(szMsg, false);
+        tstr Err = _T("- unknown parameter: ");
+        Err += params;
+        ScriptError( ET_REPORT, Err.c_str() );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
     }
 
     return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNppClose(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoNppSendMsg(const tstr& params)
 {
-    TCHAR szFileName[FILEPATH_BUFSIZE];
-
-    reportCmdAndParams( DoNppCloseCommand::Name(), params, 0 );
-
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    bool bCurrentFile = params.IsEmpty();
-    if ( bCurrentFile )
-    {
-        Runtime::GetLogger().Add(   _T("; no file name specified - closing current file") );
-
-        // file name is not specified i.e. closing current file
-        m_pNppExec->SendNppMsg(NPPM_GETFULLCURRENTPATH,
-          (WPARAM) (FILEPATH_BUFSIZE - 1), (LPARAM) szFileName);
-    }
-    else
-    {
-        Runtime::GetLogger().Add(   _T("; retrieving full file name") );
-    }
-
-    messageConsole( DoNppCloseCommand::Name(), bCurrentFile ? szFileName : params.c_str() );
-
-    if ( bCurrentFile || m_pNppExec->nppSwitchToDocument(params.c_str(), true) )
-    {
-        m_pNppExec->SendNppMsg(NPPM_MENUCOMMAND, 0, IDM_FILE_CLOSE);
-    }
-    else
-    {
-        ScriptError( ET_REPORT, _T("- no such file opened") );
-        nCmdResult = CMDRESULT_FAILED;
-    }
+    return doSendMsg(params, CMDTYPE_NPPSENDMSG);
+}
 
-    return nCmdResult;
+CScriptEngine::eCmdResult CScriptEngine::DoNppSendMsgEx(const tstr& params)
+{
+    return doSendMsg(params, CMDTYPE_NPPSENDMSGEX);
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNppConsole(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::DoSciSendMsg(const tstr& params)
 {
-    reportCmdAndParams( DoNppConsoleCommand::Name(), params, 0 );
-
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    return doSendMsg(params, CMDTYPE_SCISENDMSG);
+}
 
-    switch ( getOnOffParam(params) )
+CScriptEngine::eCmdResult CScriptEngine::doSendMsg(const tstr& params, int cmdType)
+{
+    tstr cmdName;
+    HWND hWnd = NULL;
+    bool isMsgEx = false;
+    
+    switch ( cmdType )
     {
-        case PARAM_EMPTY:
-            errorCmdNoParam(DoNppConsoleCommand::Name());
-            nCmdResult = CMDRESULT_INVALIDPARAM;
-            break;
-
-        case PARAM_ON:
-            messageConsole( DoNppConsoleCommand::Name(), _T("On") );
-            m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, CNppExec::scfCmdNppConsole);
-            break;
-
-        case PARAM_OFF:
-            messageConsole( DoNppConsoleCommand::Name(), _T("Off") );
-            //m_pNppExec->verifyConsoleDialogExists();
-            if ( m_pNppExec->isConsoleDialogVisible() )
-            {
-                m_isClosingConsole = true;
-                m_pNppExec->showConsoleDialog(CNppExec::hideIfShown, CNppExec::scfCmdNppConsole);
-                m_isClosingConsole = false;
-            }
-            m_pNppExec->_consoleIsVisible = true;
-            updateFocus();
-            break;
-
-        case PARAM_KEEP:
-            messageConsole( DoNppConsoleCommand::Name(), _T("?") );
-            //m_pNppExec->verifyConsoleDialogExists();
-            if ( !m_pNppExec->isConsoleDialogVisible() )
-            {
-                m_pNppExec->_consoleIsVisible = true;
-                updateFocus();
-            }
+        case CMDTYPE_NPPSENDMSG:
+            cmdName = DoNppSendMsgCommand::Name();
+            hWnd = m_pNppExec->m_nppData._nppHandle;
             break;
 
-        case PARAM_ENABLE:
-            messageConsole( DoNppConsoleCommand::Name(), _T("+") );
-            m_pNppExec->GetConsole().SetOutputEnabled(true);
-            m_pNppExec->GetConsole().LockConsoleEndPos();
+        case CMDTYPE_SCISENDMSG:
+            cmdName = DoSciSendMsgCommand::Name();
+            hWnd = m_pNppExec->GetScintillaHandle();
             break;
 
-        case PARAM_DISABLE:
-            // messageConsole( DoNppConsoleCommand::Name(), _T("-") );  --  don't output anything
-            m_pNppExec->GetConsole().LockConsoleEndPos();
-            m_pNppExec->GetConsole().SetOutputEnabled(false);
+        case CMDTYPE_NPPSENDMSGEX:
+            cmdName = DoNppSendMsgExCommand::Name();
+            isMsgEx = true;
             break;
 
         default:
-            // show error
-            m_pNppExec->showConsoleDialog(CNppExec::showIfHidden, CNppExec::scfCmdNppConsole);
-            {
-                tstr Err = _T("- unknown parameter: ");
-                Err += params;
-                ScriptError( ET_REPORT, Err.c_str() );
-                nCmdResult = CMDRESULT_INVALIDPARAM;
-            }
-            break;
+            // unsupported command
+            return CMDRESULT_FAILED;
     }
 
-    Runtime::GetLogger().AddEx( _T("; the Console is %s"), m_pNppExec->isConsoleDialogVisible() ? _T("On") : _T("Off") );
-
-    return nCmdResult;
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoNppExec(const tstr& params)
-{
-    if ( !reportCmdAndParams( DoNppExecCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+    if ( !reportCmdAndParams( cmdName.c_str(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
         return CMDRESULT_INVALIDPARAM;
 
-    // inserting commands from a script or a file into m_pNppExec->m_CmdList
-        
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    CStrSplitT<TCHAR> args;
-    args.SplitToArgs(params);
+    // send message to Notepad++
+    
+    // npp(sci)_msg <uMsg>
+    // npp(sci)_msg <uMsg> <wParam>
+    // npp(sci)_msg <uMsg> <wParam> <lParam>
+    
+    tstr val;
+    tstr calcErr;
+    const TCHAR* s = params.c_str();
 
-    Runtime::GetLogger().Add(   _T("; args") );
-    Runtime::GetLogger().Add(   _T("; {") );
-    const tstr logIndent = Runtime::GetLogger().GetIndentStr();
-    for (int i = 0; i < args.GetArgCount(); i++)
+    for ( int n = 0; n < (isMsgEx ? 2 : 1); n++ )
     {
-        Runtime::GetLogger().AddEx( _T("; %s[%d], \"%s\""), logIndent.c_str(), i, args.GetArg(i).c_str() );
-    }
-    Runtime::GetLogger().Add(   _T("; }") );
+        bool isValidParam = true;
+        bool hasDblQuote = false;
 
-    tstr scriptName = args.GetArg(0);
-    NppExecHelpers::StrUpper(scriptName);
-    if (!m_execState.GetScriptContextItemPtr(scriptName))
-    {        
-        bool bContinue = true;
-          
-        m_execState.nExecCounter++;
-        if (m_execState.nExecCounter > m_execState.nExecMaxCount)
+        s = get_param(s, val, SEP_TABSPACE, &hasDblQuote); // uMsg or hWnd
+        if ( !val.IsEmpty() )
         {
-            TCHAR szMsg[240];
-
-            m_execState.nExecCounter = 0;
-            bContinue = false;
-            ::wsprintf(szMsg, 
-                _T("%s was performed more than %d times.\n") \
-                _T("Abort execution of this script?\n") \
-                _T("(Press Yes to abort or No to continue execution)"),
-                DoNppExecCommand::Name(),
-                m_execState.nExecMaxCount
-            );
-            if (::MessageBox(m_pNppExec->m_nppData._nppHandle, szMsg, 
-                    _T("NppExec Warning: Possible infinite loop"),
-                      MB_YESNO | MB_ICONWARNING) == IDNO)
-            {
-                bContinue = true;
-            }
-        }
-
-        if (bContinue)
-        {  
-            CFileBufT<TCHAR> fbuf;
-            CNppScript       Script;
-            tstr             line;
-            ScriptContext    scriptContext;
-
-            if (m_pNppExec->m_ScriptsList.GetScript(args.GetArg(0), Script))
-            {
-                Runtime::GetLogger().AddEx( _T("; adding commands from the script \"%s\""), args.GetArg(0).c_str() );  
-                
-                scriptContext.ScriptName = scriptName;
-                scriptContext.CmdRange.pBegin = m_execState.pScriptLineCurrent;
-                scriptContext.CmdRange.pEnd = m_execState.pScriptLineCurrent->GetNext();
-                scriptContext.IsNppExeced = true;
-
-                int n = 0;
-                CListItemT<tstr>* pline = m_execState.pScriptLineCurrent;
-                CListItemT<tstr>* pscriptline = Script.GetFirst();
-                while (pscriptline)
-                {
-                    //line = "";
-                    line = pscriptline->GetItem();
-                    if (line.length() > 0)
-                    {
-                        ++n;
-
-                        Runtime::GetLogger().AddEx( _T("; + line %d:  %s"), n, line.c_str() );
-                    
-                        m_pNppExec->GetMacroVars().CheckCmdArgs(line, args);
-                        pline = m_CmdList.Insert(pline, true, line);
-                    }
-                    pscriptline = pscriptline->GetNext();
-                }
 
-                if (n != 0)
-                {
-                    scriptContext.CmdRange.pBegin = scriptContext.CmdRange.pBegin->GetNext();
-                    m_execState.ScriptContextList.Add(scriptContext);
+            if ( isMsgEx && n == 0 )
+                Runtime::GetLogger().Add(   _T("; hWnd parameter...") );
+            else
+                Runtime::GetLogger().Add(   _T("; uMsg parameter...") );
 
-                    Runtime::GetLogger().AddEx( _T("; script context added: { Name = \"%s\"; CmdRange = [0x%X, 0x%X) }"), 
-                        scriptContext.ScriptName.c_str(), scriptContext.CmdRange.pBegin, scriptContext.CmdRange.pEnd ); 
+            const CStrSplitT<TCHAR> args;
+            m_pNppExec->GetMacroVars().CheckCmdArgs(val, args);
+            m_pNppExec->GetMacroVars().CheckAllMacroVars(this, val, true);
 
-                }
-            }
-            else 
+            if ( isMsgEx && n == 0 )
             {
-                Runtime::GetLogger().AddEx( _T("; there is no script with such name (\"%s\")"), args.GetArg(0).c_str() ); 
-                Runtime::GetLogger().Add(   _T("; trying to load the script from a file") ); 
-              
-                tstr fileName = args.GetArg(0);
-
-                if ( fileName.EndsWith(_T(".exe")) ||
-                     fileName.EndsWith(_T(".com")) ||
-                     fileName.EndsWith(_T(".bat")) ||
-                     fileName.EndsWith(_T(".cmd")) ||
-                     fileName.EndsWith(_T(".ps1")) ||
-                     fileName.EndsWith(_T(".js"))  ||
-                     fileName.EndsWith(_T(".vbs")) )
+                // hWnd
+                if ( hasDblQuote || val.GetAt(0) == _T('@') )
                 {
-                    // executable or command file
-                    ScriptError( ET_REPORT, _T("- syntax error: NppExec\'s script file expected, executable file given") );
-                    m_pNppExec->GetConsole().PrintError( _T("; If you want to run an executable file, don\'t use NPP_EXEC command!") );
-                    m_pNppExec->GetConsole().PrintError( _T("; (type HELP NPP_EXEC in the Console window for details)") );
-                    m_pNppExec->GetConsole().PrintError( _T("; To run program.exe type just") );
-                    m_pNppExec->GetConsole().PrintError( _T(";     program.exe") );
-                    m_pNppExec->GetConsole().PrintError( _T("; instead of") );
-                    m_pNppExec->GetConsole().PrintError( _T(";     npp_exec program.exe") );
-                    nCmdResult = CMDRESULT_FAILED;
+                    isValidParam = false;
                 }
                 else
                 {
-                    // not executable or command file
-
-                    if ( fileName.length() > 1 )
-                    {
-                        m_pNppExec->nppConvertToFullPathName(fileName, true);
-                    }
-
-                    if ( fbuf.LoadFromFile(fileName.c_str(), true, m_pNppExec->GetOptions().GetInt(OPTI_UTF8_DETECT_LENGTH)) )
-                    {
-                        Runtime::GetLogger().AddEx( _T("; loading the script from a file \"%s\""), fileName.c_str() );
-                  
-                        scriptContext.ScriptName = scriptName;
-                        scriptContext.CmdRange.pBegin = m_execState.pScriptLineCurrent;
-                        scriptContext.CmdRange.pEnd = m_execState.pScriptLineCurrent->GetNext();
-                        scriptContext.IsNppExeced = true;
-
-                        int n = 0;
-                        CListItemT<tstr>* pline = m_execState.pScriptLineCurrent;
-                        while (fbuf.GetLine(line) >= 0)
-                        {
-                            if (line.length() > 0)
-                            {
-                                ++n;
-                    
-                                Runtime::GetLogger().AddEx( _T("; + line %d:  %s"), n, line.c_str() );
-                      
-                                m_pNppExec->GetMacroVars().CheckCmdArgs(line, args);
-                                pline = m_CmdList.Insert(pline, true, line);
-                            }
-                        }
-
-                        if (n != 0)
-                        {
-                            scriptContext.CmdRange.pBegin = scriptContext.CmdRange.pBegin->GetNext();
-                            m_execState.ScriptContextList.Add(scriptContext);
 
-                            Runtime::GetLogger().AddEx( _T("; script context added: { Name = \"%s\"; CmdRange = [0x%X, 0x%X) }"), 
-                                scriptContext.ScriptName.c_str(), scriptContext.CmdRange.pBegin, scriptContext.CmdRange.pEnd ); 
+                  #ifdef _WIN64
+                    hWnd = (HWND) (UINT_PTR) c_base::_tstr2uint64( val.c_str() ); // 64-bit pointer
+                  #else
+                    hWnd = (HWND) (UINT_PTR) c_base::_tstr2uint( val.c_str() ); // 32-bit pointer
+                  #endif
 
-                        }
-                    }
-                    else
-                    {
-                        Runtime::GetLogger().Add(   _T("; there is no file with such name ") ); 
-                  
-                        ScriptError( ET_REPORT, _T("- can not open specified file or it is empty") );
-                        nCmdResult = CMDRESULT_FAILED;
-                    }
+                    if ( !::IsWindow(hWnd) )
+                        isValidParam = false;
                 }
-                
             }
         }
         else
         {
-            ScriptError( ET_ABORT, _T("; Script execution aborted to prevent possible infinite loop (from DoNppExec())") );
-            nCmdResult = CMDRESULT_FAILED;
+            if ( isMsgEx && n == 0 )
+                isValidParam = false;
         }
 
-    }
-    else
-    {
-        Runtime::GetLogger().Add(   _T("; the script with the same name is being executed") );
-            
-        ScriptError( ET_REPORT, _T("- can\'t exec the same script at the same time") );
-        nCmdResult = CMDRESULT_FAILED;
-    }
-
-    return nCmdResult;
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoNppMenuCommand(const tstr& params)
-{
-    if ( !reportCmdAndParams( DoNppMenuCommandCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
-
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    tstr parsedItemPath, parsedSep;
-    int menuItemId = m_pNppExec->nppGetMenuItemIdByName(params, parsedItemPath, parsedSep);
-    if ( menuItemId > 0 )
+        if ( isMsgEx && !isValidParam )
+        {
+            // hwnd should be a valid window handle
+            ScriptError( ET_REPORT, _T("- incorrect hWnd: should be a valid window handle") );
+            return CMDRESULT_FAILED;
+        }
+    }
+
+    if ( (!isDecNumChar(val.GetAt(0))) &&
+         (val.GetAt(0) != _T('-') || !isDecNumChar(val.GetAt(1))) )
     {
-        Runtime::GetLogger().AddEx( _T("; menu item separator: %s"), 
-            parsedSep.IsEmpty() ? _T("<none>") : parsedSep.c_str() );
-        Runtime::GetLogger().AddEx( _T("; menu item found: id = %d"), menuItemId );
+        FParserAccess(this)->Calculate(m_pNppExec, val, calcErr, val); // try to calculate
+    }
 
-        m_pNppExec->SendNppMsg(NPPM_MENUCOMMAND, 0, menuItemId);
+    UINT uMsg = c_base::_tstr2uint( val.c_str() );
+    if ( uMsg == 0 )
+    {
+        ScriptError( ET_REPORT, _T("- uMsg is 0 (no message to send)") );
+        return CMDRESULT_FAILED;
     }
-    else
+
+    if ( *s == 0 )
     {
-        tstr err = _T("- the menu item was not found. Parsed item path: ");
-        if ( !parsedItemPath.IsEmpty() )
-            err += parsedItemPath;
-        else
-            err += _T("<none>");
+        // npp(sci)_msg <uMsg>
 
-        Runtime::GetLogger().AddEx( _T("; menu item separator: %s"), 
-            parsedSep.IsEmpty() ? _T("<none>") : parsedSep.c_str() );
+        if ( isMsgEx )
+            Runtime::GetLogger().AddEx( _T("; hWnd  = %d (0x%X)"), hWnd, hWnd );
+        Runtime::GetLogger().AddEx( _T("; uMsg  = %d (0x%X)"), uMsg, uMsg );
+        Runtime::GetLogger().AddEx( _T("; wType = %s,  wParam = \"0\""), STR_PARAMTYPE[PT_INT] );
+        Runtime::GetLogger().AddEx( _T("; lType = %s,  lParam = \"0\""), STR_PARAMTYPE[PT_INT] );
 
-        ScriptError( ET_REPORT, err.c_str() );
-        nCmdResult = CMDRESULT_FAILED;
-    }
+        Runtime::GetLogger().Add(   _T("; calling SendMessage ...") );
 
-    return nCmdResult;
-}
+        LRESULT lResult = ::SendMessage( hWnd, uMsg, 0, 0 );
 
-CScriptEngine::eCmdResult CScriptEngine::DoNppOpen(const tstr& params)
-{
-    if ( !reportCmdAndParams( DoNppOpenCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+        Runtime::GetLogger().Add(   _T("; ... SendMessage has been called") );
+        
+        // RESULT
+        tstr varName;
+        tstr varValue;
+        TCHAR szNum[50];
 
-    // opening a file in Notepad++
+        varName = MACRO_MSG_RESULT;
+        szNum[0] = 0;
+      #ifdef _WIN64
+        c_base::_tint64_to_str( static_cast<INT_PTR>(lResult), szNum );
+      #else
+        c_base::_tint2str( static_cast<INT_PTR>(lResult), szNum );
+      #endif
+        varValue = szNum;
+        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+        
+        // WPARAM
+        varName = MACRO_MSG_WPARAM;
+        varValue.Clear();
+        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+        
+        // LPARAM
+        varName = MACRO_MSG_LPARAM;
+        varValue.Clear();
+        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+        
+        return CMDRESULT_SUCCEEDED;
+    }
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    int nFilterPos = FileFilterPos( params.c_str() );
-    if ( nFilterPos < 0 )
+    int  paramType[2] = { PT_INT, PT_INT };
+    tstr paramValue[2] = { _T("0"), _T("0") };
+
+    // npp(sci)_msg <uMsg> <wParam>
+    // npp(sci)_msg <uMsg> <wParam> <lParam>
+    
+    for ( int n = 0; n < 2; n++ )
     {
-        Runtime::GetLogger().Add(   _T("; direct file (path)name specified") );
-        
-        // direct file (path)name
-        if ( !m_pNppExec->SendNppMsg(NPPM_RELOADFILE, (WPARAM) FALSE, (LPARAM) params.c_str()) )
+        bool hasDblQuote = false;
+        bool hasBracket = false;
+        tstr& value = paramValue[n];
+        s = get_param(s, value, SEP_TABSPACE, &hasDblQuote, &hasBracket); // wType or lType
+        if ( !value.IsEmpty() )
         {
-            int nFiles = (int) m_pNppExec->SendNppMsg(NPPM_GETNBOPENFILES, 0, 0);
 
-            if ( !m_pNppExec->SendNppMsg(NPPM_DOOPEN, (WPARAM) 0, (LPARAM) params.c_str()) )
-            {
-                nCmdResult = CMDRESULT_FAILED;
+            if ( n == 0 )
+                Runtime::GetLogger().Add(   _T("; wParam parameter...") );
+            else
+                Runtime::GetLogger().Add(   _T("; lParam parameter...") );
 
-                DWORD dwAttr = ::GetFileAttributes(params.c_str());
-                if ( (dwAttr != INVALID_FILE_ATTRIBUTES) &&
-                     ((dwAttr & FILE_ATTRIBUTE_DIRECTORY) == FILE_ATTRIBUTE_DIRECTORY) )
+            const CStrSplitT<TCHAR> args;
+            m_pNppExec->GetMacroVars().CheckCmdArgs(value, args);
+            m_pNppExec->GetMacroVars().CheckAllMacroVars(this, value, true);
+
+            if ( hasBracket )
+            {
+                if ( value.GetLastChar() != _T(']') )
                 {
-                    // NPPM_DOOPEN unexpectedly returns 0 when a folder is specified
-                    // as its argument, though in fact it does open all the files
-                    // from that folder.
-                    int nFilesNow = (int) m_pNppExec->SendNppMsg(NPPM_GETNBOPENFILES, 0, 0);
-                    if ( nFilesNow != nFiles )
-                    {
-                        nCmdResult = CMDRESULT_SUCCEEDED;
-                    }
+                    //  starts with '[', but no ']' in the end
+                    ScriptError( ET_REPORT, _T("- hex-string parameter should end with \']\'") );
+                    return CMDRESULT_INVALIDPARAM;
                 }
             }
         }
-    }
-    else
-    {
-          
-        Runtime::GetLogger().Add(   _T("; file (path)name mask specified") );
-            
-        // file (path)name mask (e.g. "C:\Documents\*.txt")
-        tstr         Path;
-        tstr         Filter;
-        CListT<tstr> FilesList;
 
-        GetPathAndFilter( params.c_str(), nFilterPos, Path, Filter );
-
-        Runtime::GetLogger().AddEx( _T("; searching \"%s\" for \"%s\""), Path.c_str(), Filter.c_str() );
-          
-        GetFilePathNamesList( Path.c_str(), Filter.c_str(), FilesList );
-
-        tstr S;
-        CListItemT<tstr>* ptr = FilesList.GetFirst();
-        while ( ptr )
+        if ( value.GetAt(0) == _T('@') )
         {
-            S = ptr->GetItem();
-            if ( !m_pNppExec->SendNppMsg(NPPM_RELOADFILE, (WPARAM) FALSE, (LPARAM) S.c_str()) )
+            value.Delete(0, 1);
+            if ( value.IsEmpty() && !hasDblQuote )
             {
-                if ( !m_pNppExec->SendNppMsg(NPPM_DOOPEN, (WPARAM) 0, (LPARAM) S.c_str()) )
-                    nCmdResult = CMDRESULT_FAILED;
+                // empty, no '"'
+                ScriptError( ET_REPORT, _T("- empty pointer parameter specified") );
+                return CMDRESULT_INVALIDPARAM;
             }
-            ptr = ptr->GetNext();
-        }
-    }
-
-    return nCmdResult;
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoNppRun(const tstr& params)
-{
-    if ( !reportCmdAndParams( DoNppRunCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
-
-    // run a command
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    tstr arg1, arg2;
-    if ( SearchPath(NULL, params.c_str(), NULL, 0, NULL, NULL) != 0 )
-    {
-        arg1 = params;
-    }
-    else
-    {
-        CStrSplitT<TCHAR> args;
-        args.SplitToArgs(params, 2);
-        arg1 = args.Arg(0);
-        arg2 = args.Arg(1);
-    }
+            if ( hasBracket )
+                paramType[n] = PT_PHEXSTR;
+            else if ( hasDblQuote )
+                paramType[n] = PT_PSTR;
+            else
+                paramType[n] = PT_PINT;
+        }
+        else
+        {
+            if ( hasBracket )
+                paramType[n] = PT_HEXSTR;
+            else if ( hasDblQuote )
+                paramType[n] = PT_STR;
+            else
+                paramType[n] = PT_INT;
+        }
 
-    Runtime::GetLogger().Add(   _T("; ShellExecute() arguments") ); 
-    Runtime::GetLogger().Add(   _T("; {") );
-    const tstr logIndent = Runtime::GetLogger().GetIndentStr();
-    Runtime::GetLogger().AddEx( _T("; %s[file]   %s"), logIndent.c_str(), arg1.c_str() );
-    Runtime::GetLogger().AddEx( _T("; %s[params] %s"), logIndent.c_str(), arg2.c_str() );
-    Runtime::GetLogger().Add(   _T("; }") );
-    
-    tstr S;
-    int  nResult = (int) (INT_PTR) ShellExecute( NULL, _T("open"), arg1.c_str(), 
-           (arg2.length() > 0) ? arg2.c_str() : NULL, NULL, SW_SHOWNORMAL );
-    switch ( nResult )
-    {
-        case 0:
-            S = _T("- the operating system is out of memory or resources");
-            break;
-        case ERROR_FILE_NOT_FOUND:
-            S = _T("- the specified file was not found");
-            break;
-        case ERROR_PATH_NOT_FOUND:
-            S = _T("- the specified path was not found");
-            break;
-        case ERROR_BAD_FORMAT:
-            S = _T("- the .exe file is invalid (non-Microsoft Win32 .exe or error in .exe image)");
-            break;
-        case SE_ERR_ACCESSDENIED:
-            S = _T("- the operating system denied access to the specified file");
-            break;
-        case SE_ERR_ASSOCINCOMPLETE:
-            S = _T("- the file name association is incomplete or invalid");
-            break; 
-        case SE_ERR_DDEBUSY:
-            S = _T("- the DDE transaction could not be completed because other DDE transactions were being processed");
-            break;
-        case SE_ERR_DDEFAIL:
-            S = _T("- the DDE transaction failed");
-            break;
-        case SE_ERR_DDETIMEOUT:
-            S = _T("- the DDE transaction could not be completed because the request timed out");
-            break;
-        case SE_ERR_DLLNOTFOUND:
-            S = _T("- the specified dynamic-link library (DLL) was not found");
-            break;
-        case SE_ERR_NOASSOC:
-            S = _T("- there is no application associated with the given file name extension");
-            break;
-        case SE_ERR_OOM:
-            S = _T("- there was not enough memory to complete the operation");
-            break;
-        case SE_ERR_SHARE:
-            S = _T("- a sharing violation occurred");
-            break;
-        default:
-            S = _T("");
+        switch ( paramType[n] )
+        {
+            case PT_INT:
+            case PT_PINT:
+            {
+                if ( (!isDecNumChar(value.GetAt(0))) &&
+                     (value.GetAt(0) != _T('-') || !isDecNumChar(value.GetAt(1))) )
+                {
+                    if ( !FParserAccess(this)->Calculate(m_pNppExec, value, calcErr, value) ) // try to calculate
+                    {
+                        ScriptError( ET_REPORT, _T("- string parameter specified without \"\"") );
+                        return CMDRESULT_INVALIDPARAM;
+                    }
+                }
+                break;
+            }
+        }
+
+        if ( *s == 0 )
             break;
     }
-    if ( S.length() > 0 )
-    {
-        ScriptError( ET_REPORT, S.c_str() );
-        nCmdResult = CMDRESULT_FAILED;
-    }
 
-    return nCmdResult;
-}
+    if ( isMsgEx )
+        Runtime::GetLogger().AddEx( _T("; hWnd  = %d (0x%X)"), hWnd, hWnd );
+    Runtime::GetLogger().AddEx( _T("; uMsg  = %d (0x%X)"), uMsg, uMsg );
+    Runtime::GetLogger().AddEx( _T("; wType = %s,  wParam = \"%s\""), 
+      STR_PARAMTYPE[paramType[0]], paramValue[0].c_str() );
+    Runtime::GetLogger().AddEx( _T("; lType = %s,  lParam = \"%s\""), 
+      STR_PARAMTYPE[paramType[1]], paramValue[1].c_str() );
+        
+    // npp(sci)_msg <uMsg> <wParam> <lParam>
 
-CScriptEngine::eCmdResult CScriptEngine::DoNppSave(const tstr& params)
-{
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    TCHAR szFileName[FILEPATH_BUFSIZE];
+    const int PARAM_BUF_SIZE = m_pNppExec->GetOptions().GetInt(OPTI_SENDMSG_MAXBUFLEN);
+    TCHAR*   pParam[2] = { NULL, NULL };
+    char*    pSciParam[2] = { NULL, NULL };
+    UINT_PTR uiParam[2] = { 0, 0 };
+    WPARAM   wParam = 0;
+    LPARAM   lParam = 0;
+    TCHAR    szNum[50];
 
-    reportCmdAndParams( DoNppSaveCommand::Name(), params, 0 );
-          
-    // save a file
-    bool bCurrentFile = params.IsEmpty();
-    if ( bCurrentFile )
-    {
-          
-        Runtime::GetLogger().Add(   _T("; no file name specified - saving current file") );
-            
-        // file name is not specified i.e. saving current file
-        m_pNppExec->SendNppMsg( NPPM_GETFULLCURRENTPATH,
-          (WPARAM) (FILEPATH_BUFSIZE - 1), (LPARAM) szFileName );
-    }
-    else
+    for ( int n = 0; n < 2; n++ )
     {
-          
-        Runtime::GetLogger().Add(   _T("; retrieving full file name") );
-            
-        // file name is specified
-        if ( !m_pNppExec->nppSwitchToDocument(params.c_str(), true) )
+        switch ( paramType[n] )
         {
-            ScriptError( ET_REPORT, _T("- no such file opened") );
-            return CMDRESULT_FAILED;
+            case PT_INT:
+              #ifdef _WIN64
+                uiParam[n] = c_base::_tstr2int64( paramValue[n].c_str() );
+              #else
+                uiParam[n] = c_base::_tstr2int( paramValue[n].c_str() );
+              #endif
+                if ( n == 0 )
+                    wParam = uiParam[n];
+                else
+                    lParam = uiParam[n];
+                break;
+
+            case PT_PINT:
+              #ifdef _WIN64
+                uiParam[n] = c_base::_tstr2int64( paramValue[n].c_str() );
+              #else
+                uiParam[n] = c_base::_tstr2int( paramValue[n].c_str() );
+              #endif
+                if ( n == 0 )
+                    wParam = (WPARAM) &uiParam[n];
+                else
+                    lParam = (LPARAM) &uiParam[n];
+                break;
+
+            case PT_STR:
+            case PT_PSTR:
+            case PT_HEXSTR:
+            case PT_PHEXSTR:
+                if ( paramType[n] == PT_HEXSTR || paramType[n] == PT_PHEXSTR )
+                {
+                    int nHexBufSize = PARAM_BUF_SIZE;
+                    if ( cmdType != CMDTYPE_SCISENDMSG )
+                        nHexBufSize *= sizeof(TCHAR);
+                    c_base::byte_t* pHexBuf = new c_base::byte_t[nHexBufSize];
+                    if ( pHexBuf )
+                    {
+                        memset( pHexBuf, 0, nHexBufSize );
+
+                        tstr& value = paramValue[n];
+                        const TCHAR* pHexStr = value.c_str() + 1; // skip leading '['
+                        value.SetSize( value.length() - 1 ); // exlude trailing ']'
+                        c_base::_thexstrex2buf( pHexStr, pHexBuf, nHexBufSize - sizeof(TCHAR) );
+
+                        if ( cmdType == CMDTYPE_SCISENDMSG )
+                            pSciParam[n] = (char*) pHexBuf;
+                        else
+                            pParam[n] = (TCHAR*) pHexBuf;
+                    }
+                }
+                else
+                {
+                    if ( cmdType == CMDTYPE_SCISENDMSG )
+                    {
+                        pSciParam[n] = new char[PARAM_BUF_SIZE];
+                        if ( pSciParam[n] )
+                        {
+                            memset( pSciParam[n], 0, PARAM_BUF_SIZE*sizeof(char) );
+                            if ( !paramValue[n].IsEmpty() )
+                            {
+                                char* pp = SciTextFromLPCTSTR(paramValue[n].c_str(), hWnd);
+                                if ( pp )
+                                {
+                                    lstrcpyA(pSciParam[n], pp);
+                                    SciTextDeleteResultPtr(pp, paramValue[n].c_str());
+                                }
+                            }
+                        }
+                    }
+                    else
+                    {
+                        pParam[n] = new TCHAR[PARAM_BUF_SIZE];
+                        if ( pParam[n] )
+                        {
+                            memset( pParam[n], 0, PARAM_BUF_SIZE*sizeof(TCHAR) );
+                            lstrcpy( pParam[n], paramValue[n].c_str() );
+                        }
+                    }
+                }
+                if ( pParam[n] )
+                {
+                    if ( n == 0 )
+                        wParam = (WPARAM) pParam[n];
+                    else
+                        lParam = (LPARAM) pParam[n];
+                }
+                else if ( pSciParam[n] )
+                {
+                    if ( n == 0 )
+                        wParam = (WPARAM) pSciParam[n];
+                    else
+                        lParam = (LPARAM) pSciParam[n];
+                }
+                else
+                {
+                    ScriptError( ET_REPORT, _T("- could not allocate memory for a parameter") );
+                    return CMDRESULT_FAILED;
+                }
+                break;
         }
     }
-        
-    messageConsole( DoNppSaveCommand::Name(), bCurrentFile ? szFileName : params.c_str() );
-    
-    Runtime::GetLogger().Add(   _T("; saving") );
 
-    // TODO: use Notepad++'s message to check the document's state
-    HWND hSciWnd = m_pNppExec->GetScintillaHandle();
-    BOOL bModified = (BOOL) ::SendMessage(hSciWnd, SCI_GETMODIFY, 0, 0);
+    Runtime::GetLogger().Add(   _T("; calling SendMessage ...") );
 
-    if ( !m_pNppExec->SendNppMsg(NPPM_SAVECURRENTFILE, 0, 0) )
+    LRESULT lResult = ::SendMessage( hWnd, uMsg, wParam, lParam );
+
+    Runtime::GetLogger().Add(   _T("; ... SendMessage has been called") );
+
+    for ( int n = 0; n < 2; n++ )
     {
-        if ( bModified )
+        if ( paramType[n] == PT_STR || paramType[n] == PT_HEXSTR )
         {
-            ScriptError( ET_REPORT, _T("- could not save the file") );
-            nCmdResult = CMDRESULT_FAILED;
+            if ( pSciParam[n] )
+            {
+                #ifdef UNICODE
+                    delete [] pSciParam[n];
+                #else
+                    if ( pSciParam[n] != paramValue[n].c_str() )
+                        delete [] pSciParam[n];
+                #endif
+
+                pSciParam[n] = NULL;
+            }
+            if ( pParam[n] )
+            {
+                delete [] pParam[n];
+                pParam[n] = NULL;
+            }
         }
-        // else the document is unmodified - nothing to save
     }
 
-    return nCmdResult;
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoNppSaveAs(const tstr& params)
-{
-    if ( !reportCmdAndParams( DoNppSaveAsCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+    int  i;
+    tstr varName;
+    tstr varValue;
+    
+    for ( int n = 0; n < 2; n++ )
+    {
+        varName = (n == 0) ? MACRO_MSG_WPARAM : MACRO_MSG_LPARAM;
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+        switch ( paramType[n] )
+        {
+            case PT_PINT:
+                szNum[0] = 0;
+              #ifdef _WIN64
+                c_base::_tint64_to_str( static_cast<INT_PTR>(uiParam[n]), szNum );
+              #else
+                c_base::_tint2str( static_cast<INT_PTR>(uiParam[n]), szNum );
+              #endif
+                varValue = szNum;
+                m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+                break;
 
-    Runtime::GetLogger().Add(   _T("; saving") );
+            case PT_PSTR:
+                if ( cmdType == CMDTYPE_SCISENDMSG )
+                {
+                    TCHAR* pp = SciTextToLPTSTR(pSciParam[n], hWnd);
+                    varValue = pp;
+                    SciTextDeleteResultPtr(pp, pSciParam[n]);
+                    delete [] pSciParam[n];
+                    pSciParam[n] = NULL;
+                }
+                else
+                {
+                    varValue = pParam[n];
+                    delete [] pParam[n];
+                    pParam[n] = NULL;
+                }
+                for ( i = varValue.length() - 1; i >= 0; i-- )
+                {
+                    const TCHAR ch = varValue[i];
+                    if ( ch == _T('\r') || ch == _T('\n') )
+                        varValue.Delete(i, 1); // exclude trailing '\r' or '\n'
+                    else
+                        break;
+                }
+                m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+                break;
 
-    if ( !m_pNppExec->SendNppMsg(NPPM_SAVECURRENTFILEAS, 0, (LPARAM) params.c_str()) )
-    {
-        ScriptError( ET_REPORT, _T("- failed to save the file") );
-        nCmdResult = CMDRESULT_FAILED;
-    }
+            case PT_PHEXSTR:
+                varValue = _T("[ ");
+                {
+                    const int nBytesInLine = 16;
+                    const int nBytesToShow = 256;
+                    c_base::byte_t* pHexBuf;
+                    c_base::byte_t* p;
+                    TCHAR szBytesLine[3*nBytesInLine + 2];
 
-    return nCmdResult;
-}
+                    if ( cmdType == CMDTYPE_SCISENDMSG )
+                        pHexBuf = (c_base::byte_t *) pSciParam[n];
+                    else
+                        pHexBuf = (c_base::byte_t *) pParam[n];
 
-CScriptEngine::eCmdResult CScriptEngine::DoNppSaveAll(const tstr& params)
-{
-    reportCmdAndParams( DoNppSaveAllCommand::Name(), params, 0 );
+                    p = pHexBuf;
+                    while ( p < pHexBuf + nBytesToShow )
+                    {
+                        if ( p != pHexBuf )  varValue += _T_RE_EOL _T("  ");
+                        c_base::_tbuf2hexstr(p, nBytesInLine, szBytesLine, 3*nBytesInLine + 2, _T(" "));
+                        varValue += szBytesLine;
+                        p += nBytesInLine;
+                    }
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+                    delete [] pHexBuf;
+                    if ( cmdType == CMDTYPE_SCISENDMSG )
+                        pSciParam[n] = NULL;
+                    else
+                        pParam[n] = NULL;
+                }
+                varValue += _T(" ]");
+                m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+                break;
 
-    if ( !params.IsEmpty() )
-    {
-        ScriptError( ET_REPORT, _T("- unexpected parameter(s)") );
-        nCmdResult = CMDRESULT_INVALIDPARAM;
+            default:
+                varValue.Clear();
+                m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+                break;
+        }
     }
-          
-    m_pNppExec->GetConsole().PrintMessage(DoNppSaveAllCommand::Name());
-    if ( !m_pNppExec->nppSaveAllFiles() )
-        nCmdResult = CMDRESULT_FAILED;
 
-    return nCmdResult;
+    varName = MACRO_MSG_RESULT;
+    szNum[0] = 0;
+  #ifdef _WIN64
+    c_base::_tint64_to_str( static_cast<INT_PTR>(lResult), szNum );
+  #else
+    c_base::_tint2str( static_cast<INT_PTR>(lResult), szNum );
+  #endif
+    varValue = szNum;
+    m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+
+    return CMDRESULT_SUCCEEDED;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoNppSwitch(const tstr& params)
+CScriptEngine::eCmdResult CScriptEngine::doSciFindReplace(const tstr& params, eCmdType cmdType)
 {
-    if ( !reportCmdAndParams( DoNppSwitchCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+    if ( !reportCmdAndParams( GetCommandRegistry().GetCmdNameByType(cmdType), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
         return CMDRESULT_INVALIDPARAM;
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-
-    if ( !m_pNppExec->nppSwitchToDocument(params.c_str(), true) )
+    // 1. Preparing the arguments...
+    const CStrSplitT<TCHAR> cmdArgs;
+    CStrSplitT<TCHAR> args;
+    const int nArgs = args.SplitToArgs(params, (cmdType == CMDTYPE_SCIFIND) ? 2 : 3);
+    if ( nArgs < 2 )
     {
-        ScriptError( ET_REPORT, _T("- no such file opened") );
-        nCmdResult = CMDRESULT_FAILED;
+        TCHAR szErr[64];
+        wsprintf(szErr, _T("not enough parameters: %s expected, %d given"), (cmdType == CMDTYPE_SCIFIND) ? _T("2") : _T("at least 2"), nArgs );
+        errorCmdNotEnoughParams( GetCommandRegistry().GetCmdNameByType(cmdType), szErr );
+        return CMDRESULT_INVALIDPARAM;
     }
 
-    return nCmdResult;
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoNppSetFocus(const tstr& params)
-{
-    if ( !reportCmdAndParams( DoNppSetFocusCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+    for ( int i = 0; i < nArgs; i++ )
+    {
+        tstr& val = args.Arg(i);
+        NppExecHelpers::StrUnquote(val);
+        m_pNppExec->GetMacroVars().CheckCmdArgs(val, cmdArgs);
+        m_pNppExec->GetMacroVars().CheckAllMacroVars(this, val, true);
+    }
 
-    eCmdResult nCmdResult = CMDRESULT_FAILED;
-    tstr type = params;
-    NppExecHelpers::StrUpper(type);
+    // 2. Search flags...
+    tstr sFlags = args.Arg(0);
+    NppExecHelpers::StrUnquote(sFlags);
+    CNppExecMacroVars::StrCalc(sFlags, m_pNppExec, this).Process();
+    HWND hSci = m_pNppExec->GetScintillaHandle();
+    unsigned int nSearchFlags = 0;
+    unsigned int nFlags = c_base::_tstr2uint(sFlags.c_str());
+    if ( nFlags & NPE_SF_MATCHCASE )
+        nSearchFlags |= SCFIND_MATCHCASE;
+    if ( nFlags & NPE_SF_WHOLEWORD )
+        nSearchFlags |= SCFIND_WHOLEWORD;
+    if ( nFlags & NPE_SF_WORDSTART )
+        nSearchFlags |= SCFIND_WORDSTART;
+    if ( nFlags & NPE_SF_REGEXP )
+        nSearchFlags |= SCFIND_REGEXP;
+    if ( nFlags & NPE_SF_POSIX )
+        nSearchFlags |= SCFIND_POSIX;
+    if ( nFlags & NPE_SF_CXX11REGEX )
+        nSearchFlags |= SCFIND_CXX11REGEX;
+    ::SendMessage(hSci, SCI_SETSEARCHFLAGS, nSearchFlags, 0);
 
-    if ( type == _T("CON") )
+    // 3. Search range...
+    INT_PTR nSelStart = (INT_PTR) ::SendMessage(hSci, SCI_GETSELECTIONSTART, 0, 0);
+    INT_PTR nSelEnd = (INT_PTR) ::SendMessage(hSci, SCI_GETSELECTIONEND, 0, 0);
+    const bool bNoSelection = (nSelStart == nSelEnd);
+    const bool bReplacingAll = ((nFlags & NPE_SF_REPLACEALL) && (cmdType == CMDTYPE_SCIREPLACE));
+    INT_PTR nTextLength = (INT_PTR) ::SendMessage(hSci, SCI_GETTEXTLENGTH, 0, 0);
+    INT_PTR nRangeStart = -1, nRangeEnd = -1;
+    if ( (nFlags & NPE_SF_PRINTALL) || bReplacingAll )
     {
-        HWND hConDlg = m_pNppExec->GetConsole().GetDialogWnd();
-        if ( ::IsWindowVisible(hConDlg) )
+        if ( nFlags & NPE_SF_INWHOLETEXT )
         {
-            // Note: since this code is executed in the scope of
-            // CNppExecCommandExecutor::BackgroundExecuteThreadFunc,
-            // it is not straightforward to set the focus
-            HWND hCon = m_pNppExec->GetConsole().GetConsoleWnd();
-            HWND hFocused = ::GetFocus(); // most likely returns NULL
-            if ( hFocused != hCon && hFocused != hConDlg )
+            // in the whole text
+            nRangeStart = 0;
+            nRangeEnd = nTextLength;
+        }
+        else if ( nFlags & NPE_SF_INSELECTION )
+        {
+            // only in the selected text
+            nRangeStart = nSelStart;
+            nRangeEnd = nSelEnd;
+        }
+        else
+        {
+            if ( nFlags & NPE_SF_BACKWARD )
             {
-                //m_pNppExec->SendNppMsg(NPPM_DMMSHOW, 0, (LPARAM) hConDlg);
-                ::SetFocus(hConDlg);
-                ::SendMessage(hConDlg, WM_SETFOCUS, 0, 0);
+                nRangeStart = 0;
+                nRangeEnd = nSelStart;
+            }
+            else
+            {
+                nRangeStart = nSelEnd;
+                nRangeEnd = nTextLength;
             }
-            m_pNppExec->m_hFocusedWindowBeforeScriptStarted = hCon;
-            nCmdResult = CMDRESULT_SUCCEEDED;
         }
     }
-    else if ( type == _T("SCI") )
+    else if ( nFlags & NPE_SF_INSELECTION )
     {
-        HWND hSci = m_pNppExec->GetScintillaHandle();
-        if ( ::IsWindowVisible(hSci) )
-        {
-            // Note: since this code is executed in the scope of
-            // CNppExecCommandExecutor::BackgroundExecuteThreadFunc,
-            // it is not straightforward to set the focus
-            HWND hFocused = ::GetFocus(); // most likely returns NULL
-            if ( hFocused != hSci )
-                ::SendMessage(hSci, SCI_SETFOCUS, 1, 0);
-            m_pNppExec->m_hFocusedWindowBeforeScriptStarted = hSci;
-            nCmdResult = CMDRESULT_SUCCEEDED;
-        }
+        nRangeStart = nSelStart;
+        nRangeEnd = nSelEnd;
     }
     else
     {
-        tstr Err = _T("- unknown parameter: ");
-        Err += params;
-        ScriptError( ET_REPORT, Err.c_str() );
-        nCmdResult = CMDRESULT_INVALIDPARAM;
+        if ( nFlags & NPE_SF_BACKWARD )
+        {
+            nRangeStart = 0;
+            nRangeEnd = nSelStart;
+            // in case of NPE_SF_NEXT, no need to adjust nRangeEnd here
+        }
+        else
+        {
+            nRangeStart = nSelEnd;
+            if ( ((nFlags & NPE_SF_NEXT) != 0) &&
+                 bNoSelection && (nRangeStart != nTextLength) )
+            {
+                nRangeStart = (INT_PTR) ::SendMessage(hSci, SCI_POSITIONRELATIVE, (WPARAM) nRangeStart, (LPARAM) (1));
+                // Note: just ++nRangeStart will not work for UTF-8
+            }
+            nRangeEnd = nTextLength;
+        }
     }
 
-    return nCmdResult;
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoNppSendMsg(const tstr& params)
-{
-    return doSendMsg(params, CMDTYPE_NPPSENDMSG);
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoNppSendMsgEx(const tstr& params)
-{
-    return doSendMsg(params, CMDTYPE_NPPSENDMSGEX);
-}
-
-CScriptEngine::eCmdResult CScriptEngine::DoSciSendMsg(const tstr& params)
-{
-    return doSendMsg(params, CMDTYPE_SCISENDMSG);
-}
+    // 4. Strings to find & replace...
+    int nFindStrLen = 0;
+    char* pFindStr = SciTextFromLPCTSTR(args.GetArg(1).c_str(), hSci, &nFindStrLen);
 
-CScriptEngine::eCmdResult CScriptEngine::doSendMsg(const tstr& params, int cmdType)
-{
-    tstr cmdName;
-    HWND hWnd = NULL;
-    bool isMsgEx = false;
-    
-    switch ( cmdType )
+    if ( nFindStrLen == 0 )
     {
-        case CMDTYPE_NPPSENDMSG:
-            cmdName = DoNppSendMsgCommand::Name();
-            hWnd = m_pNppExec->m_nppData._nppHandle;
-            break;
-
-        case CMDTYPE_SCISENDMSG:
-            cmdName = DoSciSendMsgCommand::Name();
-            hWnd = m_pNppExec->GetScintillaHandle();
-            break;
-
-        case CMDTYPE_NPPSENDMSGEX:
-            cmdName = DoNppSendMsgExCommand::Name();
-            isMsgEx = true;
-            break;
-
-        default:
-            // unsupported command
-            return CMDRESULT_FAILED;
+        ScriptError( ET_REPORT, _T("- can not search for an empty string") );
+        return CMDRESULT_INVALIDPARAM;
     }
 
-    if ( !reportCmdAndParams( cmdName.c_str(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+    int nReplaceStrLen = 0;
+    char* pReplaceStr = NULL;
+    if ( cmdType == CMDTYPE_SCIREPLACE )
+    {
+        pReplaceStr = SciTextFromLPCTSTR(args.GetArg(2).c_str(), hSci, &nReplaceStrLen);
+    }
 
-    // send message to Notepad++
-    
-    // npp(sci)_msg <uMsg>
-    // npp(sci)_msg <uMsg> <wParam>
-    // npp(sci)_msg <uMsg> <wParam> <lParam>
+    INT_PTR nFindStrLenOut = nFindStrLen;
+    INT_PTR nReplaceStrLenOut = nReplaceStrLen;
     
-    tstr val;
-    tstr calcErr;
-    const TCHAR* s = params.c_str();
-
-    for ( int n = 0; n < (isMsgEx ? 2 : 1); n++ )
+    // 5. Searching...
+    INT_PTR nPos = -1;
+    if ( (nFlags & NPE_SF_PRINTALL) || bReplacingAll )
     {
-        bool isValidParam = true;
-        bool hasDblQuote = false;
+        tstr S;
+        unsigned int nOccurrences = 0;
 
-        s = get_param(s, val, SEP_TABSPACE, &hasDblQuote); // uMsg or hWnd
-        if ( !val.IsEmpty() )
-        {
+        if ( bReplacingAll )
+            ::SendMessage(hSci, SCI_BEGINUNDOACTION, 0, 0);
 
-            if ( isMsgEx && n == 0 )
-                Runtime::GetLogger().Add(   _T("; hWnd parameter...") );
+        for ( ; ; )
+        {
+            if ( nFlags & NPE_SF_BACKWARD )
+                ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeEnd, nRangeStart);
             else
-                Runtime::GetLogger().Add(   _T("; uMsg parameter...") );
+                ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeStart, nRangeEnd);
 
-            const CStrSplitT<TCHAR> args;
-            m_pNppExec->GetMacroVars().CheckCmdArgs(val, args);
-            m_pNppExec->GetMacroVars().CheckAllMacroVars(this, val, true);
+            INT_PTR pos = (INT_PTR) ::SendMessage( hSci, SCI_SEARCHINTARGET, (WPARAM) nFindStrLen, (LPARAM) (pFindStr ? pFindStr : "") );
+            if ( pos < 0 )
+                break;
 
-            if ( isMsgEx && n == 0 )
+            nPos = pos;
+
+            pos = (INT_PTR) ::SendMessage(hSci, SCI_GETTARGETEND, 0, 0);
+            nFindStrLenOut = pos - nPos;
+
+            ++nOccurrences;
+
+            bool isReplacing = (bReplacingAll || ((cmdType == CMDTYPE_SCIREPLACE) && (nOccurrences == 1)));
+            if ( isReplacing )
             {
-                // hWnd
-                if ( hasDblQuote || val.GetAt(0) == _T('@') )
+                if ( nFlags & (NPE_SF_REGEXP | NPE_SF_POSIX | NPE_SF_CXX11REGEX) )
                 {
-                    isValidParam = false;
+                    nReplaceStrLenOut = (INT_PTR) ::SendMessage( hSci, SCI_REPLACETARGETRE, (WPARAM) nReplaceStrLen, (LPARAM) (pReplaceStr ? pReplaceStr : "") );
                 }
                 else
                 {
+                    nReplaceStrLenOut = (INT_PTR) ::SendMessage( hSci, SCI_REPLACETARGET, (WPARAM) nReplaceStrLen, (LPARAM) (pReplaceStr ? pReplaceStr : "") );
+                }
 
-                  #ifdef _WIN64
-                    hWnd = (HWND) (UINT_PTR) c_base::_tstr2uint64( val.c_str() ); // 64-bit pointer
-                  #else
-                    hWnd = (HWND) (UINT_PTR) c_base::_tstr2uint( val.c_str() ); // 32-bit pointer
-                  #endif
+                if ( nFlags & NPE_SF_BACKWARD )
+                {
+                    nRangeEnd = nPos;
+                }
+                else
+                {
+                    nRangeStart = nPos + nReplaceStrLenOut;
+                    nRangeEnd += (nReplaceStrLenOut - nFindStrLenOut);
+                }
 
-                    if ( !::IsWindow(hWnd) )
-                        isValidParam = false;
+                if ( nPos + nFindStrLen <= nSelEnd )
+                {
+                    // each replacement affects the selection range
+                    nSelEnd += (nReplaceStrLenOut - nFindStrLenOut);
+                    if ( bNoSelection )
+                        nSelStart = nSelEnd;
+                }
+            }
+            else
+            {
+                if ( nFlags & NPE_SF_BACKWARD )
+                {
+                    nRangeEnd = nPos;
+                }
+                else
+                {
+                    nRangeStart = nPos + nFindStrLenOut;
                 }
             }
-        }
-        else
-        {
-            if ( isMsgEx && n == 0 )
-                isValidParam = false;
-        }
 
-        if ( isMsgEx && !isValidParam )
-        {
-            // hwnd should be a valid window handle
-            ScriptError( ET_REPORT, _T("- incorrect hWnd: should be a valid window handle") );
-            return CMDRESULT_FAILED;
+            if ( nFlags & NPE_SF_PRINTALL )
+            {
+                const int MAX_STR_TO_SHOW = 128;
+                const int UTF8_MAX_BYTES_PER_CHAR = 4;
+                INT_PTR nLine = (INT_PTR) ::SendMessage(hSci, SCI_LINEFROMPOSITION, (WPARAM) nPos, 0);
+                INT_PTR nLinePos = (INT_PTR) ::SendMessage(hSci, SCI_POSITIONFROMLINE, (WPARAM) nLine, 0);
+                INT_PTR nLen = isReplacing ? nReplaceStrLenOut : nFindStrLenOut;
+                int     nLenToShow = static_cast<int>(nLen);
+                bool    isUtf8 = (::SendMessage(hSci, SCI_GETCODEPAGE, 0, 0) == SC_CP_UTF8);
+                bool    isLenTruncated = false;
+                if ( isUtf8 )
+                {
+                    if ( nLen > (MAX_STR_TO_SHOW*UTF8_MAX_BYTES_PER_CHAR) )
+                    {
+                        nLen = MAX_STR_TO_SHOW*UTF8_MAX_BYTES_PER_CHAR - 5; // number of chars, plus "(...)" will be added
+                        nLenToShow = MAX_STR_TO_SHOW - 5; // number of TCHARs
+                        isLenTruncated = true;
+                    }
+                    else
+                        nLenToShow = MAX_STR_TO_SHOW; // will be adjusted later
+                }
+                else
+                {
+                    if ( nLen > MAX_STR_TO_SHOW )
+                    {
+                        nLen = MAX_STR_TO_SHOW - 5; // number of chars, plus "(...)" will be added
+                        nLenToShow = MAX_STR_TO_SHOW - 5; // number of TCHARs
+                        isLenTruncated = true;
+                    }
+                }
+                Sci_TextRange tr;
+                tr.chrg.cpMin = nPos;        // I believe Sci_CharacterRange will use INT_PTR
+                tr.chrg.cpMax = nPos + nLen; // or UINT_PTR to deal with 64-bit ranges
+                S.Reserve(50 + static_cast<int>(nLen)); // enough for both char* and TCHAR* buffer
+                tr.lpstrText = (char *) S.c_str(); // temporary using S as a char* buffer
+                ::SendMessage(hSci, SCI_GETTEXTRANGE, 0, (LPARAM) &tr);
+                TCHAR* pText = SciTextToLPTSTR(tr.lpstrText, hSci); // now we have the text as TCHAR*
+                INT_PTR nCharPos = ::SendMessage(hSci, SCI_COUNTCHARACTERS, nLinePos, nPos);
+                // Note: nCharPos can't be just (nPos - nLinePos) because it will not work for UTF-8
+                // where each character occupies up to several bytes in Scintilla's buffer
+                if ( isUtf8 )
+                {
+                    int n = pText ? lstrlen(pText) : 0;
+                    if ( n > nLenToShow )
+                    {
+                        if ( !isLenTruncated )
+                        {
+                            isLenTruncated = true;
+                            nLenToShow = MAX_STR_TO_SHOW - 5;
+                        }
+                        pText[nLenToShow] = 0;
+                    }
+                }
+                nLen = _t_sprintf( S.c_str(), // now using S as a TCHAR* buffer
+                                 #ifdef _WIN64
+                                   _T("(%I64d,%I64d)\t %s%s"), 
+                                 #else
+                                   _T("(%d,%d)\t %s%s"), 
+                                 #endif
+                                   nLine + 1, 
+                                   nCharPos + 1, 
+                                   pText ? pText : _T("(empty)"), 
+                                   isLenTruncated ? _T("(...)") : _T("")
+                                 );
+                SciTextDeleteResultPtr(pText, tr.lpstrText);
+                S.SetLengthValue(static_cast<int>(nLen));
+                m_pNppExec->GetConsole().PrintOutput(S.c_str());
+            }
         }
-    }
 
-    if ( (!isDecNumChar(val.GetAt(0))) &&
-         (val.GetAt(0) != _T('-') || !isDecNumChar(val.GetAt(1))) )
-    {
-        g_fp.Calculate(m_pNppExec, val, calcErr, val); // try to calculate
-    }
+        if ( bReplacingAll )
+            ::SendMessage(hSci, SCI_ENDUNDOACTION, 0, 0);
 
-    UINT uMsg = c_base::_tstr2uint( val.c_str() );
-    if ( uMsg == 0 )
-    {
-        ScriptError( ET_REPORT, _T("- uMsg is 0 (no message to send)") );
-        return CMDRESULT_FAILED;
+        S.Format(50, _T("- %u occurrences %s."), nOccurrences, bReplacingAll ? _T("replaced") : _T("found"));
+        m_pNppExec->GetConsole().PrintMessage(S.c_str(), (nFlags & NPE_SF_PRINTALL) == 0);
     }
-
-    if ( *s == 0 )
+    else
     {
-        // npp(sci)_msg <uMsg>
-
-        if ( isMsgEx )
-            Runtime::GetLogger().AddEx( _T("; hWnd  = %d (0x%X)"), hWnd, hWnd );
-        Runtime::GetLogger().AddEx( _T("; uMsg  = %d (0x%X)"), uMsg, uMsg );
-        Runtime::GetLogger().AddEx( _T("; wType = %s,  wParam = \"0\""), STR_PARAMTYPE[PT_INT] );
-        Runtime::GetLogger().AddEx( _T("; lType = %s,  lParam = \"0\""), STR_PARAMTYPE[PT_INT] );
-
-        Runtime::GetLogger().Add(   _T("; calling SendMessage ...") );
-
-        LRESULT lResult = ::SendMessage( hWnd, uMsg, 0, 0 );
-
-        Runtime::GetLogger().Add(   _T("; ... SendMessage has been called") );
-        
-        // RESULT
-        tstr varName;
-        tstr varValue;
-        TCHAR szNum[50];
-
-        varName = MACRO_MSG_RESULT;
-        szNum[0] = 0;
-      #ifdef _WIN64
-        c_base::_tint64_to_str( static_cast<INT_PTR>(lResult), szNum );
-      #else
-        c_base::_tint2str( static_cast<INT_PTR>(lResult), szNum );
-      #endif
-        varValue = szNum;
-        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
-        
-        // WPARAM
-        varName = MACRO_MSG_WPARAM;
-        varValue.Clear();
-        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
-        
-        // LPARAM
-        varName = MACRO_MSG_LPARAM;
-        varValue.Clear();
-        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
-        
-        return CMDRESULT_SUCCEEDED;
-    }
-
-    int  paramType[2] = { PT_INT, PT_INT };
-    tstr paramValue[2] = { _T("0"), _T("0") };
+        if ( nFlags & NPE_SF_BACKWARD )
+            ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeEnd, nRangeStart);
+        else
+            ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeStart, nRangeEnd);
 
-    // npp(sci)_msg <uMsg> <wParam>
-    // npp(sci)_msg <uMsg> <wParam> <lParam>
-    
-    for ( int n = 0; n < 2; n++ )
-    {
-        bool hasDblQuote = false;
-        bool hasBracket = false;
-        tstr& value = paramValue[n];
-        s = get_param(s, value, SEP_TABSPACE, &hasDblQuote, &hasBracket); // wType or lType
-        if ( !value.IsEmpty() )
+        nPos = (INT_PTR) ::SendMessage( hSci, SCI_SEARCHINTARGET, (WPARAM) nFindStrLen, (LPARAM) (pFindStr ? pFindStr : "") );
+        if ( (nPos < 0) && (nFlags & NPE_SF_INWHOLETEXT) )
         {
+            // search again - in the rest of the document...
+            if ( nFlags & NPE_SF_INSELECTION )
+            {
+                nRangeStart = 0;
+                nRangeEnd = nTextLength;
+            }
+            else
+            {
+                if ( nFlags & NPE_SF_BACKWARD )
+                {
+                    nRangeStart = nSelStart - nFindStrLen;
+                    if ( nRangeStart < 0 )
+                        nRangeStart = 0;
+                    nRangeEnd = nTextLength;
+                }
+                else
+                {
+                    nRangeStart = 0;
+                    nRangeEnd = nSelEnd + nFindStrLen;
+                    if ( nRangeEnd > nTextLength )
+                        nRangeEnd = nTextLength;
+                }
+            }
 
-            if ( n == 0 )
-                Runtime::GetLogger().Add(   _T("; wParam parameter...") );
+            if ( nFlags & NPE_SF_BACKWARD )
+                ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeEnd, nRangeStart);
             else
-                Runtime::GetLogger().Add(   _T("; lParam parameter...") );
+                ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeStart, nRangeEnd);
+            
+            nPos = (INT_PTR) ::SendMessage( hSci, SCI_SEARCHINTARGET, (WPARAM) nFindStrLen, (LPARAM) (pFindStr ? pFindStr : "") );
+        }
 
-            const CStrSplitT<TCHAR> args;
-            m_pNppExec->GetMacroVars().CheckCmdArgs(value, args);
-            m_pNppExec->GetMacroVars().CheckAllMacroVars(this, value, true);
+        if ( nPos >= 0 )
+        {
+            INT_PTR pos = (INT_PTR) ::SendMessage(hSci, SCI_GETTARGETEND, 0, 0);
+            nFindStrLenOut = pos - nPos;
 
-            if ( hasBracket )
+            if ( cmdType == CMDTYPE_SCIREPLACE )
             {
-                if ( value.GetLastChar() != _T(']') )
+                if ( nFlags & (NPE_SF_REGEXP | NPE_SF_POSIX | NPE_SF_CXX11REGEX) )
                 {
-                    //  starts with '[', but no ']' in the end
-                    ScriptError( ET_REPORT, _T("- hex-string parameter should end with \']\'") );
-                    return CMDRESULT_INVALIDPARAM;
+                    nReplaceStrLenOut = (INT_PTR) ::SendMessage( hSci, SCI_REPLACETARGETRE, (WPARAM) nReplaceStrLen, (LPARAM) (pReplaceStr ? pReplaceStr : "") );
+                }
+                else
+                {
+                    nReplaceStrLenOut = (INT_PTR) ::SendMessage( hSci, SCI_REPLACETARGET, (WPARAM) nReplaceStrLen, (LPARAM) (pReplaceStr ? pReplaceStr : "") );
                 }
             }
         }
+    }
 
-        if ( value.GetAt(0) == _T('@') )
+    SciTextDeleteResultPtr(pFindStr, args.GetArg(1).c_str());
+    SciTextDeleteResultPtr(pReplaceStr, args.GetArg(2).c_str());
+
+    // 6. Result
+    {
+        tstr varName;
+        tstr varValue;
+        TCHAR szNum[50];
+
+        varName = MACRO_MSG_RESULT;
+        szNum[0] = 0;
+      #ifdef _WIN64
+        c_base::_tint64_to_str(nPos, szNum);
+      #else
+        c_base::_tint2str(nPos, szNum);
+      #endif
+        varValue = szNum;
+        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+
+        if ( ((nFlags & NPE_SF_PRINTALL) == 0) && !bReplacingAll )
         {
-            value.Delete(0, 1);
-            if ( value.IsEmpty() && !hasDblQuote )
+            if ( nPos >= 0 )
             {
-                // empty, no '"'
-                ScriptError( ET_REPORT, _T("- empty pointer parameter specified") );
-                return CMDRESULT_INVALIDPARAM;
+                tstr S = (cmdType == CMDTYPE_SCIREPLACE) ? _T("- replaced") : _T("- found");
+                S += _T(" at pos ");
+                S += szNum;
+                m_pNppExec->GetConsole().PrintMessage( S.c_str() );
             }
-
-            if ( hasBracket )
-                paramType[n] = PT_PHEXSTR;
-            else if ( hasDblQuote )
-                paramType[n] = PT_PSTR;
             else
-                paramType[n] = PT_PINT;
+            {
+                m_pNppExec->GetConsole().PrintMessage( _T("- not found") );
+            }
+        }
+
+        varName = MACRO_MSG_WPARAM;
+        szNum[0] = 0;
+      #ifdef _WIN64
+        c_base::_tint64_to_str(nFindStrLenOut, szNum);
+      #else
+        c_base::_tint2str(nFindStrLenOut, szNum);
+      #endif
+        varValue = szNum;
+        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+
+        varName = MACRO_MSG_LPARAM;
+        if ( cmdType == CMDTYPE_SCIREPLACE )
+        {
+            szNum[0] = 0;
+          #ifdef _WIN64
+            c_base::_tint64_to_str(nReplaceStrLenOut, szNum);
+          #else
+            c_base::_tint2str(nReplaceStrLenOut, szNum);
+          #endif
+            varValue = szNum;
+            m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
         }
         else
         {
-            if ( hasBracket )
-                paramType[n] = PT_HEXSTR;
-            else if ( hasDblQuote )
-                paramType[n] = PT_STR;
-            else
-                paramType[n] = PT_INT;
+            varValue.Clear();
+            m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar | CNppExecMacroVars::svRemoveVar); // local var
         }
+    }
 
-        switch ( paramType[n] )
+    // 7. Set pos/sel
+    if ( nPos >= 0 )
+    {
+        if ( nFlags & NPE_SF_SETSEL )
         {
-            case PT_INT:
-            case PT_PINT:
-            {
-                if ( (!isDecNumChar(value.GetAt(0))) &&
-                     (value.GetAt(0) != _T('-') || !isDecNumChar(value.GetAt(1))) )
-                {
-                    if ( !g_fp.Calculate(m_pNppExec, value, calcErr, value) ) // try to calculate
-                    {
-                        ScriptError( ET_REPORT, _T("- string parameter specified without \"\"") );
-                        return CMDRESULT_INVALIDPARAM;
-                    }
-                }
-                break;
-            }
+            INT_PTR nEndPos = (cmdType == CMDTYPE_SCIFIND) ? (nPos + nFindStrLenOut) : (nPos + nReplaceStrLenOut);
+            ::SendMessage(hSci, SCI_SETSEL, (WPARAM) nPos, (LPARAM) nEndPos);
+        }
+        else if ( nFlags & NPE_SF_SETPOS )
+        {
+            ::SendMessage(hSci, SCI_GOTOPOS, (WPARAM) nPos, 0);
+        }
+        else if ( cmdType == CMDTYPE_SCIREPLACE )
+        {
+            // adjust the selection after the replacement(s)
+            ::SendMessage(hSci, SCI_SETSEL, (WPARAM) nSelStart, (LPARAM) nSelEnd);
         }
-
-        if ( *s == 0 )
-            break;
     }
 
-    if ( isMsgEx )
-        Runtime::GetLogger().AddEx( _T("; hWnd  = %d (0x%X)"), hWnd, hWnd );
-    Runtime::GetLogger().AddEx( _T("; uMsg  = %d (0x%X)"), uMsg, uMsg );
-    Runtime::GetLogger().AddEx( _T("; wType = %s,  wParam = \"%s\""), 
-      STR_PARAMTYPE[paramType[0]], paramValue[0].c_str() );
-    Runtime::GetLogger().AddEx( _T("; lType = %s,  lParam = \"%s\""), 
-      STR_PARAMTYPE[paramType[1]], paramValue[1].c_str() );
-        
-    // npp(sci)_msg <uMsg> <wParam> <lParam>
+    return CMDRESULT_SUCCEEDED;
+}
 
-    const int PARAM_BUF_SIZE = m_pNppExec->GetOptions().GetInt(OPTI_SENDMSG_MAXBUFLEN);
-    TCHAR*   pParam[2] = { NULL, NULL };
-    char*    pSciParam[2] = { NULL, NULL };
-    UINT_PTR uiParam[2] = { 0, 0 };
-    WPARAM   wParam = 0;
-    LPARAM   lParam = 0;
-    TCHAR    szNum[50];
+CScriptEngine::eCmdResult CScriptEngine::DoSciFind(const tstr& params)
+{
+    return doSciFindReplace(params, CMDTYPE_SCIFIND);
+}
 
-    for ( int n = 0; n < 2; n++ )
-    {
-        switch ( paramType[n] )
-        {
-            case PT_INT:
-              #ifdef _WIN64
-                uiParam[n] = c_base::_tstr2int64( paramValue[n].c_str() );
-              #else
-                uiParam[n] = c_base::_tstr2int( paramValue[n].c_str() );
-              #endif
-                if ( n == 0 )
-                    wParam = uiParam[n];
-                else
-                    lParam = uiParam[n];
-                break;
+CScriptEngine::eCmdResult CScriptEngine::DoSciReplace(const tstr& params)
+{
+    return doSciFindReplace(params, CMDTYPE_SCIREPLACE);
+}
 
-            case PT_PINT:
-              #ifdef _WIN64
-                uiParam[n] = c_base::_tstr2int64( paramValue[n].c_str() );
-              #else
-                uiParam[n] = c_base::_tstr2int( paramValue[n].c_str() );
-              #endif
-                if ( n == 0 )
-                    wParam = (WPARAM) &uiParam[n];
-                else
-                    lParam = (LPARAM) &uiParam[n];
-                break;
+void CScriptEngine::AddParallelJobOutput(int nJob, eParallelJobOutput nType, const TCHAR* cszText)
+{
+    {
+        CCriticalSectionLockGuard lock(m_csParallelJobs);
+        m_ParallelJobOutput.push_back( tParallelJobOutput() );
+        tParallelJobOutput& jobOutput = m_ParallelJobOutput.back();
+        jobOutput.nJob = nJob;
+        jobOutput.nType = nType;
+        jobOutput.sText = cszText;
+    }
 
-            case PT_STR:
-            case PT_PSTR:
-            case PT_HEXSTR:
-            case PT_PHEXSTR:
-                if ( paramType[n] == PT_HEXSTR || paramType[n] == PT_PHEXSTR )
-                {
-                    int nHexBufSize = PARAM_BUF_SIZE;
-                    if ( cmdType != CMDTYPE_SCISENDMSG )
-                        nHexBufSize *= sizeof(TCHAR);
-                    c_base::byte_t* pHexBuf = new c_base::byte_t[nHexBufSize];
-                    if ( pHexBuf )
-                    {
-                        memset( pHexBuf, 0, nHexBufSize );
+    m_eventParallelJobOutput.Set();
+}
 
-                        tstr& value = paramValue[n];
-                        const TCHAR* pHexStr = value.c_str() + 1; // skip leading '['
-                        value.SetSize( value.length() - 1 ); // exlude trailing ']'
-                        c_base::_thexstrex2buf( pHexStr, pHexBuf, nHexBufSize - sizeof(TCHAR) );
+void CScriptEngine::ParallelJobsMustBreak(unsigned int nBreakMethod)
+{
+    CCriticalSectionLockGuard lock(m_csParallelJobs);
 
-                        if ( cmdType == CMDTYPE_SCISENDMSG )
-                            pSciParam[n] = (char*) pHexBuf;
-                        else
-                            pParam[n] = (TCHAR*) pHexBuf;
-                    }
-                }
-                else
-                {
-                    if ( cmdType == CMDTYPE_SCISENDMSG )
-                    {
-                        pSciParam[n] = new char[PARAM_BUF_SIZE];
-                        if ( pSciParam[n] )
-                        {
-                            memset( pSciParam[n], 0, PARAM_BUF_SIZE*sizeof(char) );
-                            if ( !paramValue[n].IsEmpty() )
-                            {
-                                char* pp = SciTextFromLPCTSTR(paramValue[n].c_str(), hWnd);
-                                if ( pp )
-                                {
-                                    lstrcpyA(pSciParam[n], pp);
-                                    SciTextDeleteResultPtr(pp, paramValue[n].c_str());
-                                }
-                            }
-                        }
-                    }
-                    else
-                    {
-                        pParam[n] = new TCHAR[PARAM_BUF_SIZE];
-                        if ( pParam[n] )
-                        {
-                            memset( pParam[n], 0, PARAM_BUF_SIZE*sizeof(TCHAR) );
-                            lstrcpy( pParam[n], paramValue[n].c_str() );
-                        }
-                    }
-                }
-                if ( pParam[n] )
-                {
-                    if ( n == 0 )
-                        wParam = (WPARAM) pParam[n];
-                    else
-                        lParam = (LPARAM) pParam[n];
-                }
-                else if ( pSciParam[n] )
-                {
-                    if ( n == 0 )
-                        wParam = (WPARAM) pSciParam[n];
-                    else
-                        lParam = (LPARAM) pSciParam[n];
-                }
-                else
-                {
-                    ScriptError( ET_REPORT, _T("- could not allocate memory for a parameter") );
-                    return CMDRESULT_FAILED;
-                }
+    for ( auto& pChildProc : m_ParallelChildProcesses )
+    {
+        pChildProc->MustBreak(nBreakMethod);
+    }
+}
+
+void CScriptEngine::printParallelJobOutput()
+{
+    std::list<tParallelJobOutput> jobsOutput;
+    {
+        CCriticalSectionLockGuard lock(m_csParallelJobs);
+        jobsOutput.swap(m_ParallelJobOutput);
+    }
+
+    CNppExecConsole& Console = m_pNppExec->GetConsole();
+    TCHAR szPrefix[20];
+    tstr S;
+
+    for ( const tParallelJobOutput& jobOutput : jobsOutput )
+    {
+        ::wsprintf( szPrefix, _T("[%d] "), jobOutput.nJob );
+        S = szPrefix;
+        S += jobOutput.sText;
+        switch ( jobOutput.nType )
+        {
+            case pjoOutput:
+                Console.PrintOutput( S.c_str() );
+                break;
+            case pjoMessage:
+                Console.PrintMessage( S.c_str(), false );
+                break;
+            case pjoInternalMessage:
+                Console.PrintMessage( S.c_str() );
+                break;
+            case pjoError:
+                Console.PrintError( S.c_str() );
                 break;
         }
     }
+}
 
-    Runtime::GetLogger().Add(   _T("; calling SendMessage ...") );
+DWORD WINAPI CScriptEngine::ParallelJobThreadProc(LPVOID lpParam)
+{
+    tParallelJob* pJob = (tParallelJob *) lpParam;
 
-    LRESULT lResult = ::SendMessage( hWnd, uMsg, wParam, lParam );
+    // Note: Create() does not return until the child process exits
+    pJob->isCreated = pJob->pChildProcess->Create(NULL, pJob->sCmdLine.c_str());
+    pJob->pScriptEngine->m_eventParallelJobOutput.Set(); // wakes up DoParallel()
 
-    Runtime::GetLogger().Add(   _T("; ... SendMessage has been called") );
+    return 0;
+}
 
-    for ( int n = 0; n < 2; n++ )
+CScriptEngine::eCmdResult CScriptEngine::DoParallel(const tstr& params)
+{
+    reportCmdAndParams( DoParallelCommand::Name(), params, fMessageToConsole );
+
+    ScriptContext& currentScript = m_execState.GetCurrentScriptContext();
+    tParallelJumps::const_iterator itrJoin = currentScript.ParallelJumpToJoin.find(m_execState.pScriptLineCurrent);
+    if ( itrJoin == currentScript.ParallelJumpToJoin.end() )
     {
-        if ( paramType[n] == PT_STR || paramType[n] == PT_HEXSTR )
+        ScriptError( ET_UNPREDICTABLE, _T("- PARALLEL found without its JOIN.") );
+        return CMDRESULT_FAILED;
+    }
+
+    // the lines up to JOIN are never executed one by one
+    CListItemT<tstr>* pJoin = itrJoin->second;
+    m_execState.SetScriptLineNext(pJoin);
+
+    int nMaxJobs = m_pNppExec->GetOptions().GetInt(OPTI_CHILDP_MAXPARALLEL);
+    if ( !params.IsEmpty() )
+    {
+        if ( (params[0] < _T('1')) || (params[0] > _T('9')) )
         {
-            if ( pSciParam[n] )
+            tstr Err = _T("- positive integer expected: ");
+            Err += params;
+            ScriptError( ET_REPORT, Err.c_str() );
+            return CMDRESULT_INVALIDPARAM;
+        }
+        nMaxJobs = c_base::_tstr2int(params.c_str());
+    }
+    if ( nMaxJobs <= 0 )
+    {
+        SYSTEM_INFO si;
+        ::GetSystemInfo(&si);
+        nMaxJobs = static_cast<int>(si.dwNumberOfProcessors);
+    }
+
+    // the command lines are completed here, in the script's thread;
+    // the vars of the Console filters are substituted by SetParallelJob()
+    // below, also in the script's thread, so the jobs' threads do not
+    // access the macro-vars
+    std::vector<tParallelJob> Jobs;
+    tstr Cmd;
+    for ( CListItemT<tstr>* p = m_execState.pScriptLineCurrent->GetNext(); p != pJoin; p = p->GetNext() )
+    {
+        Cmd = p->GetItem();
+        const eCmdType nCmdType = modifyCommandLine(this, Cmd, IF_NONE, p);
+        if ( nCmdType == CMDTYPE_COMMENT_OR_EMPTY )
+            continue;
+
+        if ( (nCmdType != CMDTYPE_UNKNOWN) || Cmd.IsEmpty() )
+        {
+            tstr Err = _T("- only child processes can be started between PARALLEL and JOIN: ");
+            Err += p->GetItem();
+            ScriptError( ET_REPORT, Err.c_str() );
+            return CMDRESULT_FAILED;
+        }
+
+        Jobs.push_back( tParallelJob() );
+        tParallelJob& job = Jobs.back();
+        job.sCmdLine = Cmd;
+        job.pScriptEngine = this;
+        job.hThread = NULL;
+        job.isCreated = false;
+    }
+
+    Runtime::GetLogger().AddEx( _T("; PARALLEL: %d job(s), at most %d at once"), static_cast<int>(Jobs.size()), nMaxJobs );
+
+    if ( m_eventParallelJobOutput.IsNull() )
+        m_eventParallelJobOutput.Create(NULL, FALSE, FALSE, NULL); // auto reset, non-signaled
+
+    // Jobs is not modified below, so each thread's pointer to its job stays valid
+    const DWORD dwCycleTimeOut = m_pNppExec->GetOptions().GetUint(OPTU_CHILDP_CYCLETIMEOUT_MS);
+    size_t nNextJob = 0;
+    int    nRunningJobs = 0;
+    bool   isAborting = false;
+    for ( ; ; )
+    {
+        while ( !isAborting && (nNextJob < Jobs.size()) && (nRunningJobs < nMaxJobs) )
+        {
+            tParallelJob& job = Jobs[nNextJob++];
+            const int nJob = static_cast<int>(nNextJob); // 1-based
+            job.pChildProcess.reset( new CChildProcess(this) );
+            job.pChildProcess->SetParallelJob(nJob);
             {
-                #ifdef UNICODE
-                    delete [] pSciParam[n];
-                #else
-                    if ( pSciParam[n] != paramValue[n].c_str() )
-                        delete [] pSciParam[n];
-                #endif
+                CCriticalSectionLockGuard lock(m_csParallelJobs);
+                m_ParallelChildProcesses.push_back(job.pChildProcess);
+            }
 
-                pSciParam[n] = NULL;
+            AddParallelJobOutput( nJob, pjoInternalMessage, job.sCmdLine.c_str() );
+            if ( NppExecHelpers::CreateNewThread(ParallelJobThreadProc, &job, &job.hThread) )
+            {
+                ++nRunningJobs;
             }
-            if ( pParam[n] )
+            else
             {
-                delete [] pParam[n];
-                pParam[n] = NULL;
+                job.hThread = NULL;
+                AddParallelJobOutput( nJob, pjoError, _T("- can not start a new thread") );
+            }
+        }
+
+        printParallelJobOutput();
+
+        if ( (nRunningJobs == 0) && (isAborting || (nNextJob == Jobs.size())) )
+            break;
+
+        m_eventParallelJobOutput.Wait(dwCycleTimeOut);
+
+        if ( !isAborting && (IsAborted() || !ContinueExecution()) )
+        {
+            // all the running jobs are stopped at once, the rest are not started
+            isAborting = true;
+            ParallelJobsMustBreak(CProcessKiller::killCtrlBreak);
+        }
+
+        for ( tParallelJob& job : Jobs )
+        {
+            if ( (job.hThread != NULL) && (::WaitForSingleObject(job.hThread, 0) == WAIT_OBJECT_0) )
+            {
+                ::CloseHandle(job.hThread);
+                job.hThread = NULL;
+                --nRunningJobs;
             }
         }
     }
 
-    int  i;
+    {
+        CCriticalSectionLockGuard lock(m_csParallelJobs);
+        m_ParallelChildProcesses.clear();
+    }
+
+    // $(EXITCODE[n]) and $(OUTPUT[n]) of each job;
+    // $(EXITCODE) is the first non-zero exit code, if any
+    const bool bOutputVar = m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_SETOUTPUTVAR);
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nExitCode = 0;
+    TCHAR szNum[50];
+    TCHAR szExitCode[50];
     tstr varName;
-    tstr varValue;
-    
-    for ( int n = 0; n < 2; n++ )
+
+    for ( size_t i = 0; i < Jobs.size(); ++i )
     {
-        varName = (n == 0) ? MACRO_MSG_WPARAM : MACRO_MSG_LPARAM;
+        tParallelJob& job = Jobs[i];
+        const int nJobExitCode = job.pChildProcess ? job.pChildProcess->GetExitCode() : -1;
+        if ( !job.isCreated )
+            nCmdResult = CMDRESULT_FAILED;
+        if ( (nJobExitCode != 0) && (nExitCode == 0) )
+            nExitCode = nJobExitCode;
 
-        switch ( paramType[n] )
+        c_base::_tint2str( static_cast<int>(i + 1), szNum );
+        c_base::_tint2str( nJobExitCode, szExitCode );
+        varName = _T("$(EXITCODE[");
+        varName += szNum;
+        varName += _T("])");
+        m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, szExitCode, CNppExecMacroVars::svLocalVar ); // local var
+
+        if ( bOutputVar && job.pChildProcess )
         {
-            case PT_PINT:
-                szNum[0] = 0;
-              #ifdef _WIN64
-                c_base::_tint64_to_str( static_cast<INT_PTR>(uiParam[n]), szNum );
-              #else
-                c_base::_tint2str( static_cast<INT_PTR>(uiParam[n]), szNum );
-              #endif
-                varValue = szNum;
-                m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
-                break;
+            tstr& OutputVar = job.pChildProcess->GetOutput();
+            if ( OutputVar.GetLastChar() == _T('\n') )
+                OutputVar.SetSize(OutputVar.length() - 1);
+            if ( OutputVar.GetFirstChar() == _T('\n') )
+                OutputVar.Delete(0, 1);
 
-            case PT_PSTR:
-                if ( cmdType == CMDTYPE_SCISENDMSG )
-                {
-                    TCHAR* pp = SciTextToLPTSTR(pSciParam[n], hWnd);
-                    varValue = pp;
-                    SciTextDeleteResultPtr(pp, pSciParam[n]);
-                    delete [] pSciParam[n];
-                    pSciParam[n] = NULL;
-                }
-                else
-                {
-                    varValue = pParam[n];
-                    delete [] pParam[n];
-                    pParam[n] = NULL;
-                }
-                for ( i = varValue.length() - 1; i >= 0; i-- )
-                {
-                    const TCHAR ch = varValue[i];
-                    if ( ch == _T('\r') || ch == _T('\n') )
-                        varValue.Delete(i, 1); // exclude trailing '\r' or '\n'
-                    else
-                        break;
-                }
-                m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
-                break;
+            varName = _T("$(OUTPUT[");
+            varName += szNum;
+            varName += _T("])");
+            m_pNppExec->GetMacroVars().MoveToUserMacroVar( this, varName, OutputVar, CNppExecMacroVars::svLocalVar ); // local var
+        }
+    }
 
-            case PT_PHEXSTR:
-                varValue = _T("[ ");
-                {
-                    const int nBytesInLine = 16;
-                    const int nBytesToShow = 256;
-                    c_base::byte_t* pHexBuf;
-                    c_base::byte_t* p;
-                    TCHAR szBytesLine[3*nBytesInLine + 2];
+    c_base::_tint2str( nExitCode, szExitCode );
+    varName = MACRO_EXITCODE;
+    m_pNppExec->GetMacroVars().SetUserMacroVar( this, varName, szExitCode, CNppExecMacroVars::svLocalVar ); // local var
 
-                    if ( cmdType == CMDTYPE_SCISENDMSG )
-                        pHexBuf = (c_base::byte_t *) pSciParam[n];
-                    else
-                        pHexBuf = (c_base::byte_t *) pParam[n];
+    return nCmdResult;
+}
 
-                    p = pHexBuf;
-                    while ( p < pHexBuf + nBytesToShow )
-                    {
-                        if ( p != pHexBuf )  varValue += _T_RE_EOL _T("  ");
-                        c_base::_tbuf2hexstr(p, nBytesInLine, szBytesLine, 3*nBytesInLine + 2, _T(" "));
-                        varValue += szBytesLine;
-                        p += nBytesInLine;
-                    }
+CScriptEngine::eCmdResult CScriptEngine::DoProcSignal(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoProcSignalCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-                    delete [] pHexBuf;
-                    if ( cmdType == CMDTYPE_SCISENDMSG )
-                        pSciParam[n] = NULL;
-                    else
-                        pParam[n] = NULL;
-                }
-                varValue += _T(" ]");
-                m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
-                break;
+    if ( !m_pNppExec->GetCommandExecutor().IsChildProcessRunning() )
+    {
+        ScriptError( ET_REPORT, _T("- child console process is not running") );
+        return CMDRESULT_FAILED;
+    }
 
-            default:
-                varValue.Clear();
-                m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
-                break;
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    const int nMaxKillMethods = 8;
+    int nKillMethods = 0;
+    CProcessKiller::eKillMethod arrKillMethods[nMaxKillMethods];
+    CProcessKiller::eKillMethod nSignal;
+    unsigned int nWaitTimeout = 50; // just a _small_ hard-coded timeout; meaningful value to be specified as the PROC_SIGNAL argument
+    tstr arg;
+    tstr unknown_args;
+    CStrSplitT<TCHAR> args;
+    const int n = args.SplitToArgs(params);
+    for ( int i = 0; i < n && nKillMethods < nMaxKillMethods; i++ )
+    {
+        nSignal = CProcessKiller::killNone;
+        arg = args.GetArg(i);
+        NppExecHelpers::StrUpper(arg);
+
+        if ( arg == _T("CTRLBREAK") || arg == _T("CTRL-BREAK") || arg == _T("CTRL+BREAK") )
+            nSignal = CProcessKiller::killCtrlBreak;
+        else if ( arg == _T("CTRLC") || arg == _T("CTRL-C") || arg == _T("CTRL+C") )
+            nSignal = CProcessKiller::killCtrlC;
+        else if ( arg == _T("WMCLOSE") || arg == _T("WM_CLOSE") )
+            nSignal = CProcessKiller::killWmClose;
+        else if ( c_base::_tis_dec_value(arg.c_str()) )
+            nWaitTimeout = c_base::_tstr2uint(arg.c_str());
+        else
+        {
+            if ( !unknown_args.IsEmpty() )
+                unknown_args += _T(", ");
+            unknown_args += arg;
+        }
+
+        if ( nSignal != CProcessKiller::killNone )
+            arrKillMethods[nKillMethods++] = nSignal;
+    }
+
+    if ( !unknown_args.IsEmpty() )
+    {
+        unknown_args.Insert( 0, _T("- unknown PROC_SIGNAL parameter(s): ") );
+        ScriptError( ET_REPORT, unknown_args.c_str() );
+        nCmdResult = CMDRESULT_INVALIDPARAM;
+    }
+
+    if ( nKillMethods == 0 )
+    {
+        const TCHAR* const cszErr = _T("- no kill method recognized");
+        if ( !unknown_args.IsEmpty() )
+            m_pNppExec->GetConsole().PrintError( cszErr );
+        else
+            ScriptError( ET_REPORT, cszErr );
+        return CMDRESULT_INVALIDPARAM;
+    }
+
+    std::shared_ptr<CChildProcess> pChildProc = GetRunningChildProcess();
+    if ( pChildProc )
+    {
+        if ( pChildProc->Kill(arrKillMethods, nKillMethods, nWaitTimeout, &nSignal) )
+            return CMDRESULT_FAILED;
+    }
+
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoSleep(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoSleepCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    CStrSplitT<TCHAR> args;
+    const int n = args.SplitToArgs(params, 2);
+
+    if ( n == 2 )
+    {
+        tstr Text = args.GetArg(1);
+        NppExecHelpers::StrUnquote(Text);
+        if ( !Text.IsEmpty() )
+        {
+            m_pNppExec->GetConsole().PrintMessage( Text.c_str(), false );
         }
     }
-
-    varName = MACRO_MSG_RESULT;
-    szNum[0] = 0;
-  #ifdef _WIN64
-    c_base::_tint64_to_str( static_cast<INT_PTR>(lResult), szNum );
-  #else
-    c_base::_tint2str( static_cast<INT_PTR>(lResult), szNum );
-  #endif
-    varValue = szNum;
-    m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+
+    const TCHAR* pszMilliseconds = args.GetArg(0).c_str();
+    if ( (pszMilliseconds[0] < _T('0')) || (pszMilliseconds[0] > _T('9')) )
+    {
+        tstr Err = _T("- positive integer expected: ");
+        Err += pszMilliseconds;
+        ScriptError( ET_REPORT, Err.c_str() );
+        return CMDRESULT_INVALIDPARAM;
+    }
+    
+    unsigned int nMilliseconds = c_base::_tstr2uint(pszMilliseconds);
+    m_eventAbortTheScript.Wait(nMilliseconds);
 
     return CMDRESULT_SUCCEEDED;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::doSciFindReplace(const tstr& params, eCmdType cmdType)
+CScriptEngine::eCmdResult CScriptEngine::doTextLoad(const tstr& params, eCmdType cmdType)
 {
+    bool bSelectionOnly = (cmdType == CMDTYPE_SELLOADFROM);
     if ( !reportCmdAndParams( GetCommandRegistry().GetCmdNameByType(cmdType), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
         return CMDRESULT_INVALIDPARAM;
 
-    // 1. Preparing the arguments...
-    const CStrSplitT<TCHAR> cmdArgs;
-    CStrSplitT<TCHAR> args;
-    const int nArgs = args.SplitToArgs(params, (cmdType == CMDTYPE_SCIFIND) ? 2 : 3);
-    if ( nArgs < 2 )
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nBytes = m_pNppExec->textLoadFrom(params.c_str(), bSelectionOnly);
+    if ( nBytes < 0 )
     {
-        TCHAR szErr[64];
-        wsprintf(szErr, _T("not enough parameters: %s expected, %d given"), (cmdType == CMDTYPE_SCIFIND) ? _T("2") : _T("at least 2"), nArgs );
-        errorCmdNotEnoughParams( GetCommandRegistry().GetCmdNameByType(cmdType), szErr );
-        return CMDRESULT_INVALIDPARAM;
+        ScriptError( ET_REPORT, _T("- can not open the file") );
+        nCmdResult = CMDRESULT_FAILED;
     }
 
-    for ( int i = 0; i < nArgs; i++ )
-    {
-        tstr& val = args.Arg(i);
-        NppExecHelpers::StrUnquote(val);
-        m_pNppExec->GetMacroVars().CheckCmdArgs(val, cmdArgs);
-        m_pNppExec->GetMacroVars().CheckAllMacroVars(this, val, true);
-    }
+    return nCmdResult;
+}
 
-    // 2. Search flags...
-    tstr sFlags = args.Arg(0);
-    NppExecHelpers::StrUnquote(sFlags);
-    CNppExecMacroVars::StrCalc(sFlags, m_pNppExec).Process();
-    HWND hSci = m_pNppExec->GetScintillaHandle();
-    unsigned int nSearchFlags = 0;
-    unsigned int nFlags = c_base::_tstr2uint(sFlags.c_str());
-    if ( nFlags & NPE_SF_MATCHCASE )
-        nSearchFlags |= SCFIND_MATCHCASE;
-    if ( nFlags & NPE_SF_WHOLEWORD )
-        nSearchFlags |= SCFIND_WHOLEWORD;
-    if ( nFlags & NPE_SF_WORDSTART )
-        nSearchFlags |= SCFIND_WORDSTART;
-    if ( nFlags & NPE_SF_REGEXP )
-        nSearchFlags |= SCFIND_REGEXP;
-    if ( nFlags & NPE_SF_POSIX )
-        nSearchFlags |= SCFIND_POSIX;
-    if ( nFlags & NPE_SF_CXX11REGEX )
-        nSearchFlags |= SCFIND_CXX11REGEX;
-    ::SendMessage(hSci, SCI_SETSEARCHFLAGS, nSearchFlags, 0);
+CScriptEngine::eCmdResult CScriptEngine::doTextSave(const tstr& params, eCmdType cmdType)
+{
+    bool bSelectionOnly = (cmdType == CMDTYPE_SELSAVETO);
+    if ( !reportCmdAndParams( GetCommandRegistry().GetCmdNameByType(cmdType), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
+        return CMDRESULT_INVALIDPARAM;
 
-    // 3. Search range...
-    INT_PTR nSelStart = (INT_PTR) ::SendMessage(hSci, SCI_GETSELECTIONSTART, 0, 0);
-    INT_PTR nSelEnd = (INT_PTR) ::SendMessage(hSci, SCI_GETSELECTIONEND, 0, 0);
-    const bool bNoSelection = (nSelStart == nSelEnd);
-    const bool bReplacingAll = ((nFlags & NPE_SF_REPLACEALL) && (cmdType == CMDTYPE_SCIREPLACE));
-    INT_PTR nTextLength = (INT_PTR) ::SendMessage(hSci, SCI_GETTEXTLENGTH, 0, 0);
-    INT_PTR nRangeStart = -1, nRangeEnd = -1;
-    if ( (nFlags & NPE_SF_PRINTALL) || bReplacingAll )
+    tstr  S;
+    TCHAR szCmdLine[FILEPATH_BUFSIZE + 20];
+    lstrcpy(szCmdLine, params.c_str());
+
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    int nBytes = m_pNppExec->textSaveTo(szCmdLine, bSelectionOnly);
+    if ( nBytes >= 0 )
+        S.Format(60, _T("- OK, %d bytes have been written to \""), nBytes);
+    else
+        S = _T("- failed to write to \"");
+    S += (szCmdLine[0] == _T('\"')) ? (szCmdLine + 1) : szCmdLine;
+    S += _T("\"");
+    if ( nBytes >= 0 )
     {
-        if ( nFlags & NPE_SF_INWHOLETEXT )
-        {
-            // in the whole text
-            nRangeStart = 0;
-            nRangeEnd = nTextLength;
-        }
-        else if ( nFlags & NPE_SF_INSELECTION )
-        {
-            // only in the selected text
-            nRangeStart = nSelStart;
-            nRangeEnd = nSelEnd;
-        }
-        else
-        {
-            if ( nFlags & NPE_SF_BACKWARD )
-            {
-                nRangeStart = 0;
-                nRangeEnd = nSelStart;
-            }
-            else
-            {
-                nRangeStart = nSelEnd;
-                nRangeEnd = nTextLength;
-            }
-        }
+        m_pNppExec->GetConsole().PrintMessage( S.c_str() );
     }
-    else if ( nFlags & NPE_SF_INSELECTION )
+    else
     {
-        nRangeStart = nSelStart;
-        nRangeEnd = nSelEnd;
+        if ( nBytes == -2 )
+            S += _T(" (text length exceeds 2 GB)");
+        ScriptError( ET_REPORT, S.c_str() );
+        nCmdResult = CMDRESULT_FAILED;
     }
-    else
+
+    return nCmdResult;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoSelLoadFrom(const tstr& params)
+{
+    return doTextLoad(params, CMDTYPE_SELLOADFROM);
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoSelSaveTo(const tstr& params)
+{
+    return doTextSave(params, CMDTYPE_SELSAVETO);
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoSelSetText(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoSelSetTextCommand::Name(), params, fMessageToConsole ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    m_pNppExec->textSetText( params.c_str(), true );
+
+    return CMDRESULT_SUCCEEDED;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoSelSetTextEx(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoSelSetTextExCommand::Name(), params, fMessageToConsole ) )
+        return CMDRESULT_INVALIDPARAM;
+
+    int  pos = params.Find( _T('\\') );
+    if ( pos >= 0 )
     {
-        if ( nFlags & NPE_SF_BACKWARD )
-        {
-            nRangeStart = 0;
-            nRangeEnd = nSelStart;
-            // in case of NPE_SF_NEXT, no need to adjust nRangeEnd here
-        }
-        else
+        tstr S = params;
+        while ( pos < S.length() )
         {
-            nRangeStart = nSelEnd;
-            if ( ((nFlags & NPE_SF_NEXT) != 0) &&
-                 bNoSelection && (nRangeStart != nTextLength) )
+            if ( S[pos] == _T('\\') )
             {
-                nRangeStart = (INT_PTR) ::SendMessage(hSci, SCI_POSITIONRELATIVE, (WPARAM) nRangeStart, (LPARAM) (1));
-                // Note: just ++nRangeStart will not work for UTF-8
+                switch ( S.GetAt(pos + 1) )
+                {
+                    case _T('n'):
+                        S[pos] = _T('\n');
+                        S.Delete(pos + 1, 1);
+                        break;
+                    case _T('r'):
+                        S[pos] = _T('\r');
+                        S.Delete(pos + 1, 1);
+                        break;
+                    case _T('t'):
+                        S[pos] = _T('\t');
+                        S.Delete(pos + 1, 1);
+                        break;
+                    case _T('\\'):
+                        S.Delete(pos + 1, 1);
+                        break;
+                }
             }
-            nRangeEnd = nTextLength;
+            ++pos;
         }
+        m_pNppExec->textSetText( S.c_str(), true );
     }
+    else
+        m_pNppExec->textSetText( params.c_str(), true );
 
-    // 4. Strings to find & replace...
-    int nFindStrLen = 0;
-    char* pFindStr = SciTextFromLPCTSTR(args.GetArg(1).c_str(), hSci, &nFindStrLen);
+    return CMDRESULT_SUCCEEDED;
+}
 
-    if ( nFindStrLen == 0 )
-    {
-        ScriptError( ET_REPORT, _T("- can not search for an empty string") );
+CScriptEngine::eCmdResult CScriptEngine::DoTextLoadFrom(const tstr& params)
+{
+    return doTextLoad(params, CMDTYPE_TEXTLOADFROM);
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoTextSaveTo(const tstr& params)
+{
+    return doTextSave(params, CMDTYPE_TEXTSAVETO);
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoClipSetText(const tstr& params)
+{
+    if ( !reportCmdAndParams( DoClipSetTextCommand::Name(), params, fMessageToConsole ) )
         return CMDRESULT_INVALIDPARAM;
+
+    HWND hWndOwner = m_pNppExec->m_nppData._nppHandle;
+    return NppExecHelpers::SetClipboardText(params, hWndOwner) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
+}
+
+CScriptEngine::eCmdResult CScriptEngine::DoSet(const tstr& params)
+{
+    reportCmdAndParams( DoSetCommand::Name(), params, fMessageToConsole );
+    
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+
+    // sets the value of user's variable
+    tstr CmdParams = params;
+    {
+        CNppExecMacroVars& MacroVars = m_pNppExec->GetMacroVars();
+        const CStrSplitT<TCHAR> args;
+        MacroVars.CheckCmdArgs(CmdParams, args);
+        if ( !MacroVars.CheckAllMacroVars(this, CmdParams, true, CMDTYPE_SET) )
+            nCmdResult = CMDRESULT_FAILED;
     }
 
-    int nReplaceStrLen = 0;
-    char* pReplaceStr = NULL;
-    if ( cmdType == CMDTYPE_SCIREPLACE )
+    bool isInternal = false;
+    bool bLocalVar = false;
+    
+    tstr varName;
+    if ( CmdParams.IsEmpty() )
     {
-        pReplaceStr = SciTextFromLPCTSTR(args.GetArg(2).c_str(), hSci, &nReplaceStrLen);
+          
+        Runtime::GetLogger().Add(   _T("; no arguments given - showing all user\'s variables") );
+
+    }
+    else
+    {
+        varName = CmdParams;
+        int k = varName.Find( _T("=") );
+        if ( k >= 0 )  
+        {
+            varName.SetSize(k);
+            isInternal = true;
+        }
+        NppExecHelpers::StrDelLeadingTabSpaces(varName);
+        NppExecHelpers::StrDelTrailingTabSpaces(varName);
+        bLocalVar = m_pNppExec->GetMacroVars().IsLocalMacroVar(varName);
+        if ( varName.length() > 0 )
+        {
+            if ( varName.StartsWith(_T("$(")) == false )
+                varName.Insert(0, _T("$("));
+            if ( varName.GetLastChar() != _T(')') )
+                varName.Append(_T(')'));
+            NppExecHelpers::StrUpper(varName);
+        }
     }
 
-    INT_PTR nFindStrLenOut = nFindStrLen;
-    INT_PTR nReplaceStrLenOut = nReplaceStrLen;
-    
-    // 5. Searching...
-    INT_PTR nPos = -1;
-    if ( (nFlags & NPE_SF_PRINTALL) || bReplacingAll )
     {
-        tstr S;
-        unsigned int nOccurrences = 0;
-
-        if ( bReplacingAll )
-            ::SendMessage(hSci, SCI_BEGINUNDOACTION, 0, 0);
+        CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
+        const CNppExecMacroVars::tMacroVars& userLocalMacroVars = m_pNppExec->GetMacroVars().GetUserLocalMacroVars(this);
+        const CNppExecMacroVars::tMacroVars& userMacroVars = m_pNppExec->GetMacroVars().GetUserMacroVars();
+        const CNppExecMacroVars::tMacroVars& namedMacroVars = bLocalVar ? userLocalMacroVars : userMacroVars;
 
-        for ( ; ; )
+        if ( !varName.IsEmpty() &&
+             namedMacroVars.find(varName) == namedMacroVars.end() &&
+             printMacroVarItems(m_pNppExec, this, varName, isInternal) )
         {
-            if ( nFlags & NPE_SF_BACKWARD )
-                ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeEnd, nRangeStart);
-            else
-                ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeStart, nRangeEnd);
-
-            INT_PTR pos = (INT_PTR) ::SendMessage( hSci, SCI_SEARCHINTARGET, (WPARAM) nFindStrLen, (LPARAM) (pFindStr ? pFindStr : "") );
-            if ( pos < 0 )
-                break;
-
-            nPos = pos;
-
-            pos = (INT_PTR) ::SendMessage(hSci, SCI_GETTARGETEND, 0, 0);
-            nFindStrLenOut = pos - nPos;
-
-            ++nOccurrences;
-
-            bool isReplacing = (bReplacingAll || ((cmdType == CMDTYPE_SCIREPLACE) && (nOccurrences == 1)));
-            if ( isReplacing )
+            // an array or its item
+        }
+        else if ( userLocalMacroVars.empty() && bLocalVar )
+        {
+            m_pNppExec->GetConsole().PrintMessage( _T("- no user-defined local variables"), false );
+            nCmdResult = CMDRESULT_FAILED;
+        }
+        else if ( userLocalMacroVars.empty() && userMacroVars.empty() )
+        {
+            m_pNppExec->GetConsole().PrintMessage( _T("- no user-defined variables"), false );
+            nCmdResult = CMDRESULT_FAILED;
+        }
+        else
+        {
+            if ( varName.IsEmpty() )
             {
-                if ( nFlags & (NPE_SF_REGEXP | NPE_SF_POSIX | NPE_SF_CXX11REGEX) )
-                {
-                    nReplaceStrLenOut = (INT_PTR) ::SendMessage( hSci, SCI_REPLACETARGETRE, (WPARAM) nReplaceStrLen, (LPARAM) (pReplaceStr ? pReplaceStr : "") );
-                }
-                else
-                {
-                    nReplaceStrLenOut = (INT_PTR) ::SendMessage( hSci, SCI_REPLACETARGET, (WPARAM) nReplaceStrLen, (LPARAM) (pReplaceStr ? pReplaceStr : "") );
-                }
-
-                if ( nFlags & NPE_SF_BACKWARD )
+                if ( bLocalVar )
                 {
-                    nRangeEnd = nPos;
+                    PrintMacroVarFunc func(m_pNppExec);
+                    std::vector<PrintMacroVarFunc::item_type> sortedVars;
+                    userLocalMacroVars.GetSortedItems(sortedVars);
+                    for ( PrintMacroVarFunc::item_type pVar : sortedVars )
+                    {
+                        func(pVar, true);
+                    }
                 }
                 else
-                {
-                    nRangeStart = nPos + nReplaceStrLenOut;
-                    nRangeEnd += (nReplaceStrLenOut - nFindStrLenOut);
-                }
-
-                if ( nPos + nFindStrLen <= nSelEnd )
-                {
-                    // each replacement affects the selection range
-                    nSelEnd += (nReplaceStrLenOut - nFindStrLenOut);
-                    if ( bNoSelection )
-                        nSelStart = nSelEnd;
-                }
+                    IterateUserMacroVars<PrintMacroVarFunc>(userMacroVars, userLocalMacroVars, PrintMacroVarFunc(m_pNppExec));
             }
             else
             {
-                if ( nFlags & NPE_SF_BACKWARD )
-                {
-                    nRangeEnd = nPos;
-                }
-                else
-                {
-                    nRangeStart = nPos + nFindStrLenOut;
-                }
-            }
-
-            if ( nFlags & NPE_SF_PRINTALL )
-            {
-                const int MAX_STR_TO_SHOW = 128;
-                const int UTF8_MAX_BYTES_PER_CHAR = 4;
-                INT_PTR nLine = (INT_PTR) ::SendMessage(hSci, SCI_LINEFROMPOSITION, (WPARAM) nPos, 0);
-                INT_PTR nLinePos = (INT_PTR) ::SendMessage(hSci, SCI_POSITIONFROMLINE, (WPARAM) nLine, 0);
-                INT_PTR nLen = isReplacing ? nReplaceStrLenOut : nFindStrLenOut;
-                int     nLenToShow = static_cast<int>(nLen);
-                bool    isUtf8 = (::SendMessage(hSci, SCI_GETCODEPAGE, 0, 0) == SC_CP_UTF8);
-                bool    isLenTruncated = false;
-                if ( isUtf8 )
+                const CNppExecMacroVars::tMacroVars& macroVars = bLocalVar ? userLocalMacroVars : userMacroVars;
+                CNppExecMacroVars::tMacroVars::const_iterator itrVar = macroVars.find(varName);
+                if ( itrVar != macroVars.end() )
                 {
-                    if ( nLen > (MAX_STR_TO_SHOW*UTF8_MAX_BYTES_PER_CHAR) )
+                    tstr S = bLocalVar ? _T("local ") : _T("");
+                    S += itrVar->first;
+                    S += _T(" = ");
+                    if ( itrVar->second.length() > MAX_VAR_LENGTH2SHOW )
                     {
-                        nLen = MAX_STR_TO_SHOW*UTF8_MAX_BYTES_PER_CHAR - 5; // number of chars, plus "(...)" will be added
-                        nLenToShow = MAX_STR_TO_SHOW - 5; // number of TCHARs
-                        isLenTruncated = true;
+                        S.Append( itrVar->second.c_str(), MAX_VAR_LENGTH2SHOW - 5 );
+                        S += _T("(...)");
                     }
                     else
-                        nLenToShow = MAX_STR_TO_SHOW; // will be adjusted later
-                }
-                else
-                {
-                    if ( nLen > MAX_STR_TO_SHOW )
                     {
-                        nLen = MAX_STR_TO_SHOW - 5; // number of chars, plus "(...)" will be added
-                        nLenToShow = MAX_STR_TO_SHOW - 5; // number of TCHARs
-                        isLenTruncated = true;
+                        S += itrVar->second;
                     }
+                    m_pNppExec->GetConsole().PrintMessage( S.c_str(), isInternal );
                 }
-                Sci_TextRange tr;
-                tr.chrg.cpMin = nPos;        // I believe Sci_CharacterRange will use INT_PTR
-                tr.chrg.cpMax = nPos + nLen; // or UINT_PTR to deal with 64-bit ranges
-                S.Reserve(50 + static_cast<int>(nLen)); // enough for both char* and TCHAR* buffer
-                tr.lpstrText = (char *) S.c_str(); // temporary using S as a char* buffer
-                ::SendMessage(hSci, SCI_GETTEXTRANGE, 0, (LPARAM) &tr);
-                TCHAR* pText = SciTextToLPTSTR(tr.lpstrText, hSci); // now we have the text as TCHAR*
-                INT_PTR nCharPos = ::SendMessage(hSci, SCI_COUNTCHARACTERS, nLinePos, nPos);
-                // Note: nCharPos can't be just (nPos - nLinePos) because it will not work for UTF-8
-                // where each character occupies up to several bytes in Scintilla's buffer
-                if ( isUtf8 )
+                else
                 {
-                    int n = pText ? lstrlen(pText) : 0;
-                    if ( n > nLenToShow )
-                    {
-                        if ( !isLenTruncated )
-                        {
-                            isLenTruncated = true;
-                            nLenToShow = MAX_STR_TO_SHOW - 5;
-                        }
-                        pText[nLenToShow] = 0;
-                    }
+                    tstr t = _T("- no such user\'s ");
+                    if ( bLocalVar ) t += _T("local ");
+                    t += _T("variable: ");
+                    t += varName;
+                    m_pNppExec->GetConsole().PrintMessage( t.c_str(), false );
+                    nCmdResult = CMDRESULT_FAILED;
                 }
-                nLen = _t_sprintf( S.c_str(), // now using S as a TCHAR* buffer
-                                 #ifdef _WIN64
-                                   _T("(%I64d,%I64d)\t %s%s"), 
-                                 #else
-                                   _T("(%d,%d)\t %s%s"), 
-                                 #endif
-                                   nLine + 1, 
-                                   nCharPos + 1, 
-                                   pText ? pText : _T("(empty)"), 
-                                   isLenTruncated ? _T("(...)") : _T("")
-                                 );
-                SciTextDeleteResultPtr(pText, tr.lpstrText);
-                S.SetLengthValue(static_cast<int>(nLen));
-                m_pNppExec->GetConsole().PrintOutput(S.c_str());
             }
         }
-
-        if ( bReplacingAll )
-            ::SendMessage(hSci, SCI_ENDUNDOACTION, 0, 0);
-
-        S.Format(50, _T("- %u occurrences %s."), nOccurrences, bReplacingAll ? _T("replaced") : _T("found"));
-        m_pNppExec->GetConsole().PrintMessage(S.c_str(), (nFlags & NPE_SF_PRINTALL) == 0);
     }
-    else
-    {
-        if ( nFlags & NPE_SF_BACKWARD )
-            ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeEnd, nRangeStart);
-        else
-            ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeStart, nRangeEnd);
 
-        nPos = (INT_PTR) ::SendMessage( hSci, SCI_SEARCHINTARGET, (WPARAM) nFindStrLen, (LPARAM) (pFindStr ? pFindStr : "") );
-        if ( (nPos < 0) && (nFlags & NPE_SF_INWHOLETEXT) )
-        {
-            // search again - in the rest of the document...
-            if ( nFlags & NPE_SF_INSELECTION )
-            {
-                nRangeStart = 0;
-                nRangeEnd = nTextLength;
-            }
-            else
-            {
-                if ( nFlags & NPE_SF_BACKWARD )
-                {
-                    nRangeStart = nSelStart - nFindStrLen;
-                    if ( nRangeStart < 0 )
-                        nRangeStart = 0;
-                    nRangeEnd = nTextLength;
-                }
-                else
-                {
-                    nRangeStart = 0;
-                    nRangeEnd = nSelEnd + nFindStrLen;
-                    if ( nRangeEnd > nTextLength )
-                        nRangeEnd = nTextLength;
-                }
-            }
+    return nCmdResult;
+}
 
-            if ( nFlags & NPE_SF_BACKWARD )
-                ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeEnd, nRangeStart);
-            else
-                ::SendMessage(hSci, SCI_SETTARGETRANGE, nRangeStart, nRangeEnd);
-            
-            nPos = (INT_PTR) ::SendMessage( hSci, SCI_SEARCHINTARGET, (WPARAM) nFindStrLen, (LPARAM) (pFindStr ? pFindStr : "") );
-        }
+CScriptEngine::eCmdResult CScriptEngine::DoUnset(const tstr& params)
+{
+    reportCmdAndParams( DoUnsetCommand::Name(), params, fMessageToConsole );
 
-        if ( nPos >= 0 )
-        {
-            INT_PTR pos = (INT_PTR) ::SendMessage(hSci, SCI_GETTARGETEND, 0, 0);
-            nFindStrLenOut = pos - nPos;
+    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
 
-            if ( cmdType == CMDTYPE_SCIREPLACE )
-            {
-                if ( nFlags & (NPE_SF_REGEXP | NPE_SF_POSIX | NPE_SF_CXX11REGEX) )
-                {
-                    nReplaceStrLenOut = (INT_PTR) ::SendMessage( hSci, SCI_REPLACETARGETRE, (WPARAM) nReplaceStrLen, (LPARAM) (pReplaceStr ? pReplaceStr : "") );
-                }
-                else
-                {
-                    nReplaceStrLenOut = (INT_PTR) ::SendMessage( hSci, SCI_REPLACETARGET, (WPARAM) nReplaceStrLen, (LPARAM) (pReplaceStr ? pReplaceStr : "") );
-                }
-            }
-        }
+    // unsets the user's variable
+    tstr CmdParams = params;
+    {
+        CNppExecMacroVars& MacroVars = m_pNppExec->GetMacroVars();
+        const CStrSplitT<TCHAR> args;
+        MacroVars.CheckCmdArgs(CmdParams, args);
+        if ( !MacroVars.CheckAllMacroVars(this, CmdParams, true, CMDTYPE_UNSET) )
+            nCmdResult = CMDRESULT_FAILED;
+    }
+    
+    if ( CmdParams.IsEmpty() )
+    {
+        errorCmdNoParam(DoUnsetCommand::Name());
+        nCmdResult = CMDRESULT_INVALIDPARAM;
     }
 
-    SciTextDeleteResultPtr(pFindStr, args.GetArg(1).c_str());
-    SciTextDeleteResultPtr(pReplaceStr, args.GetArg(2).c_str());
+    return nCmdResult;
+}
 
-    // 6. Result
+//////////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////////
+
+CNppExecMacroVars::CNppExecMacroVars() : m_pNppExec(0), m_nCmdAliasesVersion(0),
+  m_nUserMacroVarsVersion(1), m_dwUserMacroVarsWriterThreadId(0), m_nUserMacroVarsSnapshotVersion(0),
+  m_nCmdAliasIndexVersion(-1),
+  m_nNppStateVersion(1), m_nNppStateRoundTripsSaved(0)
+{
+    for ( int i = 0; i < nsiCount; ++i )
     {
-        tstr varName;
-        tstr varValue;
-        TCHAR szNum[50];
+        m_NppStateVersions[i] = 0;
+    }
+}
 
-        varName = MACRO_MSG_RESULT;
-        szNum[0] = 0;
-      #ifdef _WIN64
-        c_base::_tint64_to_str(nPos, szNum);
-      #else
-        c_base::_tint2str(nPos, szNum);
-      #endif
-        varValue = szNum;
-        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+CNppExec* CNppExecMacroVars::GetNppExec() const
+{
+    return m_pNppExec;
+}
 
-        if ( ((nFlags & NPE_SF_PRINTALL) == 0) && !bReplacingAll )
+void CNppExecMacroVars::SetNppExec(CNppExec* pNppExec)
+{
+    m_pNppExec = pNppExec;
+}
+
+bool CNppExecMacroVars::IsLocalMacroVar(tstr& varName)
+{
+    bool isLocal = false;
+    int n = varName.Find(_T(' '));
+    if ( n < 0 )
+    {
+        n = varName.Find(_T('\t'));
+        if ( n < 0 )
+            n = varName.length();
+    }
+    if ( n == 5 ) // length of "local"
+    {
+        tstr Prefix;
+        Prefix.Copy( varName.c_str(), n );
+        NppExecHelpers::StrLower(Prefix);
+        if ( Prefix == _T("local") )
         {
-            if ( nPos >= 0 )
-            {
-                tstr S = (cmdType == CMDTYPE_SCIREPLACE) ? _T("- replaced") : _T("- found");
-                S += _T(" at pos ");
-                S += szNum;
-                m_pNppExec->GetConsole().PrintMessage( S.c_str() );
-            }
-            else
-            {
-                m_pNppExec->GetConsole().PrintMessage( _T("- not found") );
-            }
+            isLocal = true;
+            varName.Delete(0, n);
+            NppExecHelpers::StrDelLeadingTabSpaces(varName);
         }
+    }
+    return isLocal;
+}
 
-        varName = MACRO_MSG_WPARAM;
-        szNum[0] = 0;
-      #ifdef _WIN64
-        c_base::_tint64_to_str(nFindStrLenOut, szNum);
-      #else
-        c_base::_tint2str(nFindStrLenOut, szNum);
-      #endif
-        varValue = szNum;
-        m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
+bool CNppExecMacroVars::ContainsMacroVar(const tstr& S)
+{
+    return ( (S.Find(_T("$(")) >= 0) ? true : false );
+}
 
-        varName = MACRO_MSG_LPARAM;
-        if ( cmdType == CMDTYPE_SCIREPLACE )
-        {
-            szNum[0] = 0;
-          #ifdef _WIN64
-            c_base::_tint64_to_str(nReplaceStrLenOut, szNum);
-          #else
-            c_base::_tint2str(nReplaceStrLenOut, szNum);
-          #endif
-            varValue = szNum;
-            m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar); // local var
-        }
-        else
+CNppExecMacroVars::tMacroVarArrays& CNppExecMacroVars::GetUserLocalMacroArrays(CScriptEngine* pScriptEngine)
+{
+    CListItemT<CScriptEngine::ScriptContext>* pScriptContextItemPtr = NULL;
+
+    if ( pScriptEngine != nullptr )
+    {
+        CScriptEngine::ExecState& execState = pScriptEngine->GetExecState();
+        pScriptContextItemPtr = execState.ScriptContextList.GetLast();
+    }
+    else
+    {
+        std::shared_ptr<CScriptEngine> pRunningScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine();
+        if ( pRunningScriptEngine )
         {
-            varValue.Clear();
-            m_pNppExec->GetMacroVars().SetUserMacroVar(this, varName, varValue, CNppExecMacroVars::svLocalVar | CNppExecMacroVars::svRemoveVar); // local var
+            CScriptEngine::ExecState& execState = pRunningScriptEngine->GetExecState();
+            pScriptContextItemPtr = execState.ScriptContextList.GetLast();
         }
     }
 
-    // 7. Set pos/sel
-    if ( nPos >= 0 )
+    if ( pScriptContextItemPtr != NULL )
     {
-        if ( nFlags & NPE_SF_SETSEL )
-        {
-            INT_PTR nEndPos = (cmdType == CMDTYPE_SCIFIND) ? (nPos + nFindStrLenOut) : (nPos + nReplaceStrLenOut);
-            ::SendMessage(hSci, SCI_SETSEL, (WPARAM) nPos, (LPARAM) nEndPos);
-        }
-        else if ( nFlags & NPE_SF_SETPOS )
-        {
-            ::SendMessage(hSci, SCI_GOTOPOS, (WPARAM) nPos, 0);
-        }
-        else if ( cmdType == CMDTYPE_SCIREPLACE )
-        {
-            // adjust the selection after the replacement(s)
-            ::SendMessage(hSci, SCI_SETSEL, (WPARAM) nSelStart, (LPARAM) nSelEnd);
-        }
+        CScriptEngine::ScriptContext& scriptContext = pScriptContextItemPtr->GetItem();
+        return scriptContext.LocalMacroArrays;
     }
 
-    return CMDRESULT_SUCCEEDED;
+    return m_UserLocalMacroArrays0;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoSciFind(const tstr& params)
+CNppExecMacroVars::tMacroVarArrays& CNppExecMacroVars::GetUserConsoleMacroArrays()
 {
-    return doSciFindReplace(params, CMDTYPE_SCIFIND);
+    return m_UserConsoleMacroArrays;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoSciReplace(const tstr& params)
+CNppExecMacroVars::tMacroVarArrays& CNppExecMacroVars::GetUserMacroArrays()
 {
-    return doSciFindReplace(params, CMDTYPE_SCIREPLACE);
+    return m_UserMacroArrays;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoProcSignal(const tstr& params)
+CNppExecMacroVars::tMacroVars& CNppExecMacroVars::GetUserLocalMacroVars(CScriptEngine* pScriptEngine)
 {
-    if ( !reportCmdAndParams( DoProcSignalCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+    CListItemT<CScriptEngine::ScriptContext>* pScriptContextItemPtr = NULL;
 
-    if ( !m_pNppExec->GetCommandExecutor().IsChildProcessRunning() )
+    if ( pScriptEngine != nullptr )
     {
-        ScriptError( ET_REPORT, _T("- child console process is not running") );
-        return CMDRESULT_FAILED;
+        CScriptEngine::ExecState& execState = pScriptEngine->GetExecState();
+        pScriptContextItemPtr = execState.ScriptContextList.GetLast();
     }
-
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    const int nMaxKillMethods = 8;
-    int nKillMethods = 0;
-    CProcessKiller::eKillMethod arrKillMethods[nMaxKillMethods];
-    CProcessKiller::eKillMethod nSignal;
-    unsigned int nWaitTimeout = 50; // just a _small_ hard-coded timeout; meaningful value to be specified as the PROC_SIGNAL argument
-    tstr arg;
-    tstr unknown_args;
-    CStrSplitT<TCHAR> args;
-    const int n = args.SplitToArgs(params);
-    for ( int i = 0; i < n && nKillMethods < nMaxKillMethods; i++ )
+    else
     {
-        nSignal = CProcessKiller::killNone;
-        arg = args.GetArg(i);
-        NppExecHelpers::StrUpper(arg);
-
-        if ( arg == _T("CTRLBREAK") || arg == _T("CTRL-BREAK") || arg == _T("CTRL+BREAK") )
-            nSignal = CProcessKiller::killCtrlBreak;
-        else if ( arg == _T("CTRLC") || arg == _T("CTRL-C") || arg == _T("CTRL+C") )
-            nSignal = CProcessKiller::killCtrlC;
-        else if ( arg == _T("WMCLOSE") || arg == _T("WM_CLOSE") )
-            nSignal = CProcessKiller::killWmClose;
-        else if ( c_base::_tis_dec_value(arg.c_str()) )
-            nWaitTimeout = c_base::_tstr2uint(arg.c_str());
-        else
+        std::shared_ptr<CScriptEngine> pRunningScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine();
+        if ( pRunningScriptEngine )
         {
-            if ( !unknown_args.IsEmpty() )
-                unknown_args += _T(", ");
-            unknown_args += arg;
+            CScriptEngine::ExecState& execState = pRunningScriptEngine->GetExecState();
+            pScriptContextItemPtr = execState.ScriptContextList.GetLast();
         }
-
-        if ( nSignal != CProcessKiller::killNone )
-            arrKillMethods[nKillMethods++] = nSignal;
     }
-
-    if ( !unknown_args.IsEmpty() )
+    
+    if ( pScriptContextItemPtr != NULL )
     {
-        unknown_args.Insert( 0, _T("- unknown PROC_SIGNAL parameter(s): ") );
-        ScriptError( ET_REPORT, unknown_args.c_str() );
-        nCmdResult = CMDRESULT_INVALIDPARAM;
+        CScriptEngine::ScriptContext& scriptContext = pScriptContextItemPtr->GetItem();
+        return scriptContext.LocalMacroVars;
     }
 
-    if ( nKillMethods == 0 )
-    {
-        const TCHAR* const cszErr = _T("- no kill method recognized");
-        if ( !unknown_args.IsEmpty() )
-            m_pNppExec->GetConsole().PrintError( cszErr );
-        else
-            ScriptError( ET_REPORT, cszErr );
-        return CMDRESULT_INVALIDPARAM;
-    }
+    return m_UserLocalMacroVars0;
+}
 
-    std::shared_ptr<CChildProcess> pChildProc = GetRunningChildProcess();
-    if ( pChildProc )
-    {
-        if ( pChildProc->Kill(arrKillMethods, nKillMethods, nWaitTimeout, &nSignal) )
-            return CMDRESULT_FAILED;
-    }
+CNppExecMacroVars::tMacroVars& CNppExecMacroVars::GetUserConsoleMacroVars()
+{
+    return m_UserConsoleMacroVars;
+}
 
-    return nCmdResult;
+CNppExecMacroVars::tMacroVars& CNppExecMacroVars::GetUserMacroVars()
+{
+    return m_UserMacroVars;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoSleep(const tstr& params)
+CNppExecMacroVars::tMacroVars& CNppExecMacroVars::GetCmdAliases()
 {
-    if ( !reportCmdAndParams( DoSleepCommand::Name(), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+    return m_CmdAliases;
+}
 
-    CStrSplitT<TCHAR> args;
-    const int n = args.SplitToArgs(params, 2);
+CCriticalSection& CNppExecMacroVars::GetCsUserMacroVars()
+{
+    return m_csUserMacroVars;
+}
 
-    if ( n == 2 )
+CCriticalSection& CNppExecMacroVars::GetCsCmdAliases()
+{
+    return m_csCmdAliases;
+}
+
+unsigned int CNppExecMacroVars::GetCmdAliasesVersion() const
+{
+    return (unsigned int) m_nCmdAliasesVersion;
+}
+
+void CNppExecMacroVars::IncCmdAliasesVersion()
+{
+    ::InterlockedIncrement(&m_nCmdAliasesVersion);
+}
+
+bool CNppExecMacroVars::RefreshUserMacroVarsSnapshot(UserMacroVarsSnapshot& snapshot)
+{
+    if ( snapshot.m_nVersion == m_nUserMacroVarsVersion )
+        return true; // up to date, no locking
+
+    if ( m_dwUserMacroVarsWriterThreadId == ::GetCurrentThreadId() )
+        return false; // e.g. a script that modifies and reads a shared var in a loop
+
+    CCriticalSectionLockGuard lock(GetCsUserMacroVars());
+    if ( m_nUserMacroVarsSnapshotVersion != m_nUserMacroVarsVersion )
     {
-        tstr Text = args.GetArg(1);
-        NppExecHelpers::StrUnquote(Text);
-        if ( !Text.IsEmpty() )
+        // the first reader of a new version publishes a copy for the other readers
+        // (the copy shares the slots until the next modification of the vars)
+        m_pUserMacroVarsSnapshot = std::make_shared<const tMacroVars>(m_UserMacroVars);
+        m_nUserMacroVarsSnapshotVersion = m_nUserMacroVarsVersion;
+    }
+    snapshot.m_pVars = m_pUserMacroVarsSnapshot;
+    snapshot.m_nVersion = m_nUserMacroVarsSnapshotVersion;
+    return true;
+}
+
+void CNppExecMacroVars::RefreshCmdAliasesSnapshot(CmdAliasesSnapshot& snapshot)
+{
+    if ( snapshot.m_nVersion == m_nCmdAliasesVersion )
+        return; // up to date, no locking
+
+    CCriticalSectionLockGuard lock(GetCsCmdAliases());
+    if ( m_nCmdAliasIndexVersion != m_nCmdAliasesVersion )
+    {
+        // the first reader of a new version builds the index for the other readers
+        std::shared_ptr<tCmdAliasIndex> pIndex = std::make_shared<tCmdAliasIndex>();
+        const tMacroVars& cmdAliases = m_CmdAliases;
+        pIndex->Aliases = cmdAliases;
+        pIndex->nMaxNameLength = 0;
+        for ( tMacroVars::const_iterator itrAlias = cmdAliases.begin(); itrAlias != cmdAliases.end(); ++itrAlias )
         {
-            m_pNppExec->GetConsole().PrintMessage( Text.c_str(), false );
+            if ( itrAlias->first.length() > pIndex->nMaxNameLength )
+                pIndex->nMaxNameLength = itrAlias->first.length();
         }
+        m_pCmdAliasIndex = pIndex;
+        m_nCmdAliasIndexVersion = m_nCmdAliasesVersion;
     }
+    snapshot.m_pIndex = m_pCmdAliasIndex;
+    snapshot.m_nVersion = m_nCmdAliasIndexVersion;
+}
 
-    const TCHAR* pszMilliseconds = args.GetArg(0).c_str();
-    if ( (pszMilliseconds[0] < _T('0')) || (pszMilliseconds[0] > _T('9')) )
+bool CNppExecMacroVars::GetCachedNppState(eNppStateItem nItem, tstr& value, LONG& nVersion)
+{
+    CCriticalSectionLockGuard lock(m_csNppState);
+    nVersion = m_nNppStateVersion;
+    if ( m_NppStateVersions[nItem] != nVersion )
+        return false;
+
+    value = m_NppStateValues[nItem];
+    ::InterlockedIncrement(&m_nNppStateRoundTripsSaved);
+    return true;
+}
+
+void CNppExecMacroVars::SetCachedNppState(eNppStateItem nItem, LONG nVersion, const tstr& value)
+{
+    CCriticalSectionLockGuard lock(m_csNppState);
+    if ( nVersion == m_nNppStateVersion ) // not invalidated while the value was being retrieved
     {
-        tstr Err = _T("- positive integer expected: ");
-        Err += pszMilliseconds;
-        ScriptError( ET_REPORT, Err.c_str() );
-        return CMDRESULT_INVALIDPARAM;
+        m_NppStateValues[nItem] = value;
+        m_NppStateVersions[nItem] = nVersion;
     }
-    
-    unsigned int nMilliseconds = c_base::_tstr2uint(pszMilliseconds);
-    m_eventAbortTheScript.Wait(nMilliseconds);
+}
 
-    return CMDRESULT_SUCCEEDED;
+void CNppExecMacroVars::InvalidateNppState()
+{
+    ::InterlockedIncrement(&m_nNppStateVersion);
 }
 
-CScriptEngine::eCmdResult CScriptEngine::doTextLoad(const tstr& params, eCmdType cmdType)
+LONG CNppExecMacroVars::GetNppStateRoundTripsSaved() const
 {
-    bool bSelectionOnly = (cmdType == CMDTYPE_SELLOADFROM);
-    if ( !reportCmdAndParams( GetCommandRegistry().GetCmdNameByType(cmdType), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+    return m_nNppStateRoundTripsSaved;
+}
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    int nBytes = m_pNppExec->textLoadFrom(params.c_str(), bSelectionOnly);
-    if ( nBytes < 0 )
+void CNppExecMacroVars::CheckCmdArgs(tstr& Cmd, const CStrSplitT<TCHAR>& args)
+{
+  
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().Add(   _T("CheckCmdArgs()") );
+    Runtime::GetLogger().Add(   _T("{") );
+    Runtime::GetLogger().IncIndentLevel();
+    Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), Cmd.c_str() );   
+  }
+    
+  if ( ContainsMacroVar(Cmd) )
+  {
+    tCmdArgsTemplate cmdTemplate;
+    if ( CompileCmdArgs(Cmd, cmdTemplate) )
     {
-        ScriptError( ET_REPORT, _T("- can not open the file") );
-        nCmdResult = CMDRESULT_FAILED;
+      tCmdArgValues values;
+      PrepareCmdArgValues(args, values);
+      BindCmdArgs(cmdTemplate, values, Cmd);
     }
+  }
+
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().AddEx( _T("[out] \"%s\""), Cmd.c_str() );
+    Runtime::GetLogger().DecIndentLevel();
+    Runtime::GetLogger().Add(   _T("}") );
+  }
 
-    return nCmdResult;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::doTextSave(const tstr& params, eCmdType cmdType)
+void CNppExecMacroVars::PrepareCmdArgValues(const CStrSplitT<TCHAR>& args, tCmdArgValues& values)
 {
-    bool bSelectionOnly = (cmdType == CMDTYPE_SELSAVETO);
-    if ( !reportCmdAndParams( GetCommandRegistry().GetCmdNameByType(cmdType), params, fMessageToConsole | fReportEmptyParam | fFailIfEmptyParam ) )
-        return CMDRESULT_INVALIDPARAM;
+  const int nArgs = args.GetArgCount();
 
-    tstr  S;
-    TCHAR szCmdLine[FILEPATH_BUFSIZE + 20];
-    lstrcpy(szCmdLine, params.c_str());
+  values.Argv.clear();
+  values.Argv.reserve(nArgs);
+  for ( int i = 0; i < nArgs; ++i )
+  {
+    values.Argv.push_back( args.GetArg(i) );
+  }
+  values.Args = args.GetArgs();
+  values.RArgs = args.GetRArgs();
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-    int nBytes = m_pNppExec->textSaveTo(szCmdLine, bSelectionOnly);
-    if ( nBytes >= 0 )
-        S.Format(60, _T("- OK, %d bytes have been written to \""), nBytes);
-    else
-        S = _T("- failed to write to \"");
-    S += (szCmdLine[0] == _T('\"')) ? (szCmdLine + 1) : szCmdLine;
-    S += _T("\"");
-    if ( nBytes >= 0 )
+  TCHAR szNum[3*sizeof(int) + 2];
+  c_base::_tint2str(nArgs, szNum);
+  values.Argc = szNum;
+}
+
+bool CNppExecMacroVars::CompileCmdArgs(const tstr& Cmd, tCmdArgsTemplate& cmdTemplate)
+{
+  // One left-to-right pass: the values are not inserted here, so
+  // they are never searched for $(ARGV) and such
+  cmdTemplate.Text.Clear();
+  cmdTemplate.Slots.clear();
+
+  if ( !ContainsMacroVar(Cmd) )
+    return false;
+
+  tstr S = Cmd;
+  NppExecHelpers::StrUpper(S);
+
+  const int lenArgc = lstrlen(MACRO_ARGC);
+  const int lenArgv = lstrlen(MACRO_ARGV);
+  const int lenRArgv = lstrlen(MACRO_RARGV);
+  int pos0 = 0; // the text before pos0 is in cmdTemplate.Text
+  int pos = 0;
+
+  while ( (pos = S.Find(_T("$("), pos)) >= 0 )
+  {
+    tCmdArgsTemplate::tSlot slot;
+    int len = 0;
+
+    if ( c_base::_tstr_unsafe_cmpn(S.c_str() + pos, MACRO_ARGC, lenArgc) == 0 )
     {
-        m_pNppExec->GetConsole().PrintMessage( S.c_str() );
+      slot.nType = tCmdArgsTemplate::stArgc;
+      len = lenArgc;
     }
     else
     {
-        if ( nBytes == -2 )
-            S += _T(" (text length exceeds 2 GB)");
-        ScriptError( ET_REPORT, S.c_str() );
-        nCmdResult = CMDRESULT_FAILED;
+      bool bReverse = false;
+      if ( c_base::_tstr_unsafe_cmpn(S.c_str() + pos, MACRO_RARGV, lenRArgv) == 0 )
+      {
+        bReverse = true;
+        len = lenRArgv;
+      }
+      else if ( c_base::_tstr_unsafe_cmpn(S.c_str() + pos, MACRO_ARGV, lenArgv) == 0 )
+      {
+        len = lenArgv;
+      }
+
+      switch ( (len != 0) ? S.GetAt(pos + len) : _T('\n') )
+      {
+        case 0:
+          slot.nType = bReverse ? tCmdArgsTemplate::stRArgs : tCmdArgsTemplate::stArgs;
+          break;
+
+        case _T(')'):
+          slot.nType = bReverse ? tCmdArgsTemplate::stRArgs : tCmdArgsTemplate::stArgs;
+          ++len;
+          break;
+
+        case _T('['):
+        {
+          // "$(ARGV[N])": N is up to 3*sizeof(int)+1 digits, anything else up to ')' is ignored
+          TCHAR szNum[3*sizeof(int) + 2];
+          unsigned int k = 0;
+          TCHAR ch = S.GetAt(pos + len + 1);
+          while ( isDecNumChar(ch) && (k < 3*sizeof(int) + 1) )
+          {
+            szNum[k] = ch;
+            ++k;
+            ch = S.GetAt(pos + len + k + 1);
+          }
+          szNum[k] = 0;
+          while ( (ch != _T(')')) && (ch != 0) )
+          {
+            ++k;
+            ch = S.GetAt(pos + len + k + 1);
+          }
+          slot.nType = bReverse ? tCmdArgsTemplate::stRArgv : tCmdArgsTemplate::stArgv;
+          slot.nIndex = _ttoi(szNum);
+          len += k + 1;
+          if ( ch == _T(')') )
+            ++len;
+          break;
+        }
+
+        default:
+          // not an argument: e.g. "$(ARGVX)" or another var
+          pos += (len != 0) ? len : 2;
+          continue;
+      }
     }
 
-    return nCmdResult;
-}
+    cmdTemplate.Text.Append( Cmd.c_str() + pos0, pos - pos0 );
+    slot.nPos = cmdTemplate.Text.length();
+    if ( (slot.nType == tCmdArgsTemplate::stArgc) ||
+         (slot.nType == tCmdArgsTemplate::stArgs) ||
+         (slot.nType == tCmdArgsTemplate::stRArgs) )
+    {
+      slot.nIndex = 0;
+    }
+    cmdTemplate.Slots.push_back(slot);
+    pos += len;
+    pos0 = pos;
+  }
 
-CScriptEngine::eCmdResult CScriptEngine::DoSelLoadFrom(const tstr& params)
-{
-    return doTextLoad(params, CMDTYPE_SELLOADFROM);
-}
+  if ( cmdTemplate.Slots.empty() )
+    return false;
 
-CScriptEngine::eCmdResult CScriptEngine::DoSelSaveTo(const tstr& params)
-{
-    return doTextSave(params, CMDTYPE_SELSAVETO);
+  cmdTemplate.Text.Append( Cmd.c_str() + pos0, Cmd.length() - pos0 );
+  return true;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoSelSetText(const tstr& params)
+void CNppExecMacroVars::BindCmdArgs(const tCmdArgsTemplate& cmdTemplate, const tCmdArgValues& values, tstr& Cmd)
 {
-    if ( !reportCmdAndParams( DoSelSetTextCommand::Name(), params, fMessageToConsole ) )
-        return CMDRESULT_INVALIDPARAM;
-
-    m_pNppExec->textSetText( params.c_str(), true );
+  const tstr emptyStr;
+  const int nArgs = static_cast<int>(values.Argv.size());
+  const TCHAR* pText = cmdTemplate.Text.c_str();
+  int pos0 = 0;
 
-    return CMDRESULT_SUCCEEDED;
+  Cmd.Clear();
+  Cmd.Reserve( cmdTemplate.Text.length() + 64 );
+  for ( const tCmdArgsTemplate::tSlot& slot : cmdTemplate.Slots )
+  {
+    Cmd.Append( pText + pos0, slot.nPos - pos0 );
+    pos0 = slot.nPos;
+
+    const tstr* pValue = &emptyStr;
+    switch ( slot.nType )
+    {
+      case tCmdArgsTemplate::stArgc:
+        pValue = &values.Argc;
+        break;
+      case tCmdArgsTemplate::stArgs:
+        pValue = &values.Args;
+        break;
+      case tCmdArgsTemplate::stRArgs:
+        pValue = &values.RArgs;
+        break;
+      case tCmdArgsTemplate::stArgv:
+        if ( slot.nIndex < nArgs )
+          pValue = &values.Argv[slot.nIndex];
+        break;
+      case tCmdArgsTemplate::stRArgv:
+        if ( (slot.nIndex > 0) && (slot.nIndex < nArgs) ) // $(RARGV[0]) is empty
+          pValue = &values.Argv[nArgs - slot.nIndex];
+        break;
+    }
+    Cmd.Append( *pValue );
+  }
+  Cmd.Append( pText + pos0, cmdTemplate.Text.length() - pos0 );
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoSelSetTextEx(const tstr& params)
+void CNppExecMacroVars::CheckCmdAliases(tstr& S, bool useLogging, CmdAliasesSnapshot* pSnapshot)
 {
-    if ( !reportCmdAndParams( DoSelSetTextExCommand::Name(), params, fMessageToConsole ) )
-        return CMDRESULT_INVALIDPARAM;
+    if ( useLogging )
+    {
+        Runtime::GetLogger().Add(   _T("CheckCmdAliases()") );
+        Runtime::GetLogger().Add(   _T("{") );
+        Runtime::GetLogger().IncIndentLevel();
+    }
 
-    int  pos = params.Find( _T('\\') );
-    if ( pos >= 0 )
+    if ( !m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOCMDALIASES) )
     {
-        tstr S = params;
-        while ( pos < S.length() )
+        if ( useLogging )
         {
-            if ( S[pos] == _T('\\') )
+            Runtime::GetLogger().Add(   _T("; command aliases enabled") );
+            Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );
+        }
+        
+        //NppExecHelpers::StrDelLeadingTabSpaces(S);
+        
+        if ( S.length() > 0 )
+        {
+            CmdAliasesSnapshot localSnapshot;
+            if ( pSnapshot == nullptr )
+                pSnapshot = &localSnapshot;
+            RefreshCmdAliasesSnapshot(*pSnapshot);
+
+            const tCmdAliasIndex& aliasIndex = *pSnapshot->m_pIndex;
+            const int nMaxLen = (S.length() < aliasIndex.nMaxNameLength) ? S.length() : aliasIndex.nMaxNameLength;
+            if ( nMaxLen > 0 )
             {
-                switch ( S.GetAt(pos + 1) )
+                tstr t( S.c_str(), nMaxLen );
+                NppExecHelpers::StrUpper(t);
+
+                // the shortest matching alias is applied
+                tstr aliasName;
+                for ( int len = 1; len <= nMaxLen; ++len )
                 {
-                    case _T('n'):
-                        S[pos] = _T('\n');
-                        S.Delete(pos + 1, 1);
-                        break;
-                    case _T('r'):
-                        S[pos] = _T('\r');
-                        S.Delete(pos + 1, 1);
-                        break;
-                    case _T('t'):
-                        S[pos] = _T('\t');
-                        S.Delete(pos + 1, 1);
-                        break;
-                    case _T('\\'):
-                        S.Delete(pos + 1, 1);
-                        break;
+                    if ( IsTabSpaceOrEmptyChar(S.GetAt(len)) )
+                    {
+                        aliasName.Copy( t.c_str(), len );
+                        tMacroVars::const_iterator itrAlias = aliasIndex.Aliases.find(aliasName);
+                        if ( itrAlias != aliasIndex.Aliases.end() )
+                        {
+                            const tstr& aliasValue = itrAlias->second;
+                            S.Replace( 0, len, aliasValue.c_str(), aliasValue.length() );
+                            break;
+                        }
+                    }
                 }
             }
-            ++pos;
         }
-        m_pNppExec->textSetText( S.c_str(), true );
+
+        if ( useLogging )
+        {
+            Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
+        }
     }
     else
-        m_pNppExec->textSetText( params.c_str(), true );
+    {
+        if ( useLogging )
+        {
+            Runtime::GetLogger().Add(   _T("; command aliases disabled") );
+        }
+    }
 
-    return CMDRESULT_SUCCEEDED;
+    if ( useLogging )
+    {
+        Runtime::GetLogger().DecIndentLevel();
+        Runtime::GetLogger().Add(   _T("}") );
+    }
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoTextLoadFrom(const tstr& params)
-{
-    return doTextLoad(params, CMDTYPE_TEXTLOADFROM);
-}
+const MacroVarsExpander::tMacroVarHandler MacroVarsExpander::m_Handlers[] = {
+    // Notepad++'s vars
+    { MACRO_FILE_FULLPATH,       false, esNppVars,    &MacroVarsExpander::getNppString,   NPPM_GETFULLCURRENTPATH,  CNppExecMacroVars::nsiFullCurrentPath },
+    { MACRO_FILE_DIRPATH,        false, esNppVars,    &MacroVarsExpander::getNppString,   NPPM_GETCURRENTDIRECTORY, CNppExecMacroVars::nsiCurrentDirectory },
+    { MACRO_FILE_FULLNAME,       false, esNppVars,    &MacroVarsExpander::getNppString,   NPPM_GETFILENAME,         CNppExecMacroVars::nsiFileName },
+    { MACRO_FILE_NAMEONLY,       false, esNppVars,    &MacroVarsExpander::getNppString,   NPPM_GETNAMEPART,         CNppExecMacroVars::nsiNamePart },
+    { MACRO_FILE_EXTONLY,        false, esNppVars,    &MacroVarsExpander::getNppString,   NPPM_GETEXTPART,          CNppExecMacroVars::nsiExtPart },
+    { MACRO_NPP_DIRECTORY,       false, esNppVars,    &MacroVarsExpander::getNppString,   NPPM_GETNPPDIRECTORY,     CNppExecMacroVars::nsiNppDirectory },
+    { MACRO_CURRENT_WORD,        false, esNppVars,    &MacroVarsExpander::getNppString,   NPPM_GETCURRENTWORD,      CNppExecMacroVars::nsiCurrentWord },
+    { MACRO_CURRENT_LINE,        false, esNppVars,    &MacroVarsExpander::getNppInt,      NPPM_GETCURRENTLINE,      CNppExecMacroVars::nsiCurrentLine },
+    { MACRO_CURRENT_COLUMN,      false, esNppVars,    &MacroVarsExpander::getNppInt,      NPPM_GETCURRENTCOLUMN,    CNppExecMacroVars::nsiCurrentColumn },
+    // plugin's vars
+    { MACRO_DOCNUMBER,           true,  esPluginVars, &MacroVarsExpander::getDocNumber,   0,                        -1 },
+    { MACRO_SYSVAR,              true,  esPluginVars, &MacroVarsExpander::getSysVar,      0,                        -1 },
+    { MACRO_LEFT_VIEW_FILE,      false, esPluginVars, &MacroVarsExpander::getViewFile,    PRIMARY_VIEW,             CNppExecMacroVars::nsiLeftViewFile },
+    { MACRO_RIGHT_VIEW_FILE,     false, esPluginVars, &MacroVarsExpander::getViewFile,    SECOND_VIEW,              CNppExecMacroVars::nsiRightViewFile },
+    { MACRO_CURRENT_WORKING_DIR, false, esPluginVars, &MacroVarsExpander::getCwd,         0,                        -1 },
+    { MACRO_PLUGINS_CONFIG_DIR,  false, esPluginVars, &MacroVarsExpander::getConfigDir,   0,                        -1 },
+    { MACRO_CLIPBOARD_TEXT,      false, esPluginVars, &MacroVarsExpander::getClipboard,   0,                        -1 },
+    { MACRO_NPP_HWND,            false, esPluginVars, &MacroVarsExpander::getHwnd,        0,                        -1 },
+    { MACRO_SCI_HWND,            false, esPluginVars, &MacroVarsExpander::getHwnd,        1,                        -1 },
+    // user's vars
+    { MACRO_OUTPUT_LINE,         true,  esUserVars,   &MacroVarsExpander::getOutputLine,  0,                        -1 }
+};
 
-CScriptEngine::eCmdResult CScriptEngine::DoTextSaveTo(const tstr& params)
+MacroVarsExpander::MacroVarsExpander(CNppExecMacroVars& MacroVars, CScriptEngine* pScriptEngine, unsigned int nScopes) :
+  m_MacroVars(MacroVars), m_pNppExec(MacroVars.GetNppExec()), m_pScriptEngine(pScriptEngine), m_nScopes(nScopes), m_isFileNamesOK(false)
 {
-    return doTextSave(params, CMDTYPE_TEXTSAVETO);
+    // the script's snapshot is kept between the calls, but it
+    // can't be used by other threads (e.g. the PARALLEL jobs)
+    if ( (pScriptEngine != nullptr) && (pScriptEngine->GetThreadId() == ::GetCurrentThreadId()) )
+        m_pUserVarsSnapshot = &pScriptEngine->GetUserMacroVarsSnapshot();
+    else
+        m_pUserVarsSnapshot = &m_UserVarsSnapshot;
+
+    for ( int i = 0; i < HANDLERS_COUNT; ++i )
+    {
+        m_isCached[i] = false;
+    }
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoClipSetText(const tstr& params)
+void MacroVarsExpander::Expand(tstr& S)
 {
-    if ( !reportCmdAndParams( DoClipSetTextCommand::Name(), params, fMessageToConsole ) )
-        return CMDRESULT_INVALIDPARAM;
+    if ( !CNppExecMacroVars::ContainsMacroVar(S) )
+        return;
 
-    HWND hWndOwner = m_pNppExec->m_nppData._nppHandle;
-    return NppExecHelpers::SetClipboardText(params, hWndOwner) ? CMDRESULT_SUCCEEDED : CMDRESULT_FAILED;
+    tstr Out;
+    Out.Reserve( S.length() );
+    expandText( S.c_str(), Out, false );
+    S.Swap(Out);
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoSet(const tstr& params)
+const TCHAR* MacroVarsExpander::expandText(const TCHAR* p, tstr& Out, bool isVarName)
 {
-    reportCmdAndParams( DoSetCommand::Name(), params, fMessageToConsole );
-    
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
-
-    // sets the value of user's variable
-    tstr CmdParams = params;
-    {
-        CNppExecMacroVars& MacroVars = m_pNppExec->GetMacroVars();
-        const CStrSplitT<TCHAR> args;
-        MacroVars.CheckCmdArgs(CmdParams, args);
-        if ( !MacroVars.CheckAllMacroVars(this, CmdParams, true, CMDTYPE_SET) )
-            nCmdResult = CMDRESULT_FAILED;
-    }
-
-    bool isInternal = false;
-    bool bLocalVar = false;
-    
-    tstr varName;
-    if ( CmdParams.IsEmpty() )
-    {
-          
-        Runtime::GetLogger().Add(   _T("; no arguments given - showing all user\'s variables") );
-
-    }
-    else
+    const TCHAR* pText = p;
+    while ( *p != 0 )
     {
-        varName = CmdParams;
-        int k = varName.Find( _T("=") );
-        if ( k >= 0 )  
-        {
-            varName.SetSize(k);
-            isInternal = true;
-        }
-        NppExecHelpers::StrDelLeadingTabSpaces(varName);
-        NppExecHelpers::StrDelTrailingTabSpaces(varName);
-        bLocalVar = m_pNppExec->GetMacroVars().IsLocalMacroVar(varName);
-        if ( varName.length() > 0 )
+        if ( (*p == _T('$')) && (*(p + 1) == _T('(')) )
         {
-            if ( varName.StartsWith(_T("$(")) == false )
-                varName.Insert(0, _T("$("));
-            if ( varName.GetLastChar() != _T(')') )
-                varName.Append(_T(')'));
-            NppExecHelpers::StrUpper(varName);
+            if ( p != pText )
+                Out.Append( pText, static_cast<int>(p - pText) );
+            p = expandVar(p, Out);
+            pText = p;
         }
+        else if ( isVarName && (*p == _T(')')) )
+            break;
+        else
+            ++p;
     }
+    if ( p != pText )
+        Out.Append( pText, static_cast<int>(p - pText) );
+    return p;
+}
 
+const TCHAR* MacroVarsExpander::expandVar(const TCHAR* p, tstr& Out)
+{
+    // p points to "$(", the inner vars of the name are expanded first
+    tstr varName = _T("$(");
+    p = expandText(p + 2, varName, true);
+    if ( *p != _T(')') )
     {
-        CCriticalSectionLockGuard lock(m_pNppExec->GetMacroVars().GetCsUserMacroVars());
-        const CNppExecMacroVars::tMacroVars& userLocalMacroVars = m_pNppExec->GetMacroVars().GetUserLocalMacroVars(this);
-        const CNppExecMacroVars::tMacroVars& userMacroVars = m_pNppExec->GetMacroVars().GetUserMacroVars();
+        // unterminated "$(..."
+        if ( (m_nScopes & esNoEmptyVars) == 0 )
+            Out += varName;
+        return p;
+    }
 
-        if ( userLocalMacroVars.empty() && bLocalVar )
-        {
-            m_pNppExec->GetConsole().PrintMessage( _T("- no user-defined local variables"), false );
-            nCmdResult = CMDRESULT_FAILED;
-        }
-        else if ( userLocalMacroVars.empty() && userMacroVars.empty() )
-        {
-            m_pNppExec->GetConsole().PrintMessage( _T("- no user-defined variables"), false );
-            nCmdResult = CMDRESULT_FAILED;
-        }
-        else
+    varName += _T(')');
+    if ( !resolve(varName, Out) && ((m_nScopes & esNoEmptyVars) == 0) )
+        Out += varName; // unknown var, kept as is
+    return p + 1;
+}
+
+bool MacroVarsExpander::resolve(const tstr& varName, tstr& Out)
+{
+    m_varNameUpper = varName;
+    NppExecHelpers::StrUpper(m_varNameUpper);
+
+    if ( m_nScopes & (esNppVars | esPluginVars | esUserVars) )
+    {
+        const TCHAR ch = m_varNameUpper.GetAt(2);
+        for ( int i = 0; i < HANDLERS_COUNT; ++i )
         {
-            if ( varName.IsEmpty() )
-            {
-                if ( bLocalVar )
-                {
-                    PrintMacroVarFunc func(m_pNppExec);
-                    CNppExecMacroVars::tMacroVars::const_iterator itrVar = userLocalMacroVars.begin();
-                    for ( ; itrVar != userLocalMacroVars.end(); ++itrVar )
-                    {
-                        func(itrVar, true);
-                    }
-                }
-                else
-                    IterateUserMacroVars<PrintMacroVarFunc>(userMacroVars, userLocalMacroVars, PrintMacroVarFunc(m_pNppExec));
-            }
-            else
+            const tMacroVarHandler& handler = m_Handlers[i];
+            if ( ((m_nScopes & handler.nScope) == 0) || (handler.szName[2] != ch) )
+                continue;
+
+            if ( handler.isPrefix ? m_varNameUpper.StartsWith(handler.szName) : (m_varNameUpper == handler.szName) )
             {
-                const CNppExecMacroVars::tMacroVars& macroVars = bLocalVar ? userLocalMacroVars : userMacroVars;
-                CNppExecMacroVars::tMacroVars::const_iterator itrVar = macroVars.find(varName);
-                if ( itrVar != macroVars.end() )
+                if ( !m_isCached[i] && (handler.nNppStateItem >= 0) )
                 {
-                    tstr S = bLocalVar ? _T("local ") : _T("");
-                    S += itrVar->first;
-                    S += _T(" = ");
-                    if ( itrVar->second.length() > MAX_VAR_LENGTH2SHOW )
+                    // Notepad++'s state is shared by the strings, the lines and the scripts
+                    const CNppExecMacroVars::eNppStateItem nItem = static_cast<CNppExecMacroVars::eNppStateItem>(handler.nNppStateItem);
+                    LONG nVersion = 0;
+                    if ( m_MacroVars.GetCachedNppState(nItem, m_varValue, nVersion) )
                     {
-                        S.Append( itrVar->second.c_str(), MAX_VAR_LENGTH2SHOW - 5 );
-                        S += _T("(...)");
+                        if ( Runtime::GetLogger().IsLogging() )
+                        {
+                            Runtime::GetLogger().AddEx( _T("; %s: from the cache (round-trips saved: %d)"), 
+                                handler.szName, m_MacroVars.GetNppStateRoundTripsSaved() );
+                        }
                     }
                     else
                     {
-                        S += itrVar->second;
+                        m_varValue.Clear();
+                        (this->*handler.getValue)(handler);
+                        m_MacroVars.SetCachedNppState(nItem, nVersion, m_varValue);
                     }
-                    m_pNppExec->GetConsole().PrintMessage( S.c_str(), isInternal );
+                    m_CachedValues[i] = m_varValue;
+                    m_isCached[i] = true;
                 }
-                else
+                else if ( !m_isCached[i] )
                 {
-                    tstr t = _T("- no such user\'s ");
-                    if ( bLocalVar ) t += _T("local ");
-                    t += _T("variable: ");
-                    t += varName;
-                    m_pNppExec->GetConsole().PrintMessage( t.c_str(), false );
-                    nCmdResult = CMDRESULT_FAILED;
+                    m_varValue.Clear();
+                    (this->*handler.getValue)(handler);
+                    if ( handler.isPrefix )
+                    {
+                        Out += m_varValue; // depends on the name, not cached
+                        return true;
+                    }
+
+                    m_CachedValues[i] = m_varValue;
+                    m_isCached[i] = true;
                 }
+                else
+                    m_varValue = m_CachedValues[i];
+                Out += m_varValue;
+                return true;
             }
         }
     }
 
-    return nCmdResult;
+    if ( m_nScopes & esUserVars )
+    {
+        {
+            CCriticalSectionLockGuard lock(m_MacroVars.GetCsUserMacroVars());
+            const CNppExecMacroVars::tMacroVars& userLocalMacroVars = m_MacroVars.GetUserLocalMacroVars(m_pScriptEngine);
+            CNppExecMacroVars::tMacroVars::const_iterator itrVar = userLocalMacroVars.find(m_varNameUpper);
+            if ( itrVar != userLocalMacroVars.end() )
+            {
+                Out += itrVar->second; // a large value such as $(OUTPUT) is copied just once
+                return true;
+            }
+        }
+
+        // the shared vars are read from the snapshot, without locking
+        if ( m_MacroVars.RefreshUserMacroVarsSnapshot(*m_pUserVarsSnapshot) )
+        {
+            const CNppExecMacroVars::tMacroVars* pUserMacroVars = m_pUserVarsSnapshot->GetVars();
+            CNppExecMacroVars::tMacroVars::const_iterator itrVar = pUserMacroVars->find(m_varNameUpper);
+            if ( itrVar == pUserMacroVars->end() )
+                return m_MacroVars.GetUserMacroVarItem(m_pScriptEngine, m_varNameUpper, Out); // $(arr[key]) or $(arr.count)
+            Out += itrVar->second;
+        }
+        else
+        {
+            CCriticalSectionLockGuard lock(m_MacroVars.GetCsUserMacroVars());
+            const CNppExecMacroVars::tMacroVars& userMacroVars = m_MacroVars.GetUserMacroVars();
+            CNppExecMacroVars::tMacroVars::const_iterator itrVar = userMacroVars.find(m_varNameUpper);
+            if ( itrVar == userMacroVars.end() )
+                return m_MacroVars.GetUserMacroVarItem(m_pScriptEngine, m_varNameUpper, Out); // $(arr[key]) or $(arr.count)
+            Out += itrVar->second;
+        }
+        return true;
+    }
+
+    return false;
 }
 
-CScriptEngine::eCmdResult CScriptEngine::DoUnset(const tstr& params)
+void MacroVarsExpander::getNppString(const tMacroVarHandler& handler)
 {
-    reportCmdAndParams( DoUnsetCommand::Name(), params, fMessageToConsole );
+    const int MACRO_SIZE = CONSOLECOMMAND_BUFSIZE;
+    TCHAR     szMacro[MACRO_SIZE];
 
-    eCmdResult nCmdResult = CMDRESULT_SUCCEEDED;
+    szMacro[0] = 0;
+    m_pNppExec->SendNppMsg((UINT) handler.nParam, (WPARAM) (MACRO_SIZE - 1), (LPARAM) szMacro);
+    m_varValue = szMacro;
+}
 
-    // unsets the user's variable
-    tstr CmdParams = params;
+void MacroVarsExpander::getNppInt(const tMacroVarHandler& handler)
+{
+    TCHAR szNum[3*sizeof(int) + 2];
+
+    int nn = (int) m_pNppExec->SendNppMsg((UINT) handler.nParam, 0, 0);
+    c_base::_tint2str(nn, szNum);
+    m_varValue = szNum;
+}
+
+void MacroVarsExpander::getDocNumber(const tMacroVarHandler& )
+{
+    // "$(#N)": the digits after "$(#", anything else removes the var
+    const int len = lstrlen(MACRO_DOCNUMBER);
+    int k = len;
+    while ( isDecNumChar(m_varNameUpper.GetAt(k)) )  ++k;
+    if ( k == len )
+        return;
+
+    k = _ttoi(m_varNameUpper.c_str() + len);
+    if ( k > 0 )
     {
-        CNppExecMacroVars& MacroVars = m_pNppExec->GetMacroVars();
-        const CStrSplitT<TCHAR> args;
-        MacroVars.CheckCmdArgs(CmdParams, args);
-        if ( !MacroVars.CheckAllMacroVars(this, CmdParams, true, CMDTYPE_UNSET) )
-            nCmdResult = CMDRESULT_FAILED;
+        // #doc = 1..nbFiles
+        if ( !m_isFileNamesOK )
+        {
+            m_pNppExec->nppGetOpenFileNames();
+            m_isFileNamesOK = true;
+        }
+        if ( k <= m_pNppExec->npp_nbFiles )
+        {
+            m_varValue = m_pNppExec->npp_bufFileNames[k-1];
+        }
     }
-    
-    if ( CmdParams.IsEmpty() )
+    else if ( k == 0 )
     {
-        errorCmdNoParam(DoUnsetCommand::Name());
-        nCmdResult = CMDRESULT_INVALIDPARAM;
+        // #doc = 0 means notepad++ full path
+        TCHAR szPath[FILEPATH_BUFSIZE];
+
+        szPath[0] = 0;
+        ::GetModuleFileName(NULL, szPath, FILEPATH_BUFSIZE - 1);
+        m_varValue = szPath;
     }
+}
 
-    return nCmdResult;
+void MacroVarsExpander::getSysVar(const tMacroVarHandler& )
+{
+    // "$(SYS.<var>)": an undefined environment variable removes the var
+    const int len = lstrlen(MACRO_SYSVAR);
+    tstr sub( m_varNameUpper.c_str() + len, m_varNameUpper.length() - len - 1 );
+    if ( sub.length() > 0 )
+    {
+        m_varValue = NppExecHelpers::GetEnvironmentVariable(sub);
+    }
 }
 
-//////////////////////////////////////////////////////////////////////////////
-//////////////////////////////////////////////////////////////////////////////
+void MacroVarsExpander::getViewFile(const tMacroVarHandler& handler)
+{
+    const int nView = handler.nParam;
+    const int ind = (int) m_pNppExec->SendNppMsg(NPPM_GETCURRENTDOCINDEX, 
+      (nView == PRIMARY_VIEW) ? MAIN_VIEW : SUB_VIEW, (nView == PRIMARY_VIEW) ? MAIN_VIEW : SUB_VIEW);
+    m_isFileNamesOK = false; // npp_bufFileNames is modified below
+    if ( m_pNppExec->nppGetOpenFileNamesInView(nView, ind + 1) == ind + 1 )
+    {
+        m_varValue = m_pNppExec->npp_bufFileNames.GetAt(ind);
+    }
+}
 
-CNppExecMacroVars::CNppExecMacroVars() : m_pNppExec(0)
+void MacroVarsExpander::getCwd(const tMacroVarHandler& )
 {
+    TCHAR szPath[FILEPATH_BUFSIZE];
+
+    szPath[0] = 0;
+    ::GetCurrentDirectory(FILEPATH_BUFSIZE - 1, szPath);
+    m_varValue = szPath;
 }
 
-CNppExec* CNppExecMacroVars::GetNppExec() const
+void MacroVarsExpander::getConfigDir(const tMacroVarHandler& )
 {
-    return m_pNppExec;
+    m_varValue = m_pNppExec->getConfigPath();
 }
 
-void CNppExecMacroVars::SetNppExec(CNppExec* pNppExec)
+void MacroVarsExpander::getClipboard(const tMacroVarHandler& )
 {
-    m_pNppExec = pNppExec;
+    m_varValue = NppExecHelpers::GetClipboardText();
 }
 
-bool CNppExecMacroVars::IsLocalMacroVar(tstr& varName)
+void MacroVarsExpander::getHwnd(const tMacroVarHandler& handler)
 {
-    bool isLocal = false;
-    int n = varName.Find(_T(' '));
-    if ( n < 0 )
+    TCHAR szHex[40];
+    HWND  hWnd = (handler.nParam == 0) ? m_pNppExec->m_nppData._nppHandle : m_pNppExec->GetScintillaHandle();
+
+    #ifdef _WIN64
+      c_base::_tuint64_to_strhex((unsigned __int64)(UINT_PTR)(hWnd), szHex);
+    #else
+      c_base::_tuint2strhex((unsigned int)(UINT_PTR)(hWnd), szHex);
+    #endif
+    m_varValue = _T("0x");
+    m_varValue += szHex;
+}
+
+void MacroVarsExpander::getOutputLine(const tMacroVarHandler& )
+{
+    // "$(OUTPUTL[N])": Nth line of $(OUTPUT), N < 0 counts from the end;
+    // only this line is copied, not the whole $(OUTPUT)
+    const int len = lstrlen(MACRO_OUTPUT_LINE);
+    const TCHAR* pNum = m_varNameUpper.c_str() + len;
+    int k = (*pNum == _T('-')) ? 1 : 0;
+    while ( isDecNumChar(pNum[k]) )  ++k;
+    if ( (k == 0) || (pNum[k] != _T(']')) || (pNum[k + 1] != _T(')')) || (pNum[k + 2] != 0) )
+        return;
+
+    int nLine = _ttoi(pNum);
+    if ( nLine == 0 )
+        return;
+
+    CCriticalSectionLockGuard lock(m_MacroVars.GetCsUserMacroVars());
+    const tstr varName = MACRO_OUTPUT;
+    const CNppExecMacroVars::tMacroVars& userLocalMacroVars = m_MacroVars.GetUserLocalMacroVars(m_pScriptEngine);
+    CNppExecMacroVars::tMacroVars::const_iterator itrVar = userLocalMacroVars.find(varName);
+    if ( itrVar == userLocalMacroVars.end() )
     {
-        n = varName.Find(_T('\t'));
-        if ( n < 0 )
-            n = varName.length();
+        const CNppExecMacroVars::tMacroVars& userMacroVars = m_MacroVars.GetUserMacroVars();
+        itrVar = userMacroVars.find(varName);
+        if ( itrVar == userMacroVars.end() )
+            return;
     }
-    if ( n == 5 ) // length of "local"
+
+    const tstr& Output = itrVar->second;
+    int nStart = 0;
+    int nEnd = Output.length();
+    if ( nLine > 0 )
     {
-        tstr Prefix;
-        Prefix.Copy( varName.c_str(), n );
-        NppExecHelpers::StrLower(Prefix);
-        if ( Prefix == _T("local") )
+        while ( --nLine > 0 )
         {
-            isLocal = true;
-            varName.Delete(0, n);
-            NppExecHelpers::StrDelLeadingTabSpaces(varName);
+            const int i = Output.Find( _T('\n'), nStart );
+            if ( i < 0 )
+                return; // no such line
+            nStart = i + 1;
         }
+        const int i = Output.Find( _T('\n'), nStart );
+        if ( i >= 0 )
+            nEnd = i;
     }
-    return isLocal;
+    else
+    {
+        while ( ++nLine < 0 )
+        {
+            const int i = (nEnd > 0) ? Output.RFind( _T('\n'), nEnd - 1 ) : -1;
+            if ( i < 0 )
+                return; // no such line
+            nEnd = i;
+        }
+        nStart = (nEnd > 0) ? (Output.RFind( _T('\n'), nEnd - 1 ) + 1) : 0;
+    }
+    m_varValue.Copy( Output.c_str() + nStart, nEnd - nStart );
 }
 
-bool CNppExecMacroVars::ContainsMacroVar(const tstr& S)
+void CNppExecMacroVars::CheckNppMacroVars(tstr& S)
 {
-    return ( (S.Find(_T("$(")) >= 0) ? true : false );
+  
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().Add(   _T("CheckNppMacroVars()") );
+    Runtime::GetLogger().Add(   _T("{") );
+    Runtime::GetLogger().IncIndentLevel();
+    Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );
+  }
+  
+  MacroVarsExpander(*this, nullptr, MacroVarsExpander::esNppVars).Expand(S);
+
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
+    Runtime::GetLogger().DecIndentLevel();
+    Runtime::GetLogger().Add(   _T("}") );
+  }
+  
 }
 
-CNppExecMacroVars::tMacroVars& CNppExecMacroVars::GetUserLocalMacroVars(CScriptEngine* pScriptEngine)
+void CNppExecMacroVars::CheckPluginMacroVars(tstr& S)
 {
-    CListItemT<CScriptEngine::ScriptContext>* pScriptContextItemPtr = NULL;
+  
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().Add(   _T("CheckPluginMacroVars()") );
+    Runtime::GetLogger().Add(   _T("{") );
+    Runtime::GetLogger().IncIndentLevel();
+    Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );  
+  }
+    
+  MacroVarsExpander(*this, nullptr, MacroVarsExpander::esPluginVars).Expand(S);
 
-    if ( pScriptEngine != nullptr )
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
+    Runtime::GetLogger().DecIndentLevel();
+    Runtime::GetLogger().Add(   _T("}") );
+  }
+
+}
+
+bool CNppExecMacroVars::CheckUserMacroVars(CScriptEngine* pScriptEngine, tstr& S, int nCmdType )
+{
+  bool bResult = true;
+  
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().Add(   _T("CheckUserMacroVars()") );
+    Runtime::GetLogger().Add(   _T("{") );
+    Runtime::GetLogger().IncIndentLevel();
+    Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );
+  }
+    
+  if ( nCmdType == CScriptEngine::CMDTYPE_SET )
+  {
+    
+    if ( Runtime::GetLogger().IsLogging() )
     {
-        CScriptEngine::ExecState& execState = pScriptEngine->GetExecState();
-        pScriptContextItemPtr = execState.ScriptContextList.GetLast();
+      Runtime::GetLogger().AddEx( _T("; %s command found"), CScriptEngine::DoSetCommand::Name() );
     }
-    else
+      
+    const TCHAR* DEF_OP  = _T("=");
+    const TCHAR* CALC_OP = _T("~");
+    const int i1 = S.Find(DEF_OP);    
+    const int i2 = S.Find(CALC_OP);
+    const bool bSep1 = ((i1 < i2 && i1 >= 0) || (i2 < 0));
+    const TCHAR* sep = bSep1 ? DEF_OP : CALC_OP;
+    CStrSplitT<TCHAR> args;
+
+    if ( args.Split(S, sep, 2) == 2 )
     {
-        std::shared_ptr<CScriptEngine> pRunningScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine();
-        if ( pRunningScriptEngine )
+      tstr& varName = args.Arg(0);
+      tstr& varValue = args.Arg(1);
+      NppExecHelpers::StrDelLeadingTabSpaces(varName);
+      NppExecHelpers::StrDelTrailingTabSpaces(varName);
+      NppExecHelpers::StrDelLeadingTabSpaces(varValue);
+      NppExecHelpers::StrDelTrailingTabSpaces(varValue);
+
+      bool bCalculated = false;
+      if ( !bSep1 && ContainsMacroVar(varValue) )
+      {
+        bCalculated = StrCalc(varValue, m_pNppExec, pScriptEngine).ProcessWithBoundVars();
+      }
+
+      if ( !bCalculated )
+      {
+        if ( ContainsMacroVar(varValue) )
         {
-            CScriptEngine::ExecState& execState = pRunningScriptEngine->GetExecState();
-            pScriptContextItemPtr = execState.ScriptContextList.GetLast();
+          MacroVarsExpander(*this, pScriptEngine, MacroVarsExpander::esUserVars).Expand(varValue);
+          CheckEmptyMacroVars(m_pNppExec, varValue);
+        }
+
+        if ( !bSep1 )
+        {
+          StrCalc(varValue, m_pNppExec, pScriptEngine).Process();
+        }
+      }
+
+      bool bLocalVar = IsLocalMacroVar(varName);
+      if ( IsMacroVarItemName(varName) )
+        ExpandMacroVarItemKey(pScriptEngine, varName);
+
+      S = bLocalVar ? _T("local ") : _T("");
+      S += varName;
+      S += _T(" = ");
+      S += varValue;
+
+      bool bSetOK = false;
+      if ( IsMacroVarItemName(varName) )
+        bSetOK = SetUserMacroVarItem(pScriptEngine, varName, varValue, bLocalVar ? CNppExecMacroVars::svLocalVar : 0);
+      else
+        bSetOK = SetUserMacroVar(pScriptEngine, varName, varValue, bLocalVar ? CNppExecMacroVars::svLocalVar : 0);
+
+      if ( bSetOK )
+      {
+        
+          if ( Runtime::GetLogger().IsLogging() )
+          {
+            Runtime::GetLogger().AddEx( _T("; OK: %s%s = %s"), bLocalVar ? _T("local ") : _T(""), varName.c_str(), varValue.c_str() );
+          }
+
+      }
+      else
+      {
+
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+          Runtime::GetLogger().AddEx( _T("; failed to set %s%s = %s"), bLocalVar ? _T("local ") : _T(""), varName.c_str(), varValue.c_str() );
         }
+
+        bResult = false;
+
+      }
+    }
+    else
+    {
+      // "set $(var)" returns the value of var
+      // "set" returns all vars and values
     }
+  }
+  else if ( nCmdType == CScriptEngine::CMDTYPE_UNSET )
+  {
     
-    if ( pScriptContextItemPtr != NULL )
+    if ( Runtime::GetLogger().IsLogging() )
     {
-        CScriptEngine::ScriptContext& scriptContext = pScriptContextItemPtr->GetItem();
-        return scriptContext.LocalMacroVars;
+      Runtime::GetLogger().AddEx( _T("; %s command found"), CScriptEngine::DoUnsetCommand::Name() );
     }
 
-    return m_UserLocalMacroVars0;
-}
+    tstr varName = S;
+    int k = varName.Find( _T("=") );
+    if ( k >= 0 )  varName.SetSize(k);
+    NppExecHelpers::StrDelLeadingTabSpaces(varName);
+    NppExecHelpers::StrDelTrailingTabSpaces(varName);
 
-CNppExecMacroVars::tMacroVars& CNppExecMacroVars::GetUserConsoleMacroVars()
-{
-    return m_UserConsoleMacroVars;
-}
+    bool bLocalVar = IsLocalMacroVar(varName);
+    if ( IsMacroVarItemName(varName) )
+      ExpandMacroVarItemKey(pScriptEngine, varName);
+    unsigned int nFlags = CNppExecMacroVars::svRemoveVar;
+    if ( bLocalVar )
+        nFlags |= CNppExecMacroVars::svLocalVar;
+    tstr arrName = varName;
+    if ( SetUserMacroVar(pScriptEngine, varName, S, nFlags) ||
+         SetUserMacroVarItem(pScriptEngine, arrName, S, nFlags) ) // an array or its item
+    {
 
-CNppExecMacroVars::tMacroVars& CNppExecMacroVars::GetUserMacroVars()
-{
-    return m_UserMacroVars;
-}
+      if ( Runtime::GetLogger().IsLogging() )
+      {
+        Runtime::GetLogger().AddEx( _T("; OK: %s%s has been removed"), bLocalVar ? _T("local ") : _T(""), varName.c_str() );
+      }
 
-CNppExecMacroVars::tMacroVars& CNppExecMacroVars::GetCmdAliases()
-{
-    return m_CmdAliases;
-}
+      tstr t = _T("- the user\'s ");
+      if ( bLocalVar ) t += _T("local ");
+      t += _T("variable has been removed: ");
+      t += varName;
+      m_pNppExec->GetConsole().PrintMessage( t.c_str() /*, false*/ );
+    }
+    else
+    {
 
-CCriticalSection& CNppExecMacroVars::GetCsUserMacroVars()
-{
-    return m_csUserMacroVars;
-}
+      if ( Runtime::GetLogger().IsLogging() )
+      {
+        Runtime::GetLogger().AddEx( _T("; failed to unset %s%s (no such user\'s variable)"), bLocalVar ? _T("local ") : _T(""), varName.c_str() );
+      }
 
-CCriticalSection& CNppExecMacroVars::GetCsCmdAliases()
-{
-    return m_csCmdAliases;
+      tstr t = _T("- no such user\'s ");
+      if ( bLocalVar ) t += _T("local ");
+      t += _T("variable: ");
+      t += varName;
+      m_pNppExec->GetConsole().PrintMessage( t.c_str(), false );
+
+      bResult = false;
+    }
+  }
+  else
+  {
+    MacroVarsExpander(*this, pScriptEngine, MacroVarsExpander::esUserVars).Expand(S);
+  }
+
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
+    Runtime::GetLogger().DecIndentLevel();
+    Runtime::GetLogger().Add(   _T("}") );
+  }
+
+  return bResult;
 }
 
-void CNppExecMacroVars::CheckCmdArgs(tstr& Cmd, const CStrSplitT<TCHAR>& args)
+void CNppExecMacroVars::CheckEmptyMacroVars(CNppExec* pNppExec, tstr& S, int nCmdType )
 {
-  
-  Runtime::GetLogger().Add(   _T("CheckCmdArgs()") );
-  Runtime::GetLogger().Add(   _T("{") );
-  Runtime::GetLogger().IncIndentLevel();
-  Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), Cmd.c_str() );   
     
-  if ( ContainsMacroVar(Cmd) )
+  if ( Runtime::GetLogger().IsLogging() )
   {
-    tstr S = Cmd;
-    NppExecHelpers::StrUpper(S);
+    Runtime::GetLogger().Add(   _T("CheckEmptyMacroVars()") );
+    Runtime::GetLogger().Add(   _T("{") );
+    Runtime::GetLogger().IncIndentLevel();
+    Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );   
+  }
+    
+  if ( pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOEMPTYVARS) )
+  {
+    
+    Runtime::GetLogger().Add(   _T("; the function is enabled") );  
       
-    TCHAR szNum[3*sizeof(int) + 2];
-    c_base::_tint2str(args.GetArgCount(), szNum);
-
-    int   len = lstrlen(MACRO_ARGC);
-    int   pos = 0;
-    while ( (pos = S.Find(MACRO_ARGC, pos)) >= 0 )
-    {
-      S.Replace(pos, len, szNum);
-      Cmd.Replace(pos, len, szNum);
-      pos += lstrlen(szNum);
-    }
-
-    int  len1 = lstrlen(MACRO_ARGV);
-    int  len2 = lstrlen(MACRO_RARGV);
-    bool bReverse = false;
-    if ( (pos = S.Find(MACRO_RARGV)) >= 0 )
-    {
-      len = len2;
-      bReverse = true;
-    }
-    else if ( (pos = S.Find(MACRO_ARGV)) >= 0 )
-    {
-      len = len1;
-      bReverse = false;
-    }
-    while ( pos >= 0 )
+    CStrSplitT<TCHAR> args;
+    if ( (nCmdType == CScriptEngine::CMDTYPE_SET) || 
+         (nCmdType == CScriptEngine::CMDTYPE_UNSET) )
     {
-      switch ( S.GetAt(pos+len) )
+      if ( args.Split(S, _T("="), 2) == 2 )
       {
-        case 0:
-        {
-          const tstr& t = bReverse ? args.GetRArgs() : args.GetArgs();
-          S.Replace( pos, len, t.c_str(), t.length() );
-          Cmd.Replace( pos, len, t.c_str(), t.length() );
-          pos += t.length();
-          break;
-        }
-        case _T(')'):
-        {
-          const tstr& t = bReverse ? args.GetRArgs() : args.GetArgs();
-          S.Replace( pos, len + 1, t.c_str(), t.length() );
-          Cmd.Replace( pos, len + 1, t.c_str(), t.length() );
-          pos += t.length();
-          break;
-        }
-        case _T('['):
-        {
-          unsigned int k = 0;
-          TCHAR ch = S.GetAt(pos + len + k + 1);
-
-          szNum[0] = 0;
-          while ( isDecNumChar(ch) && (k < 3*sizeof(int) + 1) )
-          {
-            szNum[k] = ch;
-            ++k;
-            ch = S.GetAt(pos + len + k + 1);
-          }
-          szNum[k] = 0;
-          while ( (ch != _T(')')) && (ch != 0) )
-          {
-            ++k;
-            ch = S.GetAt(pos + len + k + 1);
-          }
-          const tstr& t = bReverse ? args.GetRArg( _ttoi(szNum) ) : args.GetArg( _ttoi(szNum) );
-          S.Replace( pos, len + k + 2, t.c_str(), t.length() );
-          Cmd.Replace( pos, len + k + 2, t.c_str(), t.length() );
-          pos += t.length();
-          break;
-        }
-        default:
-        {
-          pos += len;
-          break;
-        }
+        S = args.Arg(1);
       }
-      
-      int pos0 = pos;
-      if ( (pos = S.Find(MACRO_RARGV, pos0)) >= 0 )
+    }
+    
+    if ( S.length() > 0 )
+    {
+      int i;
+      while ( (i = S.Find(_T("$("))) >= 0 )
       {
-        len = len2;
-        bReverse = true;
+        int j = S.Find(_T(')'), i + 1);
+        if ( j > 0 )
+          S.Delete(i, j - i + 1);
+        else
+          S.Delete(i, -1);
       }
-      else if ( (pos = S.Find(MACRO_ARGV, pos0)) >= 0 )
+    }
+
+    if ( (nCmdType == CScriptEngine::CMDTYPE_SET) || 
+         (nCmdType == CScriptEngine::CMDTYPE_UNSET) )
+    {
+      if (args.GetArgCount() == 2)
       {
-        len = len1;
-        bReverse = false;
+        S.Insert( 0, _T("=") );
+        S.Insert( 0, args.Arg(0) );
       }
     }
   }
+  else
+  {
+    
+    Runtime::GetLogger().Add(   _T("; the function is disabled") );  
+
+  }
 
-  Runtime::GetLogger().AddEx( _T("[out] \"%s\""), Cmd.c_str() );
-  Runtime::GetLogger().DecIndentLevel();
-  Runtime::GetLogger().Add(   _T("}") );
+  if ( Runtime::GetLogger().IsLogging() )
+  {
+    Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
+    Runtime::GetLogger().DecIndentLevel();
+    Runtime::GetLogger().Add(   _T("}") );
+  }
 
 }
 
-void CNppExecMacroVars::CheckCmdAliases(tstr& S, bool useLogging)
+bool CNppExecMacroVars::CheckAllMacroVars(CScriptEngine* pScriptEngine, tstr& S, bool useLogging, int nCmdType )
 {
-    if ( useLogging )
+    bool bResult = false;
+    
+    if ( (nCmdType == CScriptEngine::CMDTYPE_SET) ||
+         (nCmdType == CScriptEngine::CMDTYPE_UNSET) ||
+         ContainsMacroVar(S) )
     {
-        Runtime::GetLogger().Add(   _T("CheckCmdAliases()") );
-        Runtime::GetLogger().Add(   _T("{") );
-        Runtime::GetLogger().IncIndentLevel();
-    }
+        CScriptEngine::CProfileScope profileScope(CScriptEngine::pcMacroVars);
 
-    if ( !m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOCMDALIASES) )
-    {
-        if ( useLogging )
+        // Activate() locks the logger's thread states, not needed when not logging
+        const bool isLoggingSuppressed = ( !useLogging && Runtime::GetLogger().IsLogging() );
+        if ( isLoggingSuppressed )
+            Runtime::GetLogger().Activate(false);
+
+        if ( (nCmdType == CScriptEngine::CMDTYPE_SET) ||
+             (nCmdType == CScriptEngine::CMDTYPE_UNSET) )
         {
-            Runtime::GetLogger().Add(   _T("; command aliases enabled") );
-            Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );
+            // the var's name is not a subject of the user's vars substitution
+            MacroVarsExpander(*this, pScriptEngine, MacroVarsExpander::esNppVars | MacroVarsExpander::esPluginVars).Expand(S);
+            bResult = CheckUserMacroVars(pScriptEngine, S, nCmdType); // <-- sets/unsets a var
+            if ( nCmdType != CScriptEngine::CMDTYPE_UNSET ) // <-- required for 'unset $(var)'
+                CheckEmptyMacroVars(m_pNppExec, S, nCmdType);
         }
-        
-        //NppExecHelpers::StrDelLeadingTabSpaces(S);
-        
-        if ( S.length() > 0 )
+        else
         {
-            tstr t = S;
+            unsigned int nScopes = MacroVarsExpander::esAllVars;
+            if ( m_pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOEMPTYVARS) )
+                nScopes |= MacroVarsExpander::esNoEmptyVars;
 
-            if ( t.length() > 0 )
+            if ( Runtime::GetLogger().IsLogging() )
             {
-                NppExecHelpers::StrUpper(t);
+                Runtime::GetLogger().Add(   _T("CheckAllMacroVars()") );
+                Runtime::GetLogger().Add(   _T("{") );
+                Runtime::GetLogger().IncIndentLevel();
+                Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );
+            }
 
-                CCriticalSectionLockGuard lock(GetCsCmdAliases());
-                tMacroVars::const_iterator itrAlias = GetCmdAliases().begin();
-                for ( ; itrAlias != GetCmdAliases().end(); ++itrAlias )
-                {
-                    const tstr& aliasName = itrAlias->first;
-                    const int len = aliasName.length();
-                    if ( (len > 0) &&
-                         (c_base::_tstr_unsafe_cmpn(aliasName.c_str(), t.c_str(), len) == 0) )
-                    {
-                        const TCHAR ch = t.GetAt(len);
-                        if ( IsTabSpaceOrEmptyChar(ch) )
-                        {
-                            const tstr& aliasValue = itrAlias->second;
-                            S.Replace( 0, len, aliasValue.c_str(), aliasValue.length() );
-                            break;
-                        }
-                    }
-                }
+            MacroVarsExpander(*this, pScriptEngine, nScopes).Expand(S);
+            bResult = true;
+
+            if ( Runtime::GetLogger().IsLogging() )
+            {
+                Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
+                Runtime::GetLogger().DecIndentLevel();
+                Runtime::GetLogger().Add(   _T("}") );
             }
         }
 
-        if ( useLogging )
-        {
-            Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
-        }
-    }
-    else
-    {
-        if ( useLogging )
-        {
-            Runtime::GetLogger().Add(   _T("; command aliases disabled") );
-        }
+        if ( isLoggingSuppressed )
+            Runtime::GetLogger().Activate(true);
     }
 
-    if ( useLogging )
-    {
-        Runtime::GetLogger().DecIndentLevel();
-        Runtime::GetLogger().Add(   _T("}") );
-    }
+    return bResult;
 }
 
-void CNppExecMacroVars::CheckNppMacroVars(tstr& S)
+bool CNppExecMacroVars::SetUserMacroVar(CScriptEngine* pScriptEngine, tstr& varName, const tstr& varValue, unsigned int nFlags )
 {
-  const int    NPPVAR_COUNT = 7 + 2;
-  const TCHAR* NPPVAR_STRINGS[NPPVAR_COUNT] = {
-    MACRO_FILE_FULLPATH,
-    MACRO_FILE_DIRPATH,
-    MACRO_FILE_FULLNAME,
-    MACRO_FILE_NAMEONLY,
-    MACRO_FILE_EXTONLY,
-    MACRO_NPP_DIRECTORY,
-    MACRO_CURRENT_WORD,
-    
-    MACRO_CURRENT_LINE,   // (int) line number
-    MACRO_CURRENT_COLUMN  // (int) column number
-  };
-  const UINT   NPPVAR_MESSAGES[NPPVAR_COUNT] = {
-    NPPM_GETFULLCURRENTPATH,
-    NPPM_GETCURRENTDIRECTORY,
-    NPPM_GETFILENAME,
-    NPPM_GETNAMEPART,
-    NPPM_GETEXTPART,
-    NPPM_GETNPPDIRECTORY,
-    NPPM_GETCURRENTWORD,
-    
-    NPPM_GETCURRENTLINE,
-    NPPM_GETCURRENTCOLUMN
-  };
-  
-  Runtime::GetLogger().Add(   _T("CheckNppMacroVars()") );
-  Runtime::GetLogger().Add(   _T("{") );
-  Runtime::GetLogger().IncIndentLevel();
-  Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );
-  
-  if ( ContainsMacroVar(S) )
-  {
-    tstr Cmd = S;
-    NppExecHelpers::StrUpper(Cmd);
-
-    const int MACRO_SIZE = CONSOLECOMMAND_BUFSIZE;
-    TCHAR     szMacro[MACRO_SIZE];
-
-    for (int j = 0; j < NPPVAR_COUNT; j++)
-    {
-      const TCHAR* macro_str = NPPVAR_STRINGS[j];
-      const int    macro_len = lstrlen(macro_str);
-
-      int  len = -1;
-      int  pos = 0;
-      while ( (pos = Cmd.Find(macro_str, /*macro_len,*/ pos)) >= 0 )
-      {
-        if (len < 0)
-        {
-          szMacro[0] = 0;
-          if (j < 7)
-          {
-            m_pNppExec->SendNppMsg(NPPVAR_MESSAGES[j], 
-              (WPARAM) (MACRO_SIZE - 1), (LPARAM) szMacro);
-          }
-          else
-          {
-            int nn = (int) m_pNppExec->SendNppMsg(NPPVAR_MESSAGES[j], 0, 0);
-            wsprintf(szMacro, _T("%d"), nn);
-          }
-          len = lstrlen(szMacro);
-        }
-        S.Replace(pos, macro_len, szMacro, len);
-        Cmd.Replace(pos, macro_len, szMacro, len);
-        pos += len;
-      }
-    }
-  }
-
-  Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
-  Runtime::GetLogger().DecIndentLevel();
-  Runtime::GetLogger().Add(   _T("}") );
-  
-}
+  bool bSuccess = false;
 
-void CNppExecMacroVars::CheckPluginMacroVars(tstr& S)
-{
-  
-  Runtime::GetLogger().Add(   _T("CheckPluginMacroVars()") );
-  Runtime::GetLogger().Add(   _T("{") );
-  Runtime::GetLogger().IncIndentLevel();
-  Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );  
+  if ( varName.length() > 0 )
+  {
+    if ( varName.StartsWith(_T("$(")) == false )
+      varName.Insert(0, _T("$("));
+    if ( varName.GetLastChar() != _T(')') )
+      varName.Append(_T(')'));
     
-  if ( ContainsMacroVar(S) )
-  {
-    tstr Cmd = S;
-    NppExecHelpers::StrUpper(Cmd);
-
-    tstr      sub;
-    int       len;
-    int       pos;
-    bool      bMacroOK;
-    const int MACRO_SIZE = 0x200;
-    TCHAR     szMacro[MACRO_SIZE];
+    NppExecHelpers::StrUpper(varName);
 
-    bMacroOK = false;
-    len = lstrlen(MACRO_DOCNUMBER); // "$(#"
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_DOCNUMBER, pos)) >= 0)
     {
-      int   k;
-      tstr  snum = _T("");
-      
-      for (k = pos + len; k < Cmd.length(); k++)
+      CCriticalSectionLockGuard lock(GetCsUserMacroVars());
+      tMacroVars& macroVars = (nFlags & svLocalVar) != 0 ? GetUserLocalMacroVars(pScriptEngine) : GetUserMacroVars();
+      tMacroVars::iterator itrVar = macroVars.find(varName);
+      if ( itrVar != macroVars.end() )
       {
-        if (isDecNumChar(Cmd[k]))
-          snum += Cmd[k];
+        // existing variable
+        if ( (nFlags & svRemoveVar) == 0 )
+          itrVar->second = varValue;
         else
-          break;
+          macroVars.erase(itrVar);
+        bSuccess = true;
       }
-      for (; k < Cmd.length(); k++)
+      else if ( (nFlags & svRemoveVar) == 0 )
       {
-        if (Cmd[k] == _T(')'))
-          break;
+        // new variable
+        macroVars[varName] = varValue;
+        bSuccess = true;
       }
-      k -= pos;
-      Cmd.Delete(pos, k+1);
-      S.Delete(pos, k+1);
 
-      if (snum.length() > 0)
+      if ( bSuccess && ((nFlags & svLocalVar) == 0) )
       {
-        k = _ttoi(snum.c_str());
-        if (k > 0) 
-        {
-          // #doc = 1..nbFiles
-          if (!bMacroOK)
-          {
-            m_pNppExec->nppGetOpenFileNames();
-            bMacroOK = true;
-          }
-          if (k <= m_pNppExec->npp_nbFiles)
-          {
-            lstrcpy(szMacro, m_pNppExec->npp_bufFileNames[k-1]);
-            Cmd.Insert(pos, szMacro);
-            S.Insert(pos, szMacro);
-            pos += lstrlen(szMacro);
-          }
-        }
-        else if (k == 0)
-        {
-          // #doc = 0 means notepad++ full path
-          ::GetModuleFileName(NULL, szMacro, MACRO_SIZE-1);
-          Cmd.Insert(pos, szMacro);
-          S.Insert(pos, szMacro);
-          pos += lstrlen(szMacro);
-        }
+        // the readers' snapshots are outdated now
+        m_dwUserMacroVarsWriterThreadId = ::GetCurrentThreadId();
+        ::InterlockedIncrement(&m_nUserMacroVarsVersion);
       }
-
     }
+  }
 
-    sub.Clear();
-    len = lstrlen(MACRO_SYSVAR);
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_SYSVAR, pos)) >= 0)
+  if ( bSuccess )
+  {
+    // handling "special" variables
+    if ( (varName == MACRO_EXIT_CMD) || (varName == MACRO_EXIT_CMD_SILENT) )
     {
-      bool bSysVarOK = false;
-      int  i1 = pos + len;
-      int  i2 = i1;
-      while ((i2 < Cmd.length()) && (Cmd[i2] != _T(')')))  ++i2;
-      sub.Copy(Cmd.c_str() + i1, i2 - i1);
-      if (sub.length() > 0)
-      {
-        tstr sValue = NppExecHelpers::GetEnvironmentVariable(sub);
-        if (!sValue.IsEmpty())
-        {
-          Cmd.Replace(pos, i2 - pos + 1, sValue);
-          S.Replace(pos, i2 - pos + 1, sValue);
-          pos += sValue.length();
-          bSysVarOK = true;
-        }
-      }
-      if (!bSysVarOK)
+      // we need it for the both "set" and "unset"
+      
+      if ( (nFlags & svRemoveVar) == 0 )
       {
-        Cmd.Replace(pos, i2 - pos + 1, _T(""), 0);
-        S.Replace(pos, i2 - pos + 1, _T(""), 0);
+        // either @EXIT_CMD or @EXIT_CMD_SILENT can exist
+        tstr pairVarName;
+        if ( varName == MACRO_EXIT_CMD )
+          pairVarName = MACRO_EXIT_CMD_SILENT;
+        else
+          pairVarName = MACRO_EXIT_CMD;
+        SetUserMacroVar(pScriptEngine, pairVarName, varValue, (nFlags & svLocalVar) | svRemoveVar); // remove the other one
       }
-    }
-    
-    len = lstrlen(MACRO_LEFT_VIEW_FILE);
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_LEFT_VIEW_FILE, pos)) >= 0)
-    {
-      int ind = (int) m_pNppExec->SendNppMsg(NPPM_GETCURRENTDOCINDEX, MAIN_VIEW, MAIN_VIEW);
-      if (m_pNppExec->nppGetOpenFileNamesInView(PRIMARY_VIEW, ind + 1) == ind + 1)
+
+      std::shared_ptr<CScriptEngine> pParentScriptEngine;
+      bool bShareLocalVars = false;
+
+      if ( pScriptEngine != nullptr )
       {
-        Cmd.Replace(pos, len, m_pNppExec->npp_bufFileNames.GetAt(ind));
-        S.Replace(pos, len, m_pNppExec->npp_bufFileNames.GetAt(ind));
-        pos += lstrlen(m_pNppExec->npp_bufFileNames.GetAt(ind));
+        pScriptEngine->SetTriedExitCmd(false);
+        bShareLocalVars = pScriptEngine->IsSharingLocalVars();
+        pParentScriptEngine = pScriptEngine->GetParentScriptEngine();
       }
       else
       {
-        Cmd.Replace(pos, len, _T(""), 0);
-        S.Replace(pos, len, _T(""), 0);
+        std::shared_ptr<CScriptEngine> pRunningScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine();
+        if ( pRunningScriptEngine )
+        {
+          pRunningScriptEngine->SetTriedExitCmd(false);
+          bShareLocalVars = pRunningScriptEngine->IsSharingLocalVars();
+          pParentScriptEngine = pRunningScriptEngine->GetParentScriptEngine();
+        }
       }
-    }
 
-    len = lstrlen(MACRO_RIGHT_VIEW_FILE);
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_RIGHT_VIEW_FILE, pos)) >= 0)
-    {
-      int ind = (int) m_pNppExec->SendNppMsg(NPPM_GETCURRENTDOCINDEX, SUB_VIEW, SUB_VIEW);
-      if (m_pNppExec->nppGetOpenFileNamesInView(SECOND_VIEW, ind + 1) == ind + 1)
-      {
-        Cmd.Replace(pos, len, m_pNppExec->npp_bufFileNames.GetAt(ind));
-        S.Replace(pos, len, m_pNppExec->npp_bufFileNames.GetAt(ind));
-        pos += lstrlen(m_pNppExec->npp_bufFileNames.GetAt(ind));
-      }
-      else
+      while ( pParentScriptEngine && bShareLocalVars )
       {
-        Cmd.Replace(pos, len, _T(""), 0);
-        S.Replace(pos, len, _T(""), 0);
+        pParentScriptEngine->SetTriedExitCmd(false);
+        bShareLocalVars = pParentScriptEngine->IsSharingLocalVars();
+        pParentScriptEngine = pParentScriptEngine->GetParentScriptEngine();
       }
     }
+  }
 
-    len = lstrlen(MACRO_CURRENT_WORKING_DIR);
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_CURRENT_WORKING_DIR, pos)) >= 0)
-    {
-      TCHAR szPath[FILEPATH_BUFSIZE];
-      DWORD dwLen;
+  return bSuccess;
+}
 
-      szPath[0] = 0;
-      dwLen = GetCurrentDirectory(FILEPATH_BUFSIZE - 1, szPath);
-      Cmd.Replace(pos, len, szPath);
-      S.Replace(pos, len, szPath);
-      pos += (int) dwLen;
-    }
-    
-    len = lstrlen(MACRO_PLUGINS_CONFIG_DIR);
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_PLUGINS_CONFIG_DIR, pos)) >= 0)
-    {
-      Cmd.Replace(pos, len, m_pNppExec->getConfigPath());
-      S.Replace(pos, len, m_pNppExec->getConfigPath());
-      pos += lstrlen(m_pNppExec->getConfigPath());
-    }
+bool CNppExecMacroVars::MoveToUserMacroVar(CScriptEngine* pScriptEngine, tstr& varName, tstr& varValue, unsigned int nFlags )
+{
+  // the same as SetUserMacroVar(), but the value is swapped rather than
+  // copied, so assigning e.g. a multi-megabyte $(OUTPUT) does not copy it
+  if ( (varName.length() == 0) || ((nFlags & svRemoveVar) != 0) )
+    return SetUserMacroVar(pScriptEngine, varName, varValue, nFlags);
 
-    sub.Clear(); // clipboard text will be here
-    bMacroOK = false;
-    len = lstrlen(MACRO_CLIPBOARD_TEXT);
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_CLIPBOARD_TEXT, pos)) >= 0)
-    {
-      if (!bMacroOK)
-      {
-        sub = NppExecHelpers::GetClipboardText();
-        bMacroOK = true;
-      }
+  if ( varName.StartsWith(_T("$(")) == false )
+    varName.Insert(0, _T("$("));
+  if ( varName.GetLastChar() != _T(')') )
+    varName.Append(_T(')'));
 
-      Cmd.Replace(pos, len, sub.c_str());
-      S.Replace(pos, len, sub.c_str());
-      pos += sub.length();
-    }
+  NppExecHelpers::StrUpper(varName);
 
-    sub.Clear(); // hwnd will be here
-    bMacroOK = false;
-    len = lstrlen(MACRO_NPP_HWND);
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_NPP_HWND, pos)) >= 0)
-    {
-      if (!bMacroOK)
-      {
-        #ifdef _WIN64
-          c_base::_tuint64_to_strhex((unsigned __int64)(UINT_PTR)(m_pNppExec->m_nppData._nppHandle), szMacro);
-        #else
-          c_base::_tuint2strhex((unsigned int)(UINT_PTR)(m_pNppExec->m_nppData._nppHandle), szMacro);
-        #endif
-        sub = _T("0x");
-        sub += szMacro;
-        bMacroOK = true;
-      }
+  if ( (varName == MACRO_EXIT_CMD) || (varName == MACRO_EXIT_CMD_SILENT) )
+    return SetUserMacroVar(pScriptEngine, varName, varValue, nFlags); // handles these "special" variables
 
-      Cmd.Replace(pos, len, sub.c_str());
-      S.Replace(pos, len, sub.c_str());
-      pos += sub.length();
-    }
+  CCriticalSectionLockGuard lock(GetCsUserMacroVars());
+  tMacroVars& macroVars = (nFlags & svLocalVar) != 0 ? GetUserLocalMacroVars(pScriptEngine) : GetUserMacroVars();
+  macroVars[varName].Swap(varValue);
 
-    sub.Clear(); // hwnd will be here
-    bMacroOK = false;
-    len = lstrlen(MACRO_SCI_HWND);
-    pos = 0;
-    while ((pos = Cmd.Find(MACRO_SCI_HWND, pos)) >= 0)
-    {
-      if (!bMacroOK)
-      {
-        #ifdef _WIN64
-          c_base::_tuint64_to_strhex((unsigned __int64)(UINT_PTR)(m_pNppExec->GetScintillaHandle()), szMacro);
-        #else
-          c_base::_tuint2strhex((unsigned int)(UINT_PTR)(m_pNppExec->GetScintillaHandle()), szMacro);
-        #endif
-        sub = _T("0x");
-        sub += szMacro;
-        bMacroOK = true;
-      }
+  if ( (nFlags & svLocalVar) == 0 )
+  {
+    // the readers' snapshots are outdated now
+    m_dwUserMacroVarsWriterThreadId = ::GetCurrentThreadId();
+    ::InterlockedIncrement(&m_nUserMacroVarsVersion);
+  }
+
+  return true;
+}
+
+// returns true if the key is an integer, then nIndex is 0-based (maybe out of range)
+static bool isMacroVarItemIndex(const tstr& key, int nCount, int& nIndex)
+{
+    int i = (key.GetFirstChar() == _T('-')) ? 1 : 0;
+    if ( i == key.length() )
+        return false;
 
-      Cmd.Replace(pos, len, sub.c_str());
-      S.Replace(pos, len, sub.c_str());
-      pos += sub.length();
+    for ( ; i < key.length(); ++i )
+    {
+        if ( !isDecNumChar(key[i]) )
+            return false;
     }
-  }
 
-  Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
-  Runtime::GetLogger().DecIndentLevel();
-  Runtime::GetLogger().Add(   _T("}") );
+    const int n = _ttoi(key.c_str());
+    nIndex = (n > 0) ? (n - 1) : (nCount + n); // [0] is out of range
+    return true;
+}
+
+// returns the 0-based index of the item or -1
+static int findMacroVarItem(const CNppExecMacroVars::tMacroVarItems& items, const tstr& key)
+{
+    const int nCount = static_cast<int>(items.Values.size());
+    int nIndex = -1;
+    if ( isMacroVarItemIndex(key, nCount, nIndex) )
+        return ( (nIndex >= 0 && nIndex < nCount) ? nIndex : -1 );
 
+    CStrHashMapT<TCHAR, int>::const_iterator itrKey = items.KeyIndex.find(key);
+    return ( (itrKey != items.KeyIndex.end()) ? itrKey->second : -1 );
 }
 
-bool CNppExecMacroVars::CheckUserMacroVars(CScriptEngine* pScriptEngine, tstr& S, int nCmdType )
+bool CNppExecMacroVars::IsMacroVarItemName(const tstr& varName)
 {
-  bool bResult = true;
-  
-  Runtime::GetLogger().Add(   _T("CheckUserMacroVars()") );
-  Runtime::GetLogger().Add(   _T("{") );
-  Runtime::GetLogger().IncIndentLevel();
-  Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );
-    
-  if ( nCmdType == CScriptEngine::CMDTYPE_SET )
-  {
-    
-    Runtime::GetLogger().AddEx( _T("; %s command found"), CScriptEngine::DoSetCommand::Name() );
-      
-    const TCHAR* DEF_OP  = _T("=");
-    const TCHAR* CALC_OP = _T("~");
-    const int i1 = S.Find(DEF_OP);    
-    const int i2 = S.Find(CALC_OP);
-    const bool bSep1 = ((i1 < i2 && i1 >= 0) || (i2 < 0));
-    const TCHAR* sep = bSep1 ? DEF_OP : CALC_OP;
-    CStrSplitT<TCHAR> args;
+    // "arr[key]" or "$(arr[key])"
+    const bool isDollarVar = varName.StartsWith(_T("$(")) && (varName.GetLastChar() == _T(')'));
+    const int nLastPos = varName.length() - (isDollarVar ? 2 : 1);
+    return ( (varName.Find(_T('[')) > (isDollarVar ? 2 : 0)) && (varName.GetAt(nLastPos) == _T(']')) );
+}
 
-    if ( args.Split(S, sep, 2) == 2 )
-    {
-      tstr& varName = args.Arg(0);
-      tstr& varValue = args.Arg(1);
-      NppExecHelpers::StrDelLeadingTabSpaces(varName);
-      NppExecHelpers::StrDelTrailingTabSpaces(varName);
-      NppExecHelpers::StrDelLeadingTabSpaces(varValue);
-      NppExecHelpers::StrDelTrailingTabSpaces(varValue);
+void CNppExecMacroVars::ExpandMacroVarItemKey(CScriptEngine* pScriptEngine, tstr& varName)
+{
+    // the same substitution as in $(arr[$(k)]), so a computed key can be read back
+    const int i = varName.Find(_T('['));
+    const int j = varName.RFind(_T(']'));
+    if ( (i < 0) || (j <= i) )
+        return;
 
-      if ( ContainsMacroVar(varValue) )
-      {
-        CheckUserMacroVars(pScriptEngine, varValue);
-        CheckEmptyMacroVars(m_pNppExec, varValue);
-      
-        {
-          CCriticalSectionLockGuard lock(GetCsUserMacroVars());
-          const tMacroVars& userLocalMacroVars = GetUserLocalMacroVars(pScriptEngine);
-          const tMacroVars& userMacroVars = GetUserMacroVars();
-          IterateUserMacroVars<SubstituteMacroVarFunc>(userMacroVars, userLocalMacroVars, SubstituteMacroVarFunc(varValue));
-        }
-      }
+    tstr key;
+    key.Copy( varName.c_str() + i + 1, j - i - 1 );
+    if ( !ContainsMacroVar(key) )
+        return;
 
-      if ( !bSep1 )
-      {
-        StrCalc(varValue, m_pNppExec).Process();
-      }
+    MacroVarsExpander(*this, pScriptEngine, MacroVarsExpander::esUserVars).Expand(key);
+    varName.Replace( i + 1, j - i - 1, key.c_str(), key.length() );
+}
 
-      bool bLocalVar = IsLocalMacroVar(varName);
+bool CNppExecMacroVars::SetUserMacroVarItem(CScriptEngine* pScriptEngine, tstr& varName, const tstr& varValue, unsigned int nFlags )
+{
+  tstr arrName;
+  tstr key;
+  bool hasKey = false;
 
-      S = bLocalVar ? _T("local ") : _T("");
-      S += varName;
-      S += _T(" = ");
-      S += varValue;
+  if ( varName.StartsWith(_T("$(")) && (varName.GetLastChar() == _T(')')) )
+  {
+    varName.Delete(varName.length() - 1);
+    varName.Delete(0, 2);
+  }
 
-      if ( SetUserMacroVar(pScriptEngine, varName, varValue, bLocalVar ? CNppExecMacroVars::svLocalVar : 0) )
-      {
-        
-          Runtime::GetLogger().AddEx( _T("; OK: %s%s = %s"), bLocalVar ? _T("local ") : _T(""), varName.c_str(), varValue.c_str() );
+  const int i = varName.Find(_T('['));
+  if ( (i > 0) && (varName.GetLastChar() == _T(']')) )
+  {
+    arrName.Copy( varName.c_str(), i );
+    key.Copy( varName.c_str() + i + 1, varName.length() - i - 2 );
+    hasKey = true;
+  }
+  else if ( nFlags & svRemoveVar )
+    arrName = varName; // "unset arr" removes the whole array
+  else
+    return false;
 
-      }
-      else
-      {
+  varName.Insert(0, _T("$("));
+  varName.Append(_T(')'));
+  NppExecHelpers::StrUpper(varName);
 
-        Runtime::GetLogger().AddEx( _T("; failed to set %s%s = %s"), bLocalVar ? _T("local ") : _T(""), varName.c_str(), varValue.c_str() );
+  NppExecHelpers::StrDelTrailingTabSpaces(arrName);
+  NppExecHelpers::StrDelLeadingTabSpaces(key);
+  NppExecHelpers::StrDelTrailingTabSpaces(key);
+  if ( arrName.IsEmpty() )
+    return false;
 
-        bResult = false;
+  if ( arrName.StartsWith(_T("$(")) == false )
+    arrName.Insert(0, _T("$("));
+  if ( arrName.GetLastChar() != _T(')') )
+    arrName.Append(_T(')'));
+  NppExecHelpers::StrUpper(arrName);
+  NppExecHelpers::StrUpper(key);
 
-      }
+  CCriticalSectionLockGuard lock(GetCsUserMacroVars());
+
+  tMacroVarArrays& macroArrays = (nFlags & svLocalVar) != 0 ? GetUserLocalMacroArrays(pScriptEngine) : GetUserMacroArrays();
+  tMacroVarArrays::iterator itrArr = macroArrays.find(arrName);
+  int nIndex = -1;
+
+  if ( hasKey )
+  {
+    // a plain var such as $(INPUT[1]) or $(EXITCODE[1]) takes precedence
+    tstr plainName;
+    plainName.Copy( arrName.c_str(), arrName.length() - 1 );
+    plainName += _T('[');
+    plainName += key;
+    plainName += _T("])");
+    const tMacroVars& macroVars = (nFlags & svLocalVar) != 0 ? GetUserLocalMacroVars(pScriptEngine) : GetUserMacroVars();
+    if ( macroVars.find(plainName) != macroVars.end() )
+      return SetUserMacroVar(pScriptEngine, plainName, varValue, nFlags);
+
+    // "set x[1] = v" without the array x sets the plain var $(X[1]), as before the arrays
+    if ( (itrArr == macroArrays.end()) && ((nFlags & svRemoveVar) == 0) && isMacroVarItemIndex(key, 0, nIndex) )
+      return SetUserMacroVar(pScriptEngine, plainName, varValue, nFlags);
+  }
+
+  if ( nFlags & svRemoveVar )
+  {
+    if ( itrArr == macroArrays.end() )
+      return false;
+
+    if ( key.IsEmpty() )
+    {
+      macroArrays.erase(itrArr);
+      return true;
     }
-    else
+
+    nIndex = findMacroVarItem(*itrArr->second, key);
+    if ( nIndex < 0 )
+      return false;
+  }
+  else if ( !key.IsEmpty() )
+  {
+    const int nCount = (itrArr != macroArrays.end()) ? static_cast<int>(itrArr->second->Values.size()) : 0;
+    if ( isMacroVarItemIndex(key, nCount, nIndex) )
     {
-      // "set $(var)" returns the value of var
-      // "set" returns all vars and values
+      if ( (nIndex < 0) || (nIndex >= nCount) )
+        return false; // no such item, use "set arr[] = x" to add one
     }
+    else if ( itrArr != macroArrays.end() )
+      nIndex = findMacroVarItem(*itrArr->second, key);
   }
-  else if ( nCmdType == CScriptEngine::CMDTYPE_UNSET )
+
+  if ( itrArr == macroArrays.end() )
   {
-    
-    Runtime::GetLogger().AddEx( _T("; %s command found"), CScriptEngine::DoUnsetCommand::Name() );
+    PMacroVarItems& pNewItems = macroArrays[arrName];
+    pNewItems = std::make_shared<tMacroVarItems>();
+    itrArr = macroArrays.find(arrName);
+  }
 
-    tstr varName = S;
-    int k = varName.Find( _T("=") );
-    if ( k >= 0 )  varName.SetSize(k);
-    NppExecHelpers::StrDelLeadingTabSpaces(varName);
-    NppExecHelpers::StrDelTrailingTabSpaces(varName);
+  PMacroVarItems& pItems = itrArr->second;
+  if ( pItems.use_count() > 1 )
+  {
+    // copy-on-write: e.g. the parent script or FOR EACH still uses the items
+    pItems = std::make_shared<tMacroVarItems>(*pItems);
+  }
 
-    bool bLocalVar = IsLocalMacroVar(varName);
-    unsigned int nFlags = CNppExecMacroVars::svRemoveVar;
-    if ( bLocalVar )
-        nFlags |= CNppExecMacroVars::svLocalVar;
-    if ( SetUserMacroVar(pScriptEngine, varName, S, nFlags) )
+  tMacroVarItems& items = *pItems;
+  if ( nFlags & svRemoveVar )
+  {
+    items.Keys.erase( items.Keys.begin() + nIndex );
+    items.Values.erase( items.Values.begin() + nIndex );
+    items.KeyIndex.clear();
+    for ( int k = 0; k < static_cast<int>(items.Keys.size()); ++k )
     {
+      if ( !items.Keys[k].IsEmpty() )
+        items.KeyIndex[items.Keys[k]] = k;
+    }
+  }
+  else if ( nIndex >= 0 )
+  {
+    items.Values[nIndex] = varValue;
+  }
+  else
+  {
+    if ( !key.IsEmpty() )
+      items.KeyIndex[key] = static_cast<int>(items.Values.size());
+    items.Keys.push_back(key);
+    items.Values.push_back(varValue);
+  }
 
-      Runtime::GetLogger().AddEx( _T("; OK: %s%s has been removed"), bLocalVar ? _T("local ") : _T(""), varName.c_str() );
+  return true;
+}
 
-      tstr t = _T("- the user\'s ");
-      if ( bLocalVar ) t += _T("local ");
-      t += _T("variable has been removed: ");
-      t += varName;
-      m_pNppExec->GetConsole().PrintMessage( t.c_str() /*, false*/ );
-    }
-    else
-    {
+bool CNppExecMacroVars::GetUserMacroVarItem(CScriptEngine* pScriptEngine, const tstr& varNameUpper, tstr& Out)
+{
+  // "$(NAME[KEY])" or "$(NAME.COUNT)"
+  const TCHAR* const COUNT_SUFFIX = _T(".COUNT)");
+  const int nCountSuffixLen = lstrlen(COUNT_SUFFIX);
+  const int len = varNameUpper.length();
+  tstr arrName;
+  tstr key;
+  bool isCount = false;
 
-      Runtime::GetLogger().AddEx( _T("; failed to unset %s%s (no such user\'s variable)"), bLocalVar ? _T("local ") : _T(""), varName.c_str() );
+  if ( varNameUpper.GetAt(len - 2) == _T(']') )
+  {
+    const int i = varNameUpper.Find(_T('['));
+    if ( i <= 2 )
+      return false;
+    arrName.Copy( varNameUpper.c_str(), i );
+    key.Copy( varNameUpper.c_str() + i + 1, len - i - 3 );
+    NppExecHelpers::StrDelLeadingTabSpaces(key);
+    NppExecHelpers::StrDelTrailingTabSpaces(key);
+  }
+  else if ( (len > nCountSuffixLen + 2) && varNameUpper.EndsWith(COUNT_SUFFIX) )
+  {
+    arrName.Copy( varNameUpper.c_str(), len - nCountSuffixLen );
+    isCount = true;
+  }
+  else
+    return false;
 
-      tstr t = _T("- no such user\'s ");
-      if ( bLocalVar ) t += _T("local ");
-      t += _T("variable: ");
-      t += varName;
-      m_pNppExec->GetConsole().PrintMessage( t.c_str(), false );
+  arrName += _T(')');
 
-      bResult = false;
-    }
+  CCriticalSectionLockGuard lock(GetCsUserMacroVars());
+  const tMacroVarArrays& userLocalMacroArrays = GetUserLocalMacroArrays(pScriptEngine);
+  tMacroVarArrays::const_iterator itrArr = userLocalMacroArrays.find(arrName);
+  if ( itrArr == userLocalMacroArrays.end() )
+  {
+    const tMacroVarArrays& userMacroArrays = GetUserMacroArrays();
+    itrArr = userMacroArrays.find(arrName);
+    if ( itrArr == userMacroArrays.end() )
+      return false;
+  }
+
+  const tMacroVarItems& items = *itrArr->second;
+  if ( isCount )
+  {
+    TCHAR szNum[50];
+    ::wsprintf( szNum, _T("%d"), static_cast<int>(items.Values.size()) );
+    Out += szNum;
+    return true;
   }
-  else if ( ContainsMacroVar(S) )
+
+  const int nIndex = findMacroVarItem(items, key);
+  if ( nIndex < 0 )
+    return false;
+
+  Out += items.Values[nIndex];
+  return true;
+}
+
+std::shared_ptr<const CNppExecMacroVars::tMacroVarItems> CNppExecMacroVars::GetUserMacroVarItems(CScriptEngine* pScriptEngine, const tstr& varName)
+{
+  tstr arrName = varName;
+  if ( arrName.StartsWith(_T("$(")) == false )
+    arrName.Insert(0, _T("$("));
+  if ( arrName.GetLastChar() != _T(')') )
+    arrName.Append(_T(')'));
+  NppExecHelpers::StrUpper(arrName);
+
+  CCriticalSectionLockGuard lock(GetCsUserMacroVars());
+  const tMacroVarArrays& userLocalMacroArrays = GetUserLocalMacroArrays(pScriptEngine);
+  tMacroVarArrays::const_iterator itrArr = userLocalMacroArrays.find(arrName);
+  if ( itrArr != userLocalMacroArrays.end() )
+    return itrArr->second;
+
+  const tMacroVarArrays& userMacroArrays = GetUserMacroArrays();
+  itrArr = userMacroArrays.find(arrName);
+  if ( itrArr != userMacroArrays.end() )
+    return itrArr->second;
+
+  return nullptr;
+}
+
+// The snapshot file of the shared user vars and the command aliases:
+//   header:  signature, format version, sizeof(TCHAR), number of vars, aliases and arrays
+//   vars:    name, value
+//   aliases: name, value
+//   arrays:  name, number of items, then key and value of each item
+// The numbers are DWORDs, a string is its length in TCHARs (DWORD) and its TCHARs.
+const DWORD USERVARS_SNAPSHOT_SIGNATURE = 0x5356584E; // "NXVS"
+const DWORD USERVARS_SNAPSHOT_VERSION = 1;
+
+bool CNppExecMacroVars::SaveToSnapshotFile(const TCHAR* cszFileName)
+{
+  tMacroVars vars;
+  tMacroVarArrays arrays;
+  tMacroVars aliases;
+
   {
+    // the copies share the slots, so the locks are held for O(1)
     CCriticalSectionLockGuard lock(GetCsUserMacroVars());
-    const tMacroVars& userLocalMacroVars = GetUserLocalMacroVars(pScriptEngine);
-    const tMacroVars& userMacroVars = GetUserMacroVars();
-    IterateUserMacroVars<SubstituteMacroVarFunc>(userMacroVars, userLocalMacroVars, SubstituteMacroVarFunc(S));
+    vars = m_UserMacroVars;
+    arrays = m_UserMacroArrays;
+  }
+  {
+    CCriticalSectionLockGuard lock(GetCsCmdAliases());
+    aliases = m_CmdAliases;
+  }
+
+  // the exit commands belong to the current session
+  const TCHAR* const cszSessionVars[] = { MACRO_EXIT_CMD, MACRO_EXIT_CMD_SILENT };
+  for ( const TCHAR* cszVarName : cszSessionVars )
+  {
+    tMacroVars::iterator itrVar = vars.find(cszVarName);
+    if ( itrVar != vars.end() )
+      vars.erase(itrVar);
+  }
+
+  if ( vars.empty() && arrays.empty() && aliases.empty() )
+  {
+    // nothing to restore next time
+    ::DeleteFile(cszFileName);
+    return true;
   }
 
-  Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
-  Runtime::GetLogger().DecIndentLevel();
-  Runtime::GetLogger().Add(   _T("}") );
+  CBufT<char> buf;
+  appendSnapshotDword( buf, USERVARS_SNAPSHOT_SIGNATURE );
+  appendSnapshotDword( buf, USERVARS_SNAPSHOT_VERSION );
+  appendSnapshotDword( buf, static_cast<DWORD>(sizeof(TCHAR)) );
+  appendSnapshotDword( buf, static_cast<DWORD>(vars.size()) );
+  appendSnapshotDword( buf, static_cast<DWORD>(aliases.size()) );
+  appendSnapshotDword( buf, static_cast<DWORD>(arrays.size()) );
 
-  return bResult;
-}
+  const tMacroVars& cvars = vars;
+  for ( const tMacroVars::value_type& var : cvars )
+  {
+    appendSnapshotStr( buf, var.first );
+    appendSnapshotStr( buf, var.second );
+  }
 
-void CNppExecMacroVars::CheckEmptyMacroVars(CNppExec* pNppExec, tstr& S, int nCmdType )
-{
-    
-  Runtime::GetLogger().Add(   _T("CheckEmptyMacroVars()") );
-  Runtime::GetLogger().Add(   _T("{") );
-  Runtime::GetLogger().IncIndentLevel();
-  Runtime::GetLogger().AddEx( _T("[in]  \"%s\""), S.c_str() );   
-    
-  if ( pNppExec->GetOptions().GetBool(OPTB_CONSOLE_NOEMPTYVARS) )
+  const tMacroVars& caliases = aliases;
+  for ( const tMacroVars::value_type& alias : caliases )
   {
-    
-    Runtime::GetLogger().Add(   _T("; the function is enabled") );  
-      
-    CStrSplitT<TCHAR> args;
-    if ( (nCmdType == CScriptEngine::CMDTYPE_SET) || 
-         (nCmdType == CScriptEngine::CMDTYPE_UNSET) )
-    {
-      if ( args.Split(S, _T("="), 2) == 2 )
-      {
-        S = args.Arg(1);
-      }
-    }
-    
-    if ( S.length() > 0 )
-    {
-      int i;
-      while ( (i = S.Find(_T("$("))) >= 0 )
-      {
-        int j = S.Find(_T(')'), i + 1);
-        if ( j > 0 )
-          S.Delete(i, j - i + 1);
-        else
-          S.Delete(i, -1);
-      }
-    }
+    appendSnapshotStr( buf, alias.first );
+    appendSnapshotStr( buf, alias.second );
+  }
 
-    if ( (nCmdType == CScriptEngine::CMDTYPE_SET) || 
-         (nCmdType == CScriptEngine::CMDTYPE_UNSET) )
+  const tMacroVarArrays& carrays = arrays;
+  for ( const tMacroVarArrays::value_type& arr : carrays )
+  {
+    const tMacroVarItems& items = *arr.second;
+    appendSnapshotStr( buf, arr.first );
+    appendSnapshotDword( buf, static_cast<DWORD>(items.Values.size()) );
+    for ( size_t k = 0; k < items.Values.size(); ++k )
     {
-      if (args.GetArgCount() == 2)
-      {
-        S.Insert( 0, _T("=") );
-        S.Insert( 0, args.Arg(0) );
-      }
+      appendSnapshotStr( buf, items.Keys[k] );
+      appendSnapshotStr( buf, items.Values[k] );
     }
   }
-  else
-  {
-    
-    Runtime::GetLogger().Add(   _T("; the function is disabled") );  
 
-  }
+  HANDLE hFile = ::CreateFile( cszFileName, GENERIC_WRITE, 0, NULL,
+                               CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+  if ( hFile == INVALID_HANDLE_VALUE )
+    return false;
 
-  Runtime::GetLogger().AddEx( _T("[out] \"%s\""), S.c_str() );
-  Runtime::GetLogger().DecIndentLevel();
-  Runtime::GetLogger().Add(   _T("}") );
+  DWORD dwWritten = 0;
+  const DWORD dwSize = static_cast<DWORD>(buf.GetCount());
+  const bool bSaved = ( ::WriteFile(hFile, buf.GetData(), dwSize, &dwWritten, NULL) && (dwWritten == dwSize) );
+  ::CloseHandle(hFile);
 
+  if ( !bSaved )
+    ::DeleteFile(cszFileName); // a partial snapshot would be rejected anyway
+  return bSaved;
 }
 
-bool CNppExecMacroVars::CheckAllMacroVars(CScriptEngine* pScriptEngine, tstr& S, bool useLogging, int nCmdType )
+bool CNppExecMacroVars::LoadFromSnapshotFile(const TCHAR* cszFileName)
 {
-    bool bResult = false;
-    
-    if ( (nCmdType == CScriptEngine::CMDTYPE_SET) ||
-         (nCmdType == CScriptEngine::CMDTYPE_UNSET) ||
-         ContainsMacroVar(S) )
+  HANDLE hFile = ::CreateFile( cszFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+  if ( hFile == INVALID_HANDLE_VALUE )
+    return false;
+
+  tMacroVars vars;
+  tMacroVars aliases;
+  tMacroVarArrays arrays;
+  bool bLoaded = false;
+
+  const DWORD dwSize = ::GetFileSize(hFile, NULL);
+  if ( (dwSize != INVALID_FILE_SIZE) && (dwSize >= 6*sizeof(DWORD)) )
+  {
+    HANDLE hMapping = ::CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+    if ( hMapping != NULL )
     {
-        if ( !useLogging )
-            Runtime::GetLogger().Activate(false);
+      const char* pData = static_cast<const char*>( ::MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0) );
+      if ( pData != NULL )
+      {
+        CSnapshotReader reader(pData, dwSize);
+        DWORD dwSignature = 0, dwVersion = 0, dwCharSize = 0;
+        DWORD dwVars = 0, dwAliases = 0, dwArrays = 0;
 
-        CheckNppMacroVars(S);
-        CheckPluginMacroVars(S);
-        bResult = CheckUserMacroVars(pScriptEngine, S, nCmdType); // <-- in case of CMDTYPE_SET/UNSET, sets/unsets a var
-        if ( nCmdType != CScriptEngine::CMDTYPE_UNSET ) // <-- required for 'unset $(var)'
-            CheckEmptyMacroVars(m_pNppExec, S, nCmdType);
+        reader.ReadDword(dwSignature);
+        reader.ReadDword(dwVersion);
+        reader.ReadDword(dwCharSize);
+        reader.ReadDword(dwVars);
+        reader.ReadDword(dwAliases);
+        reader.ReadDword(dwArrays);
 
-        if ( !useLogging )
-            Runtime::GetLogger().Activate(true);
+        if ( (dwSignature == USERVARS_SNAPSHOT_SIGNATURE) &&
+             (dwVersion == USERVARS_SNAPSHOT_VERSION) &&
+             (dwCharSize == sizeof(TCHAR)) )
+        {
+          bLoaded = reader.ReadVars(dwVars, vars) &&
+                    reader.ReadVars(dwAliases, aliases) &&
+                    reader.ReadArrays(dwArrays, arrays) &&
+                    reader.IsAtEnd();
+        }
+
+        ::UnmapViewOfFile(pData);
+      }
+      ::CloseHandle(hMapping);
     }
+  }
 
-    return bResult;
-}
+  ::CloseHandle(hFile);
 
-bool CNppExecMacroVars::SetUserMacroVar(CScriptEngine* pScriptEngine, tstr& varName, const tstr& varValue, unsigned int nFlags )
-{
-  bool bSuccess = false;
+  if ( !bLoaded )
+    return false;
 
-  if ( varName.length() > 0 )
+  // the vars that already exist are not overwritten
   {
-    if ( varName.StartsWith(_T("$(")) == false )
-      varName.Insert(0, _T("$("));
-    if ( varName.GetLastChar() != _T(')') )
-      varName.Append(_T(')'));
-    
-    NppExecHelpers::StrUpper(varName);
+    CCriticalSectionLockGuard lock(GetCsUserMacroVars());
 
+    if ( m_UserMacroVars.empty() )
+      m_UserMacroVars.swap(vars);
+    else
     {
-      CCriticalSectionLockGuard lock(GetCsUserMacroVars());
-      tMacroVars& macroVars = (nFlags & svLocalVar) != 0 ? GetUserLocalMacroVars(pScriptEngine) : GetUserMacroVars();
-      tMacroVars::iterator itrVar = macroVars.find(varName);
-      if ( itrVar != macroVars.end() )
-      {
-        // existing variable
-        if ( (nFlags & svRemoveVar) == 0 )
-          itrVar->second = varValue;
-        else
-          macroVars.erase(itrVar);
-        bSuccess = true;
-      }
-      else if ( (nFlags & svRemoveVar) == 0 )
+      for ( tMacroVars::iterator itrVar = vars.begin(); itrVar != vars.end(); ++itrVar )
       {
-        // new variable
-        macroVars[varName] = varValue;
-        bSuccess = true;
+        if ( m_UserMacroVars.find(itrVar->first) == m_UserMacroVars.end() )
+          m_UserMacroVars[itrVar->first].Swap(itrVar->second);
       }
     }
-  }
 
-  if ( bSuccess )
-  {
-    // handling "special" variables
-    if ( (varName == MACRO_EXIT_CMD) || (varName == MACRO_EXIT_CMD_SILENT) )
+    if ( m_UserMacroArrays.empty() )
+      m_UserMacroArrays.swap(arrays);
+    else
     {
-      // we need it for the both "set" and "unset"
-      
-      if ( (nFlags & svRemoveVar) == 0 )
+      for ( tMacroVarArrays::iterator itrArr = arrays.begin(); itrArr != arrays.end(); ++itrArr )
       {
-        // either @EXIT_CMD or @EXIT_CMD_SILENT can exist
-        tstr pairVarName;
-        if ( varName == MACRO_EXIT_CMD )
-          pairVarName = MACRO_EXIT_CMD_SILENT;
-        else
-          pairVarName = MACRO_EXIT_CMD;
-        SetUserMacroVar(pScriptEngine, pairVarName, varValue, (nFlags & svLocalVar) | svRemoveVar); // remove the other one
+        if ( m_UserMacroArrays.find(itrArr->first) == m_UserMacroArrays.end() )
+          m_UserMacroArrays[itrArr->first] = itrArr->second;
       }
+    }
 
-      std::shared_ptr<CScriptEngine> pParentScriptEngine;
-      bool bShareLocalVars = false;
+    // the readers' snapshots are outdated now
+    m_dwUserMacroVarsWriterThreadId = ::GetCurrentThreadId();
+    ::InterlockedIncrement(&m_nUserMacroVarsVersion);
+  }
 
-      if ( pScriptEngine != nullptr )
-      {
-        pScriptEngine->SetTriedExitCmd(false);
-        bShareLocalVars = pScriptEngine->IsSharingLocalVars();
-        pParentScriptEngine = pScriptEngine->GetParentScriptEngine();
-      }
-      else
-      {
-        std::shared_ptr<CScriptEngine> pRunningScriptEngine = m_pNppExec->GetCommandExecutor().GetRunningScriptEngine();
-        if ( pRunningScriptEngine )
-        {
-          pRunningScriptEngine->SetTriedExitCmd(false);
-          bShareLocalVars = pRunningScriptEngine->IsSharingLocalVars();
-          pParentScriptEngine = pRunningScriptEngine->GetParentScriptEngine();
-        }
-      }
+  {
+    CCriticalSectionLockGuard lock(GetCsCmdAliases());
 
-      while ( pParentScriptEngine && bShareLocalVars )
+    if ( m_CmdAliases.empty() )
+      m_CmdAliases.swap(aliases);
+    else
+    {
+      for ( tMacroVars::iterator itrAlias = aliases.begin(); itrAlias != aliases.end(); ++itrAlias )
       {
-        pParentScriptEngine->SetTriedExitCmd(false);
-        bShareLocalVars = pParentScriptEngine->IsSharingLocalVars();
-        pParentScriptEngine = pParentScriptEngine->GetParentScriptEngine();
+        if ( m_CmdAliases.find(itrAlias->first) == m_CmdAliases.end() )
+          m_CmdAliases[itrAlias->first].Swap(itrAlias->second);
       }
     }
   }
+  IncCmdAliasesVersion();
 
-  return bSuccess;
+  return true;
 }
 
 
-CNppExecMacroVars::StrCalc::StrCalc(tstr& varValue, CNppExec* pNppExec)
-  : m_varValue(varValue), m_pNppExec(pNppExec), m_calcType(CT_FPARSER), m_pVar(0)
+CNppExecMacroVars::StrCalc::StrCalc(tstr& varValue, CNppExec* pNppExec, CScriptEngine* pScriptEngine)
+  : m_varValue(varValue), m_pNppExec(pNppExec), m_pScriptEngine(pScriptEngine), m_calcType(CT_FPARSER), m_pVar(0)
 {
 }
 
-void CNppExecMacroVars::StrCalc::Process()
+int CNppExecMacroVars::StrCalc::getCalcType(tstr& param)
 {
-    m_calcType = StrCalc::CT_FPARSER;
-    m_param.Clear();
-        
-    // check for 'strlen', 'strupper', 'strlower', 'substr' and so on
-    m_pVar = m_varValue.c_str();
-    m_pVar = get_param(m_pVar, m_param);
-    if ( m_param.length() > 5 )
+    if ( param.length() > 5 )
     {
         typedef struct sCalcType {
             const TCHAR* szCalcType;
@@ -7145,18 +11814,27 @@ void CNppExecMacroVars::StrCalc::Process()
             { _T("STRTOHEX"),   CT_STRTOHEX   }
         };
 
-        NppExecHelpers::StrUpper(m_param);
+        NppExecHelpers::StrUpper(param);
 
         for ( const tCalcType& ct : arrCalcType )
         {
-            if ( m_param == ct.szCalcType )
-            {
-                m_calcType = ct.nCalcType;
-                break;
-            }
+            if ( param == ct.szCalcType )
+                return ct.nCalcType;
         }
     }
 
+    return CT_FPARSER;
+}
+
+void CNppExecMacroVars::StrCalc::Process()
+{
+    m_param.Clear();
+        
+    // check for 'strlen', 'strupper', 'strlower', 'substr' and so on
+    m_pVar = m_varValue.c_str();
+    m_pVar = get_param(m_pVar, m_param);
+    m_calcType = getCalcType(m_param);
+
     switch ( m_calcType )
     {
         case CT_FPARSER:
@@ -7190,14 +11868,164 @@ void CNppExecMacroVars::StrCalc::Process()
     }
 }
 
+// a character of fparser's names and numbers
+static bool isFParserNameChar(const TCHAR ch)
+{
+    return ( (ch >= _T('0') && ch <= _T('9')) ||
+             (ch >= _T('A') && ch <= _T('Z')) ||
+             (ch >= _T('a') && ch <= _T('z')) ||
+             (ch == _T('_')) || (ch == _T('.')) ||
+             (static_cast<unsigned int>(ch) > 0x7F) );
+}
+
+// a decimal or "0x" number, maybe negative, as fparser would read it;
+// anything else is substituted as text
+static bool getFParserNumber(const tstr& S, double& value, bool& isNegative)
+{
+    const TCHAR* p = S.c_str();
+    isNegative = (*p == _T('-'));
+    if ( isNegative )
+        ++p;
+
+    if ( p[0] == _T('0') && (p[1] == _T('x') || p[1] == _T('X')) )
+    {
+        // up to 13 hex digits are exact in a 'double'
+        unsigned __int64 n = 0;
+        int nDigits = 0;
+        for ( p += 2; *p != 0; ++p, ++nDigits )
+        {
+            unsigned int d = 0;
+            if ( *p >= _T('0') && *p <= _T('9') )
+                d = *p - _T('0');
+            else if ( *p >= _T('A') && *p <= _T('F') )
+                d = *p - _T('A') + 10;
+            else if ( *p >= _T('a') && *p <= _T('f') )
+                d = *p - _T('a') + 10;
+            else
+                return false;
+            n = (n << 4) | d;
+        }
+        if ( nDigits == 0 || nDigits > 13 )
+            return false;
+        value = static_cast<double>(n);
+        return true;
+    }
+
+    if ( !isDecNumChar(*p) && !(*p == _T('.') && isDecNumChar(p[1])) )
+        return false; // e.g. "inf", "+1" or " 1"
+
+    TCHAR* pEnd = NULL;
+    value = _tcstod(p, &pEnd);
+    return ( *pEnd == 0 );
+}
+
+bool CNppExecMacroVars::StrCalc::ProcessWithBoundVars()
+{
+    // strlen, substr and so on are calculated after the substitution
+    get_param(m_varValue.c_str(), m_param);
+    if ( getCalcType(m_param) != CT_FPARSER )
+        return false;
+
+    CNppExecMacroVars& macroVars = m_pNppExec->GetMacroVars();
+    std::vector<tstr> varNames;
+    std::vector<double> varValues;
+    std::vector<bool> varNegatives;
+    tstr Expr;
+    tstr varName;
+    tstr varValue;
+    int nPos = 0;
+    int i;
+
+    while ( (i = m_varValue.Find(_T("$("), nPos)) >= 0 )
+    {
+        const int j = m_varValue.Find(_T(')'), i + 2);
+        if ( j < 0 )
+            return false;
+
+        // nested vars and vars that are a part of a name or a number
+        // (e.g. "$(a)$(b)" or "1e$(n)") are substituted as text
+        const int k = m_varValue.Find(_T("$("), i + 2);
+        if ( (k >= 0 && k < j) ||
+             (i > 0 && isFParserNameChar(m_varValue[i - 1])) ||
+             isFParserNameChar(m_varValue.GetAt(j + 1)) )
+        {
+            return false;
+        }
+
+        varName.Copy( m_varValue.c_str() + i, j - i + 1 );
+        NppExecHelpers::StrUpper(varName);
+
+        int nVar = 0;
+        while ( nVar < static_cast<int>(varNames.size()) && varNames[nVar] != varName )  ++nVar;
+        if ( nVar == static_cast<int>(varNames.size()) )
+        {
+            double value = 0;
+            bool isNegative = false;
+            varValue = varName;
+            MacroVarsExpander(macroVars, m_pScriptEngine, MacroVarsExpander::esUserVars).Expand(varValue);
+            if ( !getFParserNumber(varValue, value, isNegative) )
+                return false;
+
+            varNames.push_back(varName);
+            varValues.push_back(value);
+            varNegatives.push_back(isNegative);
+        }
+
+        // "-" keeps the expression the same as the substituted one, e.g. "-2^2"
+        Expr.Append( m_varValue.c_str() + nPos, i - nPos );
+        if ( varNegatives[nVar] )
+            Expr += _T('-');
+        FParserWrapper::GetBoundVarName(nVar, varValue);
+        Expr += varValue;
+        nPos = j + 1;
+    }
+
+    if ( varNames.empty() )
+        return false;
+
+    Expr.Append( m_varValue.c_str() + nPos, m_varValue.length() - nPos );
+
+    tstr result;
+    if ( !FParserAccess(m_pScriptEngine)->CalculateBound(m_pNppExec, Expr, varValues, result) )
+        return false; // Calculate() reports the error
+
+    if ( Runtime::GetLogger().IsLogging() )
+    {
+        Runtime::GetLogger().AddEx( _T("; fparser calc: \"%s\" (cache hits: %d, misses: %d)"), 
+            Expr.c_str(), FParserWrapper::GetCacheHits(), FParserWrapper::GetCacheMisses() );
+        Runtime::GetLogger().AddEx( _T("; fparser calc result: %s"), result.c_str() );
+    }
+
+    m_varValue.Swap(result);
+    return true;
+}
+
+static DWORD WINAPI FParserPreloadThreadProc(LPVOID lpParam)
+{
+    FParserWrapper::Preload( (CNppExec *) lpParam );
+    return 0;
+}
+
+void CNppExecMacroVars::StrCalc::PreloadFParserConsts(CNppExec* pNppExec)
+{
+    if ( !NppExecHelpers::CreateNewThread(FParserPreloadThreadProc, pNppExec) )
+    {
+        Runtime::GetLogger().Add( _T("; fparser's constants: can not start a new thread") );
+        // they will be read by the first calculation
+    }
+}
+
 void CNppExecMacroVars::StrCalc::calcFParser()
 {
     tstr calcError;
 
-    if ( g_fp.Calculate(m_pNppExec, m_varValue, calcError, m_varValue) )
+    if ( FParserAccess(m_pScriptEngine)->Calculate(m_pNppExec, m_varValue, calcError, m_varValue) )
     {
       
-        Runtime::GetLogger().AddEx( _T("; fparser calc result: %s"), m_varValue.c_str() );
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( _T("; fparser calc result: %s"), m_varValue.c_str() );
+        }
     
     }
     else
@@ -7247,11 +12075,14 @@ void CNppExecMacroVars::StrCalc::calcStrLen()
     c_base::_tint2str( len, szNum );
     m_varValue = szNum;
 
-    Runtime::GetLogger().AddEx( 
-      _T("; strlen%s: %s"), 
-      (m_calcType == CT_STRLEN) ? _T("") : _T("utf8"),
-      m_varValue.c_str() 
-    );
+    if ( Runtime::GetLogger().IsLogging() )
+    {
+        Runtime::GetLogger().AddEx( 
+          _T("; strlen%s: %s"), 
+          (m_calcType == CT_STRLEN) ? _T("") : _T("utf8"),
+          m_varValue.c_str() 
+        );
+    }
 
 }
 
@@ -7265,11 +12096,14 @@ void CNppExecMacroVars::StrCalc::calcStrCase()
         else
             NppExecHelpers::StrLower(m_varValue);
 
-        Runtime::GetLogger().AddEx( 
-          _T("; %s: %s"), 
-          (m_calcType == CT_STRUPPER) ? _T("strupper") : _T("strlower"),
-          m_varValue.c_str() 
-        );
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( 
+              _T("; %s: %s"), 
+              (m_calcType == CT_STRUPPER) ? _T("strupper") : _T("strlower"),
+              m_varValue.c_str() 
+            );
+        }
 
     }
 }
@@ -7322,10 +12156,13 @@ void CNppExecMacroVars::StrCalc::calcSubStr()
                     else
                         m_varValue.Copy(m_pVar + pos, count);
 
-                    Runtime::GetLogger().AddEx( 
-                      _T("; substr: %s"), 
-                      m_varValue.c_str() 
-                    );
+                    if ( Runtime::GetLogger().IsLogging() )
+                    {
+                        Runtime::GetLogger().AddEx( 
+                          _T("; substr: %s"), 
+                          m_varValue.c_str() 
+                        );
+                    }
 
                 }
                 else
@@ -7364,11 +12201,14 @@ void CNppExecMacroVars::StrCalc::calcStrFind()
         c_base::_tint2str( pos, szNum );
         m_varValue = szNum;
 
-        Runtime::GetLogger().AddEx( 
-          _T("; %s: %s"), 
-          (m_calcType == CT_STRFIND) ? _T("strfind") : _T("strrfind"),
-          m_varValue.c_str() 
-        );
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( 
+              _T("; %s: %s"), 
+              (m_calcType == CT_STRFIND) ? _T("strfind") : _T("strrfind"),
+              m_varValue.c_str() 
+            );
+        }
 
     }
     else if ( n < 2 )
@@ -7394,10 +12234,13 @@ void CNppExecMacroVars::StrCalc::calcStrRplc()
         m_varValue = args.GetArg(0);
         m_varValue.Replace( SFind.c_str(), SReplace.c_str() );
 
-        Runtime::GetLogger().AddEx( 
-          _T("; strreplace: %s"), 
-          m_varValue.c_str() 
-        );
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( 
+              _T("; strreplace: %s"), 
+              m_varValue.c_str() 
+            );
+        }
 
     }
     else if ( n < 3 )
@@ -7425,10 +12268,13 @@ void CNppExecMacroVars::StrCalc::calcStrFromHex()
         }
         m_varValue.SetLengthValue(nBytes / sizeof(TCHAR));
 
-        Runtime::GetLogger().AddEx( 
-          _T("; strfromhex: %s"), 
-          m_varValue.c_str() 
-        );
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( 
+              _T("; strfromhex: %s"), 
+              m_varValue.c_str() 
+            );
+        }
 
     }
 }
@@ -7446,10 +12292,13 @@ void CNppExecMacroVars::StrCalc::calcStrToHex()
                                        _T(" "));
         m_varValue.SetLengthValue(nLen);
 
-        Runtime::GetLogger().AddEx( 
-          _T("; strtohex: %s"), 
-          m_varValue.c_str() 
-        );
+        if ( Runtime::GetLogger().IsLogging() )
+        {
+            Runtime::GetLogger().AddEx( 
+              _T("; strtohex: %s"), 
+              m_varValue.c_str() 
+            );
+        }
 
     }
 }
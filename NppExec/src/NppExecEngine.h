@@ -37,6 +37,9 @@ LPTSTR SciTextToLPTSTR(const char* pSciText, HWND hSci); // finally call SciText
 #define SciTextDeleteResultPtr(ptrResult, ptrOriginal) if (ptrResult && ptrResult != ptrOriginal) delete[] ptrResult
 #endif
 
+class CCompiledCondition;
+class FParserWrapper;
+
 class CScriptEngine : public IScriptEngine
 {
     public:
@@ -96,6 +99,16 @@ class CScriptEngine : public IScriptEngine
             CMDTYPE_MESSAGEBOX,
             CMDTYPE_EXIT,
             CMDTYPE_NPESENDMSGBUFLEN,
+            CMDTYPE_WHILE,
+            CMDTYPE_ENDWHILE,
+            CMDTYPE_FOR,
+            CMDTYPE_ENDFOR,
+            CMDTYPE_BREAK,
+            CMDTYPE_CONTINUE,
+            CMDTYPE_NPEBENCHMARK,
+            CMDTYPE_NPEPROFILE,
+            CMDTYPE_PARALLEL,
+            CMDTYPE_JOIN,
 
             CMDTYPE_TOTAL_COUNT
         };
@@ -133,7 +146,8 @@ class CScriptEngine : public IScriptEngine
 
         enum eGetCmdTypeFlags {
             ctfUseLogging   = 0x01,
-            ctfIgnorePrefix = 0x02
+            ctfIgnorePrefix = 0x02,
+            ctfNoErrors     = 0x04
         };
 
     public:
@@ -145,6 +159,7 @@ class CScriptEngine : public IScriptEngine
         // 3. In case of AltName, see what was done for the existing *Command structs
         // 4. Add help info to the CONSOLE_CMD_INFO array (DlgConsole.cpp)
         eCmdResult Do(const tstr& params);
+        eCmdResult DoBreak(const tstr& params);
         eCmdResult DoCd(const tstr& params);
         eCmdResult DoCls(const tstr& params);
         eCmdResult DoClipSetText(const tstr& params);
@@ -152,22 +167,29 @@ class CScriptEngine : public IScriptEngine
         eCmdResult DoConFilter(const tstr& params);
         eCmdResult DoConLoadFrom(const tstr& params);
         eCmdResult DoConSaveTo(const tstr& params);
+        eCmdResult DoContinue(const tstr& params);
         eCmdResult DoDir(const tstr& params);
         eCmdResult DoEcho(const tstr& params);
         eCmdResult DoElse(const tstr& params);
+        eCmdResult DoEndFor(const tstr& params);
         eCmdResult DoEndIf(const tstr& params);
+        eCmdResult DoEndWhile(const tstr& params);
         eCmdResult DoEnvSet(const tstr& params);
         eCmdResult DoEnvUnset(const tstr& params);
         eCmdResult DoExit(const tstr& params);
+        eCmdResult DoFor(const tstr& params);
         eCmdResult DoGoTo(const tstr& params);
         eCmdResult DoIf(const tstr& params);
         eCmdResult DoInputBox(const tstr& params);
+        eCmdResult DoJoin(const tstr& params);
         eCmdResult DoLabel(const tstr& params);
         eCmdResult DoMessageBox(const tstr& params);
+        eCmdResult DoNpeBenchmark(const tstr& params);
         eCmdResult DoNpeCmdAlias(const tstr& params);
         eCmdResult DoNpeConsole(const tstr& params);
         eCmdResult DoNpeDebugLog(const tstr& params);
         eCmdResult DoNpeNoEmptyVars(const tstr& params);
+        eCmdResult DoNpeProfile(const tstr& params);
         eCmdResult DoNpeQueue(const tstr& params);
         eCmdResult DoNpeSendMsgBufLen(const tstr& params);
         eCmdResult DoNppClose(const tstr& params);
@@ -183,6 +205,7 @@ class CScriptEngine : public IScriptEngine
         eCmdResult DoNppSendMsgEx(const tstr& params);
         eCmdResult DoNppSetFocus(const tstr& params);
         eCmdResult DoNppSwitch(const tstr& params);
+        eCmdResult DoParallel(const tstr& params);
         eCmdResult DoProcSignal(const tstr& params);
         eCmdResult DoSleep(const tstr& params);
         eCmdResult DoSciFind(const tstr& params);
@@ -196,6 +219,7 @@ class CScriptEngine : public IScriptEngine
         eCmdResult DoTextLoadFrom(const tstr& params);
         eCmdResult DoTextSaveTo(const tstr& params);
         eCmdResult DoUnset(const tstr& params);
+        eCmdResult DoWhile(const tstr& params);
 
         struct DoCommand
         {
@@ -205,6 +229,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->Do(params); }
         };
 
+        struct DoBreakCommand
+        {
+            static const TCHAR* const Name() { return _T("BREAK"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_BREAK; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoBreak(params); }
+        };
+
         struct DoCdCommand
         {
             static const TCHAR* const Name() { return _T("CD"); }
@@ -261,6 +293,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoConSaveTo(params); }
         };
 
+        struct DoContinueCommand
+        {
+            static const TCHAR* const Name() { return _T("CONTINUE"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_CONTINUE; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoContinue(params); }
+        };
+
         struct DoDirCommand
         {
             static const TCHAR* const Name() { return _T("DIR"); }
@@ -285,6 +325,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoElse(params); }
         };
 
+        struct DoEndForCommand
+        {
+            static const TCHAR* const Name() { return _T("ENDFOR"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_ENDFOR; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoEndFor(params); }
+        };
+
         struct DoEndIfCommand
         {
             static const TCHAR* const Name() { return _T("ENDIF"); }
@@ -293,6 +341,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoEndIf(params); }
         };
 
+        struct DoEndWhileCommand
+        {
+            static const TCHAR* const Name() { return _T("ENDWHILE"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_ENDWHILE; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoEndWhile(params); }
+        };
+
         struct DoEnvSetCommand
         {
             static const TCHAR* const Name() { return _T("ENV_SET"); }
@@ -317,6 +373,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoExit(params); }
         };
 
+        struct DoForCommand
+        {
+            static const TCHAR* const Name() { return _T("FOR"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_FOR; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoFor(params); }
+        };
+
         struct DoGoToCommand
         {
             static const TCHAR* const Name() { return _T("GOTO"); }
@@ -333,6 +397,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoIf(params); }
         };
 
+        struct DoJoinCommand
+        {
+            static const TCHAR* const Name() { return _T("JOIN"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_JOIN; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoJoin(params); }
+        };
+
         struct DoInputBoxCommand
         {
             static const TCHAR* const Name() { return _T("INPUTBOX"); }
@@ -357,6 +429,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoMessageBox(params); }
         };
 
+        struct DoNpeBenchmarkCommand
+        {
+            static const TCHAR* const Name() { return _T("NPE_BENCHMARK"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_NPEBENCHMARK; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoNpeBenchmark(params); }
+        };
+
         struct DoNpeCmdAliasCommand
         {
             static const TCHAR* const Name() { return _T("NPE_CMDALIAS"); }
@@ -389,6 +469,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoNpeNoEmptyVars(params); }
         };
 
+        struct DoNpeProfileCommand
+        {
+            static const TCHAR* const Name() { return _T("NPE_PROFILE"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_NPEPROFILE; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoNpeProfile(params); }
+        };
+
         struct DoNpeQueueCommand
         {
             static const TCHAR* const Name() { return _T("NPE_QUEUE"); }
@@ -509,6 +597,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoNppSwitch(params); }
         };
 
+        struct DoParallelCommand
+        {
+            static const TCHAR* const Name() { return _T("PARALLEL"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_PARALLEL; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoParallel(params); }
+        };
+
         struct DoProcSignalCommand
         {
             static const TCHAR* const Name() { return _T("PROC_SIGNAL"); }
@@ -613,6 +709,14 @@ class CScriptEngine : public IScriptEngine
             static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoUnset(params); }
         };
 
+        struct DoWhileCommand
+        {
+            static const TCHAR* const Name() { return _T("WHILE"); }
+            static const TCHAR* const AltName() { return nullptr; }
+            static eCmdType           Type() { return CMDTYPE_WHILE; }
+            static eCmdResult         Exec(CScriptEngine* pEngine, const tstr& params) { return pEngine->DoWhile(params); }
+        };
+
         class CScriptCommandRegistry
         {
             public:
@@ -692,6 +796,7 @@ class CScriptEngine : public IScriptEngine
                 {
                     // 1. register commands
                     registerCommand<DoCommand>();
+                    registerCommand<DoBreakCommand>();
                     registerCommand<DoCdCommand>();
                     registerCommand<DoClsCommand>();
                     registerCommand<DoClipSetTextCommand>();
@@ -699,22 +804,29 @@ class CScriptEngine : public IScriptEngine
                     registerCommand<DoConFilterCommand>();
                     registerCommand<DoConLoadFromCommand>();
                     registerCommand<DoConSaveToCommand>();
+                    registerCommand<DoContinueCommand>();
                     registerCommand<DoDirCommand>();
                     registerCommand<DoEchoCommand>();
                     registerCommand<DoElseCommand>();
+                    registerCommand<DoEndForCommand>();
                     registerCommand<DoEndIfCommand>();
+                    registerCommand<DoEndWhileCommand>();
                     registerCommand<DoEnvSetCommand>();
                     registerCommand<DoEnvUnsetCommand>();
                     registerCommand<DoExitCommand>();
+                    registerCommand<DoForCommand>();
                     registerCommand<DoGoToCommand>();
                     registerCommand<DoIfCommand>();
                     registerCommand<DoInputBoxCommand>();
+                    registerCommand<DoJoinCommand>();
                     registerCommand<DoLabelCommand>();
                     registerCommand<DoMessageBoxCommand>();
+                    registerCommand<DoNpeBenchmarkCommand>();
                     registerCommand<DoNpeCmdAliasCommand>();
                     registerCommand<DoNpeConsoleCommand>();
                     registerCommand<DoNpeDebugLogCommand>();
                     registerCommand<DoNpeNoEmptyVarsCommand>();
+                    registerCommand<DoNpeProfileCommand>();
                     registerCommand<DoNpeQueueCommand>();
                     registerCommand<DoNpeSendMsgBufLenCommand>();
                     registerCommand<DoNppCloseCommand>();
@@ -730,6 +842,7 @@ class CScriptEngine : public IScriptEngine
                     registerCommand<DoNppSendMsgExCommand>();
                     registerCommand<DoNppSetFocusCommand>();
                     registerCommand<DoNppSwitchCommand>();
+                    registerCommand<DoParallelCommand>();
                     registerCommand<DoProcSignalCommand>();
                     registerCommand<DoSleepCommand>();
                     registerCommand<DoSciFindCommand>();
@@ -743,6 +856,7 @@ class CScriptEngine : public IScriptEngine
                     registerCommand<DoTextLoadFromCommand>();
                     registerCommand<DoTextSaveToCommand>();
                     registerCommand<DoUnsetCommand>();
+                    registerCommand<DoWhileCommand>();
 
                     // 2. sort names
                     m_SortedCommandNames.sort();
@@ -782,11 +896,13 @@ class CScriptEngine : public IScriptEngine
         const tstr& GetLastCmdParams() const  { return m_sCmdParams; }
 
         static eNppExecCmdPrefix checkNppExecCmdPrefix(CNppExec* pNppExec, tstr& Cmd, bool bRemovePrefix = true);
-        static eCmdType getCmdType(CNppExec* pNppExec, tstr& Cmd, unsigned int nFlags = ctfUseLogging);
+        static eCmdType getCmdType(CNppExec* pNppExec, tstr& Cmd, unsigned int nFlags = ctfUseLogging, CNppExecMacroVars::CmdAliasesSnapshot* pAliasesSnapshot = nullptr);
         static int      getOnOffParam(const tstr& param);
         static bool     isCommentOrEmpty(CNppExec* pNppExec, tstr& Cmd);
         static bool     isSkippingThisCommandDueToIfState(eCmdType cmdType, eIfState ifState);
-        static eCmdType modifyCommandLine(CScriptEngine* pScriptEngine, tstr& Cmd, eIfState ifState);
+        static bool     isKeepingNppState(eCmdType cmdType);
+        static eCmdType compileCommandLine(CNppExec* pNppExec, tstr& Cmd, bool& bCacheable, CNppExecMacroVars::CmdAliasesSnapshot* pAliasesSnapshot = nullptr);
+        static eCmdType modifyCommandLine(CScriptEngine* pScriptEngine, tstr& Cmd, eIfState ifState, const CListItemT<tstr>* pCmdItem = NULL);
 
         CScriptEngine(CNppExec* pNppExec, const CListT<tstr>& CmdList, const tstr& id);
         virtual ~CScriptEngine();
@@ -799,6 +915,49 @@ class CScriptEngine : public IScriptEngine
 
         DWORD GetThreadId() const { return m_dwThreadId; }
 
+        // the script's snapshot of the shared user macro vars, for the script's thread only
+        CNppExecMacroVars::UserMacroVarsSnapshot& GetUserMacroVarsSnapshot() { return m_UserMacroVarsSnapshot; }
+
+        // the script's snapshot of the command aliases or nullptr if called from another thread
+        CNppExecMacroVars::CmdAliasesSnapshot* GetCmdAliasesSnapshot()
+        {
+            return (m_dwThreadId == ::GetCurrentThreadId()) ? &m_CmdAliasesSnapshot : nullptr;
+        }
+
+        // the script's own fparser's evaluator or nullptr if called from another thread
+        FParserWrapper* GetFParser();
+
+        // NPE_PROFILE: the parts of a script line's time measured separately
+        enum eProfileCounter {
+            pcChildProcess = 0,
+            pcMacroVars,
+            pcConsoleOutput,
+
+            pcTotalCount
+        };
+
+        // NPE_PROFILE: adds the time spent in its scope to the script line
+        // being profiled in the current thread; does nothing when no script
+        // is being profiled
+        class CProfileScope
+        {
+            public:
+                CProfileScope(eProfileCounter nCounter);
+                ~CProfileScope();
+
+                CProfileScope(const CProfileScope&) = delete;
+                CProfileScope& operator=(const CProfileScope&) = delete;
+
+            protected:
+                CScriptEngine*  m_pScriptEngine; // NULL if not profiling
+                eProfileCounter m_nCounter;
+                __int64         m_nStartTicks;
+        };
+
+        // NPE_PROFILE: the TLS slot of the profiled engine, see DllMain()
+        static void InitProfilingTls();
+        static void FreeProfilingTls();
+
         CListT<tstr>& GetCmdList() { return m_CmdList; }
         const std::shared_ptr<CScriptEngine> GetParentScriptEngine() const { return m_pParentScriptEngine; }
         std::shared_ptr<CScriptEngine> GetParentScriptEngine() { return m_pParentScriptEngine; }
@@ -831,21 +990,61 @@ class CScriptEngine : public IScriptEngine
         void ChildProcessMustBreakAll();
         bool WaitUntilDone(DWORD dwTimeoutMs) const;
 
+        // PARALLEL: the jobs' output is printed by the script's thread
+        enum eParallelJobOutput {
+            pjoOutput = 0,
+            pjoMessage,
+            pjoInternalMessage,
+            pjoError
+        };
+
+        void AddParallelJobOutput(int nJob, eParallelJobOutput nType, const TCHAR* cszText); // thread-safe
+        void ParallelJobsMustBreak(unsigned int nBreakMethod); // thread-safe
+
     public:
         typedef std::map< tstr, CListItemT<tstr>* > tLabels;
+        typedef std::map< const CListItemT<tstr>*, CListItemT<tstr>* > tIfJumps;
+        typedef tIfJumps tLoopJumps;
+        typedef tIfJumps tParallelJumps;
         typedef CNppExecMacroVars::tMacroVars tMacroVars;
+        typedef CNppExecMacroVars::tMacroVarArrays tMacroVarArrays;
 
         typedef struct sCmdRange {
             CListItemT<tstr>* pBegin; // points to first cmd
-            CListItemT<tstr>* pEnd;   // points _after_ last cmd
+            CListItemT<tstr>* pEnd;   // points _after_ last cmd (NPP_EXEC: the line to return to)
         } tCmdRange;
 
+        typedef struct sLoopState {
+            CListItemT<tstr>* pLoopBegin; // WHILE or FOR
+            CListItemT<tstr>* pLoopEnd;   // ENDWHILE or ENDFOR
+            int     nIfDepth;    // IfState depth outside the loop
+            int     nIterations; // WHILE: limited by GoTo_MaxCount
+            bool    isIterating; // WHILE: ENDWHILE jumped back to the WHILE
+            bool    isBreaking;  // ENDWHILE or ENDFOR leaves the loop
+            __int64 nValue;      // FOR: current value of the variable
+            __int64 nLastValue;  // FOR: the TO value
+            __int64 nStep;       // FOR: the STEP value
+            tstr    sVarName;    // FOR: the variable
+            std::shared_ptr<const CNppExecMacroVars::tMacroVarItems> pItems; // FOR EACH: the items, nValue is the index
+        } tLoopState;
+
         class ScriptContext {
             public:
                 tstr         ScriptName;
                 tCmdRange    CmdRange;
                 tLabels      Labels;
+                tIfJumps     IfJumpToElse;  // IF or ELSE -> next ELSE or ENDIF of the same IF...ENDIF block
+                tIfJumps     IfJumpToEndIf; // ELSE -> ENDIF of the same IF...ENDIF block
+                tLoopJumps   LoopJumpToEnd;   // WHILE or FOR -> its ENDWHILE or ENDFOR
+                tLoopJumps   LoopJumpToBegin; // ENDWHILE or ENDFOR -> its WHILE or FOR
+                tParallelJumps ParallelJumpToJoin; // PARALLEL -> its JOIN
+                CListT<tLoopState> LoopState; // the innermost loop is the last one
                 tMacroVars   LocalMacroVars; // use with GetMacroVars().GetCsUserMacroVars()
+                tMacroVarArrays LocalMacroArrays; // use with GetMacroVars().GetCsUserMacroVars()
+                PNppScriptBody    ScriptBody; // NPP_EXEC: the shared lines CmdRange.pBegin belongs to
+                PNppScriptLineNumbers LineNumbers; // NPP_EXEC: source line numbers of the ScriptBody's lines
+                CStrSplitT<TCHAR> Args;       // NPP_EXEC: $(ARGC), $(ARGV) and $(RARGV) of this call
+                CNppExecMacroVars::PCmdArgValues ArgValues; // NPP_EXEC: the same, prepared for the lines' templates
                 bool         IsNppExeced;
             
             protected:
@@ -884,6 +1083,9 @@ class CScriptEngine : public IScriptEngine
                 
                 void logIfState(const TCHAR* cszFuncName)
                 {
+                    if ( !Runtime::GetLogger().IsLogging() )
+                        return;
+
                     tstr S;
                     const int nIfStates = IfState.size();
                     S.Reserve(20 * nIfStates);
@@ -938,6 +1140,17 @@ class CScriptEngine : public IScriptEngine
 
                     logIfState( _T("PopIfState") );
                 }
+
+                void RestoreIfDepth(int nIfDepth)
+                {
+                    // e.g. BREAK from IF ... ENDIF inside a loop
+                    if ( IfState.size() > nIfDepth )
+                    {
+                        IfState.SetSize(nIfDepth);
+
+                        logIfState( _T("RestoreIfDepth") );
+                    }
+                }
         };
 
         typedef struct tExecState {
@@ -1000,6 +1213,112 @@ class CScriptEngine : public IScriptEngine
 
         static CScriptCommandRegistry m_CommandRegistry; // one and only, for all script engines
 
+        // compiled script line: the part of modifyCommandLine() that does not
+        // depend on macro-vars and thus is done only once per script line
+        typedef struct sCompiledCmd {
+            eCmdType nCmdType;     // command type
+            tstr     sCmdParams;   // command's argument(s) before macro-vars substitution
+            int      nMacroVarPos; // position of the first "$(" in sCmdParams or -1
+        } tCompiledCmd;
+
+        typedef struct sCompiledCmds {
+            std::map< const CListItemT<tstr>*, tCompiledCmd > Items;
+            // the compiled lines depend on these values:
+            unsigned int nCmdAliasesVersion;
+            bool         bNoCmdAliases;
+            tstr         sCommentDelimiter;
+        } tCompiledCmds;
+
+        // NPP_EXEC'ed script body from m_ScriptsList, indexed once per script engine
+        typedef struct sScriptBodyIndex {
+            PNppScriptBody pScriptBody; // keeps the lines (keys of m_CompiledCmds) alive
+            tLabels        Labels;
+            tIfJumps       IfJumpToElse;
+            tIfJumps       IfJumpToEndIf;
+            tLoopJumps     LoopJumpToEnd;
+            tLoopJumps     LoopJumpToBegin;
+            tParallelJumps ParallelJumpToJoin;
+        } tScriptBodyIndex;
+        typedef std::map< const CNppScript*, tScriptBodyIndex > tScriptBodies;
+
+        // NPP_EXEC'ed script line compiled once into a template of its arguments
+        typedef std::map< const CListItemT<tstr>*, CNppExecMacroVars::tCmdArgsTemplate > tCmdArgsTemplates;
+
+        // NPP_EXEC's arguments split once per distinct argument string
+        typedef struct sNppExecArgs {
+            CStrSplitT<TCHAR> Args;
+            CNppExecMacroVars::PCmdArgValues pArgValues;
+        } tNppExecArgs;
+        typedef std::map< tstr, tNppExecArgs > tNppExecArgsCache;
+
+        // IF/ELSE IF/WHILE condition compiled once per script line
+        typedef struct sCompiledCondition {
+            tstr sCondition; // the condition before macro-vars substitution
+            std::shared_ptr<const CCompiledCondition> pCondition; // NULL if not compilable
+        } tCompiledCondition;
+        typedef std::map< const CListItemT<tstr>*, tCompiledCondition > tCompiledConditions;
+
+        // NPE_BENCHMARK: timings of the script lines executed by Run()
+        enum eBenchmarkConsts {
+            BENCHMARK_CMDTYPE_OFFSET = 2, // for CMDTYPE_COLLATERAL_FORCED and CMDTYPE_COMMENT_OR_EMPTY
+            BENCHMARK_CMDTYPE_COUNT  = CMDTYPE_TOTAL_COUNT + BENCHMARK_CMDTYPE_OFFSET
+        };
+
+        typedef struct sBenchmarkWorkload {
+            tstr    sName;
+            __int64 nLines;        // script lines executed
+            __int64 nElapsedTicks; // from "npe_benchmark start" to "npe_benchmark stop"
+            CBufT<unsigned int> LineTicks[BENCHMARK_CMDTYPE_COUNT]; // per command type
+        } tBenchmarkWorkload;
+
+        typedef struct sBenchmark {
+            std::list<tBenchmarkWorkload> Workloads; // the last one is being measured while isMeasuring
+            __int64 nStartTicks;
+            bool    isMeasuring;
+        } tBenchmark;
+
+        // NPE_PROFILE: per-line statistics of the script lines executed by Run()
+        typedef struct sProfileLine {
+            tstr    sScriptName;
+            int     nLineNumber;   // 1-based, within the script
+            tstr    sLine;         // the line before macro-vars substitution
+            __int64 nHits;
+            __int64 nTotalTicks;
+            __int64 CounterTicks[pcTotalCount];
+        } tProfileLine;
+
+        // the same script NPP_EXEC'ed several times is accumulated in one place
+        typedef std::map< std::pair<tstr, int>, tProfileLine > tProfileLines;
+
+        typedef struct sProfile {
+            tProfileLines Lines;
+            std::map< const CListItemT<tstr>*, tProfileLine* > LineByItem;
+            __int64 LineCounterTicks[pcTotalCount]; // of the line being executed
+            int     CounterDepth[pcTotalCount];     // nested CProfileScope
+            __int64 nStartTicks;
+            bool    isProfiling;
+        } tProfile;
+
+        // PARALLEL: a child process started by PARALLEL ... JOIN
+        typedef struct sParallelJob {
+            tstr    sCmdLine;
+            std::shared_ptr<CChildProcess> pChildProcess;
+            CScriptEngine* pScriptEngine;
+            HANDLE  hThread;   // NULL if not started or already finished
+            bool    isCreated; // CChildProcess::Create() has succeeded
+        } tParallelJob;
+
+        typedef struct sParallelJobOutput {
+            int  nJob;
+            eParallelJobOutput nType;
+            tstr sText;
+        } tParallelJobOutput;
+
+        static CCriticalSection m_csLastProfile;
+        static tProfileLines m_LastProfileLines; // of the last profiled script that has ended
+        static volatile LONG m_nProfilingEngines; // checked without locking
+        static DWORD m_dwProfilingTlsIndex; // the engine being profiled in the thread, set and reset by that engine's thread
+
         std::shared_ptr<CScriptEngine> m_pParentScriptEngine;
         std::shared_ptr<CScriptEngine> m_pChildScriptEngine;
         CNppExec*      m_pNppExec;
@@ -1007,6 +1326,16 @@ class CScriptEngine : public IScriptEngine
         tstr           m_strInstance;
         tstr           m_id;
         ExecState      m_execState;
+        tCompiledCmds  m_CompiledCmds; // accessed from the script's thread only
+        tScriptBodies  m_ScriptBodies; // accessed from the script's thread only
+        tCmdArgsTemplates m_CmdArgsTemplates; // accessed from the script's thread only
+        tNppExecArgsCache m_NppExecArgsCache; // accessed from the script's thread only
+        tCompiledConditions m_CompiledConditions; // accessed from the script's thread only
+        tBenchmark     m_Benchmark;    // accessed from the script's thread only
+        tProfile       m_Profile;      // accessed from the script's thread only
+        CNppExecMacroVars::UserMacroVarsSnapshot m_UserMacroVarsSnapshot; // accessed from the script's thread only
+        CNppExecMacroVars::CmdAliasesSnapshot m_CmdAliasesSnapshot; // accessed from the script's thread only
+        std::shared_ptr<FParserWrapper> m_pFParser; // accessed from the script's thread only
         eCmdType       m_nCmdType;       // is not updated for empty command type
         //int          m_nLastCmdResult; // is not updated for empty command type
         tstr           m_sCmdParams;
@@ -1017,6 +1346,10 @@ class CScriptEngine : public IScriptEngine
         bool           m_isClosingConsole;
         CEvent         m_eventRunIsDone;
         CEvent         m_eventAbortTheScript;
+        CEvent         m_eventParallelJobOutput;
+        CCriticalSection m_csParallelJobs;
+        std::list<tParallelJobOutput> m_ParallelJobOutput; // under m_csParallelJobs
+        std::list< std::shared_ptr<CChildProcess> > m_ParallelChildProcesses; // under m_csParallelJobs
 
         void errorCmdNotEnoughParams(const TCHAR* cszCmd, const TCHAR* cszErrorMessage);
         void errorCmdNoParam(const TCHAR* cszCmd);
@@ -1024,6 +1357,31 @@ class CScriptEngine : public IScriptEngine
         bool reportCmdAndParams(const TCHAR* cszCmd, const tstr& params, unsigned int uFlags);
         void updateFocus();
 
+        eCmdType getCompiledCmd(const CListItemT<tstr>* pCmdItem, tstr& Cmd, bool& bHasMacroVars);
+        bool     buildScriptIndex(ScriptContext& scriptContext);
+        bool     jumpToIfTarget(const tIfJumps& ifJumps, const CListItemT<tstr>* pCmdItem);
+        bool     jumpToLoopEnd(tLoopState& loopState, bool isBreaking);
+        tLoopState* enterLoop(ScriptContext& currentScript, eCmdType loopCmdType);
+        tLoopState* getLoopStateByEnd(ScriptContext& currentScript, eCmdType endCmdType);
+        void     leaveLoopsByGoTo(ScriptContext& currentScript, const CListItemT<tstr>* pGoToLine);
+        eCmdResult  doForEach(const tstr& varName, const tstr& arrName);
+        bool     pushScriptBody(const tstr& scriptName, const PNppScriptBody& pScriptBody, const PNppScriptLineNumbers& pLineNumbers, bool isSharedBody, const tNppExecArgs& nppExecArgs);
+        const tNppExecArgs& getNppExecArgs(const tstr& params);
+        bool     bindCmdArgs(const CListItemT<tstr>* pCmdItem, const ScriptContext& scriptContext, tstr& Cmd);
+        void     popScriptContext();
+        void     removeCompiledCmd(const CListItemT<tstr>* pCmdItem);
+        bool     isConditionTrue(const tstr& Condition, bool* pHasSyntaxError);
+        void     addBenchmarkSample(eCmdType nCmdType, __int64 nLineStartTicks);
+        void     stopBenchmarkWorkload();
+        void     getBenchmarkReport(tstr& Report) const;
+        void     startProfiling();
+        void     stopProfiling();
+        tProfileLine* getProfileLine(const CListItemT<tstr>* pCmdItem, const ScriptContext& scriptContext);
+        void     addProfileSample(tProfileLine* pProfileLine, __int64 nLineStartTicks);
+        void     getProfileReport(tstr& Report) const;
+        void     printParallelJobOutput();
+        static DWORD WINAPI ParallelJobThreadProc(LPVOID lpParam);
+
         eCmdResult doSendMsg(const tstr& params, int cmdType);
         eCmdResult doSciFindReplace(const tstr& params, eCmdType cmdType);
         eCmdResult doIf(const tstr& params, bool isElseIf);
@@ -1071,6 +1429,7 @@ extern const TCHAR MACRO_INPUT[];
 extern const TCHAR MACRO_OUTPUT[];
 extern const TCHAR MACRO_OUTPUT1[];
 extern const TCHAR MACRO_OUTPUTL[];
+extern const TCHAR MACRO_OUTPUT_LINE[];
 extern const TCHAR MACRO_EXITCODE[];
 extern const TCHAR MACRO_PID[];
 extern const TCHAR MACRO_MSG_RESULT[];
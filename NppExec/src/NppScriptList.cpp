@@ -110,6 +110,7 @@ bool CNppScriptList::DeleteScript(const tstr& ScriptName)
       }
       _Scripts.Delete(p1);
       _ScriptNames.Delete(p);
+      _ScriptBodies.erase(ScriptName);
 
       // script is deleted -> list is modified
       _bIsModified = true;
@@ -158,6 +159,62 @@ bool CNppScriptList::GetScript(const tstr& ScriptName, CNppScript& outScript)
   return bRet;
 }
 
+bool CNppScriptList::GetScriptBody(const tstr& ScriptName, PNppScriptBody& outBody, PNppScriptLineNumbers* pOutLineNumbers )
+{
+  outBody.reset();
+  if (pOutLineNumbers)
+    pOutLineNumbers->reset();
+
+  CCriticalSectionLockGuard lock(_csScripts);
+
+  std::map<tstr, tScriptBody>::const_iterator itr = _ScriptBodies.find(ScriptName);
+  if (itr != _ScriptBodies.end())
+  {
+    outBody = itr->second.pBody; // the script is not copied
+    if (pOutLineNumbers)
+      *pOutLineNumbers = itr->second.pLineNumbers;
+    return true;
+  }
+
+  CListItemT<tstr>* p = _ScriptNames.GetFirst();
+  CListItemT<PNppScript>* p1 = _Scripts.GetFirst();
+  while (p && p1)
+  {
+    if (p->GetItem() == ScriptName)
+    {
+      std::shared_ptr<CNppScript> pBody(new CNppScript);
+      std::shared_ptr<std::vector<int>> pLineNumbers(new std::vector<int>);
+      const CNppScript* pScript = p1->GetItem();
+      if (pScript)
+      {
+        // empty lines are not needed for execution,
+        // but the source line numbers are kept for NPE_PROFILE
+        int nLine = 0;
+        for (CListItemT<tstr>* pLine = pScript->GetFirst(); pLine; pLine = pLine->GetNext())
+        {
+          ++nLine;
+          if (pLine->GetItem().length() > 0)
+          {
+            pBody->Add(pLine->GetItem());
+            pLineNumbers->push_back(nLine);
+          }
+        }
+      }
+      tScriptBody& scriptBody = _ScriptBodies[ScriptName];
+      scriptBody.pBody = pBody;
+      scriptBody.pLineNumbers = pLineNumbers;
+      outBody = scriptBody.pBody;
+      if (pOutLineNumbers)
+        *pOutLineNumbers = scriptBody.pLineNumbers;
+      return true;
+    }
+    p = p->GetNext();
+    p1 = p1->GetNext();
+  }
+
+  return false;
+}
+
 int CNppScriptList::GetScriptCount() const
 {
   CCriticalSectionLockGuard lock(_csScripts);
@@ -203,6 +260,7 @@ void CNppScriptList::LoadFromFile(const TCHAR* cszFileName, int nUtf8DetectLengt
   free();
   _ScriptNames.DeleteAll();
   _Scripts.DeleteAll();
+  _ScriptBodies.clear(); // the bodies being executed are still owned by their script engines
   _bIsModified = false;
   
   if (fbuf.LoadFromFile(cszFileName, true, nUtf8DetectLength))
@@ -263,6 +321,7 @@ bool CNppScriptList::ModifyScript(const tstr& ScriptName, const CNppScript& newS
     if (p->GetItem() == ScriptName)
     {
       // ScriptName is matched
+      _ScriptBodies.erase(ScriptName); // the next NPP_EXEC gets the new body
       CNppScript* pScript = p1->GetItem();
       if (pScript)
       {
@@ -25,16 +25,27 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "cpp/CListT.h"
 #include "cpp/CFileBufT.h"
 #include "NppExecHelpers.h"
+#include <map>
+#include <memory>
+#include <vector>
 
 typedef CStrT<TCHAR> tstr;
 typedef CListT<tstr> CNppScript;
 typedef CNppScript*  PNppScript;
+typedef std::shared_ptr<const CNppScript> PNppScriptBody; // immutable, shared by NPP_EXEC
+typedef std::shared_ptr<const std::vector<int>> PNppScriptLineNumbers; // 1-based source line of each body's line
 
 class CNppScriptList 
 {
 private:
   CListT<tstr>        _ScriptNames;
   CListT<PNppScript>  _Scripts;
+  typedef struct sScriptBody {
+    PNppScriptBody        pBody;
+    PNppScriptLineNumbers pLineNumbers;
+  } tScriptBody;
+
+  std::map<tstr, tScriptBody> _ScriptBodies; // built on demand by GetScriptBody()
   bool                _bIsModified;
   mutable CCriticalSection _csScripts;
 
@@ -47,6 +58,7 @@ public:
   bool AddScript(const tstr& ScriptName, const CNppScript& newScript);
   bool DeleteScript(const tstr& ScriptName);
   bool GetScript(const tstr& ScriptName, CNppScript& outScript);
+  bool GetScriptBody(const tstr& ScriptName, PNppScriptBody& outBody, PNppScriptLineNumbers* pOutLineNumbers = NULL);
   int  GetScriptCount() const;
   CListT<tstr> GetScriptNames() const;
   CListT<CNppScript> GetScripts(CListT<tstr>* pScriptNames = NULL) const;
@@ -0,0 +1,347 @@
+/***********************************************
+ *
+ *  CStrHashMapT ver. 1.2.1
+ *  --------------------------------
+ *  (C) DV, Oct 2026
+ *  --------------------------------
+ *
+ *  Template:
+ *  >>  CStrHashMapT<type T, type V = CStrT<T>>
+ *
+ *  A hash table of CStrT<T> keys and V values
+ *  with open addressing (linear probing).
+ *  The interface is a subset of std::map's one:
+ *  begin(), end(), find(), erase(), operator[],
+ *  size(), empty(), clear(), swap().
+ *  The items are not ordered, see GetSortedItems().
+ *
+ *  Each slot keeps the hash of its key, so a lookup
+ *  compares the strings only when the hashes match.
+ *  The slots of the removed items keep their memory,
+ *  so re-adding an item or re-assigning its value
+ *  does not allocate while the strings fit.
+ *
+ *  The slots are shared on copy (copy-on-write):
+ *  copying a map is O(1), the slots are copied by
+ *  the first modifying call (including the non-const
+ *  begin() and a successful non-const find() as their
+ *  iterators may modify the values) while another copy
+ *  shares them. The end() iterator is the same for all
+ *  the maps, so end() and a failed find() never copy.
+ *  As with std::map, copying a map must be synchronized
+ *  with modifying it; then the copies themselves may be
+ *  used and destroyed in different threads.
+ *
+ *  Pre-defined types: none
+ *  >>  Example:  typedef CStrHashMapT<TCHAR> tMacroVars;
+ *  >>  Example:  typedef CStrHashMapT<TCHAR, int> tKeyIndex;
+ *
+ ***********************************************/
+
+#ifndef _str_hash_map_t_h_
+#define _str_hash_map_t_h_
+//----------------------------------------------------------------------------
+#include "CStrT.h"
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <memory>
+
+template <class T, class V = CStrT<T> > class CStrHashMapT
+{
+public:
+  typedef CStrT<T> key_type;
+  typedef V        mapped_type;
+
+  struct value_type {
+    CStrT<T> first;  // key
+    V        second; // value
+  };
+
+private:
+  enum eSlotState {
+    ssEmpty = 0,
+    ssUsed,
+    ssDeleted
+  };
+
+  struct tSlot {
+    value_type   item;
+    unsigned int hash;
+    int          state;
+
+    tSlot() : hash(0), state(ssEmpty) { }
+  };
+
+  typedef std::vector<tSlot> tSlots;
+
+  std::shared_ptr<tSlots> m_pSlots; // nullptr or a power of 2 slots, shared by the copies
+  int m_nUsed;
+  int m_nDeleted;
+
+  static unsigned int getHash(const T* pStr, int nLength);
+  int  findSlot(const T* pStr, int nLength, unsigned int hash) const; // -1 if not found
+  void rehash(int nMinSlots);
+  void detach(); // makes the slots not shared before modifying them
+
+  // a string value keeps its memory, other values are reset
+  static void clearValue(CStrT<T>& value)  { value.Clear(); }
+  template <class V2> static void clearValue(V2& value)  { value = V2(); }
+  static void swapValues(CStrT<T>& value1, CStrT<T>& value2)  { value1.Swap(value2); }
+  template <class V2> static void swapValues(V2& value1, V2& value2)  { std::swap(value1, value2); }
+
+  int          slotsCount() const  { return m_pSlots ? static_cast<int>(m_pSlots->size()) : 0; }
+  tSlot*       slotsBegin()  { return m_pSlots ? m_pSlots->data() : 0; }
+  const tSlot* slotsBegin() const  { return m_pSlots ? m_pSlots->data() : 0; }
+
+public:
+  template <class TSlot, class TItem> class iterator_t
+  {
+  private:
+    TSlot* m_pSlot;
+    TSlot* m_pEnd;
+
+    void skipUnused()
+    {
+        while ( (m_pSlot != m_pEnd) && (m_pSlot->state != ssUsed) )  ++m_pSlot;
+        if ( m_pSlot == m_pEnd )  m_pSlot = m_pEnd = 0; // end() does not depend on the slots
+    }
+
+  public:
+    iterator_t() : m_pSlot(0), m_pEnd(0) { }
+    iterator_t(TSlot* pSlot, TSlot* pEnd) : m_pSlot(pSlot), m_pEnd(pEnd)  { skipUnused(); }
+    template <class TSlot2, class TItem2> iterator_t(const iterator_t<TSlot2, TItem2>& itr) : m_pSlot(itr.slot()), m_pEnd(itr.slotEnd()) { }
+
+    TItem& operator*() const  { return m_pSlot->item; }
+    TItem* operator->() const  { return &m_pSlot->item; }
+    iterator_t& operator++()  { ++m_pSlot; skipUnused(); return *this; }
+    iterator_t operator++(int)  { iterator_t itr(*this); ++(*this); return itr; }
+    template <class TSlot2, class TItem2> bool operator==(const iterator_t<TSlot2, TItem2>& itr) const  { return (m_pSlot == itr.slot()); }
+    template <class TSlot2, class TItem2> bool operator!=(const iterator_t<TSlot2, TItem2>& itr) const  { return (m_pSlot != itr.slot()); }
+
+    TSlot* slot() const  { return m_pSlot; }
+    TSlot* slotEnd() const  { return m_pEnd; }
+  };
+
+  typedef iterator_t<tSlot, value_type> iterator;
+  typedef iterator_t<const tSlot, const value_type> const_iterator;
+
+  CStrHashMapT() : m_nUsed(0), m_nDeleted(0) { }
+
+  iterator       begin()  { detach(); return iterator(slotsBegin(), slotsBegin() + slotsCount()); }
+  iterator       end()  { return iterator(); }
+  const_iterator begin() const  { return const_iterator(slotsBegin(), slotsBegin() + slotsCount()); }
+  const_iterator end() const  { return const_iterator(); }
+
+  iterator       find(const key_type& key);
+  const_iterator find(const key_type& key) const;
+  void           erase(iterator itr);
+  mapped_type&   operator[](const key_type& key); // adds the key if it does not exist
+  int            size() const  { return m_nUsed; }
+  bool           empty() const  { return (m_nUsed == 0); }
+  void           clear();
+  void           swap(CStrHashMapT& other);
+  bool           IsShared() const  { return (m_pSlots && (m_pSlots.use_count() > 1)); }
+
+  // the items sorted by their keys, e.g. to show them
+  void           GetSortedItems(std::vector<const value_type*>& items) const;
+};
+
+//----------------------------------------------------------------------------
+
+template <class T, class V> unsigned int CStrHashMapT<T, V>::getHash(const T* pStr, int nLength)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261U;
+    while ( nLength-- > 0 )
+    {
+        hash ^= (unsigned int) (*pStr++);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+template <class T, class V> int CStrHashMapT<T, V>::findSlot(const T* pStr, int nLength, unsigned int hash) const
+{
+    if ( !m_pSlots )
+        return -1;
+
+    const tSlots& slots = *m_pSlots;
+    const int nMask = static_cast<int>(slots.size()) - 1;
+    int i = static_cast<int>(hash) & nMask;
+    for ( ; ; )
+    {
+        const tSlot& slot = slots[i];
+        if ( slot.state == ssEmpty )
+            return -1;
+
+        if ( (slot.state == ssUsed) && (slot.hash == hash) &&
+             (slot.item.first.length() == nLength) )
+        {
+            const T* pKey = slot.item.first.c_str();
+            int n = 0;
+            while ( (n < nLength) && (pKey[n] == pStr[n]) )  ++n;
+            if ( n == nLength )
+                return i;
+        }
+
+        i = (i + 1) & nMask;
+    }
+}
+
+template <class T, class V> void CStrHashMapT<T, V>::rehash(int nMinSlots)
+{
+    int nSlots = 16;
+    while ( nSlots < nMinSlots )  nSlots *= 2;
+
+    // the old slots are not shared here (detached), so the strings can be moved
+    std::shared_ptr<tSlots> pOldSlots = m_pSlots;
+    m_pSlots = std::make_shared<tSlots>(nSlots);
+    m_nDeleted = 0;
+
+    if ( !pOldSlots )
+        return;
+
+    tSlots& slots = *m_pSlots;
+    const int nMask = nSlots - 1;
+    for ( tSlot& oldSlot : *pOldSlots )
+    {
+        if ( oldSlot.state == ssUsed )
+        {
+            int i = static_cast<int>(oldSlot.hash) & nMask;
+            while ( slots[i].state != ssEmpty )  i = (i + 1) & nMask;
+
+            tSlot& slot = slots[i];
+            slot.item.first.Swap(oldSlot.item.first);
+            swapValues(slot.item.second, oldSlot.item.second);
+            slot.hash = oldSlot.hash;
+            slot.state = ssUsed;
+        }
+    }
+}
+
+template <class T, class V> void CStrHashMapT<T, V>::detach()
+{
+    if ( IsShared() )
+    {
+        if ( m_nUsed == 0 )
+        {
+            m_pSlots.reset();
+            m_nDeleted = 0;
+        }
+        else
+        {
+            // the deleted slots are not copied
+            std::shared_ptr<tSlots> pSharedSlots = m_pSlots;
+            m_pSlots = std::make_shared<tSlots>(pSharedSlots->size());
+            m_nDeleted = 0;
+
+            tSlots& slots = *m_pSlots;
+            const int nMask = static_cast<int>(slots.size()) - 1;
+            for ( const tSlot& sharedSlot : *pSharedSlots )
+            {
+                if ( sharedSlot.state == ssUsed )
+                {
+                    int i = static_cast<int>(sharedSlot.hash) & nMask;
+                    while ( slots[i].state != ssEmpty )  i = (i + 1) & nMask;
+
+                    slots[i] = sharedSlot;
+                }
+            }
+        }
+    }
+}
+
+template <class T, class V> typename CStrHashMapT<T, V>::iterator CStrHashMapT<T, V>::find(const key_type& key)
+{
+    const unsigned int hash = getHash( key.c_str(), key.length() );
+    if ( findSlot(key.c_str(), key.length(), hash) < 0 )
+        return end(); // does not detach
+
+    detach();
+    const int i = findSlot( key.c_str(), key.length(), hash );
+    return iterator( slotsBegin() + i, slotsBegin() + slotsCount() );
+}
+
+template <class T, class V> typename CStrHashMapT<T, V>::const_iterator CStrHashMapT<T, V>::find(const key_type& key) const
+{
+    const int i = findSlot( key.c_str(), key.length(), getHash(key.c_str(), key.length()) );
+    if ( i < 0 )
+        return end();
+    return const_iterator( slotsBegin() + i, slotsBegin() + slotsCount() );
+}
+
+template <class T, class V> void CStrHashMapT<T, V>::erase(iterator itr)
+{
+    if ( itr == end() )
+        return;
+
+    tSlot* pSlot = itr.slot();
+    if ( pSlot && (pSlot->state == ssUsed) )
+    {
+        // the strings are cleared, but their memory is kept
+        pSlot->item.first.Clear();
+        clearValue(pSlot->item.second);
+        pSlot->state = ssDeleted;
+        --m_nUsed;
+        ++m_nDeleted;
+    }
+}
+
+template <class T, class V> typename CStrHashMapT<T, V>::mapped_type& CStrHashMapT<T, V>::operator[](const key_type& key)
+{
+    detach();
+
+    const unsigned int hash = getHash( key.c_str(), key.length() );
+    int i = findSlot( key.c_str(), key.length(), hash );
+    if ( i >= 0 )
+        return (*m_pSlots)[i].item.second;
+
+    // keeping the load factor (including the deleted slots) below 3/4
+    if ( (m_nUsed + m_nDeleted + 1)*4 > slotsCount()*3 )
+        rehash( (m_nUsed + 1)*2 );
+
+    tSlots& slots = *m_pSlots;
+    const int nMask = static_cast<int>(slots.size()) - 1;
+    i = static_cast<int>(hash) & nMask;
+    while ( slots[i].state == ssUsed )  i = (i + 1) & nMask;
+
+    tSlot& slot = slots[i];
+    if ( slot.state == ssDeleted )
+        --m_nDeleted;
+    slot.item.first = key;
+    clearValue(slot.item.second);
+    slot.hash = hash;
+    slot.state = ssUsed;
+    ++m_nUsed;
+    return slot.item.second;
+}
+
+template <class T, class V> void CStrHashMapT<T, V>::clear()
+{
+    m_pSlots.reset();
+    m_nUsed = 0;
+    m_nDeleted = 0;
+}
+
+template <class T, class V> void CStrHashMapT<T, V>::swap(CStrHashMapT& other)
+{
+    m_pSlots.swap(other.m_pSlots);
+    std::swap(m_nUsed, other.m_nUsed);
+    std::swap(m_nDeleted, other.m_nDeleted);
+}
+
+template <class T, class V> void CStrHashMapT<T, V>::GetSortedItems(std::vector<const value_type*>& items) const
+{
+    items.clear();
+    items.reserve(m_nUsed);
+    for ( const_iterator itr = begin(); itr != end(); ++itr )
+    {
+        items.push_back( &(*itr) );
+    }
+    std::sort( items.begin(), items.end(),
+        [](const value_type* item1, const value_type* item2) { return (item1->first < item2->first); } );
+}
+
+//----------------------------------------------------------------------------
+#endif
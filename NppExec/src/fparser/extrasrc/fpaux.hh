@@ -19,6 +19,7 @@
 #include "fptypes.hh"
 
 #include <cmath>
+#include <limits>
 
 #ifdef FP_SUPPORT_MPFR_FLOAT_TYPE
 #include "mpfr/MpfrFloat.hh"